@@ -0,0 +1,75 @@
+#include "cpuBackend.h"
+#include <limits>
+#include <algorithm>
+
+CpuBackend::CpuBackend(const HaloSim::Scene &scene, unsigned int width, unsigned int height, unsigned int raysPerStep, std::uint32_t seed, unsigned int threadCount)
+    : mSimulator(scene, width, height, threadCount),
+      mRaysPerStep(raysPerStep),
+      mMaxRayCount(std::numeric_limits<unsigned long long>::max()),
+      mThreadCount(threadCount)
+{
+    mSimulator.setSeed(seed);
+}
+
+void CpuBackend::restart(const HaloSim::SceneFile &file)
+{
+    mSimulator = HaloSim::CpuSimulator(file.scene, file.outputWidth, file.outputHeight, mThreadCount);
+    mSimulator.setSeed(file.seed);
+    mRaysPerStep = file.raysPerStep;
+}
+
+void CpuBackend::setMaxRayCount(unsigned long long rays)
+{
+    mMaxRayCount = rays;
+}
+
+void CpuBackend::setRandomStream(unsigned int index, unsigned int count)
+{
+    mSimulator.setRandomStream(index, count);
+}
+
+void CpuBackend::step()
+{
+    auto rayCount = mSimulator.getRayCount();
+    if (rayCount >= mMaxRayCount)
+        return;
+    mSimulator.step((unsigned int)std::min<unsigned long long>(mRaysPerStep, mMaxRayCount - rayCount));
+}
+
+unsigned long long CpuBackend::getRayCount() const
+{
+    return mSimulator.getRayCount();
+}
+
+double CpuBackend::getNoiseEstimate() const
+{
+    return mSimulator.getNoiseEstimate();
+}
+
+std::vector<float> CpuBackend::readAccumulation()
+{
+    return mSimulator.getAccumulation();
+}
+
+std::vector<float> CpuBackend::readNoise()
+{
+    return mSimulator.getNoise();
+}
+
+HaloSim::Checkpoint CpuBackend::createCheckpoint()
+{
+    HaloSim::Checkpoint checkpoint;
+    checkpoint.width = mSimulator.getWidth();
+    checkpoint.height = mSimulator.getHeight();
+    checkpoint.iteration = mSimulator.getIteration();
+    checkpoint.rayCount = mSimulator.getRayCount();
+    checkpoint.randomCounter = mSimulator.getRandomCounter();
+    checkpoint.accumulation = mSimulator.getAccumulation();
+    checkpoint.noise = readNoise();
+    return checkpoint;
+}
+
+void CpuBackend::resume(const HaloSim::Checkpoint &checkpoint)
+{
+    mSimulator.restore(checkpoint.iteration, checkpoint.rayCount, checkpoint.randomCounter, checkpoint.accumulation, checkpoint.noise);
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <cstdint>
+#include "renderBackend.h"
+#include "../simulation/cpuSimulator.h"
+
+class CpuBackend : public RenderBackend
+{
+public:
+    CpuBackend(const HaloSim::Scene &scene, unsigned int width, unsigned int height, unsigned int raysPerStep, std::uint32_t seed, unsigned int threadCount);
+
+    void setRandomStream(unsigned int index, unsigned int count) override;
+    void restart(const HaloSim::SceneFile &file) override;
+    void setMaxRayCount(unsigned long long rays) override;
+    void step() override;
+    unsigned long long getRayCount() const override;
+    double getNoiseEstimate() const override;
+    std::vector<float> readAccumulation() override;
+    std::vector<float> readNoise() override;
+    HaloSim::Checkpoint createCheckpoint() override;
+    void resume(const HaloSim::Checkpoint &checkpoint) override;
+
+private:
+    HaloSim::CpuSimulator mSimulator;
+    unsigned int mRaysPerStep;
+    unsigned long long mMaxRayCount;
+    unsigned int mThreadCount;
+};
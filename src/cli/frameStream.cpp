@@ -0,0 +1,236 @@
+#include "frameStream.h"
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <csignal>
+#include <stdexcept>
+#include "../simulation/toneMapping.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+namespace
+{
+
+// Rounds to the nearest half float, with ties to even
+std::uint16_t toHalf(float value)
+{
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    std::uint32_t sign = (bits >> 16) & 0x8000;
+    std::uint32_t magnitude = bits & 0x7fffffff;
+
+    if (magnitude > 0x7f800000)
+        return (std::uint16_t)(sign | 0x7e00);
+    if (magnitude >= 0x477ff000)
+        return (std::uint16_t)(sign | 0x7c00);
+    if (magnitude < 0x38800000)
+    {
+        // Subnormal halves are whole multiples of 2^-24
+        float absolute;
+        std::memcpy(&absolute, &magnitude, sizeof(absolute));
+        return (std::uint16_t)(sign | (std::uint32_t)std::lrint(absolute * 16777216.0f));
+    }
+    return (std::uint16_t)(sign | ((magnitude - 0x38000000 + 0x0fff + ((magnitude >> 13) & 1)) >> 13));
+}
+
+} // namespace
+
+FrameStream::FrameStream(const std::string &filename, Format format, unsigned int width, unsigned int height, double frameInterval, unsigned int queueLength)
+    : mFilename(filename),
+      mFormat(format),
+      mWidth(width),
+      mHeight(height),
+      mFrameInterval(frameInterval),
+      mQueueLength(queueLength),
+      mWriting(true),
+      mFinished(false),
+      mDroppedFrameCount(0)
+{
+#ifndef _WIN32
+    // A reader going away should fail the writes instead of ending the process
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+    mThread = std::thread(&FrameStream::writeFrames, this);
+}
+
+FrameStream::~FrameStream()
+{
+    stop();
+}
+
+bool FrameStream::hasRoom() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mWriting && mQueue.size() < mQueueLength;
+}
+
+void FrameStream::push(std::vector<float> accumulation, float exposure)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!mWriting || mQueue.size() >= mQueueLength)
+        {
+            ++mDroppedFrameCount;
+            return;
+        }
+        mQueue.push_back({std::move(accumulation), exposure});
+    }
+    mFrameAdded.notify_one();
+}
+
+void FrameStream::skip()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    ++mDroppedFrameCount;
+}
+
+void FrameStream::finish(std::vector<float> accumulation, float exposure)
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mFrameTaken.wait(lock, [this]() { return !mWriting || mQueue.size() < mQueueLength; });
+        if (mWriting)
+            mQueue.push_back({std::move(accumulation), exposure});
+    }
+    mFrameAdded.notify_one();
+    stop();
+}
+
+void FrameStream::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mFinished = true;
+    }
+    mFrameAdded.notify_one();
+    if (mThread.joinable())
+        mThread.join();
+}
+
+unsigned int FrameStream::getDroppedFrameCount() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mDroppedFrameCount;
+}
+
+std::string FrameStream::getError() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mError;
+}
+
+void FrameStream::writeFrames()
+{
+    std::FILE *file = nullptr;
+    try
+    {
+        // Opening a named pipe waits for its reader, which is why it is opened here
+        if (mFilename == "-")
+        {
+            file = stdout;
+#ifdef _WIN32
+            _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        }
+        else
+        {
+            file = std::fopen(mFilename.c_str(), "wb");
+            if (file == nullptr)
+                throw std::runtime_error("Could not open " + mFilename);
+        }
+
+        if (mFormat == Format::Y4m)
+        {
+            auto milliseconds = std::max(1l, std::lround(mFrameInterval * 1000.0));
+            std::fprintf(file, "YUV4MPEG2 W%u H%u F1000:%ld Ip A1:1 C444\n", mWidth, mHeight, milliseconds);
+        }
+
+        while (true)
+        {
+            Frame frame;
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mFrameAdded.wait(lock, [this]() { return mFinished || !mQueue.empty(); });
+                if (mQueue.empty())
+                    break;
+                frame = std::move(mQueue.front());
+                mQueue.pop_front();
+            }
+            mFrameTaken.notify_one();
+            writeFrame(file, frame);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mError = e.what();
+            mWriting = false;
+            mDroppedFrameCount += (unsigned int)mQueue.size();
+            mQueue.clear();
+        }
+        mFrameTaken.notify_one();
+    }
+
+    if (file != nullptr && file != stdout)
+        std::fclose(file);
+}
+
+void FrameStream::writeFrame(std::FILE *file, const Frame &frame)
+{
+    auto pixelCount = (std::size_t)mWidth * mHeight;
+    std::vector<unsigned char> bytes;
+    switch (mFormat)
+    {
+    case Format::Rgb:
+        bytes = HaloSim::toneMapToSrgb(mWidth, mHeight, frame.accumulation, frame.exposure);
+        break;
+    case Format::Y4m:
+    {
+        // Limited range BT.601, which is what readers of YUV4MPEG2 assume
+        auto rgb = HaloSim::toneMapToSrgb(mWidth, mHeight, frame.accumulation, frame.exposure);
+        const char header[] = "FRAME\n";
+        bytes.resize(sizeof(header) - 1 + pixelCount * 3);
+        std::memcpy(bytes.data(), header, sizeof(header) - 1);
+        auto luma = bytes.data() + sizeof(header) - 1;
+        auto blue = luma + pixelCount;
+        auto red = blue + pixelCount;
+        for (std::size_t i = 0; i < pixelCount; ++i)
+        {
+            float r = rgb[i * 3];
+            float g = rgb[i * 3 + 1];
+            float b = rgb[i * 3 + 2];
+            luma[i] = (unsigned char)std::lround(16.0f + (65.481f * r + 128.553f * g + 24.966f * b) / 255.0f);
+            blue[i] = (unsigned char)std::lround(128.0f + (-37.797f * r - 74.203f * g + 112.0f * b) / 255.0f);
+            red[i] = (unsigned char)std::lround(128.0f + (112.0f * r - 93.786f * g - 18.214f * b) / 255.0f);
+        }
+        break;
+    }
+    case Format::Half:
+    {
+        bytes.resize(pixelCount * 3 * 2);
+        auto output = bytes.data();
+        for (auto y = 0u; y < mHeight; ++y)
+        {
+            auto row = (std::size_t)(mHeight - 1 - y) * mWidth;
+            for (auto x = 0u; x < mWidth; ++x)
+            {
+                for (auto c = 0u; c < 3; ++c)
+                {
+                    auto half = toHalf(frame.accumulation[(row + x) * 4 + c] * frame.exposure);
+                    *output++ = (unsigned char)(half & 0xff);
+                    *output++ = (unsigned char)(half >> 8);
+                }
+            }
+        }
+        break;
+    }
+    }
+
+    if (std::fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size() || std::fflush(file) != 0)
+        throw std::runtime_error(mFilename == "-" ? std::string("Could not write to the standard output") : "Could not write to " + mFilename);
+}
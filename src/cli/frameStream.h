@@ -0,0 +1,81 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/*
+Writes frames of a render in progress into a file or a pipe, on a thread of
+its own, for watching a render live or capturing it into a video. Frames are
+taken as accumulation images with four floats per pixel, bottom row first,
+and written from the top row down as
+
+- Rgb: 8-bit sRGB, three bytes per pixel
+- Y4m: a YUV4MPEG2 stream of 4:4:4 BT.601 frames, with a frame rate of one
+  frame per frame interval
+- Half: XYZ times the exposure as 16-bit half floats, three per pixel
+
+Rgb and Half frames follow each other without any headers. The queue holds
+only a few frames, and frames that do not fit are dropped, so that a slow
+reader never slows the simulation down. Once writing fails, for example
+because the reader has gone away, the remaining frames are dropped.
+*/
+class FrameStream
+{
+public:
+    enum class Format
+    {
+        Rgb,
+        Y4m,
+        Half
+    };
+
+    // A filename of "-" means the standard output
+    FrameStream(const std::string &filename, Format format, unsigned int width, unsigned int height, double frameInterval, unsigned int queueLength = 2);
+    ~FrameStream();
+
+    // Whether a frame would fit into the queue, so that a frame that would be dropped need not be read at all
+    bool hasRoom() const;
+
+    void push(std::vector<float> accumulation, float exposure);
+    void skip();
+
+    // Queues the last frame even if it has to wait for room, and waits until all frames are written
+    void finish(std::vector<float> accumulation, float exposure);
+
+    unsigned int getDroppedFrameCount() const;
+
+    // Empty unless writing has failed
+    std::string getError() const;
+
+private:
+    struct Frame
+    {
+        std::vector<float> accumulation;
+        float exposure;
+    };
+
+    void writeFrames();
+    void writeFrame(std::FILE *file, const Frame &frame);
+    void stop();
+
+    std::string mFilename;
+    Format mFormat;
+    unsigned int mWidth;
+    unsigned int mHeight;
+    double mFrameInterval;
+    unsigned int mQueueLength;
+
+    mutable std::mutex mMutex;
+    std::condition_variable mFrameAdded;
+    std::condition_variable mFrameTaken;
+    std::deque<Frame> mQueue;
+    bool mWriting;
+    bool mFinished;
+    unsigned int mDroppedFrameCount;
+    std::string mError;
+    std::thread mThread;
+};
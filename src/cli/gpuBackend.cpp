@@ -0,0 +1,124 @@
+#include "gpuBackend.h"
+#include <limits>
+#include <stdexcept>
+#include <QSurfaceFormat>
+
+GpuBackend::GpuBackend(const HaloSim::SceneFile &file)
+    : mCrystalRepository(std::make_shared<HaloSim::CrystalPopulationRepository>()),
+      mMaxRayCount(std::numeric_limits<unsigned long long>::max())
+{
+    QSurfaceFormat format;
+    format.setVersion(4, 4);
+    format.setProfile(QSurfaceFormat::OpenGLContextProfile::CoreProfile);
+    mSurface.setFormat(format);
+    mSurface.create();
+    mContext.setFormat(format);
+    if (!mContext.create() || !mContext.makeCurrent(&mSurface))
+        throw std::runtime_error("Could not create an OpenGL 4.4 context, the CPU backend works without one");
+    initializeOpenGLFunctions();
+    createEngine(file);
+}
+
+GpuBackend::~GpuBackend()
+{
+    mContext.makeCurrent(&mSurface);
+    releaseEngine();
+    mContext.doneCurrent();
+}
+
+// A fresh engine for every scene, so that accumulations cached by the engine never carry over to another seed
+void GpuBackend::createEngine(const HaloSim::SceneFile &file)
+{
+    const auto &scene = file.scene;
+    releaseEngine();
+    while (mCrystalRepository->getCount() > 0)
+        mCrystalRepository->remove(0);
+    for (auto i = 0u; i < scene.crystals.size(); ++i)
+        mCrystalRepository->add(scene.crystals[i], scene.crystalWeights[i]);
+
+    mEngine = std::make_shared<HaloSim::SimulationEngine>(file.outputWidth, file.outputHeight, mCrystalRepository);
+    mEngine->setLightSource(scene.light);
+    mEngine->setCamera(scene.camera);
+    mEngine->setMultipleScatteringProbability(scene.multipleScatteringProbability);
+    mEngine->setRaysPerStep(file.raysPerStep);
+    mEngine->setMaxRayCount(mMaxRayCount);
+    mEngine->setNoiseTracking(true);
+    mEngine->setPreviewsEnabled(false);
+    mEngine->initialize();
+    mEngine->setRandomSeed(file.seed);
+    mEngine->start();
+}
+
+void GpuBackend::releaseEngine()
+{
+    if (mEngine == nullptr)
+        return;
+    mEngine->releaseResources();
+    mEngine.reset();
+}
+
+void GpuBackend::restart(const HaloSim::SceneFile &file)
+{
+    createEngine(file);
+}
+
+void GpuBackend::setMaxRayCount(unsigned long long rays)
+{
+    mMaxRayCount = rays;
+    mEngine->setMaxRayCount(rays);
+}
+
+void GpuBackend::setRandomStream(unsigned int index, unsigned int count)
+{
+    mEngine->setRandomStream(index, count);
+}
+
+void GpuBackend::step()
+{
+    mEngine->step();
+    mEngine->updateOutput();
+}
+
+unsigned long long GpuBackend::getRayCount() const
+{
+    return mEngine->getOutputRayCount();
+}
+
+double GpuBackend::getNoiseEstimate() const
+{
+    return mEngine->getNoiseEstimate();
+}
+
+std::vector<float> GpuBackend::readAccumulation()
+{
+    std::vector<float> pixels((std::size_t)mEngine->getOutputWidth() * mEngine->getOutputHeight() * 4);
+    glBindTexture(GL_TEXTURE_2D, mEngine->getOutputTextureHandle());
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, pixels.data());
+    return pixels;
+}
+
+std::vector<float> GpuBackend::readNoise()
+{
+    std::vector<float> pixels((std::size_t)mEngine->getOutputWidth() * mEngine->getOutputHeight() * 4);
+    glBindTexture(GL_TEXTURE_2D, mEngine->getOutputNoiseTextureHandle());
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, pixels.data());
+    return pixels;
+}
+
+HaloSim::Checkpoint GpuBackend::createCheckpoint()
+{
+    HaloSim::Checkpoint checkpoint;
+    checkpoint.width = mEngine->getOutputWidth();
+    checkpoint.height = mEngine->getOutputHeight();
+    checkpoint.iteration = mEngine->getOutputIteration();
+    checkpoint.rayCount = mEngine->getOutputRayCount();
+    checkpoint.randomCounter = mEngine->getRandomCounter();
+    checkpoint.accumulation = readAccumulation();
+    checkpoint.noise = readNoise();
+    return checkpoint;
+}
+
+void GpuBackend::resume(const HaloSim::Checkpoint &checkpoint)
+{
+    mEngine->resumeAccumulation(checkpoint.iteration, checkpoint.rayCount, checkpoint.randomCounter, checkpoint.accumulation, checkpoint.noise);
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <memory>
+#include <cstdint>
+#include <QOpenGLContext>
+#include <QOffscreenSurface>
+#include <QOpenGLFunctions_4_4_Core>
+#include "renderBackend.h"
+#include "../simulation/simulationEngine.h"
+#include "../simulation/crystalPopulationRepository.h"
+
+/*
+Runs the simulation engine in an OpenGL context of its own, without any
+window or previews, tracing the rays per step of the scene file. Restarting
+replaces the engine but keeps the context, so that its shader programs are
+loaded from the driver and binary caches of the running process.
+*/
+class GpuBackend : public RenderBackend, protected QOpenGLFunctions_4_4_Core
+{
+public:
+    explicit GpuBackend(const HaloSim::SceneFile &file);
+    ~GpuBackend();
+
+    void setRandomStream(unsigned int index, unsigned int count) override;
+    void restart(const HaloSim::SceneFile &file) override;
+    void setMaxRayCount(unsigned long long rays) override;
+    void step() override;
+    unsigned long long getRayCount() const override;
+    double getNoiseEstimate() const override;
+    std::vector<float> readAccumulation() override;
+    std::vector<float> readNoise() override;
+    HaloSim::Checkpoint createCheckpoint() override;
+    void resume(const HaloSim::Checkpoint &checkpoint) override;
+
+private:
+    void createEngine(const HaloSim::SceneFile &file);
+    void releaseEngine();
+
+    QOffscreenSurface mSurface;
+    QOpenGLContext mContext;
+    std::shared_ptr<HaloSim::CrystalPopulationRepository> mCrystalRepository;
+    std::shared_ptr<HaloSim::SimulationEngine> mEngine;
+    unsigned long long mMaxRayCount;
+};
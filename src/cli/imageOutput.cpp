@@ -0,0 +1,27 @@
+#include "imageOutput.h"
+#include <stdexcept>
+#include <QImage>
+#include <QFile>
+#include "../simulation/toneMapping.h"
+#include "../simulation/accumulationFile.h"
+
+void writeImage(const QString &filename, const HaloSim::RawImage &image)
+{
+    auto encodedFilename = QFile::encodeName(filename).toStdString();
+    auto extension = filename.section('.', -1).toLower();
+    if (extension == "exr")
+        HaloSim::writeExr(encodedFilename, image);
+    else if (extension == "pfm")
+        HaloSim::writePfm(encodedFilename, image);
+    else if (extension == "hra")
+        HaloSim::writeAccumulationFile(encodedFilename, image);
+    else if (extension == "tif" || extension == "tiff")
+        HaloSim::writeTiff16(encodedFilename, image.width, image.height, HaloSim::toneMapToSrgb16(image.width, image.height, image.accumulation, image.exposure));
+    else
+    {
+        auto pixels = HaloSim::toneMapToSrgb(image.width, image.height, image.accumulation, image.exposure);
+        QImage qImage(pixels.data(), (int)image.width, (int)image.height, (int)image.width * 3, QImage::Format_RGB888);
+        if (!qImage.save(filename))
+            throw std::runtime_error(QString("Could not write %1").arg(filename).toStdString());
+    }
+}
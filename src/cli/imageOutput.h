@@ -0,0 +1,6 @@
+#pragma once
+#include <QString>
+#include "../simulation/imageFile.h"
+
+// The type of the image is chosen by the extension of the file name
+void writeImage(const QString &filename, const HaloSim::RawImage &image);
@@ -0,0 +1,597 @@
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <chrono>
+#include <future>
+#include <algorithm>
+#include <stdexcept>
+#include <QtGlobal>
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QStringList>
+#include <QFile>
+#include <QFileInfo>
+#include <QLocalSocket>
+#include "cpuBackend.h"
+#include "gpuBackend.h"
+#include "imageOutput.h"
+#include "frameStream.h"
+#include "renderServer.h"
+#include "resultCache.h"
+#include "../simulation/scene.h"
+#include "../simulation/sceneFile.h"
+#include "../simulation/toneMapping.h"
+#include "../simulation/imageFile.h"
+#include "../simulation/checkpoint.h"
+#include "../simulation/accumulationFile.h"
+#include "../simulation/json.h"
+#include "../simulation/sharedMemoryRing.h"
+
+/*
+Renders a scene without any window and writes the result into an image.
+Progress is reported on stderr.
+*/
+
+namespace
+{
+
+HaloSim::CrystalPopulationPreset parsePreset(const QString &name)
+{
+    const QStringList names = {"random", "plate", "column", "parry", "lowitz"};
+    auto index = names.indexOf(name.toLower());
+    if (index == -1)
+        throw std::runtime_error(QString("Unknown crystal population %1").arg(name).toStdString());
+    return (HaloSim::CrystalPopulationPreset)index;
+}
+
+HaloSim::Projection parseProjection(const QString &name)
+{
+    const QStringList names = {"stereographic", "rectilinear", "equidistant", "equal-area", "orthographic"};
+    auto index = names.indexOf(name.toLower());
+    if (index == -1)
+        throw std::runtime_error(QString("Unknown projection %1").arg(name).toStdString());
+    return (HaloSim::Projection)index;
+}
+
+const double maxUnsigned = 4294967295.0;
+const double maxInterval = 1e6;
+
+// Checked before any conversion, since converting a number out of range of the type is undefined
+double parseNumber(const QCommandLineParser &parser, const QString &option, double minimum, double maximum, bool whole = false)
+{
+    bool ok;
+    auto value = parser.value(option).toDouble(&ok);
+    if (!ok)
+        throw std::runtime_error(QString("Invalid value for --%1").arg(option).toStdString());
+    if (!(value >= minimum && value <= maximum) || (whole && value != std::floor(value)))
+    {
+        std::ostringstream message;
+        message.precision(17);
+        message << "--" << option.toStdString() << " must be a " << (whole ? "whole " : "") << "number between " << minimum << " and " << maximum;
+        throw std::runtime_error(message.str());
+    }
+    return value;
+}
+
+// Crystal populations are given as a comma separated list of presets, each with an optional weight
+void parseCrystals(const QString &list, HaloSim::Scene &scene)
+{
+    scene.crystals.clear();
+    scene.crystalWeights.clear();
+    for (auto &entry : list.split(',', QString::SkipEmptyParts))
+    {
+        auto parts = entry.split(':');
+        bool ok = true;
+        unsigned int weight = parts.size() > 1 ? parts[1].toUInt(&ok) : 1;
+        if (!ok || parts.size() > 2)
+            throw std::runtime_error(QString("Invalid crystal population %1").arg(entry).toStdString());
+        scene.crystals.push_back(HaloSim::CrystalPopulation::presetPopulation(parsePreset(parts[0])));
+        scene.crystalWeights.push_back(weight);
+    }
+    if (scene.crystals.empty())
+        throw std::runtime_error("No crystal populations given");
+}
+
+/*
+Settings come from the scene file when one is given, or otherwise from the
+defaults of scene files, and the options given on the command line replace
+them
+*/
+HaloSim::SceneFile readSceneSettings(const QCommandLineParser &parser)
+{
+    auto file = parser.isSet("scene") ? HaloSim::SceneFile::load(parser.value("scene").toStdString()) : HaloSim::SceneFile::createDefault();
+    auto &scene = file.scene;
+    if (parser.isSet("sun-altitude"))
+        scene.light.altitude = (float)parseNumber(parser, "sun-altitude", -90.0, 90.0);
+    if (parser.isSet("sun-diameter"))
+        scene.light.diameter = (float)parseNumber(parser, "sun-diameter", 0.0, 180.0);
+    if (parser.isSet("pitch"))
+        scene.camera.pitch = (float)parseNumber(parser, "pitch", -90.0, 90.0);
+    if (parser.isSet("yaw"))
+        scene.camera.yaw = (float)parseNumber(parser, "yaw", -360.0, 360.0);
+    if (parser.isSet("fov"))
+        scene.camera.fov = (float)parseNumber(parser, "fov", 0.01, 360.0);
+    if (parser.isSet("projection"))
+        scene.camera.projection = parseProjection(parser.value("projection"));
+    if (parser.isSet("hide-sub-horizon"))
+        scene.camera.hideSubHorizon = true;
+    if (parser.isSet("multiple-scattering"))
+        scene.multipleScatteringProbability = (float)parseNumber(parser, "multiple-scattering", 0.0, 1.0);
+    if (parser.isSet("crystals"))
+        parseCrystals(parser.value("crystals"), scene);
+    if (parser.isSet("width"))
+        file.outputWidth = (unsigned int)parseNumber(parser, "width", 1, maxUnsigned, true);
+    if (parser.isSet("height"))
+        file.outputHeight = (unsigned int)parseNumber(parser, "height", 1, maxUnsigned, true);
+    if (parser.isSet("seed"))
+        file.seed = (std::uint32_t)parseNumber(parser, "seed", 0, maxUnsigned, true);
+    if (parser.isSet("rays-per-step"))
+        file.raysPerStep = (unsigned int)parseNumber(parser, "rays-per-step", 1, maxUnsigned, true);
+    return file;
+}
+
+/*
+Checkpoints are written on a thread of their own from a copy of the
+simulation result, so that the simulation continues while they are written.
+A failed checkpoint is reported, but is not a reason to give up the render.
+*/
+class CheckpointWriter
+{
+public:
+    CheckpointWriter(const std::string &filename, const std::string &backend, const std::string &scene, unsigned int shardIndex, unsigned int shardCount)
+        : mFilename(filename),
+          mBackend(backend),
+          mScene(scene),
+          mShardIndex(shardIndex),
+          mShardCount(shardCount)
+    {
+    }
+
+    ~CheckpointWriter()
+    {
+        if (mWrite.valid())
+            mWrite.wait();
+    }
+
+    bool isBusy() const
+    {
+        return mWrite.valid() && mWrite.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+    }
+
+    void start(RenderBackend &backend)
+    {
+        finish();
+        auto checkpoint = std::make_shared<HaloSim::Checkpoint>(backend.createCheckpoint());
+        checkpoint->backend = mBackend;
+        checkpoint->scene = mScene;
+        checkpoint->randomStreamIndex = mShardIndex;
+        checkpoint->randomStreamCount = mShardCount;
+        auto filename = mFilename;
+        mWrite = std::async(std::launch::async, [checkpoint, filename]() {
+            checkpoint->save(filename);
+        });
+    }
+
+    void finish()
+    {
+        if (!mWrite.valid())
+            return;
+        try
+        {
+            mWrite.get();
+        }
+        catch (const std::exception &e)
+        {
+            std::fprintf(stderr, "\nCould not write a checkpoint: %s\n", e.what());
+        }
+    }
+
+    HaloSim::Checkpoint load() const
+    {
+        auto checkpoint = HaloSim::Checkpoint::load(mFilename);
+        if (checkpoint.backend != mBackend)
+            throw std::runtime_error(mFilename + " was made with the " + checkpoint.backend + " backend");
+        if (HaloSim::SceneFile::parse(checkpoint.scene).getHash() != HaloSim::SceneFile::parse(mScene).getHash())
+            throw std::runtime_error(mFilename + " was made with different scene settings");
+        if (checkpoint.randomStreamIndex != mShardIndex || checkpoint.randomStreamCount != mShardCount)
+            throw std::runtime_error(mFilename + " was made for shard " + std::to_string(checkpoint.randomStreamIndex) + "/" + std::to_string(checkpoint.randomStreamCount));
+        return checkpoint;
+    }
+
+private:
+    std::string mFilename;
+    std::string mBackend;
+    std::string mScene;
+    unsigned int mShardIndex;
+    unsigned int mShardCount;
+    std::future<void> mWrite;
+};
+
+FrameStream::Format parseStreamFormat(const QString &name)
+{
+    const QStringList names = {"rgb", "y4m", "half"};
+    auto index = names.indexOf(name.toLower());
+    if (index == -1)
+        throw std::runtime_error(QString("Unknown stream format %1").arg(name).toStdString());
+    return (FrameStream::Format)index;
+}
+
+void publishSnapshot(HaloSim::SharedMemoryWriter &writer, RenderBackend &backend, const HaloSim::SceneFile &file)
+{
+    HaloSim::RawImage image;
+    image.width = file.outputWidth;
+    image.height = file.outputHeight;
+    image.accumulation = backend.readAccumulation();
+    image.noise = backend.readNoise();
+    image.rayCount = backend.getRayCount();
+    image.exposure = 0.0f;
+    writer.publish(image, file.getHash());
+}
+
+// Shards are given as index/count, with indices from zero
+void parseShard(const QCommandLineParser &parser, unsigned int &index, unsigned int &count)
+{
+    index = 0;
+    count = 1;
+    if (!parser.isSet("shard"))
+        return;
+    auto parts = parser.value("shard").split('/');
+    bool indexOk = false, countOk = false;
+    if (parts.size() == 2)
+    {
+        index = parts[0].toUInt(&indexOk);
+        count = parts[1].toUInt(&countOk);
+    }
+    if (!indexOk || !countOk || count == 0 || index >= count)
+        throw std::runtime_error("Invalid shard, it should be like 0/4 for the first of four shards");
+}
+
+/*
+Reads a level or a region of an accumulation file, and writes it into an
+image with the brightness given on the command line. Regions are measured
+from the top left corner of the level.
+*/
+int exposeAccumulationFile(const QCommandLineParser &parser)
+{
+    HaloSim::AccumulationFileReader reader(QFile::encodeName(parser.value("from")).toStdString());
+    auto level = (unsigned int)parseNumber(parser, "level", 0, 31, true);
+    if (level >= reader.getLevelCount())
+        throw std::runtime_error(QString("The file has only %1 levels").arg(reader.getLevelCount()).toStdString());
+
+    auto levelWidth = reader.getWidth(level);
+    auto levelHeight = reader.getHeight(level);
+    unsigned int x = 0, y = 0, width = levelWidth, height = levelHeight;
+    if (parser.isSet("region"))
+    {
+        auto parts = parser.value("region").split(',');
+        bool ok = parts.size() == 4;
+        std::vector<unsigned int> values;
+        for (const auto &part : parts)
+        {
+            bool partOk;
+            values.push_back(part.toUInt(&partOk));
+            ok = ok && partOk;
+        }
+        if (!ok || values[2] == 0 || values[3] == 0 || values[0] + values[2] > levelWidth || values[1] + values[3] > levelHeight)
+            throw std::runtime_error(QString("Invalid region, the level is %1x%2 pixels").arg(levelWidth).arg(levelHeight).toStdString());
+        x = values[0];
+        width = values[2];
+        height = values[3];
+        y = levelHeight - values[1] - height;
+    }
+
+    auto scene = HaloSim::SceneFile::parse(reader.getScene()).scene;
+    HaloSim::RawImage image;
+    image.width = width;
+    image.height = height;
+    image.accumulation = reader.readAccumulation(level, x, y, width, height);
+    if (reader.hasNoise())
+        image.noise = reader.readNoise(level, x, y, width, height);
+    image.rayCount = reader.getRayCount();
+    image.exposure = HaloSim::getExposure(parseNumber(parser, "brightness", 0.001, 1000), image.rayCount, reader.getWidth(), reader.getHeight(), 1u << level, scene.camera.fov);
+    image.scene = reader.getScene();
+    image.seed = reader.getSeed();
+    image.randomStreamIndex = reader.getRandomStreamIndex();
+    image.randomStreamCount = reader.getRandomStreamCount();
+    writeImage(parser.value("output"), image);
+    return 0;
+}
+
+int mergeShards(const QCommandLineParser &parser)
+{
+    std::vector<std::string> filenames;
+    for (const auto &filename : parser.positionalArguments())
+        filenames.push_back(QFile::encodeName(filename).toStdString());
+    auto image = HaloSim::mergeAccumulationFiles(filenames);
+    auto scene = HaloSim::SceneFile::parse(image.scene).scene;
+    image.exposure = HaloSim::getExposure(parseNumber(parser, "brightness", 0.001, 1000), image.rayCount, image.width, image.height, 1, scene.camera.fov);
+    writeImage(parser.value("output"), image);
+    std::fprintf(stderr, "Merged %u files with %llu rays\n", (unsigned int)filenames.size(), image.rayCount);
+    return 0;
+}
+
+std::unique_ptr<RenderBackend> createBackend(const QCommandLineParser &parser, const HaloSim::SceneFile &file)
+{
+    auto backendName = parser.value("backend");
+    if (backendName == "cpu")
+        return std::make_unique<CpuBackend>(file.scene, file.outputWidth, file.outputHeight, file.raysPerStep, file.seed, (unsigned int)parseNumber(parser, "threads", 0, 4096, true));
+    if (backendName == "gpu")
+        return std::make_unique<GpuBackend>(file);
+    throw std::runtime_error(QString("Unknown backend %1").arg(backendName).toStdString());
+}
+
+// The backend is created up front, so that the first job finds it ready
+int serve(const QCommandLineParser &parser)
+{
+    auto backend = createBackend(parser, readSceneSettings(parser));
+    std::unique_ptr<ResultCache> cache;
+    if (parser.isSet("cache"))
+        cache = std::make_unique<ResultCache>(parser.value("cache"), (qint64)(parseNumber(parser, "cache-size", 0, 1e9) * 1024 * 1024));
+    RenderServer server(std::move(backend), parser.value("backend").toStdString(), std::move(cache));
+    server.listen(parser.value("serve"));
+    return QGuiApplication::exec();
+}
+
+/*
+Sends the render to a render server instead of rendering it here, and waits
+until the server has written the output file
+*/
+int submit(const QCommandLineParser &parser, const HaloSim::SceneFile &file, const QString &outputFilename)
+{
+    auto request = HaloSim::JsonValue::createObject();
+    request.set("scene", file.toJson());
+    request.set("rays", parseNumber(parser, "rays", 1, 1e15, true));
+    request.set("noiseTarget", parseNumber(parser, "noise-target", 0, 100));
+    request.set("brightness", parseNumber(parser, "brightness", 0.001, 1000));
+    request.set("priority", (int)parseNumber(parser, "priority", std::numeric_limits<int>::min(), std::numeric_limits<int>::max(), true));
+    // The server is unlikely to run in the same directory
+    request.set("output", QFileInfo(outputFilename).absoluteFilePath().toStdString());
+
+    QLocalSocket socket;
+    socket.connectToServer(parser.value("submit"));
+    if (!socket.waitForConnected(5000))
+        throw std::runtime_error(QString("Could not connect to %1: %2").arg(parser.value("submit"), socket.errorString()).toStdString());
+    auto message = RenderServer::formatMessage(request);
+    socket.write(message.data(), (qint64)message.size());
+
+    while (true)
+    {
+        while (!socket.canReadLine())
+        {
+            if (!socket.waitForReadyRead(-1))
+                throw std::runtime_error("The render server closed the connection");
+        }
+        auto reply = HaloSim::JsonValue::parse(socket.readLine().toStdString());
+        auto status = reply.at("status").toString();
+        if (status == "invalid" || status == "failed")
+            throw std::runtime_error("The render server could not render the job: " + reply.at("error").toString());
+        if (status == "done")
+        {
+            std::fprintf(stderr, "Rendered %.0f rays, %.0f of them from the cache\n", reply.at("rays").toNumber(), reply.at("cachedRays").toNumber());
+            return 0;
+        }
+        std::fprintf(stderr, "Job %.0f %s\n", reply.at("job").toNumber(), status.c_str());
+    }
+}
+
+int render(const QCommandLineParser &parser)
+{
+    if (parser.isSet("merge") || parser.isSet("from"))
+    {
+        if (!parser.isSet("output"))
+            throw std::runtime_error("No output file given");
+        return parser.isSet("merge") ? mergeShards(parser) : exposeAccumulationFile(parser);
+    }
+    if (!parser.positionalArguments().isEmpty())
+        throw std::runtime_error("Files to merge are only used with --merge");
+    if (parser.isSet("serve"))
+        return serve(parser);
+
+    auto file = readSceneSettings(parser);
+    if (parser.isSet("save-scene"))
+        file.save(parser.value("save-scene").toStdString());
+
+    auto outputFilename = parser.value("output");
+    if (outputFilename.isEmpty())
+    {
+        // Only writing the scene file is fine
+        if (parser.isSet("save-scene"))
+            return 0;
+        throw std::runtime_error("No output file given");
+    }
+    if (parser.isSet("submit"))
+        return submit(parser, file, outputFilename);
+
+    const auto &scene = file.scene;
+    auto width = file.outputWidth;
+    auto height = file.outputHeight;
+    auto rayBudget = (unsigned long long)parseNumber(parser, "rays", 1, 1e15, true);
+    unsigned int shardIndex, shardCount;
+    parseShard(parser, shardIndex, shardCount);
+    rayBudget = rayBudget / shardCount + (shardIndex < rayBudget % shardCount ? 1 : 0);
+    auto noiseTarget = parseNumber(parser, "noise-target", 0, 100) / 100.0;
+
+    auto backendName = parser.value("backend");
+    auto backend = createBackend(parser, file);
+    backend->setRandomStream(shardIndex, shardCount);
+    backend->setMaxRayCount(rayBudget);
+
+    std::unique_ptr<CheckpointWriter> checkpointWriter;
+    if (parser.isSet("checkpoint"))
+    {
+        auto checkpointFilename = QFile::encodeName(parser.value("checkpoint")).toStdString();
+        checkpointWriter = std::make_unique<CheckpointWriter>(checkpointFilename, backendName.toStdString(), file.serialize(), shardIndex, shardCount);
+        if (parser.isSet("resume") && QFile::exists(parser.value("checkpoint")))
+        {
+            backend->resume(checkpointWriter->load());
+            std::fprintf(stderr, "Resuming from %s\n", checkpointFilename.c_str());
+        }
+    }
+    else if (parser.isSet("resume"))
+    {
+        throw std::runtime_error("--resume needs a --checkpoint file");
+    }
+    auto checkpointInterval = std::chrono::duration<double>(parseNumber(parser, "checkpoint-interval", 0, maxInterval));
+
+    auto brightness = parseNumber(parser, "brightness", 0.001, 1000);
+    std::unique_ptr<FrameStream> frameStream;
+    auto frameInterval = std::chrono::duration<double>(parseNumber(parser, "stream-interval", 0, maxInterval));
+    if (parser.isSet("stream"))
+    {
+        auto streamFilename = parser.value("stream") == "-" ? std::string("-") : QFile::encodeName(parser.value("stream")).toStdString();
+        frameStream = std::make_unique<FrameStream>(streamFilename, parseStreamFormat(parser.value("stream-format")), width, height, frameInterval.count());
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+    auto lastCheckpointTime = startTime;
+    auto lastFrameTime = startTime;
+
+    std::unique_ptr<HaloSim::SharedMemoryWriter> snapshotWriter;
+    auto snapshotInterval = std::chrono::duration<double>(parseNumber(parser, "shared-memory-interval", 0, maxInterval));
+    auto lastSnapshotTime = startTime;
+    if (parser.isSet("shared-memory"))
+        snapshotWriter = std::make_unique<HaloSim::SharedMemoryWriter>(parser.value("shared-memory").toStdString(), width, height, true);
+    double elapsedSeconds = 0.0;
+    while (true)
+    {
+        auto noise = backend->getNoiseEstimate();
+        if (backend->getRayCount() >= rayBudget || (noiseTarget > 0.0 && noise >= 0.0 && noise <= noiseTarget))
+            break;
+
+        backend->step();
+
+        auto now = std::chrono::steady_clock::now();
+        if (checkpointWriter != nullptr && now - lastCheckpointTime >= checkpointInterval && !checkpointWriter->isBusy())
+        {
+            checkpointWriter->start(*backend);
+            lastCheckpointTime = now;
+        }
+
+        // A frame that would not fit into the queue is not even read
+        if (frameStream != nullptr && now - lastFrameTime >= frameInterval)
+        {
+            if (frameStream->hasRoom())
+                frameStream->push(backend->readAccumulation(), HaloSim::getExposure(brightness, backend->getRayCount(), width, height, 1, scene.camera.fov));
+            else
+                frameStream->skip();
+            lastFrameTime = now;
+        }
+
+        if (snapshotWriter != nullptr && now - lastSnapshotTime >= snapshotInterval)
+        {
+            publishSnapshot(*snapshotWriter, *backend, file);
+            lastSnapshotTime = now;
+        }
+
+        elapsedSeconds = std::chrono::duration<double>(now - startTime).count();
+        std::fprintf(stderr, "\r%llu rays, %.2f Mrays/s, noise %.2f %%   ",
+                     backend->getRayCount(),
+                     backend->getRayCount() / std::max(1e-9, elapsedSeconds) / 1e6,
+                     std::max(0.0, backend->getNoiseEstimate()) * 100.0);
+    }
+    std::fprintf(stderr, "\nTraced %llu rays in %.1f s\n", backend->getRayCount(), elapsedSeconds);
+
+    // The ring is closed when the render returns, and readers keep the final snapshot until they let go
+    if (snapshotWriter != nullptr)
+        publishSnapshot(*snapshotWriter, *backend, file);
+
+    if (frameStream != nullptr)
+    {
+        frameStream->finish(backend->readAccumulation(), HaloSim::getExposure(brightness, backend->getRayCount(), width, height, 1, scene.camera.fov));
+        if (!frameStream->getError().empty())
+            std::fprintf(stderr, "Streaming stopped: %s\n", frameStream->getError().c_str());
+        if (frameStream->getDroppedFrameCount() > 0)
+            std::fprintf(stderr, "Dropped %u of the streamed frames\n", frameStream->getDroppedFrameCount());
+    }
+
+    // The final checkpoint lets a later run continue with a larger ray budget
+    if (checkpointWriter != nullptr)
+    {
+        checkpointWriter->start(*backend);
+        checkpointWriter->finish();
+    }
+
+    HaloSim::RawImage image;
+    image.width = width;
+    image.height = height;
+    image.accumulation = backend->readAccumulation();
+    image.noise = backend->readNoise();
+    image.rayCount = backend->getRayCount();
+    image.exposure = HaloSim::getExposure(brightness, image.rayCount, width, height, 1, scene.camera.fov);
+    image.scene = file.serialize();
+    image.seed = file.seed;
+    image.randomStreamIndex = shardIndex;
+    image.randomStreamCount = shardCount;
+    writeImage(outputFilename, image);
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    // Nothing is shown, so no display is needed unless another platform is chosen
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QGuiApplication app(argc, argv);
+    QGuiApplication::setApplicationName("haloray-cli");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Renders ice crystal halos without a user interface");
+    parser.addHelpOption();
+    parser.addOptions({
+        {{"o", "output"}, "Image file to write. Files ending in .exr or .pfm get the raw XYZ result, .hra an accumulation file, and .tif or .tiff a 16-bit image.", "file"},
+        {"scene", "Scene file to render. The options below replace its settings.", "file"},
+        {"save-scene", "Write the scene and settings to a scene file.", "file"},
+        {"backend", "Simulation backend, gpu or cpu.", "backend", "gpu"},
+        {"width", "Image width in pixels, 1920 by default.", "pixels"},
+        {"height", "Image height in pixels, 1080 by default.", "pixels"},
+        {"rays", "Number of rays to trace, shared between all shards.", "rays", "100000000"},
+        {"noise-target", "Stop early once the estimated noise falls below this percentage.", "percent", "0"},
+        {"seed", "Seed of the random numbers, 1 by default.", "seed"},
+        {"rays-per-step", "Rays traced per step, 500000 by default.", "rays"},
+        {"threads", "Threads used by the CPU backend, 0 for all cores.", "count", "0"},
+        {"crystals", "Crystal populations as comma separated presets with optional weights, such as column:2,plate. Columns, plates and random crystals by default.", "list"},
+        {"sun-altitude", "Sun altitude in degrees, 30 by default.", "degrees"},
+        {"sun-diameter", "Sun diameter in degrees, 0.5 by default.", "degrees"},
+        {"multiple-scattering", "Probability of a ray scattering from two crystals, 0 by default.", "probability"},
+        {"pitch", "Camera pitch in degrees, 0 by default.", "degrees"},
+        {"yaw", "Camera yaw in degrees, 0 by default.", "degrees"},
+        {"fov", "Camera field of view in degrees, 75 by default.", "degrees"},
+        {"projection", "Camera projection: stereographic, rectilinear, equidistant, equal-area or orthographic. Stereographic by default.", "projection"},
+        {"hide-sub-horizon", "Hide the rays below the horizon."},
+        {"brightness", "Brightness of the image.", "brightness", "1"},
+        {"checkpoint", "Checkpoint file, written periodically while rendering and when done.", "file"},
+        {"checkpoint-interval", "Time between checkpoints.", "seconds", "300"},
+        {"resume", "Continue from the checkpoint file if it exists, instead of starting over."},
+        {"shard", "Render one shard of the rays, such as 2/8 for the third of eight. Shards never share random numbers, and their accumulation files can be merged with --merge.", "index/count"},
+        {"merge", "Merge the accumulation files given after the options into one image, instead of rendering."},
+        {"serve", "Run a render server on the local socket of this name, which renders the jobs sent to it until it is stopped. The backend and threads of the server are used for all jobs.", "name"},
+        {"cache", "Directory where the render server keeps finished renders, so that renders of the same settings continue from them.", "directory"},
+        {"cache-size", "Size limit of the render server cache.", "megabytes", "4096"},
+        {"submit", "Send the render to the render server of this name instead of rendering it here, and wait until it is done.", "name"},
+        {"priority", "Priority of a render sent with --submit. Renders of higher priority go first.", "priority", "0"},
+        {"stream", "Write frames of the render in progress into this file or named pipe, or - for the standard output.", "file"},
+        {"stream-format", "Format of the streamed frames: y4m video, rgb for raw 8-bit sRGB, or half for raw XYZ as 16-bit floats.", "format", "y4m"},
+        {"stream-interval", "Time between streamed frames.", "seconds", "1"},
+        {"shared-memory", "Publish snapshots of the render in progress into shared memory of this name, for other programs to read.", "name"},
+        {"shared-memory-interval", "Time between shared memory snapshots.", "seconds", "1"},
+        {"from", "Write an image of an accumulation file instead of rendering. Only the output, brightness, level and region options are used.", "file"},
+        {"level", "Level of the accumulation file, 0 for full resolution and each level after it half the size of the one before.", "level", "0"},
+        {"region", "Part of the level to write, in pixels from the top left corner.", "x,y,width,height"},
+    });
+    parser.addPositionalArgument("files", "Accumulation files to merge with --merge.", "[files...]");
+    parser.process(app);
+
+    try
+    {
+        return render(parser);
+    }
+    catch (const std::exception &e)
+    {
+        std::fprintf(stderr, "haloray-cli: %s\n", e.what());
+        return 1;
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <vector>
+#include "../simulation/checkpoint.h"
+#include "../simulation/sceneFile.h"
+
+/*
+A way of simulating a scene for the command line renderer. Images have four
+floats per pixel, XYZ colors first, starting from the bottom row.
+*/
+class RenderBackend
+{
+public:
+    virtual ~RenderBackend() = default;
+
+    // Only every count-th random seed is used, starting from the index-th, so that shards never share seeds
+    virtual void setRandomStream(unsigned int index, unsigned int count) = 0;
+
+    // Starts over with the scene, size and seed of a scene file, keeping what can be reused
+    virtual void restart(const HaloSim::SceneFile &file) = 0;
+
+    // Steps are cut short so that the ray count never goes past the limit, which is kept across restarts
+    virtual void setMaxRayCount(unsigned long long rays) = 0;
+
+    virtual void step() = 0;
+    virtual unsigned long long getRayCount() const = 0;
+
+    // Negative until there is an estimate
+    virtual double getNoiseEstimate() const = 0;
+
+    virtual std::vector<float> readAccumulation() = 0;
+
+    // Sums of squared luminance and ray counts of the pixels, in the same layout
+    virtual std::vector<float> readNoise() = 0;
+
+    /*
+    Checkpoints have everything except the backend name, the scene and the
+    random stream, which are up to the caller. Resuming is only possible
+    before the first step, from a checkpoint of the same backend, scene, seed
+    and random stream.
+    */
+    virtual HaloSim::Checkpoint createCheckpoint() = 0;
+    virtual void resume(const HaloSim::Checkpoint &checkpoint) = 0;
+};
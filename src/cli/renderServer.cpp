@@ -0,0 +1,280 @@
+#include "renderServer.h"
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include "imageOutput.h"
+#include "../simulation/hash.h"
+#include "../simulation/toneMapping.h"
+
+namespace
+{
+
+// Checked before any conversion, since converting a number out of range of the type is undefined
+double readNumber(const HaloSim::JsonValue &request, const std::string &key, double defaultValue, double minimum, double maximum, bool whole)
+{
+    if (!request.contains(key))
+        return defaultValue;
+    auto value = request.at(key).toNumber();
+    if (!(value >= minimum && value <= maximum) || (whole && value != std::floor(value)))
+    {
+        std::ostringstream message;
+        message.precision(17);
+        message << key << " must be a " << (whole ? "whole " : "") << "number between " << minimum << " and " << maximum;
+        throw std::runtime_error(message.str());
+    }
+    return value;
+}
+
+} // namespace
+
+RenderServer::RenderServer(std::unique_ptr<RenderBackend> backend, const std::string &backendName, std::unique_ptr<ResultCache> cache, QObject *parent)
+    : QObject(parent),
+      mBackend(std::move(backend)),
+      mBackendName(backendName),
+      mCache(std::move(cache)),
+      mResumedRayCount(0),
+      mNextJobId(1)
+{
+    connect(&mServer, &QLocalServer::newConnection, this, &RenderServer::acceptConnection);
+
+    // Steps are taken between events, so that requests are answered while a job runs
+    mWorkTimer.setInterval(0);
+    connect(&mWorkTimer, &QTimer::timeout, this, &RenderServer::work);
+}
+
+void RenderServer::listen(const QString &name)
+{
+    QLocalServer::removeServer(name);
+    if (!mServer.listen(name))
+        throw std::runtime_error(QString("Could not listen on %1: %2").arg(name, mServer.errorString()).toStdString());
+    std::fprintf(stderr, "Listening on %s\n", mServer.fullServerName().toLocal8Bit().constData());
+}
+
+void RenderServer::acceptConnection()
+{
+    while (auto client = mServer.nextPendingConnection())
+    {
+        connect(client, &QLocalSocket::disconnected, client, &QObject::deleteLater);
+        connect(client, &QLocalSocket::readyRead, this, [this, client]() {
+            while (client->canReadLine())
+                handleRequest(client, client->readLine().trimmed().toStdString());
+        });
+    }
+}
+
+std::string RenderServer::formatMessage(const HaloSim::JsonValue &message)
+{
+    // Newlines outside of strings are only formatting, and strings have theirs escaped
+    auto text = message.serialize();
+    text.erase(std::remove(text.begin(), text.end(), '\n'), text.end());
+    text += '\n';
+    return text;
+}
+
+void RenderServer::reply(QLocalSocket *client, const HaloSim::JsonValue &message)
+{
+    if (client == nullptr || client->state() != QLocalSocket::ConnectedState)
+        return;
+    auto text = formatMessage(message);
+    client->write(text.data(), (qint64)text.size());
+}
+
+HaloSim::JsonValue RenderServer::createStatus(const Job &job, const char *status) const
+{
+    auto message = HaloSim::JsonValue::createObject();
+    message.set("job", job.id);
+    message.set("status", status);
+    return message;
+}
+
+void RenderServer::replyFailure(const Job &job, const std::exception &error)
+{
+    std::fprintf(stderr, "Job %u failed: %s\n", job.id, error.what());
+    auto message = createStatus(job, "failed");
+    message.set("error", error.what());
+    reply(job.client, message);
+}
+
+void RenderServer::replyDone(const Job &job, const HaloSim::Checkpoint &checkpoint, unsigned long long cachedRayCount)
+{
+    auto message = createStatus(job, "done");
+    message.set("rays", (double)checkpoint.rayCount);
+    message.set("cachedRays", (double)cachedRayCount);
+    reply(job.client, message);
+}
+
+void RenderServer::handleRequest(QLocalSocket *client, const std::string &line)
+{
+    if (line.empty())
+        return;
+
+    try
+    {
+        auto request = HaloSim::JsonValue::parse(line);
+        if (request.contains("command"))
+        {
+            if (request.at("command").toString() != "status")
+                throw std::runtime_error("Unknown command " + request.at("command").toString());
+            auto message = HaloSim::JsonValue::createObject();
+            message.set("status", "ok");
+            message.set("queued", (unsigned int)mQueue.size());
+            if (mCurrentJob != nullptr)
+            {
+                message.set("job", mCurrentJob->id);
+                message.set("rays", (double)mBackend->getRayCount());
+            }
+            reply(client, message);
+            return;
+        }
+
+        Job job;
+        job.id = mNextJobId++;
+        job.priority = (int)readNumber(request, "priority", 0, std::numeric_limits<int>::min(), std::numeric_limits<int>::max(), true);
+        job.file = HaloSim::SceneFile::fromJson(request.at("scene"));
+        job.rays = (unsigned long long)readNumber(request, "rays", 1e8, 1, 1e15, true);
+        job.noiseTarget = readNumber(request, "noiseTarget", 0, 0, 100, false) / 100.0;
+        job.brightness = readNumber(request, "brightness", 1, 0.001, 1000, false);
+        job.output = QString::fromStdString(request.at("output").toString());
+        job.client = client;
+        if (job.output.isEmpty())
+            throw std::runtime_error("No output file given");
+
+        auto position = std::upper_bound(mQueue.begin(), mQueue.end(), job, [](const Job &a, const Job &b) {
+            return a.priority > b.priority;
+        });
+        mQueue.insert(position, job);
+        reply(client, createStatus(job, "queued"));
+        mWorkTimer.start();
+    }
+    catch (const std::runtime_error &e)
+    {
+        auto message = HaloSim::JsonValue::createObject();
+        message.set("status", "invalid");
+        message.set("error", e.what());
+        reply(client, message);
+    }
+}
+
+std::uint64_t RenderServer::getCacheKey(const HaloSim::SceneFile &file) const
+{
+    HaloSim::Hasher hasher;
+    hasher.add(file.getHash());
+    hasher.add(mBackendName);
+    return hasher.getHash();
+}
+
+void RenderServer::work()
+{
+    if (mCurrentJob == nullptr)
+    {
+        if (mQueue.empty())
+        {
+            mWorkTimer.stop();
+            return;
+        }
+        startNextJob();
+        return;
+    }
+
+    try
+    {
+        auto noise = mBackend->getNoiseEstimate();
+        const auto &job = *mCurrentJob;
+        if (mBackend->getRayCount() >= job.rays || (job.noiseTarget > 0.0 && noise >= 0.0 && noise <= job.noiseTarget))
+            finishJob();
+        else
+            mBackend->step();
+    }
+    catch (const std::exception &e)
+    {
+        replyFailure(*mCurrentJob, e);
+        mCurrentJob.reset();
+    }
+}
+
+void RenderServer::startNextJob()
+{
+    mCurrentJob = std::make_unique<Job>(mQueue.front());
+    mQueue.pop_front();
+    const auto &job = *mCurrentJob;
+    mJobStartTime = std::chrono::steady_clock::now();
+    mResumedRayCount = 0;
+
+    try
+    {
+        HaloSim::Checkpoint checkpoint;
+        bool cached = mCache != nullptr && mCache->find(getCacheKey(job.file), job.rays, checkpoint) &&
+                      checkpoint.width == job.file.outputWidth && checkpoint.height == job.file.outputHeight &&
+                      HaloSim::SceneFile::parse(checkpoint.scene).getHash() == job.file.getHash();
+        if (cached && checkpoint.rayCount >= job.rays)
+        {
+            writeOutput(job, checkpoint);
+            std::fprintf(stderr, "Job %u: %llu rays from the cache\n", job.id, checkpoint.rayCount);
+            replyDone(job, checkpoint, checkpoint.rayCount);
+            mCurrentJob.reset();
+            return;
+        }
+
+        mBackend->restart(job.file);
+        mBackend->setMaxRayCount(job.rays);
+        if (cached)
+        {
+            mBackend->resume(checkpoint);
+            mResumedRayCount = checkpoint.rayCount;
+        }
+        reply(job.client, createStatus(job, "running"));
+    }
+    catch (const std::exception &e)
+    {
+        replyFailure(job, e);
+        mCurrentJob.reset();
+    }
+}
+
+void RenderServer::finishJob()
+{
+    const auto &job = *mCurrentJob;
+    auto checkpoint = mBackend->createCheckpoint();
+    checkpoint.backend = mBackendName;
+    checkpoint.scene = job.file.serialize();
+    checkpoint.randomStreamIndex = 0;
+    checkpoint.randomStreamCount = 1;
+
+    // The image is what the client waits for, so a full cache is only worth a warning
+    if (mCache != nullptr)
+    {
+        try
+        {
+            mCache->store(getCacheKey(job.file), checkpoint);
+        }
+        catch (const std::exception &e)
+        {
+            std::fprintf(stderr, "Could not cache job %u: %s\n", job.id, e.what());
+        }
+    }
+
+    writeOutput(job, checkpoint);
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - mJobStartTime).count();
+    std::fprintf(stderr, "Job %u: %llu rays, %llu of them from the cache, in %.1f s\n", job.id, checkpoint.rayCount, mResumedRayCount, seconds);
+    replyDone(job, checkpoint, mResumedRayCount);
+    mCurrentJob.reset();
+}
+
+void RenderServer::writeOutput(const Job &job, const HaloSim::Checkpoint &checkpoint)
+{
+    HaloSim::RawImage image;
+    image.width = checkpoint.width;
+    image.height = checkpoint.height;
+    image.accumulation = checkpoint.accumulation;
+    image.noise = checkpoint.noise;
+    image.rayCount = checkpoint.rayCount;
+    image.exposure = HaloSim::getExposure(job.brightness, image.rayCount, image.width, image.height, 1, job.file.scene.camera.fov);
+    image.scene = checkpoint.scene;
+    image.seed = job.file.seed;
+    image.randomStreamIndex = checkpoint.randomStreamIndex;
+    image.randomStreamCount = checkpoint.randomStreamCount;
+    writeImage(job.output, image);
+}
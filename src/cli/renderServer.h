@@ -0,0 +1,80 @@
+#pragma once
+#include <memory>
+#include <deque>
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <QObject>
+#include <QString>
+#include <QPointer>
+#include <QTimer>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include "renderBackend.h"
+#include "resultCache.h"
+#include "../simulation/json.h"
+#include "../simulation/sceneFile.h"
+
+/*
+Renders jobs sent over a local socket one after another, with one backend
+that stays alive for as long as the server runs. Requests and replies are
+JSON objects, one per line. A render request has the scene file object as
+"scene" and the "output" image file, and may have "rays", "noiseTarget",
+"brightness" and "priority" like the options of the command line. Requests
+with values out of range are answered as invalid. Jobs of higher priority
+go first, and jobs of equal priority in the order they came in. The client
+is told when its job is queued, started and done or failed. A request of {"command": "status"}
+is answered with the state of the queue.
+
+With a cache, finished renders are kept by their settings and ray count,
+so a repeated render is written straight from the cache, and a render of
+more rays continues from the largest cached one.
+*/
+class RenderServer : public QObject
+{
+    Q_OBJECT
+public:
+    RenderServer(std::unique_ptr<RenderBackend> backend, const std::string &backendName, std::unique_ptr<ResultCache> cache, QObject *parent = nullptr);
+
+    void listen(const QString &name);
+
+    // A message as one line of text, which is how messages are sent both ways
+    static std::string formatMessage(const HaloSim::JsonValue &message);
+
+private:
+    struct Job
+    {
+        unsigned int id;
+        int priority;
+        HaloSim::SceneFile file;
+        unsigned long long rays;
+        double noiseTarget;
+        double brightness;
+        QString output;
+        QPointer<QLocalSocket> client;
+    };
+
+    void acceptConnection();
+    void handleRequest(QLocalSocket *client, const std::string &line);
+    void reply(QLocalSocket *client, const HaloSim::JsonValue &message);
+    HaloSim::JsonValue createStatus(const Job &job, const char *status) const;
+    void replyFailure(const Job &job, const std::exception &error);
+    void replyDone(const Job &job, const HaloSim::Checkpoint &checkpoint, unsigned long long cachedRayCount);
+    void work();
+    void startNextJob();
+    void finishJob();
+    void writeOutput(const Job &job, const HaloSim::Checkpoint &checkpoint);
+    std::uint64_t getCacheKey(const HaloSim::SceneFile &file) const;
+
+    QLocalServer mServer;
+    QTimer mWorkTimer;
+    std::unique_ptr<RenderBackend> mBackend;
+    std::string mBackendName;
+    std::unique_ptr<ResultCache> mCache;
+    std::deque<Job> mQueue;
+    std::unique_ptr<Job> mCurrentJob;
+    unsigned long long mResumedRayCount;
+    std::chrono::steady_clock::time_point mJobStartTime;
+    unsigned int mNextJobId;
+};
@@ -0,0 +1,75 @@
+#include "resultCache.h"
+#include <map>
+#include <iterator>
+#include <stdexcept>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+
+ResultCache::ResultCache(const QString &directory, qint64 sizeLimit)
+    : mDirectory(directory),
+      mSizeLimit(sizeLimit)
+{
+    if (!mDirectory.mkpath("."))
+        throw std::runtime_error(QString("Could not create the cache directory %1").arg(directory).toStdString());
+}
+
+QString ResultCache::getKeyPrefix(std::uint64_t key) const
+{
+    return QString("%1-").arg((qulonglong)key, 16, 16, QChar('0'));
+}
+
+bool ResultCache::find(std::uint64_t key, unsigned long long rays, HaloSim::Checkpoint &checkpoint)
+{
+    auto prefix = getKeyPrefix(key);
+    std::map<unsigned long long, QString> entries;
+    for (const auto &name : mDirectory.entryList({prefix + "*.hrck"}, QDir::Files))
+    {
+        bool ok;
+        auto entryRays = name.mid(prefix.size()).section('.', 0, 0).toULongLong(&ok);
+        if (ok)
+            entries[entryRays] = mDirectory.filePath(name);
+    }
+
+    while (!entries.empty())
+    {
+        auto entry = entries.lower_bound(rays);
+        if (entry == entries.end())
+            entry = std::prev(entries.end());
+        try
+        {
+            checkpoint = HaloSim::Checkpoint::load(QFile::encodeName(entry->second).toStdString());
+            QFile file(entry->second);
+            if (file.open(QIODevice::ReadWrite))
+                file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+            return true;
+        }
+        catch (const std::runtime_error &)
+        {
+            // Damaged entries are of no use to anyone
+            QFile::remove(entry->second);
+            entries.erase(entry);
+        }
+    }
+    return false;
+}
+
+void ResultCache::store(std::uint64_t key, const HaloSim::Checkpoint &checkpoint)
+{
+    auto name = getKeyPrefix(key) + QString::number(checkpoint.rayCount) + ".hrck";
+    checkpoint.save(QFile::encodeName(mDirectory.filePath(name)).toStdString());
+    removeOldEntries();
+}
+
+// The newest entry is kept even if it alone is over the limit
+void ResultCache::removeOldEntries()
+{
+    qint64 size = 0;
+    auto entries = mDirectory.entryInfoList({"*.hrck"}, QDir::Files, QDir::Time);
+    for (auto i = 0; i < entries.size(); ++i)
+    {
+        size += entries[i].size();
+        if (i > 0 && size > mSizeLimit)
+            QFile::remove(entries[i].filePath());
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdint>
+#include <QDir>
+#include <QString>
+#include "../simulation/checkpoint.h"
+
+/*
+Finished renders of the render server, kept in a directory as checkpoint
+files so that later renders of the same settings can continue from them.
+Files are named by the key of their settings and by their ray count, so a
+key can have entries of several sizes. The least recently used entries are
+removed once the directory grows beyond its size limit.
+*/
+class ResultCache
+{
+public:
+    ResultCache(const QString &directory, qint64 sizeLimit);
+
+    /*
+    Finds the best entry for a render of the given number of rays: the
+    smallest entry with at least that many rays, or failing that the largest
+    one. Returns false if the key has no readable entries.
+    */
+    bool find(std::uint64_t key, unsigned long long rays, HaloSim::Checkpoint &checkpoint);
+
+    void store(std::uint64_t key, const HaloSim::Checkpoint &checkpoint);
+
+private:
+    QString getKeyPrefix(std::uint64_t key) const;
+    void removeOldEntries();
+
+    QDir mDirectory;
+    qint64 mSizeLimit;
+};
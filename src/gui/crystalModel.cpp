@@ -112,6 +112,15 @@ void CrystalModel::addRow(HaloSim::CrystalPopulationPreset preset)
     endInsertRows();
 }
 
+void CrystalModel::setPopulations(const std::vector<HaloSim::CrystalPopulation> &populations, const std::vector<unsigned int> &weights)
+{
+    beginResetModel();
+    mCrystals->clear();
+    for (auto i = 0u; i < populations.size(); ++i)
+        mCrystals->add(populations[i], weights[i]);
+    endResetModel();
+}
+
 bool CrystalModel::removeRow(int row)
 {
     if (mCrystals->getCount() <= 1)
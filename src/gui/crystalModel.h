@@ -19,6 +19,7 @@ public:
 
     void addRow(HaloSim::CrystalPopulationPreset preset = HaloSim::CrystalPopulationPreset::Random);
     bool removeRow(int row);
+    void setPopulations(const std::vector<HaloSim::CrystalPopulation> &populations, const std::vector<unsigned int> &weights);
 
 private:
     std::shared_ptr<HaloSim::CrystalPopulationRepository> mCrystals;
@@ -92,6 +92,19 @@ void CrystalSettingsWidget::addPopulationComboBoxItem()
     mPopulationComboBox->addItem(QString("Population %1").arg(mNextPopulationId++));
 }
 
+// Replaces all the populations, such as when a scene is loaded
+void CrystalSettingsWidget::setPopulations(const std::vector<HaloSim::CrystalPopulation> &populations, const std::vector<unsigned int> &weights)
+{
+    mModel->setPopulations(populations, weights);
+    mPopulationComboBox->clear();
+    mNextPopulationId = 1;
+    for (auto i = 0u; i < populations.size(); ++i)
+        addPopulationComboBoxItem();
+    mMapper->toFirst();
+    updateRemovePopulationButtonState();
+    emit crystalChanged();
+}
+
 void CrystalSettingsWidget::fillPopulationComboBox()
 {
     mPopulationComboBox->addItems({"Columns", "Plates", "Random"});
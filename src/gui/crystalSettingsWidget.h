@@ -17,6 +17,7 @@ class CrystalSettingsWidget : public QGroupBox
     Q_OBJECT
 public:
     CrystalSettingsWidget(std::shared_ptr<HaloSim::CrystalPopulationRepository> crystalRepository, QWidget *parent = nullptr);
+    void setPopulations(const std::vector<HaloSim::CrystalPopulation> &populations, const std::vector<unsigned int> &weights);
 
 signals:
     void crystalChanged();
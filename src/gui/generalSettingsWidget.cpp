@@ -1,5 +1,6 @@
 #include "generalSettingsWidget.h"
 #include <QFormLayout>
+#include <QSize>
 
 GeneralSettingsWidget::GeneralSettingsWidget(QWidget *parent)
     : QGroupBox("General settings", parent)
@@ -23,19 +24,65 @@ GeneralSettingsWidget::GeneralSettingsWidget(QWidget *parent)
     });
 
     connect(mMultipleScattering, &SliderSpinBox::valueChanged, this, &GeneralSettingsWidget::multipleScatteringProbabilityChanged);
+
+    connect(mPipelineComboBox, QOverload<int>::of(&QComboBox::currentIndexChanged), [this](int index) {
+        emit pipelineChanged((HaloSim::SimulationPipeline)index);
+    });
+
+    connect(mFrameTimeBudgetSpinBox, QOverload<int>::of(&QSpinBox::valueChanged), [this](int value) {
+        mRaysPerFrameSpinBox->setEnabled(value == 0);
+        emit frameTimeBudgetChanged((unsigned int)value);
+    });
+
+    connect(mResolutionComboBox, QOverload<int>::of(&QComboBox::currentIndexChanged), [this](int index) {
+        auto size = mResolutionComboBox->itemData(index).toSize();
+        emit outputSizeChanged((unsigned int)size.width(), (unsigned int)size.height());
+    });
+
+    connect(mAdaptiveRayAllocationCheckBox, &QCheckBox::toggled, this, &GeneralSettingsWidget::adaptiveRayAllocationChanged);
+
+    connect(mNoiseTrackingCheckBox, &QCheckBox::toggled, [this](bool enabled) {
+        mNoiseTargetSpinBox->setEnabled(enabled);
+        emit noiseTrackingChanged(enabled);
+    });
+
+    connect(mNoiseTargetSpinBox, QOverload<double>::of(&QDoubleSpinBox::valueChanged), [this](double value) {
+        emit noiseTargetChanged(value / 100.0);
+    });
 }
 
 void GeneralSettingsWidget::setInitialValues(double sunDiameter,
                                              double sunAltitude,
                                              unsigned int raysPerFrame,
                                              unsigned int maxNumFrames,
-                                             double multipleScatteringProbability)
+                                             double multipleScatteringProbability,
+                                             HaloSim::SimulationPipeline pipeline,
+                                             unsigned int frameTimeBudget,
+                                             unsigned int outputWidth,
+                                             unsigned int outputHeight,
+                                             bool adaptiveRayAllocation,
+                                             bool noiseTracking,
+                                             double noiseTarget)
 {
     mSunDiameterSpinBox->setValue(sunDiameter);
     mSunAltitudeSlider->setValue(sunAltitude);
     mRaysPerFrameSpinBox->setValue(raysPerFrame);
     mMaximumFramesSpinBox->setValue(maxNumFrames);
     mMultipleScattering->setValue(multipleScatteringProbability);
+    mPipelineComboBox->setCurrentIndex((int)pipeline);
+    mFrameTimeBudgetSpinBox->setValue(frameTimeBudget);
+
+    QSize outputSize((int)outputWidth, (int)outputHeight);
+    auto resolutionIndex = mResolutionComboBox->findData(outputSize);
+    if (resolutionIndex == -1)
+    {
+        mResolutionComboBox->addItem(QString("%1 × %2").arg(outputWidth).arg(outputHeight), outputSize);
+        resolutionIndex = mResolutionComboBox->count() - 1;
+    }
+    mResolutionComboBox->setCurrentIndex(resolutionIndex);
+    mAdaptiveRayAllocationCheckBox->setChecked(adaptiveRayAllocation);
+    mNoiseTrackingCheckBox->setChecked(noiseTracking);
+    mNoiseTargetSpinBox->setValue(noiseTarget * 100.0);
 }
 
 void GeneralSettingsWidget::setupUi()
@@ -70,12 +117,51 @@ void GeneralSettingsWidget::setupUi()
     mMultipleScattering->setMinimum(0.0);
     mMultipleScattering->setMaximum(1.0);
 
+    mPipelineComboBox = new QComboBox();
+    mPipelineComboBox->addItems({tr("Single pass"),
+                                 tr("Wavefront")});
+
+    mFrameTimeBudgetSpinBox = new QSpinBox();
+    mFrameTimeBudgetSpinBox->setSuffix(" ms");
+    mFrameTimeBudgetSpinBox->setSpecialValueText(tr("Off"));
+    mFrameTimeBudgetSpinBox->setMinimum(0);
+    mFrameTimeBudgetSpinBox->setMaximum(1000);
+    mFrameTimeBudgetSpinBox->setValue(0);
+
+    mResolutionComboBox = new QComboBox();
+    mResolutionComboBox->addItem(tr("1280 × 720 (HD)"), QSize(1280, 720));
+    mResolutionComboBox->addItem(tr("1920 × 1080 (Full HD)"), QSize(1920, 1080));
+    mResolutionComboBox->addItem(tr("2560 × 1440 (QHD)"), QSize(2560, 1440));
+    mResolutionComboBox->addItem(tr("3840 × 2160 (4K)"), QSize(3840, 2160));
+    mResolutionComboBox->addItem(tr("7680 × 4320 (8K)"), QSize(7680, 4320));
+    mResolutionComboBox->addItem(tr("2048 × 2048"), QSize(2048, 2048));
+    mResolutionComboBox->addItem(tr("4096 × 4096"), QSize(4096, 4096));
+
+    mAdaptiveRayAllocationCheckBox = new QCheckBox();
+
+    mNoiseTrackingCheckBox = new QCheckBox();
+
+    mNoiseTargetSpinBox = new QDoubleSpinBox();
+    mNoiseTargetSpinBox->setSuffix(" %");
+    mNoiseTargetSpinBox->setSpecialValueText(tr("Off"));
+    mNoiseTargetSpinBox->setSingleStep(0.5);
+    mNoiseTargetSpinBox->setMinimum(0.0);
+    mNoiseTargetSpinBox->setMaximum(50.0);
+    mNoiseTargetSpinBox->setValue(0.0);
+    mNoiseTargetSpinBox->setEnabled(false);
+
     auto layout = new QFormLayout(this);
     layout->addRow(tr("Sun altitude"), mSunAltitudeSlider);
     layout->addRow(tr("Sun diameter"), mSunDiameterSpinBox);
     layout->addRow(tr("Rays per frame"), mRaysPerFrameSpinBox);
+    layout->addRow(tr("Frame time budget"), mFrameTimeBudgetSpinBox);
     layout->addRow(tr("Maximum frames"), mMaximumFramesSpinBox);
+    layout->addRow(tr("Noise tracking"), mNoiseTrackingCheckBox);
+    layout->addRow(tr("Noise target"), mNoiseTargetSpinBox);
     layout->addRow(tr("Double scattering"), mMultipleScattering);
+    layout->addRow(tr("Ray tracing"), mPipelineComboBox);
+    layout->addRow(tr("Adaptive rays"), mAdaptiveRayAllocationCheckBox);
+    layout->addRow(tr("Resolution"), mResolutionComboBox);
 }
 
 HaloSim::LightSource GeneralSettingsWidget::stateToLightSource() const
@@ -95,3 +181,8 @@ void GeneralSettingsWidget::setMaxRaysPerFrame(unsigned int maxRays)
 {
     mRaysPerFrameSpinBox->setMaximum((int)maxRays);
 }
+
+void GeneralSettingsWidget::setNoiseTracking(bool enabled)
+{
+    mNoiseTrackingCheckBox->setChecked(enabled);
+}
@@ -3,8 +3,11 @@
 #include <QDoubleSpinBox>
 #include <QSpinBox>
 #include <QGroupBox>
+#include <QComboBox>
+#include <QCheckBox>
 #include "sliderSpinBox.h"
 #include "../simulation/lightSource.h"
+#include "../simulation/simulationEngine.h"
 
 class GeneralSettingsWidget : public QGroupBox
 {
@@ -15,17 +18,31 @@ public:
                           double sunAltitude,
                           unsigned int raysPerFrame,
                           unsigned int maxNumFrames,
-                          double multipleScatteringProbability);
+                          double multipleScatteringProbability,
+                          HaloSim::SimulationPipeline pipeline,
+                          unsigned int frameTimeBudget,
+                          unsigned int outputWidth,
+                          unsigned int outputHeight,
+                          bool adaptiveRayAllocation,
+                          bool noiseTracking,
+                          double noiseTarget);
 
 signals:
     void lightSourceChanged(HaloSim::LightSource light);
     void numRaysChanged(unsigned int rays);
     void maximumNumberOfIterationsChanged(unsigned int iterations);
     void multipleScatteringProbabilityChanged(double probability);
+    void pipelineChanged(HaloSim::SimulationPipeline pipeline);
+    void frameTimeBudgetChanged(unsigned int milliseconds);
+    void outputSizeChanged(unsigned int width, unsigned int height);
+    void adaptiveRayAllocationChanged(bool enabled);
+    void noiseTrackingChanged(bool enabled);
+    void noiseTargetChanged(double relativeError);
 
 public slots:
     void toggleMaxIterationsSpinBoxStatus();
     void setMaxRaysPerFrame(unsigned int maxRays);
+    void setNoiseTracking(bool enabled);
 
 private:
     HaloSim::LightSource stateToLightSource() const;
@@ -36,4 +53,10 @@ private:
     QSpinBox *mRaysPerFrameSpinBox;
     QSpinBox *mMaximumFramesSpinBox;
     SliderSpinBox *mMultipleScattering;
+    QComboBox *mPipelineComboBox;
+    QSpinBox *mFrameTimeBudgetSpinBox;
+    QComboBox *mResolutionComboBox;
+    QCheckBox *mAdaptiveRayAllocationCheckBox;
+    QCheckBox *mNoiseTrackingCheckBox;
+    QDoubleSpinBox *mNoiseTargetSpinBox;
 };
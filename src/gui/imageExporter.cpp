@@ -0,0 +1,203 @@
+#include "imageExporter.h"
+#include <QImage>
+#include <QFile>
+#include <cstring>
+#include <stdexcept>
+#include "../simulation/imageFile.h"
+#include "../simulation/accumulationFile.h"
+#include "../simulation/toneMapping.h"
+
+namespace
+{
+
+void encode(const ImageExporter::Request &request, unsigned int width, unsigned int height, std::vector<float> accumulation, std::vector<float> noise)
+{
+    auto filename = QFile::encodeName(request.filename).toStdString();
+    switch (request.format)
+    {
+    case ImageExporter::Format::Exr:
+    case ImageExporter::Format::Pfm:
+    case ImageExporter::Format::Accumulation:
+    {
+        HaloSim::RawImage image;
+        image.width = width;
+        image.height = height;
+        image.accumulation = std::move(accumulation);
+        image.noise = std::move(noise);
+        image.rayCount = request.rayCount;
+        image.exposure = request.exposure;
+        image.scene = request.scene;
+        image.seed = request.seed;
+        image.randomStreamIndex = 0;
+        image.randomStreamCount = 1;
+        if (request.format == ImageExporter::Format::Exr)
+            HaloSim::writeExr(filename, image);
+        else if (request.format == ImageExporter::Format::Pfm)
+            HaloSim::writePfm(filename, image);
+        else
+            HaloSim::writeAccumulationFile(filename, image);
+        break;
+    }
+    case ImageExporter::Format::Tiff16:
+        HaloSim::writeTiff16(filename, width, height, HaloSim::toneMapToSrgb16(width, height, accumulation, request.exposure));
+        break;
+    case ImageExporter::Format::Png16:
+    {
+        auto pixels = HaloSim::toneMapToSrgb16(width, height, accumulation, request.exposure);
+        QImage image((int)width, (int)height, QImage::Format_RGBX64);
+        for (auto y = 0u; y < height; ++y)
+        {
+            auto line = reinterpret_cast<quint16 *>(image.scanLine((int)y));
+            for (auto x = 0u; x < width; ++x)
+            {
+                for (auto c = 0u; c < 3; ++c)
+                    line[x * 4 + c] = pixels[((std::size_t)y * width + x) * 3 + c];
+                line[x * 4 + 3] = 0xffff;
+            }
+        }
+        if (!image.save(request.filename, "PNG"))
+            throw std::runtime_error("Could not write " + filename);
+        break;
+    }
+    case ImageExporter::Format::Png8:
+    {
+        auto pixels = HaloSim::toneMapToSrgb(width, height, accumulation, request.exposure);
+        QImage image(pixels.data(), (int)width, (int)height, (int)width * 3, QImage::Format_RGB888);
+        if (!image.save(request.filename, "PNG"))
+            throw std::runtime_error("Could not write " + filename);
+        break;
+    }
+    }
+}
+
+} // namespace
+
+ImageExporter::ImageExporter(QObject *parent)
+    : QObject(parent)
+{
+    initializeOpenGLFunctions();
+}
+
+ImageExporter::~ImageExporter()
+{
+    for (auto &readback : mReadbacks)
+    {
+        glDeleteSync(readback.fence);
+        glDeleteBuffers(1, &readback.accumulationBuffer);
+        if (readback.noiseBuffer != 0)
+            glDeleteBuffers(1, &readback.noiseBuffer);
+    }
+    for (auto &encoder : mEncoders)
+        encoder.thread.join();
+}
+
+unsigned int ImageExporter::readTexture(unsigned int texture, std::size_t size)
+{
+    unsigned int buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return buffer;
+}
+
+std::vector<float> ImageExporter::takeBuffer(unsigned int buffer, std::size_t size)
+{
+    std::vector<float> pixels(size / sizeof(float));
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+    auto data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+    if (data != nullptr)
+    {
+        std::memcpy(pixels.data(), data, size);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glDeleteBuffers(1, &buffer);
+    return pixels;
+}
+
+void ImageExporter::start(const Request &request)
+{
+    Readback readback;
+    readback.request = request;
+    readback.noiseBuffer = 0;
+
+    int width, height;
+    glBindTexture(GL_TEXTURE_2D, request.accumulationTexture);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+    readback.width = (unsigned int)width;
+    readback.height = (unsigned int)height;
+
+    auto size = (std::size_t)width * height * 4 * sizeof(float);
+    readback.accumulationBuffer = readTexture(request.accumulationTexture, size);
+    bool raw = request.format == Format::Exr || request.format == Format::Pfm || request.format == Format::Accumulation;
+    if (raw && request.noiseTexture != 0)
+        readback.noiseBuffer = readTexture(request.noiseTexture, size);
+
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    mReadbacks.push_back(readback);
+}
+
+bool ImageExporter::update()
+{
+    joinFinishedEncoders();
+
+    for (auto readback = mReadbacks.begin(); readback != mReadbacks.end();)
+    {
+        auto status = glClientWaitSync(readback->fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        {
+            ++readback;
+            continue;
+        }
+        glDeleteSync(readback->fence);
+
+        auto size = (std::size_t)readback->width * readback->height * 4 * sizeof(float);
+        auto accumulation = takeBuffer(readback->accumulationBuffer, size);
+        std::vector<float> noise;
+        if (readback->noiseBuffer != 0)
+            noise = takeBuffer(readback->noiseBuffer, size);
+
+        auto encodeJob = [this](Request request, unsigned int width, unsigned int height, std::vector<float> accumulation, std::vector<float> noise, std::shared_ptr<std::atomic<bool>> done) {
+            QString error;
+            try
+            {
+                encode(request, width, height, std::move(accumulation), std::move(noise));
+            }
+            catch (const std::exception &e)
+            {
+                error = QString::fromStdString(e.what());
+            }
+            QMetaObject::invokeMethod(this, "finished", Qt::QueuedConnection, Q_ARG(QString, request.filename), Q_ARG(QString, error));
+            *done = true;
+        };
+
+        Encoder encoder;
+        encoder.done = std::make_shared<std::atomic<bool>>(false);
+        encoder.thread = std::thread(encodeJob, readback->request, readback->width, readback->height, std::move(accumulation), std::move(noise), encoder.done);
+        mEncoders.push_back(std::move(encoder));
+        readback = mReadbacks.erase(readback);
+    }
+
+    return !mReadbacks.empty();
+}
+
+void ImageExporter::joinFinishedEncoders()
+{
+    for (auto encoder = mEncoders.begin(); encoder != mEncoders.end();)
+    {
+        if (*encoder->done)
+        {
+            encoder->thread.join();
+            encoder = mEncoders.erase(encoder);
+        }
+        else
+        {
+            ++encoder;
+        }
+    }
+}
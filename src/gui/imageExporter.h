@@ -0,0 +1,81 @@
+#pragma once
+#include <QObject>
+#include <QString>
+#include <QOpenGLFunctions_4_4_Core>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <thread>
+#include <memory>
+#include <atomic>
+
+/*
+Saves simulation results into image files without stalling the view or the
+simulation. Textures are copied into pixel buffer objects, and once the GPU
+has finished the copies, the pixels are tone mapped and encoded on a thread
+of their own. The OpenGL context of the view must be current when the
+exporter is constructed, destroyed, started or updated.
+*/
+class ImageExporter : public QObject, protected QOpenGLFunctions_4_4_Core
+{
+    Q_OBJECT
+public:
+    enum class Format
+    {
+        Png8,
+        Png16,
+        Tiff16,
+        Exr,
+        Pfm,
+        Accumulation
+    };
+
+    struct Request
+    {
+        QString filename;
+        Format format;
+        unsigned int accumulationTexture;
+        // Only saved into raw formats, zero if there is none
+        unsigned int noiseTexture;
+        unsigned long long rayCount;
+        float exposure;
+        std::string scene;
+        // The random seed of the simulation, since the interactive view is seeded randomly
+        std::uint32_t seed;
+    };
+
+    explicit ImageExporter(QObject *parent = nullptr);
+    ~ImageExporter();
+
+    void start(const Request &request);
+
+    // Encodes the readbacks that have finished, and returns whether any are still pending
+    bool update();
+
+signals:
+    void finished(QString filename, QString error);
+
+private:
+    struct Readback
+    {
+        Request request;
+        unsigned int width;
+        unsigned int height;
+        unsigned int accumulationBuffer;
+        unsigned int noiseBuffer;
+        GLsync fence;
+    };
+
+    struct Encoder
+    {
+        std::thread thread;
+        std::shared_ptr<std::atomic<bool>> done;
+    };
+
+    unsigned int readTexture(unsigned int texture, std::size_t size);
+    std::vector<float> takeBuffer(unsigned int buffer, std::size_t size);
+    void joinFinishedEncoders();
+
+    std::vector<Readback> mReadbacks;
+    std::vector<Encoder> mEncoders;
+};
@@ -11,13 +11,21 @@
 #include <QApplication>
 #include <QFileDialog>
 #include <QDateTime>
+#include <QFile>
+#include <QMessageBox>
+#include <QStatusBar>
+#include <QStringList>
+#include <stdexcept>
 #include "../simulation/crystalPopulation.h"
+#include "../simulation/sceneFile.h"
 #include "sliderSpinBox.h"
 
 #define STRINGIFY0(v) #v
 #define STRINGIFY(v) STRINGIFY0(v)
 
-MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent)
+MainWindow::MainWindow(QWidget *parent)
+    : QMainWindow(parent),
+      mSceneSeed(1)
 {
 #if _WIN32
     QIcon::setThemeName("HaloRayTheme");
@@ -30,7 +38,9 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent)
     initializes OpenGL for the whole application, and mEngine depends on OpenGL
     */
     setupUi();
-    mEngine = std::make_shared<HaloSim::SimulationEngine>(mOpenGLWidget->width(), mOpenGLWidget->height(), mCrystalRepository);
+    const unsigned int defaultOutputWidth = 1920;
+    const unsigned int defaultOutputHeight = 1080;
+    mEngine = std::make_shared<HaloSim::SimulationEngine>(defaultOutputWidth, defaultOutputHeight, mCrystalRepository);
     mOpenGLWidget->setEngine(mEngine);
 
     // Signals from render button
@@ -49,6 +59,12 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent)
         mOpenGLWidget->update();
     });
     connect(mViewSettingsWidget, &ViewSettingsWidget::brightnessChanged, mOpenGLWidget, &OpenGLWidget::setBrightness);
+    // The denoiser needs the noise tracking channels, so it is connected before the widget to turn them on first
+    connect(mViewSettingsWidget, &ViewSettingsWidget::denoisingChanged, [this](bool enabled) {
+        if (enabled)
+            mGeneralSettingsWidget->setNoiseTracking(true);
+    });
+    connect(mViewSettingsWidget, &ViewSettingsWidget::denoisingChanged, mOpenGLWidget, &OpenGLWidget::setDenoising);
     connect(mViewSettingsWidget, &ViewSettingsWidget::lockToLightSource, [this](bool locked) {
         mEngine->lockCameraToLightSource(locked);
         mOpenGLWidget->update();
@@ -61,6 +77,13 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent)
     connect(mOpenGLWidget, &OpenGLWidget::cameraOrientationChanged, mViewSettingsWidget, &ViewSettingsWidget::setCameraOrientation);
     connect(mOpenGLWidget, &OpenGLWidget::maxRaysPerFrameChanged, mGeneralSettingsWidget, &GeneralSettingsWidget::setMaxRaysPerFrame);
     connect(mOpenGLWidget, &OpenGLWidget::nextIteration, mProgressBar, &QProgressBar::setValue);
+    connect(mOpenGLWidget, &OpenGLWidget::nextIteration, [this]() {
+        auto noise = mEngine->getNoiseEstimate();
+        if (noise < 0.0)
+            mNoiseLabel->setText(tr("Noise: -"));
+        else
+            mNoiseLabel->setText(tr("Noise: %1 %").arg(noise * 100.0, 0, 'f', 2));
+    });
 
     // Signals from general settings
     connect(mGeneralSettingsWidget, &GeneralSettingsWidget::lightSourceChanged, [this](HaloSim::LightSource light) {
@@ -78,29 +101,56 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent)
         mOpenGLWidget->update();
     });
 
+    connect(mGeneralSettingsWidget, &GeneralSettingsWidget::pipelineChanged, [this](HaloSim::SimulationPipeline pipeline) {
+        mEngine->setPipeline(pipeline);
+        mOpenGLWidget->update();
+    });
+    connect(mGeneralSettingsWidget, &GeneralSettingsWidget::frameTimeBudgetChanged, [this](unsigned int milliseconds) {
+        mEngine->setStepTimeBudget(milliseconds);
+    });
+    connect(mGeneralSettingsWidget, &GeneralSettingsWidget::adaptiveRayAllocationChanged, [this](bool enabled) {
+        mEngine->setAdaptiveRayAllocation(enabled);
+    });
+    connect(mGeneralSettingsWidget, &GeneralSettingsWidget::noiseTrackingChanged, [this](bool enabled) {
+        if (!enabled)
+            mViewSettingsWidget->setDenoising(false);
+        mEngine->setNoiseTracking(enabled);
+        mOpenGLWidget->update();
+    });
+    connect(mGeneralSettingsWidget, &GeneralSettingsWidget::noiseTargetChanged, [this](double relativeError) {
+        mEngine->setNoiseTarget(relativeError);
+    });
+    connect(mGeneralSettingsWidget, &GeneralSettingsWidget::outputSizeChanged, [this](unsigned int width, unsigned int height) {
+        mEngine->setOutputSize(width, height);
+        mOpenGLWidget->update();
+    });
+
     mGeneralSettingsWidget->setInitialValues(mEngine->getLightSource().diameter,
                                              mEngine->getLightSource().altitude,
                                              mEngine->getRaysPerStep(),
                                              600,
-                                             mEngine->getMultipleScatteringProbability());
+                                             mEngine->getMultipleScatteringProbability(),
+                                             mEngine->getPipeline(),
+                                             mEngine->getStepTimeBudget(),
+                                             mEngine->getOutputWidth(),
+                                             mEngine->getOutputHeight(),
+                                             mEngine->getAdaptiveRayAllocation(),
+                                             mEngine->getNoiseTracking(),
+                                             mEngine->getNoiseTarget());
 
     // Signals for menu bar
     connect(mQuitAction, &QAction::triggered, QApplication::instance(), &QApplication::quit);
-    connect(mSaveImageAction, &QAction::triggered, [this]() {
-        auto image = mOpenGLWidget->grabFramebuffer();
-        auto currentTime = QDateTime::currentDateTimeUtc().toString(Qt::DateFormat::ISODate);
-        auto defaultFilename = QString("haloray_%1.png")
-                                   .arg(currentTime)
-                                   .replace(":", "-");
-        QString filename = QFileDialog::getSaveFileName(this,
-                                                        tr("Save File"),
-                                                        defaultFilename,
-                                                        tr("Images (*.png)"));
-
-        if (!filename.isNull())
-        {
-            image.save(filename, "PNG", 50);
-        }
+    connect(mOpenSceneAction, &QAction::triggered, this, &MainWindow::openScene);
+    connect(mSaveSceneAction, &QAction::triggered, this, &MainWindow::saveScene);
+    connect(mStartBackgroundRenderAction, &QAction::triggered, this, &MainWindow::startBackgroundRender);
+    connect(mCancelBackgroundRendersAction, &QAction::triggered, this, &MainWindow::cancelBackgroundRenders);
+    connect(mBackgroundMenu, &QMenu::aboutToShow, this, &MainWindow::updateBackgroundMenu);
+    connect(mSaveImageAction, &QAction::triggered, this, &MainWindow::saveImage);
+    connect(mOpenGLWidget, &OpenGLWidget::imageExported, [this](QString filename, QString error) {
+        if (error.isEmpty())
+            statusBar()->showMessage(tr("Saved %1").arg(filename), 5000);
+        else
+            QMessageBox::warning(this, tr("Save image"), tr("Could not save %1: %2").arg(filename).arg(error));
     });
 }
 
@@ -120,6 +170,7 @@ void MainWindow::setupUi()
 
     mOpenGLWidget = new OpenGLWidget();
     mProgressBar = setupProgressBar();
+    mNoiseLabel = new QLabel(tr("Noise: -"));
     mRenderButton = new RenderButton();
 
     auto mainWidget = new QWidget();
@@ -129,6 +180,7 @@ void MainWindow::setupUi()
     auto sideBarLayout = new QVBoxLayout();
     auto sideBarScrollArea = setupSideBarScrollArea();
     sideBarLayout->addWidget(sideBarScrollArea);
+    sideBarLayout->addWidget(mNoiseLabel);
     sideBarLayout->addWidget(mProgressBar);
     sideBarLayout->addWidget(mRenderButton);
 
@@ -139,9 +191,200 @@ void MainWindow::setupUi()
 void MainWindow::setupMenuBar()
 {
     auto fileMenu = menuBar()->addMenu(tr("&File"));
+    mOpenSceneAction = fileMenu->addAction(tr("Open scene..."));
+    mSaveSceneAction = fileMenu->addAction(tr("Save scene..."));
+    fileMenu->addSeparator();
     mSaveImageAction = fileMenu->addAction(tr("Save image"));
     fileMenu->addSeparator();
     mQuitAction = fileMenu->addAction(tr("&Quit"));
+
+    mBackgroundMenu = menuBar()->addMenu(tr("&Background"));
+    mStartBackgroundRenderAction = new QAction(tr("Render current scene in background"), this);
+    mCancelBackgroundRendersAction = new QAction(tr("Cancel background renders"), this);
+    updateBackgroundMenu();
+}
+
+/*
+The widgets are updated first, since they pass their values on to the
+engine. The engine is then given the exact values of the file, which the
+widgets may have rounded.
+*/
+void MainWindow::openScene()
+{
+    auto filename = QFileDialog::getOpenFileName(this, tr("Open scene"), QString(), tr("Scenes (*.json)"));
+    if (filename.isNull())
+        return;
+
+    HaloSim::SceneFile file;
+    try
+    {
+        QFile input(filename);
+        if (!input.open(QIODevice::ReadOnly))
+            throw std::runtime_error(tr("Could not open the file").toStdString());
+        file = HaloSim::SceneFile::parse(input.readAll().toStdString());
+    }
+    catch (const std::runtime_error &e)
+    {
+        QMessageBox::warning(this, tr("Open scene"), tr("Could not open %1: %2").arg(filename).arg(e.what()));
+        return;
+    }
+
+    const auto &scene = file.scene;
+    mCrystalSettingsWidget->setPopulations(scene.crystals, scene.crystalWeights);
+    mViewSettingsWidget->setCamera(scene.camera);
+    mGeneralSettingsWidget->setInitialValues(scene.light.diameter,
+                                             scene.light.altitude,
+                                             file.raysPerStep,
+                                             mEngine->getMaxIterations(),
+                                             scene.multipleScatteringProbability,
+                                             mEngine->getPipeline(),
+                                             mEngine->getStepTimeBudget(),
+                                             file.outputWidth,
+                                             file.outputHeight,
+                                             mEngine->getAdaptiveRayAllocation(),
+                                             mEngine->getNoiseTracking(),
+                                             mEngine->getNoiseTarget());
+
+    mEngine->setLightSource(scene.light);
+    mEngine->setCamera(scene.camera);
+    mEngine->setMultipleScatteringProbability(scene.multipleScatteringProbability);
+    mEngine->setRaysPerStep(file.raysPerStep);
+    mEngine->setOutputSize(file.outputWidth, file.outputHeight);
+    mSceneSeed = file.seed;
+    mOpenGLWidget->update();
+}
+
+void MainWindow::saveScene()
+{
+    auto filename = QFileDialog::getSaveFileName(this, tr("Save scene"), "scene.json", tr("Scenes (*.json)"));
+    if (filename.isNull())
+        return;
+
+    QFile output(filename);
+    auto text = getSceneFile(*mEngine).serialize();
+    if (!output.open(QIODevice::WriteOnly) || output.write(text.data(), (qint64)text.size()) != (qint64)text.size())
+        QMessageBox::warning(this, tr("Save scene"), tr("Could not write %1").arg(filename));
+}
+
+/*
+The image is read back and encoded in the background, and the result is
+reported when the widget emits imageExported
+*/
+void MainWindow::saveImage()
+{
+    struct ImageFilter
+    {
+        QString filter;
+        ImageExporter::Format format;
+    };
+    const std::vector<ImageFilter> filters = {
+        {tr("PNG image, 8-bit (*.png)"), ImageExporter::Format::Png8},
+        {tr("PNG image, 16-bit (*.png)"), ImageExporter::Format::Png16},
+        {tr("TIFF image, 16-bit (*.tif *.tiff)"), ImageExporter::Format::Tiff16},
+        {tr("OpenEXR, raw XYZ (*.exr)"), ImageExporter::Format::Exr},
+        {tr("Portable float map, raw XYZ (*.pfm)"), ImageExporter::Format::Pfm},
+        {tr("HaloRay accumulation file (*.hra)"), ImageExporter::Format::Accumulation}};
+
+    QStringList filterList;
+    for (const auto &filter : filters)
+        filterList.append(filter.filter);
+
+    auto currentTime = QDateTime::currentDateTimeUtc().toString(Qt::DateFormat::ISODate);
+    auto defaultFilename = QString("haloray_%1.png")
+                               .arg(currentTime)
+                               .replace(":", "-");
+    QString selectedFilter;
+    QString filename = QFileDialog::getSaveFileName(this,
+                                                    tr("Save image"),
+                                                    defaultFilename,
+                                                    filterList.join(";;"),
+                                                    &selectedFilter);
+    if (filename.isNull())
+        return;
+
+    auto format = ImageExporter::Format::Png8;
+    for (const auto &filter : filters)
+    {
+        if (filter.filter == selectedFilter)
+            format = filter.format;
+    }
+    mOpenGLWidget->exportImage(filename, format, getSceneFile(*mOpenGLWidget->getDisplayedEngine()).serialize());
+}
+
+HaloSim::SceneFile MainWindow::getSceneFile(const HaloSim::SimulationEngine &engine) const
+{
+    HaloSim::SceneFile file;
+    file.scene = engine.getScene();
+    file.raysPerStep = engine.getRaysPerStep();
+    file.seed = mSceneSeed;
+    file.outputWidth = engine.getOutputWidth();
+    file.outputHeight = engine.getOutputHeight();
+    return file;
+}
+
+/*
+Copies the current scene into a new engine, which renders in the background
+while the current scene can still be edited
+*/
+void MainWindow::startBackgroundRender()
+{
+    // Background steps are kept short, so that they do not slow down interaction
+    const unsigned int backgroundStepTimeBudget = 10;
+
+    auto engine = std::make_shared<HaloSim::SimulationEngine>(mEngine->getOutputWidth(), mEngine->getOutputHeight(), mCrystalRepository);
+    engine->setLightSource(mEngine->getLightSource());
+    engine->setCamera(mEngine->getCamera());
+    engine->setMultipleScatteringProbability(mEngine->getMultipleScatteringProbability());
+    engine->setRaysPerStep(mEngine->getRaysPerStep());
+    engine->setMaxIterations(mEngine->getMaxIterations());
+    engine->setPipeline(mEngine->getPipeline());
+    engine->setAdaptiveRayAllocation(mEngine->getAdaptiveRayAllocation());
+    engine->setNoiseTracking(mEngine->getNoiseTracking());
+    engine->setNoiseTarget(mEngine->getNoiseTarget());
+    engine->setStepTimeBudget(backgroundStepTimeBudget);
+    engine->start();
+
+    mBackgroundEngines.push_back(engine);
+    mOpenGLWidget->addBackgroundJob(engine);
+}
+
+void MainWindow::cancelBackgroundRenders()
+{
+    for (auto &engine : mBackgroundEngines)
+        mOpenGLWidget->removeBackgroundJob(engine);
+    mBackgroundEngines.clear();
+}
+
+// Lists the background renders, each of which can be shown in the view
+void MainWindow::updateBackgroundMenu()
+{
+    mBackgroundMenu->clear();
+    mBackgroundMenu->addAction(mStartBackgroundRenderAction);
+    mBackgroundMenu->addSeparator();
+
+    auto displayedEngine = mOpenGLWidget->getDisplayedEngine();
+    auto interactiveAction = mBackgroundMenu->addAction(tr("Interactive view"));
+    interactiveAction->setCheckable(true);
+    interactiveAction->setChecked(displayedEngine == mEngine);
+    connect(interactiveAction, &QAction::triggered, [this]() {
+        mOpenGLWidget->setDisplayedEngine(mEngine);
+    });
+
+    for (auto i = 0u; i < mBackgroundEngines.size(); ++i)
+    {
+        auto engine = mBackgroundEngines[i];
+        auto text = tr("Render %1 (frame %2 of %3)").arg(i + 1).arg(engine->getIteration()).arg(engine->getMaxIterations());
+        auto action = mBackgroundMenu->addAction(text);
+        action->setCheckable(true);
+        action->setChecked(displayedEngine == engine);
+        connect(action, &QAction::triggered, [this, engine]() {
+            mOpenGLWidget->setDisplayedEngine(engine);
+        });
+    }
+
+    mBackgroundMenu->addSeparator();
+    mBackgroundMenu->addAction(mCancelBackgroundRendersAction);
+    mCancelBackgroundRendersAction->setEnabled(!mBackgroundEngines.empty());
 }
 
 QScrollArea *MainWindow::setupSideBarScrollArea()
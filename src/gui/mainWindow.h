@@ -3,9 +3,13 @@
 #include <QWidget>
 #include <QDoubleSpinBox>
 #include <QProgressBar>
+#include <QLabel>
 #include <QScrollArea>
 #include <QAction>
+#include <QMenu>
 #include <memory>
+#include <vector>
+#include <cstdint>
 #include "renderButton.h"
 #include "openGLWidget.h"
 #include "generalSettingsWidget.h"
@@ -13,6 +17,7 @@
 #include "viewSettingsWidget.h"
 #include "../simulation/simulationEngine.h"
 #include "../simulation/crystalPopulationRepository.h"
+#include "../simulation/sceneFile.h"
 
 class MainWindow : public QMainWindow
 {
@@ -27,17 +32,34 @@ private:
     QScrollArea *setupSideBarScrollArea();
     QProgressBar *setupProgressBar();
     void setupMenuBar();
+    void openScene();
+    void saveScene();
+    void saveImage();
+    HaloSim::SceneFile getSceneFile(const HaloSim::SimulationEngine &engine) const;
+    void startBackgroundRender();
+    void cancelBackgroundRenders();
+    void updateBackgroundMenu();
 
     GeneralSettingsWidget *mGeneralSettingsWidget;
     CrystalSettingsWidget *mCrystalSettingsWidget;
     ViewSettingsWidget *mViewSettingsWidget;
     QProgressBar *mProgressBar;
+    QLabel *mNoiseLabel;
     RenderButton *mRenderButton;
     OpenGLWidget *mOpenGLWidget;
 
+    QAction *mOpenSceneAction;
+    QAction *mSaveSceneAction;
     QAction *mSaveImageAction;
     QAction *mQuitAction;
+    QMenu *mBackgroundMenu;
+    QAction *mStartBackgroundRenderAction;
+    QAction *mCancelBackgroundRendersAction;
 
     std::shared_ptr<HaloSim::CrystalPopulationRepository> mCrystalRepository;
     std::shared_ptr<HaloSim::SimulationEngine> mEngine;
+    std::vector<std::shared_ptr<HaloSim::SimulationEngine>> mBackgroundEngines;
+
+    // Kept for saved scenes, since the interactive view is seeded randomly
+    std::uint32_t mSceneSeed;
 };
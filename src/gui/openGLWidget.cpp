@@ -3,7 +3,10 @@
 #include <QOpenGLWidget>
 #include <memory>
 #include <algorithm>
+#include <cstring>
 #include "../simulation/simulationEngine.h"
+#include "../simulation/denoiser.h"
+#include "../simulation/toneMapping.h"
 #include "../simulation/camera.h"
 #include "../simulation/lightSource.h"
 #include "../simulation/crystalPopulation.h"
@@ -14,15 +17,68 @@ OpenGLWidget::OpenGLWidget(QWidget *parent)
       mDragging(false),
       mPreviousDragPoint(QPoint(0, 0)),
       mExposure(1.0f),
-      mMaxIterations(1)
+      mDenoising(false),
+      mDenoiseFence(nullptr),
+      mDenoiseAccumulationBuffer(0),
+      mDenoiseNoiseBuffer(0),
+      mDenoiseBufferSize(0),
+      mDenoisedEngine(nullptr),
+      mDenoisedSceneHash(0),
+      mDenoisedRayCount(0)
 {
     setSizePolicy(QSizePolicy::MinimumExpanding, QSizePolicy::MinimumExpanding);
     setUpdateBehavior(UpdateBehavior::PartialUpdate);
 }
 
+OpenGLWidget::~OpenGLWidget()
+{
+    if (mDenoiseThread.joinable())
+        mDenoiseThread.join();
+
+    // The simulation context must be destroyed before the shared context
+    mSimulationThread.reset();
+    makeCurrent();
+    if (mDenoiseFence != nullptr)
+        glDeleteSync(mDenoiseFence);
+    if (mDenoiseAccumulationBuffer != 0)
+    {
+        glDeleteBuffers(1, &mDenoiseAccumulationBuffer);
+        glDeleteBuffers(1, &mDenoiseNoiseBuffer);
+    }
+    mDenoisedTexture.reset();
+    mImageExporter.reset();
+    doneCurrent();
+}
+
 void OpenGLWidget::setEngine(enginePtr engine)
 {
     mEngine = engine;
+    mDisplayedEngine = engine;
+}
+
+void OpenGLWidget::addBackgroundJob(enginePtr engine)
+{
+    mSimulationThread->addBackgroundJob(engine);
+}
+
+void OpenGLWidget::removeBackgroundJob(enginePtr engine)
+{
+    if (mDisplayedEngine == engine)
+        setDisplayedEngine(mEngine);
+    mSimulationThread->removeBackgroundJob(engine);
+}
+
+void OpenGLWidget::setDisplayedEngine(enginePtr engine)
+{
+    mDisplayedEngine = engine;
+    mDragging = false;
+    setCursor(Qt::CursorShape::ArrowCursor);
+    update();
+}
+
+OpenGLWidget::enginePtr OpenGLWidget::getDisplayedEngine() const
+{
+    return mDisplayedEngine;
 }
 
 void OpenGLWidget::toggleRendering()
@@ -36,20 +92,191 @@ void OpenGLWidget::toggleRendering()
 
 void OpenGLWidget::paintGL()
 {
-    if (mEngine->isRunning() && mEngine->getIteration() < mMaxIterations)
+    mDisplayedEngine->updateOutput();
+    if (mDenoising)
+        updateDenoisedOutput();
+    bool showDenoised = mDenoising && isDenoisedOutputCurrent();
+
+    auto rayCount = showDenoised ? mDenoisedRayCount : mDisplayedEngine->getOutputRayCount();
+    auto divisor = showDenoised ? 1 : mDisplayedEngine->getOutputResolutionDivisor();
+    auto exposure = HaloSim::getExposure(mExposure, rayCount, mDisplayedEngine->getOutputTextureWidth(), mDisplayedEngine->getOutputTextureHeight(), divisor, mDisplayedEngine->getOutputCamera().fov);
+    mTextureRenderer->setUniformFloat("exposure", exposure);
+    mTextureRenderer->render(showDenoised ? mDenoisedTexture->getHandle() : mDisplayedEngine->getOutputTextureHandle());
+
+    // Keep painting until the readbacks of exported images have finished
+    if (mImageExporter->update())
+        QMetaObject::invokeMethod(this, "update", Qt::QueuedConnection);
+}
+
+void OpenGLWidget::exportImage(const QString &filename, ImageExporter::Format format, const std::string &scene)
+{
+    makeCurrent();
+    if (mDisplayedEngine->getOutputTextureHandle() == 0)
     {
-        mEngine->step();
-        emit nextIteration(mEngine->getIteration());
-        update();
+        doneCurrent();
+        emit imageExported(filename, tr("Nothing has been simulated yet"));
+        return;
     }
-    const float exposure = mExposure / (mEngine->getIteration() + 1) / (mEngine->getCamera().fov / 180.0);
-    mTextureRenderer->setUniformFloat("exposure", exposure);
-    mTextureRenderer->render(mEngine->getOutputTextureHandle());
+
+    bool raw = format == ImageExporter::Format::Exr || format == ImageExporter::Format::Pfm || format == ImageExporter::Format::Accumulation;
+    bool denoised = !raw && mDenoising && isDenoisedOutputCurrent();
+
+    ImageExporter::Request request;
+    request.filename = filename;
+    request.format = format;
+    request.accumulationTexture = denoised ? mDenoisedTexture->getHandle() : mDisplayedEngine->getOutputTextureHandle();
+    request.noiseTexture = denoised ? 0 : mDisplayedEngine->getOutputNoiseTextureHandle();
+    request.rayCount = denoised ? mDenoisedRayCount : mDisplayedEngine->getOutputRayCount();
+    auto divisor = denoised ? 1 : mDisplayedEngine->getOutputResolutionDivisor();
+    request.exposure = HaloSim::getExposure(mExposure, request.rayCount, mDisplayedEngine->getOutputTextureWidth(), mDisplayedEngine->getOutputTextureHeight(), divisor, mDisplayedEngine->getOutputCamera().fov);
+    request.scene = scene;
+    request.seed = mDisplayedEngine->getRandomSeed();
+    mImageExporter->start(request);
+    doneCurrent();
+    update();
+}
+
+/*
+Uploads the result of a finished denoiser run, and starts the next run if
+the displayed output has changed since the previous one
+*/
+void OpenGLWidget::updateDenoisedOutput()
+{
+    if (mDenoiseResult.valid())
+    {
+        if (mDenoiseResult.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return;
+        mDenoiseThread.join();
+        auto output = mDenoiseResult.get();
+
+        if (mDenoisedTexture == nullptr || mDenoisedTexture->getWidth() != output.width || mDenoisedTexture->getHeight() != output.height)
+            mDenoisedTexture = std::make_unique<OpenGL::Texture>(output.width, output.height, 0, OpenGL::TextureType::Color);
+        glBindTexture(GL_TEXTURE_2D, mDenoisedTexture->getHandle());
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, output.width, output.height, GL_RGBA, GL_FLOAT, output.pixels.data());
+        mDenoisedEngine = output.engine;
+        mDenoisedSceneHash = output.sceneHash;
+        mDenoisedRayCount = output.rayCount;
+    }
+
+    if (mDenoiseFence != nullptr)
+    {
+        auto status = glClientWaitSync(mDenoiseFence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        {
+            // Keep painting until the readback has finished
+            QMetaObject::invokeMethod(this, "update", Qt::QueuedConnection);
+            return;
+        }
+        glDeleteSync(mDenoiseFence);
+        mDenoiseFence = nullptr;
+        startDenoiser();
+        return;
+    }
+
+    // Previews are not denoised, since they are replaced in a moment
+    if (mDisplayedEngine->getOutputResolutionDivisor() != 1 || mDisplayedEngine->getOutputNoiseTextureHandle() == 0)
+        return;
+    if (isDenoisedOutputCurrent() && mDenoisedRayCount == mDisplayedEngine->getOutputRayCount())
+        return;
+    startDenoising();
 }
 
-void OpenGLWidget::resizeGL(int w, int h)
+// Copies the displayed output and its noise into the pixel buffers, without waiting for the copies
+void OpenGLWidget::startDenoising()
 {
-    mEngine->resizeOutputTextureCallback(w, h);
+    // The snapshot may change between calls, so both textures are taken at once and the run is skipped without noise
+    auto accumulationTexture = mDisplayedEngine->getOutputTextureHandle();
+    auto noiseTexture = mDisplayedEngine->getOutputNoiseTextureHandle();
+    if (accumulationTexture == 0 || noiseTexture == 0)
+        return;
+
+    mDenoiseInput.engine = mDisplayedEngine.get();
+    mDenoiseInput.sceneHash = mDisplayedEngine->getOutputSceneHash();
+    mDenoiseInput.rayCount = mDisplayedEngine->getOutputRayCount();
+
+    int width, height;
+    glBindTexture(GL_TEXTURE_2D, accumulationTexture);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+    mDenoiseInput.width = (unsigned int)width;
+    mDenoiseInput.height = (unsigned int)height;
+
+    auto size = (std::size_t)width * height * 4 * sizeof(float);
+    if (mDenoiseAccumulationBuffer == 0)
+    {
+        glGenBuffers(1, &mDenoiseAccumulationBuffer);
+        glGenBuffers(1, &mDenoiseNoiseBuffer);
+    }
+    if (size != mDenoiseBufferSize)
+    {
+        for (auto buffer : {mDenoiseAccumulationBuffer, mDenoiseNoiseBuffer})
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+            glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+        }
+        mDenoiseBufferSize = size;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, mDenoiseAccumulationBuffer);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, mDenoiseNoiseBuffer);
+    glBindTexture(GL_TEXTURE_2D, noiseTexture);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    mDenoiseFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    QMetaObject::invokeMethod(this, "update", Qt::QueuedConnection);
+}
+
+// Takes the finished readback and denoises it on a thread of its own
+void OpenGLWidget::startDenoiser()
+{
+    auto output = std::make_shared<DenoisedOutput>(mDenoiseInput);
+    auto noise = std::make_shared<std::vector<float>>();
+    output->pixels.resize(mDenoiseBufferSize / sizeof(float));
+    noise->resize(output->pixels.size());
+    bool complete = true;
+    for (auto readback : {std::make_pair(mDenoiseAccumulationBuffer, output->pixels.data()), std::make_pair(mDenoiseNoiseBuffer, noise->data())})
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.first);
+        auto data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, mDenoiseBufferSize, GL_MAP_READ_BIT);
+        if (data != nullptr)
+        {
+            std::memcpy(readback.second, data, mDenoiseBufferSize);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        else
+            complete = false;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    // Denoising zeros instead of the missing readback would show a black image, so the next update tries again
+    if (!complete)
+        return;
+
+    std::promise<DenoisedOutput> promise;
+    mDenoiseResult = promise.get_future();
+    mDenoiseThread = std::thread([this, output, noise](std::promise<DenoisedOutput> promise) {
+        output->pixels = HaloSim::Denoiser().denoise(output->width, output->height, output->pixels, *noise);
+        promise.set_value(std::move(*output));
+        QMetaObject::invokeMethod(this, "update", Qt::QueuedConnection);
+    }, std::move(promise));
+}
+
+bool OpenGLWidget::isDenoisedOutputCurrent() const
+{
+    return mDenoisedTexture != nullptr &&
+           mDenoisedEngine == mDisplayedEngine.get() &&
+           mDenoisedSceneHash == mDisplayedEngine->getOutputSceneHash() &&
+           mDenoisedRayCount <= mDisplayedEngine->getOutputRayCount() &&
+           mDisplayedEngine->getOutputResolutionDivisor() == 1;
+}
+
+void OpenGLWidget::setDenoising(bool enabled)
+{
+    mDenoising = enabled;
+    update();
 }
 
 void OpenGLWidget::initializeGL()
@@ -57,9 +284,25 @@ void OpenGLWidget::initializeGL()
     initializeOpenGLFunctions();
 
     mTextureRenderer = std::make_unique<OpenGL::TextureRenderer>();
-    mEngine->initialize();
     mTextureRenderer->initialize();
 
+    mImageExporter = std::make_unique<ImageExporter>();
+    connect(mImageExporter.get(), &ImageExporter::finished, this, &OpenGLWidget::imageExported);
+
+    mSimulationThread = std::make_unique<HaloSim::SimulationThread>(context(), mEngine);
+    connect(mSimulationThread.get(), &HaloSim::SimulationThread::stepCompleted, this, [this](unsigned int iteration) {
+        update();
+        emit nextIteration(iteration);
+    });
+    connect(mSimulationThread.get(), &HaloSim::SimulationThread::backgroundStepCompleted, this, [this]() {
+        if (mDisplayedEngine != mEngine)
+            update();
+    });
+    connect(mSimulationThread.get(), &HaloSim::SimulationThread::failed, this, [](QString error) {
+        qFatal("%s", error.toUtf8().constData());
+    });
+    mSimulationThread->start();
+
     glClearColor(0.0, 0.0, 0.0, 1.0);
     glClear(GL_COLOR_BUFFER_BIT);
 
@@ -72,7 +315,7 @@ void OpenGLWidget::initializeGL()
 
 void OpenGLWidget::mousePressEvent(QMouseEvent *event)
 {
-    if (!mEngine->isRunning())
+    if (!mEngine->isRunning() || mDisplayedEngine != mEngine)
         return;
 
     if (event->button() == Qt::LeftButton)
@@ -122,7 +365,7 @@ void OpenGLWidget::mouseReleaseEvent(QMouseEvent *event)
 
 void OpenGLWidget::wheelEvent(QWheelEvent *event)
 {
-    if (!mEngine->isRunning())
+    if (!mEngine->isRunning() || mDisplayedEngine != mEngine)
     {
         event->ignore();
         return;
@@ -162,8 +405,33 @@ void OpenGLWidget::setBrightness(double brightness)
 
 void OpenGLWidget::setMaxIterations(unsigned int maxIterations)
 {
-    mMaxIterations = maxIterations;
-    update();
+    mEngine->setMaxIterations(maxIterations);
+}
+
+/*
+Hide and show events are also received when the window is minimized and
+restored. The simulation runs at full speed while nothing is displayed, in
+the background renders as well as in the interactive view.
+*/
+void OpenGLWidget::showEvent(QShowEvent *event)
+{
+    QOpenGLWidget::showEvent(event);
+    setOutputVisible(true);
+}
+
+void OpenGLWidget::hideEvent(QHideEvent *event)
+{
+    QOpenGLWidget::hideEvent(event);
+    setOutputVisible(false);
+}
+
+// The simulation thread is only started once the widget has an OpenGL context
+void OpenGLWidget::setOutputVisible(bool visible)
+{
+    if (mSimulationThread)
+        mSimulationThread->setOutputVisible(visible);
+    else if (mEngine)
+        mEngine->setOutputVisible(visible);
 }
 
 QSize OpenGLWidget::sizeHint() const
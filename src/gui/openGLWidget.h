@@ -3,11 +3,19 @@
 #include <QWidget>
 #include <QMouseEvent>
 #include <QWheelEvent>
+#include <QShowEvent>
+#include <QHideEvent>
 #include <QOpenGLFunctions_4_4_Core>
 #include <QSize>
 #include <memory>
+#include <vector>
+#include <thread>
+#include <future>
+#include <string>
 #include "../simulation/simulationEngine.h"
+#include "../simulation/simulationThread.h"
 #include "../opengl/textureRenderer.h"
+#include "imageExporter.h"
 
 class OpenGLWidget : public QOpenGLWidget, protected QOpenGLFunctions_4_4_Core
 {
@@ -17,7 +25,25 @@ class OpenGLWidget : public QOpenGLWidget, protected QOpenGLFunctions_4_4_Core
 
 public:
     explicit OpenGLWidget(QWidget *parent = 0);
+    ~OpenGLWidget();
     void setEngine(enginePtr engine);
+
+    /*
+    Background jobs are simulated on the same thread as the engine, with the
+    capacity it leaves unused. The view can display the output of a
+    background job instead of the engine, and then ignores camera controls.
+    */
+    void addBackgroundJob(enginePtr engine);
+    void removeBackgroundJob(enginePtr engine);
+    void setDisplayedEngine(enginePtr engine);
+    enginePtr getDisplayedEngine() const;
+
+    /*
+    Saves the displayed output in the background, and emits imageExported
+    when done. Tone mapped formats are saved as they are displayed, denoised
+    or not, and raw formats contain the simulation result.
+    */
+    void exportImage(const QString &filename, ImageExporter::Format format, const std::string &scene);
     QSize sizeHint() const override;
     QSize minimumSizeHint() const override;
 
@@ -25,16 +51,17 @@ public slots:
     void toggleRendering();
     void setBrightness(double brightness);
     void setMaxIterations(unsigned int maxIterations);
+    void setDenoising(bool enabled);
 
 signals:
     void fieldOfViewChanged(double fieldOfView);
     void cameraOrientationChanged(double pitch, double yaw);
     void nextIteration(unsigned int iteration);
     void maxRaysPerFrameChanged(unsigned int maxRays);
+    void imageExported(QString filename, QString error);
 
 protected:
     void paintGL() override;
-    void resizeGL(int w, int h) override;
     void initializeGL() override;
 
     void mousePressEvent(QMouseEvent *event) override;
@@ -43,11 +70,54 @@ protected:
 
     void wheelEvent(QWheelEvent *event) override;
 
+    void showEvent(QShowEvent *event) override;
+    void hideEvent(QHideEvent *event) override;
+
 private:
+    struct DenoisedOutput
+    {
+        HaloSim::SimulationEngine *engine;
+        std::uint64_t sceneHash;
+        unsigned long long rayCount;
+        unsigned int width;
+        unsigned int height;
+        std::vector<float> pixels;
+    };
+
+    void startDenoising();
+    void startDenoiser();
+    void updateDenoisedOutput();
+    bool isDenoisedOutputCurrent() const;
+    void setOutputVisible(bool visible);
+
     enginePtr mEngine;
+    enginePtr mDisplayedEngine;
+    std::unique_ptr<HaloSim::SimulationThread> mSimulationThread;
     std::unique_ptr<OpenGL::TextureRenderer> mTextureRenderer;
     bool mDragging;
     QPoint mPreviousDragPoint;
     float mExposure;
-    unsigned int mMaxIterations;
+
+    /*
+    The denoiser runs on a thread of its own on a copy of the displayed
+    output, and is started again whenever it finishes and the output has
+    changed. Until it finishes, the latest denoised output is shown. The
+    output is copied into pixel buffer objects, and the denoiser starts once
+    a fence shows that the GPU has finished the copies, so that painting
+    never waits for the readback.
+    */
+    bool mDenoising;
+    DenoisedOutput mDenoiseInput;
+    GLsync mDenoiseFence;
+    unsigned int mDenoiseAccumulationBuffer;
+    unsigned int mDenoiseNoiseBuffer;
+    std::size_t mDenoiseBufferSize;
+    std::thread mDenoiseThread;
+    std::future<DenoisedOutput> mDenoiseResult;
+    std::unique_ptr<OpenGL::Texture> mDenoisedTexture;
+    HaloSim::SimulationEngine *mDenoisedEngine;
+    std::uint64_t mDenoisedSceneHash;
+    unsigned long long mDenoisedRayCount;
+
+    std::unique_ptr<ImageExporter> mImageExporter;
 };
@@ -20,6 +20,7 @@ ViewSettingsWidget::ViewSettingsWidget(QWidget *parent)
     connect(mHideSubHorizonCheckBox, &QCheckBox::stateChanged, cameraChangeHandler);
     connect(mBrightnessSlider, &SliderSpinBox::valueChanged, this, &ViewSettingsWidget::brightnessChanged);
     connect(mLockToLightSource, &QCheckBox::stateChanged, this, &ViewSettingsWidget::lockToLightSource);
+    connect(mDenoiseCheckBox, &QCheckBox::toggled, this, &ViewSettingsWidget::denoisingChanged);
 }
 
 void ViewSettingsWidget::setupUi()
@@ -48,12 +49,15 @@ void ViewSettingsWidget::setupUi()
 
     mLockToLightSource = new QCheckBox();
 
+    mDenoiseCheckBox = new QCheckBox();
+
     auto layout = new QFormLayout(this);
     layout->addRow(tr("Camera projection"), mCameraProjectionComboBox);
     layout->addRow(tr("Field of view"), mFieldOfViewSlider);
     layout->addRow(tr("Pitch"), mPitchSlider);
     layout->addRow(tr("Yaw"), mYawSlider);
     layout->addRow(tr("Brightness"), mBrightnessSlider);
+    layout->addRow(tr("Denoise"), mDenoiseCheckBox);
     layout->addRow(tr("Hide sub-horizon"), mHideSubHorizonCheckBox);
     layout->addRow(tr("Lock to light source"), mLockToLightSource);
 }
@@ -93,3 +97,8 @@ void ViewSettingsWidget::setBrightness(double brightness)
 {
     mBrightnessSlider->setValue(brightness);
 }
+
+void ViewSettingsWidget::setDenoising(bool enabled)
+{
+    mDenoiseCheckBox->setChecked(enabled);
+}
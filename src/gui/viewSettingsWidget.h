@@ -16,11 +16,13 @@ public:
     void setFieldOfView(double fov);
     void setCameraOrientation(double pitch, double yaw);
     void setBrightness(double brightness);
+    void setDenoising(bool enabled);
 
 signals:
     void cameraChanged(HaloSim::Camera camera);
     void brightnessChanged(double brightness);
     void lockToLightSource(bool locked);
+    void denoisingChanged(bool enabled);
 
 private:
     void setupUi();
@@ -32,4 +34,5 @@ private:
     QCheckBox *mHideSubHorizonCheckBox;
     SliderSpinBox *mBrightnessSlider;
     QCheckBox *mLockToLightSource;
+    QCheckBox *mDenoiseCheckBox;
 };
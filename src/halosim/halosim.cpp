@@ -0,0 +1,374 @@
+#include "halosim.h"
+#include <new>
+#include <string>
+#include <cstring>
+#include <stdexcept>
+#include "../simulation/sceneFile.h"
+#include "../simulation/cpuSimulator.h"
+#include "../simulation/toneMapping.h"
+
+struct halosim_scene
+{
+    HaloSim::SceneFile file;
+};
+
+struct halosim_simulator
+{
+    HaloSim::SceneFile file;
+    HaloSim::CpuSimulator simulator;
+};
+
+namespace
+{
+
+thread_local std::string lastError;
+
+halosim_status fail(halosim_status status, const std::string &message)
+{
+    lastError = message;
+    return status;
+}
+
+/*
+Runs a function and turns the exceptions of the C++ code into status codes,
+since they must not cross the C interface
+*/
+template <typename Function>
+halosim_status guard(Function function)
+{
+    try
+    {
+        function();
+        return HALOSIM_OK;
+    }
+    catch (const std::bad_alloc &)
+    {
+        return fail(HALOSIM_ERROR_OUT_OF_MEMORY, "Out of memory");
+    }
+    catch (const std::runtime_error &e)
+    {
+        return fail(HALOSIM_ERROR_INVALID_SCENE, e.what());
+    }
+    catch (const std::exception &e)
+    {
+        return fail(HALOSIM_ERROR_INTERNAL, e.what());
+    }
+}
+
+/*
+Changes are checked by writing the scene into a scene file and reading it
+back, so that the same limits apply as for scene files. Scenes whose crystals
+have just been cleared are checked with a placeholder population.
+*/
+template <typename Function>
+halosim_status changeScene(halosim_scene *scene, Function change)
+{
+    if (scene == nullptr)
+        return fail(HALOSIM_ERROR_INVALID_ARGUMENT, "No scene given");
+    return guard([&]() {
+        auto file = scene->file;
+        change(file);
+        bool noCrystals = file.scene.crystals.empty();
+        if (noCrystals)
+        {
+            file.scene.crystals.push_back(HaloSim::CrystalPopulation::createRandom());
+            file.scene.crystalWeights.push_back(1);
+        }
+        auto checkedFile = HaloSim::SceneFile::fromJson(file.toJson());
+        if (noCrystals)
+        {
+            checkedFile.scene.crystals.clear();
+            checkedFile.scene.crystalWeights.clear();
+        }
+        scene->file = checkedFile;
+    });
+}
+
+halosim_crystal toCrystal(const HaloSim::CrystalPopulation &population)
+{
+    halosim_crystal crystal;
+    crystal.ca_ratio_average = population.caRatioAverage;
+    crystal.ca_ratio_std = population.caRatioStd;
+    crystal.tilt_distribution = (halosim_distribution)population.tiltDistribution;
+    crystal.tilt_average = population.tiltAverage;
+    crystal.tilt_std = population.tiltStd;
+    crystal.rotation_distribution = (halosim_distribution)population.rotationDistribution;
+    crystal.rotation_average = population.rotationAverage;
+    crystal.rotation_std = population.rotationStd;
+    return crystal;
+}
+
+halosim_image toImage(const HaloSim::CpuSimulator &simulator, const std::vector<float> &pixels)
+{
+    halosim_image image;
+    image.data = pixels.data();
+    image.width = simulator.getWidth();
+    image.height = simulator.getHeight();
+    image.pixel_stride = 4 * sizeof(float);
+    image.row_stride = image.pixel_stride * simulator.getWidth();
+    return image;
+}
+
+} // namespace
+
+int halosim_get_api_version(void)
+{
+    return HALOSIM_API_VERSION;
+}
+
+const char *halosim_get_last_error(void)
+{
+    return lastError.c_str();
+}
+
+halosim_scene *halosim_scene_create(void)
+{
+    halosim_scene *scene = nullptr;
+    guard([&]() {
+        scene = new halosim_scene{HaloSim::SceneFile::createDefault()};
+    });
+    return scene;
+}
+
+halosim_scene *halosim_scene_parse(const char *text, size_t length)
+{
+    if (text == nullptr)
+    {
+        fail(HALOSIM_ERROR_INVALID_ARGUMENT, "No text given");
+        return nullptr;
+    }
+    halosim_scene *scene = nullptr;
+    guard([&]() {
+        scene = new halosim_scene{HaloSim::SceneFile::parse(std::string(text, length))};
+    });
+    return scene;
+}
+
+halosim_scene *halosim_scene_copy(const halosim_scene *scene)
+{
+    if (scene == nullptr)
+    {
+        fail(HALOSIM_ERROR_INVALID_ARGUMENT, "No scene given");
+        return nullptr;
+    }
+    halosim_scene *copy = nullptr;
+    guard([&]() {
+        copy = new halosim_scene(*scene);
+    });
+    return copy;
+}
+
+void halosim_scene_destroy(halosim_scene *scene)
+{
+    delete scene;
+}
+
+size_t halosim_scene_serialize(const halosim_scene *scene, char *buffer, size_t buffer_size)
+{
+    if (scene == nullptr)
+    {
+        fail(HALOSIM_ERROR_INVALID_ARGUMENT, "No scene given");
+        return 0;
+    }
+    std::string text;
+    if (guard([&]() { text = scene->file.serialize(); }) != HALOSIM_OK)
+        return 0;
+    if (buffer != nullptr && buffer_size > text.size())
+        std::memcpy(buffer, text.c_str(), text.size() + 1);
+    return text.size() + 1;
+}
+
+uint64_t halosim_scene_get_hash(const halosim_scene *scene)
+{
+    return scene != nullptr ? scene->file.getHash() : 0;
+}
+
+halosim_status halosim_scene_set_sun(halosim_scene *scene, float altitude, float diameter)
+{
+    return changeScene(scene, [&](HaloSim::SceneFile &file) {
+        file.scene.light.altitude = altitude;
+        file.scene.light.diameter = diameter;
+    });
+}
+
+halosim_status halosim_scene_set_camera(halosim_scene *scene, float pitch, float yaw, float fov, halosim_projection projection, int hide_sub_horizon)
+{
+    if (projection < HALOSIM_PROJECTION_STEREOGRAPHIC || projection > HALOSIM_PROJECTION_ORTHOGRAPHIC)
+        return fail(HALOSIM_ERROR_INVALID_ARGUMENT, "Unknown projection");
+    return changeScene(scene, [&](HaloSim::SceneFile &file) {
+        file.scene.camera.pitch = pitch;
+        file.scene.camera.yaw = yaw;
+        file.scene.camera.fov = fov;
+        file.scene.camera.projection = (HaloSim::Projection)projection;
+        file.scene.camera.hideSubHorizon = hide_sub_horizon != 0;
+    });
+}
+
+halosim_status halosim_scene_set_multiple_scattering(halosim_scene *scene, float probability)
+{
+    return changeScene(scene, [&](HaloSim::SceneFile &file) {
+        file.scene.multipleScatteringProbability = probability;
+    });
+}
+
+halosim_status halosim_scene_set_rays_per_step(halosim_scene *scene, uint32_t rays)
+{
+    return changeScene(scene, [&](HaloSim::SceneFile &file) {
+        file.raysPerStep = rays;
+    });
+}
+
+halosim_status halosim_scene_set_seed(halosim_scene *scene, uint32_t seed)
+{
+    return changeScene(scene, [&](HaloSim::SceneFile &file) {
+        file.seed = seed;
+    });
+}
+
+halosim_status halosim_scene_set_output_size(halosim_scene *scene, uint32_t width, uint32_t height)
+{
+    return changeScene(scene, [&](HaloSim::SceneFile &file) {
+        file.outputWidth = width;
+        file.outputHeight = height;
+    });
+}
+
+/*
+A scene without crystals cannot be simulated or saved, so the populations
+are only cleared here, and the next population that is added is checked
+*/
+void halosim_scene_clear_crystals(halosim_scene *scene)
+{
+    if (scene == nullptr)
+        return;
+    scene->file.scene.crystals.clear();
+    scene->file.scene.crystalWeights.clear();
+}
+
+halosim_status halosim_scene_add_crystal(halosim_scene *scene, const halosim_crystal *crystal, uint32_t weight)
+{
+    if (crystal == nullptr)
+        return fail(HALOSIM_ERROR_INVALID_ARGUMENT, "No crystal given");
+    for (auto distribution : {crystal->tilt_distribution, crystal->rotation_distribution})
+    {
+        if (distribution != HALOSIM_DISTRIBUTION_UNIFORM && distribution != HALOSIM_DISTRIBUTION_GAUSSIAN)
+            return fail(HALOSIM_ERROR_INVALID_ARGUMENT, "Unknown distribution");
+    }
+    return changeScene(scene, [&](HaloSim::SceneFile &file) {
+        HaloSim::CrystalPopulation population;
+        population.caRatioAverage = crystal->ca_ratio_average;
+        population.caRatioStd = crystal->ca_ratio_std;
+        population.tiltDistribution = (int)crystal->tilt_distribution;
+        population.tiltAverage = crystal->tilt_average;
+        population.tiltStd = crystal->tilt_std;
+        population.rotationDistribution = (int)crystal->rotation_distribution;
+        population.rotationAverage = crystal->rotation_average;
+        population.rotationStd = crystal->rotation_std;
+        file.scene.crystals.push_back(population);
+        file.scene.crystalWeights.push_back(weight);
+    });
+}
+
+halosim_status halosim_scene_get_preset(halosim_preset preset, halosim_crystal *crystal)
+{
+    if (crystal == nullptr || preset < HALOSIM_PRESET_RANDOM || preset > HALOSIM_PRESET_LOWITZ)
+        return fail(HALOSIM_ERROR_INVALID_ARGUMENT, "Unknown preset");
+    *crystal = toCrystal(HaloSim::CrystalPopulation::presetPopulation((HaloSim::CrystalPopulationPreset)preset));
+    return HALOSIM_OK;
+}
+
+uint32_t halosim_scene_get_crystal_count(const halosim_scene *scene)
+{
+    return scene != nullptr ? (uint32_t)scene->file.scene.crystals.size() : 0;
+}
+
+halosim_status halosim_scene_get_crystal(const halosim_scene *scene, uint32_t index, halosim_crystal *crystal, uint32_t *weight)
+{
+    if (scene == nullptr || index >= scene->file.scene.crystals.size())
+        return fail(HALOSIM_ERROR_INVALID_ARGUMENT, "No such crystal population");
+    if (crystal != nullptr)
+        *crystal = toCrystal(scene->file.scene.crystals[index]);
+    if (weight != nullptr)
+        *weight = scene->file.scene.crystalWeights[index];
+    return HALOSIM_OK;
+}
+
+halosim_simulator *halosim_simulator_create(const halosim_scene *scene, uint32_t thread_count)
+{
+    if (scene == nullptr)
+    {
+        fail(HALOSIM_ERROR_INVALID_ARGUMENT, "No scene given");
+        return nullptr;
+    }
+    halosim_simulator *simulator = nullptr;
+    guard([&]() {
+        // The crystals may have been cleared without adding any back
+        auto file = HaloSim::SceneFile::fromJson(scene->file.toJson());
+        simulator = new halosim_simulator{file, HaloSim::CpuSimulator(file.scene, file.outputWidth, file.outputHeight, thread_count)};
+        simulator->simulator.setSeed(file.seed);
+    });
+    return simulator;
+}
+
+void halosim_simulator_destroy(halosim_simulator *simulator)
+{
+    delete simulator;
+}
+
+halosim_status halosim_simulator_step(halosim_simulator *simulator, uint32_t rays)
+{
+    if (simulator == nullptr)
+        return fail(HALOSIM_ERROR_INVALID_ARGUMENT, "No simulator given");
+    return guard([&]() {
+        simulator->simulator.step(rays > 0 ? rays : simulator->file.raysPerStep);
+    });
+}
+
+halosim_status halosim_simulator_reset(halosim_simulator *simulator)
+{
+    if (simulator == nullptr)
+        return fail(HALOSIM_ERROR_INVALID_ARGUMENT, "No simulator given");
+    return guard([&]() {
+        simulator->simulator.clear();
+        simulator->simulator.setSeed(simulator->file.seed);
+    });
+}
+
+uint32_t halosim_simulator_get_iteration(const halosim_simulator *simulator)
+{
+    return simulator != nullptr ? simulator->simulator.getIteration() : 0;
+}
+
+uint64_t halosim_simulator_get_ray_count(const halosim_simulator *simulator)
+{
+    return simulator != nullptr ? simulator->simulator.getRayCount() : 0;
+}
+
+double halosim_simulator_get_noise_estimate(const halosim_simulator *simulator)
+{
+    return simulator != nullptr ? simulator->simulator.getNoiseEstimate() : -1.0;
+}
+
+halosim_status halosim_simulator_get_accumulation(const halosim_simulator *simulator, halosim_image *image)
+{
+    if (simulator == nullptr || image == nullptr)
+        return fail(HALOSIM_ERROR_INVALID_ARGUMENT, "No simulator or image given");
+    *image = toImage(simulator->simulator, simulator->simulator.getAccumulation());
+    return HALOSIM_OK;
+}
+
+halosim_status halosim_simulator_get_noise(const halosim_simulator *simulator, halosim_image *image)
+{
+    if (simulator == nullptr || image == nullptr)
+        return fail(HALOSIM_ERROR_INVALID_ARGUMENT, "No simulator or image given");
+    *image = toImage(simulator->simulator, simulator->simulator.getNoise());
+    return HALOSIM_OK;
+}
+
+float halosim_simulator_get_exposure(const halosim_simulator *simulator, double brightness)
+{
+    if (simulator == nullptr)
+        return 0.0f;
+    const auto &file = simulator->file;
+    return HaloSim::getExposure(brightness, simulator->simulator.getRayCount(), file.outputWidth, file.outputHeight, 1, file.scene.camera.fov);
+}
@@ -0,0 +1,175 @@
+#ifndef HALOSIM_H
+#define HALOSIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+C interface of the HaloRay simulation core, for embedding the simulation in
+other programs. It has no Qt or OpenGL dependency, and traces rays on the
+CPU with the same model as the simulation engine of HaloRay.
+
+Scenes and simulators are opaque handles. Functions that can fail return a
+halosim_status, or NULL for constructors, and halosim_get_last_error
+describes the last failure of the calling thread. A simulator must not be
+used from several threads at once, but separate simulators are independent.
+*/
+
+#if defined(_WIN32) && !defined(HALOSIM_STATIC)
+#ifdef HALOSIM_BUILD
+#define HALOSIM_API __declspec(dllexport)
+#else
+#define HALOSIM_API __declspec(dllimport)
+#endif
+#elif defined(__GNUC__)
+#define HALOSIM_API __attribute__((visibility("default")))
+#else
+#define HALOSIM_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Incremented for changes that are not backwards compatible */
+#define HALOSIM_API_VERSION 1
+
+typedef enum halosim_status
+{
+    HALOSIM_OK = 0,
+    HALOSIM_ERROR_INVALID_ARGUMENT = 1,
+    HALOSIM_ERROR_INVALID_SCENE = 2,
+    HALOSIM_ERROR_OUT_OF_MEMORY = 3,
+    HALOSIM_ERROR_INTERNAL = 4
+} halosim_status;
+
+typedef enum halosim_projection
+{
+    HALOSIM_PROJECTION_STEREOGRAPHIC = 0,
+    HALOSIM_PROJECTION_RECTILINEAR = 1,
+    HALOSIM_PROJECTION_EQUIDISTANT = 2,
+    HALOSIM_PROJECTION_EQUAL_AREA = 3,
+    HALOSIM_PROJECTION_ORTHOGRAPHIC = 4
+} halosim_projection;
+
+typedef enum halosim_distribution
+{
+    HALOSIM_DISTRIBUTION_UNIFORM = 0,
+    HALOSIM_DISTRIBUTION_GAUSSIAN = 1
+} halosim_distribution;
+
+typedef enum halosim_preset
+{
+    HALOSIM_PRESET_RANDOM = 0,
+    HALOSIM_PRESET_PLATE = 1,
+    HALOSIM_PRESET_COLUMN = 2,
+    HALOSIM_PRESET_PARRY = 3,
+    HALOSIM_PRESET_LOWITZ = 4
+} halosim_preset;
+
+/* A crystal population, with angles in degrees */
+typedef struct halosim_crystal
+{
+    float ca_ratio_average;
+    float ca_ratio_std;
+    halosim_distribution tilt_distribution;
+    float tilt_average;
+    float tilt_std;
+    halosim_distribution rotation_distribution;
+    float rotation_average;
+    float rotation_std;
+} halosim_crystal;
+
+/*
+A read only view of an image of the simulator, which points directly into
+its memory. Pixels have four floats, and the rows start from the bottom of
+the image. Strides are in bytes. The view stays valid until the simulator
+is stepped, reset or destroyed.
+*/
+typedef struct halosim_image
+{
+    const float *data;
+    uint32_t width;
+    uint32_t height;
+    size_t pixel_stride;
+    size_t row_stride;
+} halosim_image;
+
+typedef struct halosim_scene halosim_scene;
+typedef struct halosim_simulator halosim_simulator;
+
+HALOSIM_API int halosim_get_api_version(void);
+HALOSIM_API const char *halosim_get_last_error(void);
+
+/*
+Scenes hold everything that a scene file holds: the crystal populations,
+sun, camera, multiple scattering probability, rays per step, seed and output
+size. New scenes have the same defaults as scene files.
+*/
+HALOSIM_API halosim_scene *halosim_scene_create(void);
+HALOSIM_API halosim_scene *halosim_scene_parse(const char *text, size_t length);
+HALOSIM_API halosim_scene *halosim_scene_copy(const halosim_scene *scene);
+HALOSIM_API void halosim_scene_destroy(halosim_scene *scene);
+
+/*
+Writes the scene file text with a terminating null character, if it fits
+into the buffer, and returns the size that the text needs
+*/
+HALOSIM_API size_t halosim_scene_serialize(const halosim_scene *scene, char *buffer, size_t buffer_size);
+
+/* Equal for scenes that give the same simulation */
+HALOSIM_API uint64_t halosim_scene_get_hash(const halosim_scene *scene);
+
+HALOSIM_API halosim_status halosim_scene_set_sun(halosim_scene *scene, float altitude, float diameter);
+HALOSIM_API halosim_status halosim_scene_set_camera(halosim_scene *scene, float pitch, float yaw, float fov, halosim_projection projection, int hide_sub_horizon);
+HALOSIM_API halosim_status halosim_scene_set_multiple_scattering(halosim_scene *scene, float probability);
+HALOSIM_API halosim_status halosim_scene_set_rays_per_step(halosim_scene *scene, uint32_t rays);
+HALOSIM_API halosim_status halosim_scene_set_seed(halosim_scene *scene, uint32_t seed);
+HALOSIM_API halosim_status halosim_scene_set_output_size(halosim_scene *scene, uint32_t width, uint32_t height);
+
+HALOSIM_API void halosim_scene_clear_crystals(halosim_scene *scene);
+HALOSIM_API halosim_status halosim_scene_add_crystal(halosim_scene *scene, const halosim_crystal *crystal, uint32_t weight);
+HALOSIM_API halosim_status halosim_scene_get_preset(halosim_preset preset, halosim_crystal *crystal);
+HALOSIM_API uint32_t halosim_scene_get_crystal_count(const halosim_scene *scene);
+HALOSIM_API halosim_status halosim_scene_get_crystal(const halosim_scene *scene, uint32_t index, halosim_crystal *crystal, uint32_t *weight);
+
+/*
+Simulators copy the scene they are created from, so the scene can be
+changed or destroyed afterwards. A thread count of zero uses all cores. The
+random numbers are seeded with the seed of the scene, and the same scene
+always gives the same images, regardless of the number of threads.
+*/
+HALOSIM_API halosim_simulator *halosim_simulator_create(const halosim_scene *scene, uint32_t thread_count);
+HALOSIM_API void halosim_simulator_destroy(halosim_simulator *simulator);
+
+/* Traces the given number of rays, or the rays per step of the scene for zero */
+HALOSIM_API halosim_status halosim_simulator_step(halosim_simulator *simulator, uint32_t rays);
+
+/* Clears the images and starts the random numbers over from the seed */
+HALOSIM_API halosim_status halosim_simulator_reset(halosim_simulator *simulator);
+
+HALOSIM_API uint32_t halosim_simulator_get_iteration(const halosim_simulator *simulator);
+HALOSIM_API uint64_t halosim_simulator_get_ray_count(const halosim_simulator *simulator);
+
+/* Average relative error of the pixels weighted by brightness, negative before any rays are traced */
+HALOSIM_API double halosim_simulator_get_noise_estimate(const halosim_simulator *simulator);
+
+/*
+The accumulation holds XYZ colors and a constant one for pixels that were
+hit. The noise image holds the sums of squared luminance and the ray counts
+of the pixels.
+*/
+HALOSIM_API halosim_status halosim_simulator_get_accumulation(const halosim_simulator *simulator, halosim_image *image);
+HALOSIM_API halosim_status halosim_simulator_get_noise(const halosim_simulator *simulator, halosim_image *image);
+
+/*
+Exposure that scales the accumulation to the brightness of HaloRay's view,
+for the given brightness setting
+*/
+HALOSIM_API float halosim_simulator_get_exposure(const halosim_simulator *simulator, double brightness);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
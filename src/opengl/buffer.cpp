@@ -0,0 +1,31 @@
+#include "buffer.h"
+
+namespace OpenGL
+{
+
+Buffer::Buffer(std::size_t size, const void *data)
+    : mSize(size)
+{
+    initializeOpenGLFunctions();
+    glGenBuffers(1, &mBufferHandle);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mBufferHandle);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_DYNAMIC_COPY);
+}
+
+Buffer::~Buffer()
+{
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glDeleteBuffers(1, &mBufferHandle);
+}
+
+const unsigned int Buffer::getHandle() const
+{
+    return mBufferHandle;
+}
+
+const std::size_t Buffer::getSize() const
+{
+    return mSize;
+}
+
+} // namespace OpenGL
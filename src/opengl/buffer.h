@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <QOpenGLFunctions_4_4_Core>
+
+namespace OpenGL
+{
+
+class Buffer : protected QOpenGLFunctions_4_4_Core
+{
+public:
+    Buffer(std::size_t size, const void *data = nullptr);
+    ~Buffer();
+
+    const unsigned int getHandle() const;
+    const std::size_t getSize() const;
+
+private:
+    Buffer operator=(const Buffer &);
+    Buffer(const Buffer &);
+
+    unsigned int mBufferHandle;
+    std::size_t mSize;
+};
+
+} // namespace OpenGL
@@ -0,0 +1,78 @@
+#include "programBinaryCache.h"
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+namespace OpenGL
+{
+
+namespace
+{
+const quint32 cacheFileMagic = 0x48525042; // "HRPB"
+const quint32 cacheFileVersion = 1;
+} // namespace
+
+ProgramBinaryCache::ProgramBinaryCache(const QString &directory)
+    : mDirectory(directory)
+{
+}
+
+QString ProgramBinaryCache::defaultDirectory()
+{
+    auto directory = qgetenv("HALORAY_SHADER_CACHE_DIR");
+    if (!directory.isEmpty())
+        return QString::fromLocal8Bit(directory);
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/shaders";
+}
+
+QByteArray ProgramBinaryCache::computeKey(const QByteArray &driverIdentifier, const QByteArray &source)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(driverIdentifier);
+    hash.addData(source);
+    return hash.result().toHex();
+}
+
+QString ProgramBinaryCache::filePath(const QByteArray &key) const
+{
+    return QDir(mDirectory).filePath(QString::fromLatin1(key) + ".bin");
+}
+
+bool ProgramBinaryCache::load(const QByteArray &key, ProgramBinary &binary) const
+{
+    QFile file(filePath(key));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream stream(&file);
+    quint32 magic, version, format;
+    stream >> magic >> version >> format >> binary.data;
+    if (stream.status() != QDataStream::Ok || magic != cacheFileMagic || version != cacheFileVersion || binary.data.isEmpty())
+        return false;
+
+    binary.format = format;
+    return true;
+}
+
+void ProgramBinaryCache::store(const QByteArray &key, const ProgramBinary &binary) const
+{
+    /*
+    A failure to write the cache is not an error, the program is simply
+    compiled again the next time.
+    */
+    if (!QDir().mkpath(mDirectory))
+        return;
+
+    QSaveFile file(filePath(key));
+    if (!file.open(QIODevice::WriteOnly))
+        return;
+
+    QDataStream stream(&file);
+    stream << cacheFileMagic << cacheFileVersion << static_cast<quint32>(binary.format) << binary.data;
+    file.commit();
+}
+
+} // namespace OpenGL
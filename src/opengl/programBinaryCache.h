@@ -0,0 +1,35 @@
+#pragma once
+#include <QByteArray>
+#include <QString>
+
+namespace OpenGL
+{
+
+struct ProgramBinary
+{
+    unsigned int format;
+    QByteArray data;
+};
+
+/*
+Stores linked program binaries on disk, keyed by the OpenGL driver and the
+shader source, so that programs only need to be compiled once per driver.
+*/
+class ProgramBinaryCache
+{
+public:
+    explicit ProgramBinaryCache(const QString &directory = defaultDirectory());
+
+    bool load(const QByteArray &key, ProgramBinary &binary) const;
+    void store(const QByteArray &key, const ProgramBinary &binary) const;
+
+    static QString defaultDirectory();
+    static QByteArray computeKey(const QByteArray &driverIdentifier, const QByteArray &source);
+
+private:
+    QString filePath(const QByteArray &key) const;
+
+    QString mDirectory;
+};
+
+} // namespace OpenGL
@@ -4,28 +4,52 @@
 namespace OpenGL
 {
 
-Texture::Texture(unsigned int width, unsigned int height, unsigned int textureUnit, TextureType type)
-    : mWidth(width), mHeight(height), mTextureUnit(textureUnit), mType(type)
+Texture::Texture(unsigned int width, unsigned int height, unsigned int textureUnit, TextureType type, unsigned int layers)
+    : mWidth(width), mHeight(height), mTextureUnit(textureUnit), mType(type), mLayers(layers)
 {
     initializeOpenGLFunctions();
     glGenTextures(1, &mTextureHandle);
     glActiveTexture(GL_TEXTURE0 + textureUnit);
-    glBindTexture(GL_TEXTURE_2D, mTextureHandle);
+    glBindTexture(getTarget(), mTextureHandle);
     initializeTextureImage();
+    glTexParameteri(getTarget(), GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(getTarget(), GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+Texture::Texture(const Texture &arrayTexture, unsigned int layer)
+    : mWidth(arrayTexture.mWidth), mHeight(arrayTexture.mHeight), mTextureUnit(arrayTexture.mTextureUnit), mType(arrayTexture.mType), mLayers(0)
+{
+    initializeOpenGLFunctions();
+    if (layer >= arrayTexture.mLayers)
+        throw std::runtime_error("Invalid texture layer");
+    glGenTextures(1, &mTextureHandle);
+    glTextureView(mTextureHandle, GL_TEXTURE_2D, arrayTexture.mTextureHandle, getInternalFormat(), 0, 1, layer, 1);
+    glActiveTexture(GL_TEXTURE0 + mTextureUnit);
+    glBindTexture(GL_TEXTURE_2D, mTextureHandle);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 }
 
 void Texture::initializeTextureImage()
+{
+    /*
+    Storage is immutable, which texture views of array layers require. Users
+    of textures keep them for as long as their size stays the same.
+    */
+    if (mLayers > 0)
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, getInternalFormat(), mWidth, mHeight, mLayers);
+    else
+        glTexStorage2D(GL_TEXTURE_2D, 1, getInternalFormat(), mWidth, mHeight);
+}
+
+unsigned int Texture::getInternalFormat() const
 {
     switch (mType)
     {
     case Color:
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, mWidth, mHeight, 0, GL_RGBA, GL_FLOAT, NULL);
-        break;
+        return GL_RGBA32F;
     case Monochrome:
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, mWidth, mHeight, 0, GL_RED, GL_UNSIGNED_INT, NULL);
-        break;
+        return GL_R32UI;
     default:
         throw std::runtime_error("Invalid texture type");
     }
@@ -33,7 +57,7 @@ void Texture::initializeTextureImage()
 
 Texture::~Texture()
 {
-    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindTexture(getTarget(), 0);
     glDeleteTextures(1, &mTextureHandle);
 }
 
@@ -47,4 +71,19 @@ const unsigned int Texture::getTextureUnit() const
     return mTextureUnit;
 }
 
+const unsigned int Texture::getWidth() const
+{
+    return mWidth;
+}
+
+const unsigned int Texture::getHeight() const
+{
+    return mHeight;
+}
+
+const unsigned int Texture::getTarget() const
+{
+    return mLayers > 0 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+}
+
 } // namespace OpenGL
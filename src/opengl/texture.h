@@ -13,22 +13,32 @@ enum TextureType
 class Texture : protected QOpenGLFunctions_4_4_Core
 {
 public:
-    Texture(unsigned int width, unsigned int height, unsigned int textureUnit, TextureType type);
+    /*
+    Textures with layers are array textures, and each of their layers can be
+    viewed as a separate 2D texture with the layer view constructor.
+    */
+    Texture(unsigned int width, unsigned int height, unsigned int textureUnit, TextureType type, unsigned int layers = 0);
+    Texture(const Texture &arrayTexture, unsigned int layer);
     ~Texture();
 
     const unsigned int getHandle() const;
     const unsigned int getTextureUnit() const;
+    const unsigned int getTarget() const;
+    const unsigned int getWidth() const;
+    const unsigned int getHeight() const;
 
 private:
     Texture operator=(const Texture &);
     Texture(const Texture &);
     void initializeTextureImage();
+    unsigned int getInternalFormat() const;
 
     unsigned int mTextureHandle;
     unsigned int mWidth;
     unsigned int mHeight;
     unsigned int mTextureUnit;
     unsigned int mType;
+    unsigned int mLayers;
 };
 
 } // namespace OpenGL
@@ -11,17 +11,21 @@ std::unique_ptr<QOpenGLShaderProgram> TextureRenderer::initializeTexDrawShaderPr
     const std::string vertexShaderSrc =
         "#version 440 core\n"
         "in vec2 position;"
+        "out vec2 texCoord;"
+        "uniform vec2 scale;"
         "void main(void) {"
-        "    gl_Position = vec4(position, 0.0f, 1.0);"
+        "    texCoord = 0.5 * position + 0.5;"
+        "    gl_Position = vec4(scale * position, 0.0f, 1.0);"
         "}";
 
     const std::string fragShaderSrc =
         "#version 440 core\n"
+        "in vec2 texCoord;"
         "out vec4 color;"
         "uniform float exposure;"
         "uniform sampler2D s;"
         "void main(void) {"
-        "    vec3 xyz = texelFetch(s, ivec2(gl_FragCoord.xy), 0).xyz;"
+        "    vec3 xyz = texture(s, texCoord).xyz;"
         "    mat3 xyzToSrgb = mat3(3.2406, -0.9689, 0.0557, -1.5372, 1.8758, -0.2040, -0.4986, 0.0415, 1.0570);"
         "    vec3 linearSrgb = xyzToSrgb * xyz * exposure;"
         "    vec3 gammaCorrected = pow(linearSrgb, vec3(0.42));"
@@ -69,15 +73,33 @@ void TextureRenderer::initialize()
 
 void TextureRenderer::render(unsigned int textureHandle)
 {
-    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-
     /* Render simulation result texture */
 
     mTexDrawProgram->bind();
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
     glBindVertexArray(mQuadVao);
+    glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, textureHandle);
+    if (textureHandle == 0)
+        return;
+
+    /*
+    The texture is scaled to fit the viewport, keeping its aspect ratio, so
+    that the view can be resized without affecting the simulation.
+    */
+    int viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    int textureWidth, textureHeight;
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &textureWidth);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &textureHeight);
+    float viewportAspect = (float)viewport[2] / viewport[3];
+    float textureAspect = (float)textureWidth / textureHeight;
+    if (textureAspect > viewportAspect)
+        mTexDrawProgram->setUniformValue("scale", 1.0f, viewportAspect / textureAspect);
+    else
+        mTexDrawProgram->setUniformValue("scale", textureAspect / viewportAspect, 1.0f);
+
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 }
 
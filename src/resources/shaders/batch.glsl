@@ -0,0 +1,71 @@
+/*
+Each row of work groups in a batch traces one crystal population of one
+scene. The layout of a job must match SimulationEngine::BatchJob.
+*/
+struct batchJob_t
+{
+    float sunAltitude;
+    float sunDiameter;
+    float multipleScatter;
+    int layer;
+
+    float caRatioAverage;
+    float caRatioStd;
+    int tiltDistribution;
+    float tiltAverage;
+    float tiltStd;
+    int rotationDistribution;
+    float rotationAverage;
+    float rotationStd;
+
+    float cameraPitch;
+    float cameraYaw;
+    float cameraFov;
+    int cameraProjection;
+    int cameraHideSubHorizon;
+
+    int geometryOffset;
+    int geometryBinCount;
+    int geometryTriangleCount;
+    float geometryCaRatioMin;
+    float geometryCaRatioStep;
+
+    uint rayCount;
+};
+
+layout(std430, binding = 5) restrict readonly buffer batchJobs
+{
+    batchJob_t jobs[];
+};
+
+/*
+Reads the scene parameters of a job. Returns false if the job has fewer rays
+than the width of the dispatch.
+*/
+bool loadBatchJob(uint jobIndex, uint rayIndex)
+{
+    batchJob_t job = jobs[jobIndex];
+    if (rayIndex >= job.rayCount) return false;
+
+    outputLayer = job.layer;
+    multipleScatter = job.multipleScatter;
+    rayWeight = 1.0;
+    sun = sunProperties_t(job.sunAltitude, job.sunDiameter);
+    crystalProperties = crystalProperties_t(
+        job.caRatioAverage,
+        job.caRatioStd,
+        job.tiltDistribution,
+        job.tiltAverage,
+        job.tiltStd,
+        job.rotationDistribution,
+        job.rotationAverage,
+        job.rotationStd);
+    camera = camera_t(job.cameraPitch, job.cameraYaw, job.cameraFov, job.cameraProjection, job.cameraHideSubHorizon);
+    geometryTable = geometryTable_t(
+        job.geometryOffset,
+        job.geometryBinCount,
+        job.geometryTriangleCount,
+        job.geometryCaRatioMin,
+        job.geometryCaRatioStep);
+    return true;
+}
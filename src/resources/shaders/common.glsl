@@ -0,0 +1,535 @@
+#version 440 core
+
+#define DISTRIBUTION_UNIFORM 0
+#define DISTRIBUTION_GAUSSIAN 1
+
+/*
+In batch mode several scenes are rendered into the layers of an array
+texture, and the scene parameters are read from a buffer instead of uniforms.
+*/
+#ifdef BATCH
+#define SCENE_PARAMETER
+#define OUTPUT_COORDINATES(pixelCoordinates) ivec3(pixelCoordinates, outputLayer)
+layout(binding = 0, rgba32f) uniform coherent image2DArray outputImage;
+layout(binding = 1, r32ui) uniform coherent uimage2DArray spinlock;
+int outputLayer;
+#else
+#define SCENE_PARAMETER uniform
+#define OUTPUT_COORDINATES(pixelCoordinates) pixelCoordinates
+layout(binding = 0, rgba32f) uniform coherent image2D outputImage;
+layout(binding = 1, r32ui) uniform coherent uimage2D spinlock;
+#endif
+
+uniform uint rngSeed;
+SCENE_PARAMETER float multipleScatter;
+
+/*
+Rays are weighted so that the result stays the same when the crystal
+populations are not traced in proportion to their weights.
+*/
+SCENE_PARAMETER float rayWeight;
+
+#ifndef BATCH
+/*
+Rays that hit the image are counted per crystal population, unless the
+counted population is negative.
+*/
+uniform int countedPopulation;
+layout(std430, binding = 6) coherent buffer visibleRayCounters
+{
+    uint visibleRayCounts[];
+};
+
+/*
+With noise tracking, the sum of squared luminances and the number of rays
+are accumulated for each pixel next to the output.
+*/
+uniform int trackNoise;
+layout(binding = 2, rgba32f) uniform coherent image2D noiseImage;
+#endif
+
+struct sunProperties_t
+{
+    float altitude;
+    float diameter;
+};
+SCENE_PARAMETER sunProperties_t sun;
+
+struct crystalProperties_t
+{
+    float caRatioAverage;
+    float caRatioStd;
+
+    int tiltDistribution;
+    float tiltAverage;
+    float tiltStd;
+
+    int rotationDistribution;
+    float rotationAverage;
+    float rotationStd;
+};
+SCENE_PARAMETER crystalProperties_t crystalProperties;
+
+#define PROJECTION_STEREOGRAPHIC 0
+#define PROJECTION_RECTILINEAR 1
+#define PROJECTION_EQUIDISTANT 2
+#define PROJECTION_EQUAL_AREA 3
+#define PROJECTION_ORTHOGRAPHIC 4
+
+struct camera_t
+{
+    float pitch;
+    float yaw;
+    float fov;
+    int projection;
+    int hideSubHorizon;
+};
+SCENE_PARAMETER camera_t camera;
+
+const float PI = 3.1415926535;
+
+struct intersection {
+    bool didHit;
+    uint triangleIndex;
+    vec3 hitPoint;
+};
+
+/*
+Crystal geometry is read from tables built on the CPU. Each population has a
+table of triangles for a range of evenly spaced C/A ratios, and the geometry
+for a given C/A ratio is interpolated linearly between the two nearest bins.
+Each triangle consists of its first vertex, two edge vectors and the outward
+facing unit normal, with the triangle area stored in the w component.
+*/
+#define MAX_TRIANGLES 32
+#define TRIANGLE_ORIGIN 0
+#define TRIANGLE_EDGE_1 1
+#define TRIANGLE_EDGE_2 2
+#define TRIANGLE_NORMAL 3
+#define TRIANGLE_ATTRIBUTES 4
+
+struct geometryTable_t
+{
+    int offset;
+    int binCount;
+    int triangleCount;
+    float caRatioMin;
+    float caRatioStep;
+};
+SCENE_PARAMETER geometryTable_t geometryTable;
+
+layout(std430, binding = 4) restrict readonly buffer crystalGeometryTables
+{
+    vec4 geometryTables[];
+};
+
+int geometryBinOffsets[2];
+float geometryBinWeight;
+
+uint wang_hash(uint a)
+{
+	a -= (a << 6);
+	a ^= (a >> 17);
+	a -= (a << 9);
+	a ^= (a << 4);
+	a -= (a << 3);
+	a ^= (a << 10);
+	a ^= (a >> 15);
+	return a;
+}
+
+uint rngState;
+
+uint rand_xorshift(void)
+ {
+    // Xorshift algorithm from George Marsaglia's paper
+    rngState ^= (rngState << 13);
+    rngState ^= (rngState >> 17);
+    rngState ^= (rngState << 5);
+    return rngState;
+ }
+
+float rand(void) { return float(rand_xorshift()) / 4294967295.0; }
+
+vec2 randn(void)
+{
+    float u1 = sqrt(-2.0 * log(rand()));
+    float u2 = 2.0 * PI * rand();
+    return vec2(u1 * cos(u2), u1 * sin(u2));
+}
+
+float xFit_1931(float wave)
+{
+    float t1 = (wave - 442.0) * ((wave < 442.0) ? 0.0624 : 0.0374);
+    float t2 = (wave - 599.8) * ((wave < 599.8) ? 0.0264 : 0.0323);
+    float t3 = (wave - 501.1) * ((wave < 501.1) ? 0.0490 : 0.0382);
+    return 0.362 * exp(-0.5 * t1 * t1) + 1.056 * exp(-0.5 * t2 * t2) - 0.065f * exp(-0.5 * t3 * t3);
+}
+
+float yFit_1931(float wave)
+{
+    float t1 = (wave - 568.8) * ((wave < 568.8) ? 0.0213 : 0.0247);
+    float t2 = (wave - 530.9) * ((wave < 530.9) ? 0.0613 : 0.0322);
+    return 0.821 * exp(-0.5 * t1 * t1) + 0.286 * exp(-0.5 * t2 * t2);
+}
+
+float zFit_1931(float wave)
+{
+    float t1 = (wave - 437.0) * ((wave < 437.0) ? 0.0845 : 0.0278);
+    float t2 = (wave - 459.0) * ((wave < 459.0) ? 0.0385 : 0.0725);
+    return 1.217 * exp(-0.5 * t1 * t1) + 0.681 * exp(-0.5 * t2 * t2);
+}
+
+float getIceIOR(float wavelength)
+{
+    // Eq. from Simulating rainbows and halos in color by Stanley Gedzelman
+    return 1.3203 - 0.0000333 * wavelength;
+}
+
+void selectCrystalGeometry(float caMultiplier)
+{
+    /* The vertices of the crystal depend linearly on the C/A ratio, so
+    extrapolating past the ends of the table is exact. */
+    float bin = (max(0.0, caMultiplier) - geometryTable.caRatioMin) / geometryTable.caRatioStep;
+    int firstBin = clamp(int(floor(bin)), 0, geometryTable.binCount - 2);
+    int binSize = geometryTable.triangleCount * TRIANGLE_ATTRIBUTES;
+    geometryBinOffsets[0] = geometryTable.offset + firstBin * binSize;
+    geometryBinOffsets[1] = geometryBinOffsets[0] + binSize;
+    geometryBinWeight = bin - float(firstBin);
+}
+
+vec4 getTriangleAttribute(uint triangleIndex, int attributeIndex)
+{
+    int index = int(triangleIndex) * TRIANGLE_ATTRIBUTES + attributeIndex;
+    return mix(geometryTables[geometryBinOffsets[0] + index], geometryTables[geometryBinOffsets[1] + index], geometryBinWeight);
+}
+
+uint selectFirstTriangle(vec3 rayDirection)
+{
+    // Projected areas of the triangles as seen from the ray direction
+    float triangleProjectedAreas[MAX_TRIANGLES];
+    float sumProjectedAreas = 0.0;
+    for (int i = 0; i < geometryTable.triangleCount; ++i)
+    {
+        vec4 triangleNormal = getTriangleAttribute(i, TRIANGLE_NORMAL);
+        triangleProjectedAreas[i] = max(0.0, triangleNormal.w * dot(triangleNormal.xyz, rayDirection));
+        sumProjectedAreas += triangleProjectedAreas[i];
+    }
+
+    // Select triangle to hit
+    float triangleSelector = rand() * sumProjectedAreas;
+    for (int i = 0; i < geometryTable.triangleCount; ++i)
+    {
+        triangleSelector -= triangleProjectedAreas[i];
+        if (triangleSelector < 0.0)
+        {
+            return i;
+        }
+    }
+
+    return 0;
+}
+
+vec3 sampleTriangle(uint triangleIndex)
+{
+    float u = rand();
+    float v = rand();
+    if (u + v > 1.0) {
+        u = 1.0 - u;
+        v = 1.0 - v;
+    }
+
+    return getTriangleAttribute(triangleIndex, TRIANGLE_ORIGIN).xyz
+        + u * getTriangleAttribute(triangleIndex, TRIANGLE_EDGE_1).xyz
+        + v * getTriangleAttribute(triangleIndex, TRIANGLE_EDGE_2).xyz;
+}
+
+vec3 getNormal(uint triangleIndex)
+{
+    return normalize(getTriangleAttribute(triangleIndex, TRIANGLE_NORMAL).xyz);
+}
+
+float getReflectionCoefficient(vec3 normal, vec3 rayDir, float n0, float n1)
+{
+    float incidentAngle = acos(dot(-rayDir, normal));
+    if (n1 / n0 < sin(incidentAngle)) return 1.0;
+    float transmittedAngle = asin(n0 * sin(incidentAngle) / n1);
+    float incidentCos = cos(incidentAngle);
+    float transmittedCos = cos(transmittedAngle);
+    float rs = (n0 * incidentCos - n1 * transmittedCos) / (n0 * incidentCos + n1 * transmittedCos);
+    rs = rs * rs;
+    float rp = (n0 * transmittedCos - n1 * incidentCos) / (n0 * transmittedCos + n1 * incidentCos);
+    rp = rp * rp;
+    return 0.5 * (rs + rp);
+}
+
+intersection findIntersection(vec3 rayOrigin, vec3 rayDirection)
+{
+    for (int triangleIndex = 0; triangleIndex < geometryTable.triangleCount; ++triangleIndex)
+    {
+        vec3 v0 = getTriangleAttribute(triangleIndex, TRIANGLE_ORIGIN).xyz;
+        vec3 v0v1 = getTriangleAttribute(triangleIndex, TRIANGLE_EDGE_1).xyz;
+        vec3 v0v2 = getTriangleAttribute(triangleIndex, TRIANGLE_EDGE_2).xyz;
+
+        vec3 pVec = cross(rayDirection, v0v2);
+        float determinant = dot(v0v1, pVec);
+        if (determinant < 0.000001) continue;
+
+        vec3 tVec = rayOrigin - v0;
+        float u = dot(tVec, pVec);
+        if (u < 0.0 || u > determinant) continue;
+
+        vec3 qVec = cross(tVec, v0v1);
+        float v = dot(rayDirection, qVec);
+        if (v < 0.0 || u + v > determinant) continue;
+
+        float t = dot(v0v2, qVec) / determinant;
+
+        return intersection(true, triangleIndex, rayOrigin + t * rayDirection);
+    }
+
+    return intersection(false, 0, vec3(0.0));
+}
+
+#define BOUNCE_INSIDE 0
+#define BOUNCE_EXITED 1
+#define BOUNCE_LOST 2
+
+int bounceRay(inout vec3 rayOrigin, inout vec3 rayDirection, float indexOfRefraction)
+{
+    intersection hitResult = findIntersection(rayOrigin, rayDirection);
+    if (hitResult.didHit == false) return BOUNCE_LOST;
+    vec3 normal = getNormal(hitResult.triangleIndex);
+    float reflectionCoefficient = getReflectionCoefficient(normal, rayDirection, indexOfRefraction, 1.0);
+    if (rand() < reflectionCoefficient)
+    {
+        // Ray reflects back into crystal
+        rayOrigin = hitResult.hitPoint;
+        rayDirection = reflect(rayDirection, normal);
+        return BOUNCE_INSIDE;
+    }
+
+    // Ray refracts out of crystal
+    rayDirection = refract(rayDirection, normal, indexOfRefraction);
+    return BOUNCE_EXITED;
+}
+
+vec3 sampleSun(float altitude)
+{
+    // X and Z are horizontal, sun moves on the Y-Z plane
+    vec3 sunCenterDirection = vec3(
+        0.0,
+        sin(altitude),
+        cos(altitude)
+    );
+
+    // X axis is always perpendicular to the Y-Z plane
+    vec3 diskBasis0 = vec3(1.0, 0.0, 0.0);
+    vec3 diskBasis1 = cross(sunCenterDirection, diskBasis0);
+    // Sample uniform point on disk
+    float sampleAngle = rand() * 2.0 * PI;
+    float sampleDistance = sqrt(rand()) * 0.5 * radians(sun.diameter);
+    vec3 offset = sampleDistance * (sin(sampleAngle) * diskBasis0 + cos(sampleAngle) * diskBasis1);
+    vec3 sampleDirection = sunCenterDirection + offset;
+    return normalize(sampleDirection);
+}
+
+mat3 rotateAroundX(float angle)
+{
+    return mat3(
+        1.0, 0.0, 0.0,
+        0.0, cos(angle), sin(angle),
+        0.0, -sin(angle), cos(angle)
+    );
+}
+
+mat3 rotateAroundY(float angle)
+{
+    return mat3(
+        cos(angle), 0.0, -sin(angle),
+        0.0, 1.0, 0.0,
+        sin(angle), 0.0, cos(angle)
+    );
+}
+
+mat3 rotateAroundZ(float angle)
+{
+    return mat3(
+        cos(angle), sin(angle), 0.0,
+        -sin(angle), cos(angle), 0.0,
+        0.0, 0.0, 1.0
+    );
+}
+
+mat3 getCameraOrientationMatrix()
+{
+    return rotateAroundX(radians(camera.pitch)) * rotateAroundY(radians(camera.yaw));
+}
+
+mat3 getUniformRandomRotationMatrix(void)
+{
+    // From Fast Random Rotation Matrices, by James Arvo
+    float theta = 2.0 * PI * rand();
+    float phi = 2.0 * PI * rand();
+    float z = rand();
+    mat3 zRotationMatrix = mat3(cos(theta), -sin(theta), 0.0, sin(theta), cos(theta), 0.0, 0.0, 0.0, 1.0);
+    vec3 reflectionVector = vec3(cos(phi) * sqrt(z), sin(phi) * sqrt(z), sqrt(1.0 - z));
+    return (2.0 * outerProduct(reflectionVector, reflectionVector) - mat3(1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0)) * zRotationMatrix;
+}
+
+vec2 cartesianToPolar(vec3 direction)
+{
+    float r = acos(direction.z);
+    float angle = atan(direction.y, direction.x);
+    return vec2(r, angle);
+}
+
+mat3 getRotationMatrix(void)
+{
+    if (crystalProperties.tiltDistribution == DISTRIBUTION_UNIFORM && crystalProperties.rotationDistribution == DISTRIBUTION_UNIFORM)
+    {
+        return getUniformRandomRotationMatrix();
+    }
+
+    // Tilt of the crystal C-axis
+    mat3 tiltMat;
+
+    // Rotation around crystal C-axis
+    mat3 rotationMat;
+
+    if (crystalProperties.tiltDistribution == DISTRIBUTION_UNIFORM) {
+        tiltMat = rotateAroundZ(rand() * 2.0 * PI);
+    } else {
+        float angleAverage = crystalProperties.tiltAverage;
+        float angleStd = crystalProperties.tiltStd;
+        float tiltAngle = radians(angleAverage + angleStd * randn().x);
+        tiltMat = rotateAroundZ(tiltAngle);
+    }
+
+    if (crystalProperties.rotationDistribution == DISTRIBUTION_UNIFORM)
+    {
+        rotationMat = rotateAroundY(rand() * 2.0 * PI);
+    } else {
+        float angleAverage = crystalProperties.rotationAverage;
+        float angleStd = crystalProperties.rotationStd;
+        float rotationAngle = radians(angleAverage + angleStd * randn().x);
+        rotationMat = rotateAroundY(rotationAngle);
+    }
+
+    return rotateAroundY(rand() * 2.0 * PI) * tiltMat * rotationMat;
+}
+
+float daylightEstimate(float wavelength)
+{
+    return 1.0 - 0.0013333 * wavelength;
+}
+
+void storePixel(ivec2 pixelCoordinates, vec3 value)
+{
+    bool keepWaiting = true;
+    while (keepWaiting)
+    {
+        if (imageAtomicCompSwap(spinlock, OUTPUT_COORDINATES(pixelCoordinates), 0, 1) == 0)
+        {
+            vec3 currentValue = imageLoad(outputImage, OUTPUT_COORDINATES(pixelCoordinates)).xyz;
+            vec3 newValue = currentValue + value;
+            imageStore(outputImage, OUTPUT_COORDINATES(pixelCoordinates), vec4(newValue, 1.0));
+#ifndef BATCH
+            if (trackNoise == 1)
+            {
+                vec2 noiseSums = imageLoad(noiseImage, pixelCoordinates).xy;
+                imageStore(noiseImage, pixelCoordinates, vec4(noiseSums + vec2(value.y * value.y, 1.0), 0.0, 0.0));
+            }
+#endif
+            memoryBarrier();
+            keepWaiting = false;
+            imageAtomicExchange(spinlock, OUTPUT_COORDINATES(pixelCoordinates), 0);
+        }
+    }
+}
+
+void countVisibleRay(void)
+{
+#ifndef BATCH
+    if (countedPopulation >= 0) atomicAdd(visibleRayCounts[countedPopulation], 1u);
+#endif
+}
+
+float sampleCaMultiplier(void)
+{
+    return crystalProperties.caRatioAverage + randn().x * crystalProperties.caRatioStd;
+}
+
+/*
+Returns true if the ray refracts into the crystal, in which case rayOrigin is
+set to the entry point. Otherwise rayDirection is the direction of the ray
+reflected off the crystal.
+*/
+bool enterCrystal(inout vec3 rayOrigin, inout vec3 rayDirection, float indexOfRefraction)
+{
+    uint triangleIndex = selectFirstTriangle(rayDirection);
+    vec3 startingPoint = sampleTriangle(triangleIndex);
+    vec3 startingPointNormal = -getNormal(triangleIndex);
+    float reflectionCoeff = getReflectionCoefficient(startingPointNormal, rayDirection, 1.0, indexOfRefraction);
+    if (rand() < reflectionCoeff)
+    {
+        // Ray reflects off crystal
+        rayDirection = reflect(rayDirection, startingPointNormal);
+        return false;
+    }
+
+    // Ray enters crystal
+    rayOrigin = startingPoint;
+    rayDirection = refract(rayDirection, startingPointNormal, 1.0 / indexOfRefraction);
+    return true;
+}
+
+vec3 getSpectralColor(float wavelength)
+{
+    return daylightEstimate(wavelength) * vec3(xFit_1931(wavelength), yFit_1931(wavelength), zFit_1931(wavelength));
+}
+
+bool projectToPixel(vec3 resultRay, out ivec2 pixelCoordinates)
+{
+    // Hide subhorizon rays
+    if (camera.hideSubHorizon == 1 && resultRay.y > 0.0) return false;
+
+    resultRay = -getCameraOrientationMatrix() * resultRay;
+
+    ivec2 resolution = imageSize(outputImage).xy;
+    float aspectRatio = float(resolution.y) / float(resolution.x);
+
+    vec2 polar = cartesianToPolar(resultRay);
+
+    float fovRadians = radians(camera.fov);
+    float fr;
+    float fovNormalizer;
+
+    if (camera.projection == PROJECTION_STEREOGRAPHIC) {
+        fr = 2.0 * tan(polar.x / 2.0);
+        fovNormalizer = 1.0 / (4.0 * tan(fovRadians / 4.0));
+    } else if (camera.projection == PROJECTION_RECTILINEAR) {
+        if (polar.x > 0.5 * PI) return false;
+        fr = tan(polar.x);
+        fovNormalizer = 0.5 / tan(fovRadians / 2.0);
+    } else if (camera.projection == PROJECTION_EQUIDISTANT) {
+        fr = polar.x;
+        fovNormalizer = 1.0 / fovRadians;
+    } else if (camera.projection == PROJECTION_EQUAL_AREA) {
+        fr = 2.0 * sin(polar.x / 2.0);
+        fovNormalizer = 1.0 / (4.0 * sin(fovRadians / 4.0));
+    } else if (camera.projection == PROJECTION_ORTHOGRAPHIC) {
+        if (polar.x > 0.5 * PI) return false;
+        fr = sin(polar.x);
+        fovNormalizer = 0.5 / sin(fovRadians / 2.0);
+    }
+
+    vec2 projected = fovNormalizer * fr * vec2(aspectRatio * cos(polar.y), sin(polar.y));
+    vec2 normalizedCoordinates = 0.5 + projected;
+
+    if (any(lessThanEqual(normalizedCoordinates, vec2(0.0))) || any(greaterThanEqual(normalizedCoordinates, vec2(1.0))))
+        return false;
+
+    pixelCoordinates = ivec2(resolution.x * normalizedCoordinates.x, resolution.y * normalizedCoordinates.y);
+    return true;
+}
@@ -0,0 +1,43 @@
+#version 440 core
+
+/*
+Sums the square roots of the per pixel sums of squared luminance, and the
+luminances, over the pixels of each work group. The ratio of the two totals
+is the average relative error of the pixels, weighted by their brightness.
+*/
+layout(local_size_x = 16, local_size_y = 16) in;
+
+layout(binding = 0, rgba32f) uniform readonly image2D accumulationImage;
+layout(binding = 2, rgba32f) uniform readonly image2D noiseImage;
+
+layout(std430, binding = 7) restrict writeonly buffer noiseSums
+{
+    vec2 groupSums[];
+};
+
+shared vec2 sums[256];
+
+void main(void)
+{
+    ivec2 pixelCoordinates = ivec2(gl_GlobalInvocationID.xy);
+    vec2 pixelSums = vec2(0.0);
+    if (all(lessThan(pixelCoordinates, imageSize(accumulationImage))))
+    {
+        float luminance = imageLoad(accumulationImage, pixelCoordinates).y;
+        float squaredLuminance = imageLoad(noiseImage, pixelCoordinates).x;
+        pixelSums = vec2(sqrt(squaredLuminance), luminance);
+    }
+
+    uint index = gl_LocalInvocationIndex;
+    sums[index] = pixelSums;
+    barrier();
+    for (uint stride = 128; stride > 0; stride >>= 1)
+    {
+        if (index < stride)
+            sums[index] += sums[index + stride];
+        barrier();
+    }
+
+    if (index == 0)
+        groupSums[gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x] = sums[0];
+}
@@ -0,0 +1,18 @@
+layout(local_size_x = WAVEFRONT_GROUP_SIZE) in;
+
+void main(void)
+{
+    uint rayIndex = gl_GlobalInvocationID.x;
+    if (rayIndex >= queueLength[inputQueue]) return;
+
+    ray_t ray = loadRay(rayIndex);
+    selectCrystalGeometry(ray.caMultiplier);
+
+    int result = bounceRay(ray.position, ray.direction, getIceIOR(ray.wavelength));
+    ray.bounces += 1u;
+
+    if (result == BOUNCE_EXITED)
+        exitCrystal(ray);
+    else if (result == BOUNCE_INSIDE && ray.bounces < MAX_BOUNCES)
+        storeRay(ray);
+}
@@ -0,0 +1,29 @@
+layout(local_size_x = WAVEFRONT_GROUP_SIZE) in;
+
+uniform uint rayCount;
+
+void main(void)
+{
+    uint rayIndex = gl_GlobalInvocationID.x;
+    if (rayIndex >= rayCount) return;
+
+    rngState = wang_hash(rngSeed + rayIndex);
+    float caMultiplier = sampleCaMultiplier();
+    selectCrystalGeometry(caMultiplier);
+
+    vec3 rayDirection = -sampleSun(radians(sun.altitude));
+    float wavelength = 400.0 + rand() * 300.0;
+
+    // Rotation matrix to orient ray/crystal
+    mat3 rotationMatrix = getRotationMatrix();
+
+    /* The inverse rotation matrix must be applied because we are
+    rotating the incoming ray and not the crystal itself. */
+    vec3 rotatedRayDirection = rayDirection * rotationMatrix;
+
+    ray_t ray = ray_t(vec3(0.0), caMultiplier, rotatedRayDirection, wavelength, rotationMatrix, 0u, 0u);
+    if (enterCrystal(ray.position, ray.direction, getIceIOR(wavelength)))
+        storeRay(ray);
+    else
+        exitCrystal(ray);
+}
@@ -0,0 +1,12 @@
+layout(local_size_x = 1) in;
+
+/*
+Sizes the indirect dispatches of the following stages to the number of rays
+left in the queues, and empties the queue the next bounce stage writes to.
+*/
+void main(void)
+{
+    bounceDispatch = uvec4((queueLength[inputQueue] + WAVEFRONT_GROUP_SIZE - 1u) / WAVEFRONT_GROUP_SIZE, 1u, 1u, 0u);
+    splatDispatch = uvec4((escapedLength + WAVEFRONT_GROUP_SIZE - 1u) / WAVEFRONT_GROUP_SIZE, 1u, 1u, 0u);
+    queueLength[1u - inputQueue] = 0u;
+}
@@ -0,0 +1,113 @@
+#define WAVEFRONT_GROUP_SIZE 64
+#define MAX_BOUNCES 10
+
+/*
+Ray queues store rays as a structure of arrays: each attribute occupies its own
+range of queueCapacity elements, so that neighbouring invocations access
+neighbouring memory.
+*/
+#define RAY_ATTRIBUTE_POSITION 0u
+#define RAY_ATTRIBUTE_DIRECTION 1u
+#define RAY_ATTRIBUTE_ROTATION 2u
+
+uniform uint queueCapacity;
+uniform uint inputQueue;
+
+layout(std430, binding = 0) restrict readonly buffer inputRayQueue
+{
+    uvec4 inputRays[];
+};
+
+layout(std430, binding = 1) restrict writeonly buffer outputRayQueue
+{
+    uvec4 outputRays[];
+};
+
+layout(std430, binding = 2) buffer escapedRayQueue
+{
+    uvec4 escapedRays[];
+};
+
+layout(std430, binding = 3) coherent buffer queueCounters
+{
+    uvec4 bounceDispatch;
+    uvec4 splatDispatch;
+    uint queueLength[2];
+    uint escapedLength;
+};
+
+struct ray_t
+{
+    vec3 position;
+    float caMultiplier;
+    vec3 direction;
+    float wavelength;
+    mat3 rotation;
+    uint bounces;
+    uint scatterings;
+};
+
+ray_t loadRay(uint index)
+{
+    uvec4 position = inputRays[RAY_ATTRIBUTE_POSITION * queueCapacity + index];
+    uvec4 direction = inputRays[RAY_ATTRIBUTE_DIRECTION * queueCapacity + index];
+    uvec4 rotation0 = inputRays[RAY_ATTRIBUTE_ROTATION * queueCapacity + index];
+    uvec4 rotation1 = inputRays[(RAY_ATTRIBUTE_ROTATION + 1u) * queueCapacity + index];
+    uvec4 rotation2 = inputRays[(RAY_ATTRIBUTE_ROTATION + 2u) * queueCapacity + index];
+
+    // The random number generator continues from where the previous stage left off
+    rngState = rotation0.w;
+
+    return ray_t(
+        uintBitsToFloat(position.xyz),
+        uintBitsToFloat(position.w),
+        uintBitsToFloat(direction.xyz),
+        uintBitsToFloat(direction.w),
+        mat3(uintBitsToFloat(rotation0.xyz), uintBitsToFloat(rotation1.xyz), uintBitsToFloat(rotation2.xyz)),
+        rotation1.w & 0xffffu,
+        rotation1.w >> 16u);
+}
+
+void storeRay(ray_t ray)
+{
+    uint index = atomicAdd(queueLength[1u - inputQueue], 1u);
+    outputRays[RAY_ATTRIBUTE_POSITION * queueCapacity + index] = uvec4(floatBitsToUint(ray.position), floatBitsToUint(ray.caMultiplier));
+    outputRays[RAY_ATTRIBUTE_DIRECTION * queueCapacity + index] = uvec4(floatBitsToUint(ray.direction), floatBitsToUint(ray.wavelength));
+    outputRays[RAY_ATTRIBUTE_ROTATION * queueCapacity + index] = uvec4(floatBitsToUint(ray.rotation[0]), rngState);
+    outputRays[(RAY_ATTRIBUTE_ROTATION + 1u) * queueCapacity + index] = uvec4(floatBitsToUint(ray.rotation[1]), ray.bounces | (ray.scatterings << 16u));
+    outputRays[(RAY_ATTRIBUTE_ROTATION + 2u) * queueCapacity + index] = uvec4(floatBitsToUint(ray.rotation[2]), 0u);
+}
+
+void storeEscapedRay(vec3 direction, float wavelength)
+{
+    if (length(direction) < 0.0001) return;
+    uint index = atomicAdd(escapedLength, 1u);
+    escapedRays[index] = uvec4(floatBitsToUint(direction), floatBitsToUint(wavelength));
+}
+
+/*
+Called when a ray leaves a crystal with its direction in crystal coordinates.
+The ray either escapes towards the camera, or scatters from a second crystal.
+*/
+void exitCrystal(ray_t ray)
+{
+    vec3 resultRay = ray.rotation * ray.direction;
+
+    if (ray.scatterings == 0u && multipleScatter != 0.0 && multipleScatter > rand())
+    {
+        mat3 rotationMatrix = getRotationMatrix();
+
+        /* The inverse rotation matrix must be applied because we are
+        rotating the incoming ray and not the crystal itself. */
+        vec3 rotatedRayDirection = resultRay * rotationMatrix;
+        vec3 rayOrigin;
+        if (enterCrystal(rayOrigin, rotatedRayDirection, getIceIOR(ray.wavelength)))
+        {
+            storeRay(ray_t(rayOrigin, ray.caMultiplier, rotatedRayDirection, ray.wavelength, rotationMatrix, 0u, 1u));
+            return;
+        }
+        resultRay = rotationMatrix * rotatedRayDirection;
+    }
+
+    storeEscapedRay(resultRay, ray.wavelength);
+}
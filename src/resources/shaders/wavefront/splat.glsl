@@ -0,0 +1,17 @@
+layout(local_size_x = WAVEFRONT_GROUP_SIZE) in;
+
+void main(void)
+{
+    uint rayIndex = gl_GlobalInvocationID.x;
+    if (rayIndex >= escapedLength) return;
+
+    uvec4 escapedRay = escapedRays[rayIndex];
+    vec3 resultRay = uintBitsToFloat(escapedRay.xyz);
+    float wavelength = uintBitsToFloat(escapedRay.w);
+
+    ivec2 pixelCoordinates;
+    if (!projectToPixel(resultRay, pixelCoordinates)) return;
+
+    storePixel(pixelCoordinates, rayWeight * getSpectralColor(wavelength));
+    countVisibleRay();
+}
@@ -0,0 +1,749 @@
+#include "accumulationFile.h"
+#include <cstdio>
+#include <fstream>
+#include <cstring>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include "byteStream.h"
+#include "sceneFile.h"
+#include "fileReplacement.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace HaloSim
+{
+
+/*
+A read only view of a whole file, which the operating system pages in as
+it is read
+*/
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string &filename)
+        : mData(nullptr),
+          mSize(0)
+    {
+#ifdef _WIN32
+        mFile = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (mFile == INVALID_HANDLE_VALUE)
+            throw std::runtime_error("Could not open " + filename);
+        LARGE_INTEGER size;
+        GetFileSizeEx(mFile, &size);
+        mSize = (std::size_t)size.QuadPart;
+        mMapping = mSize > 0 ? CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+        if (mMapping != nullptr)
+            mData = static_cast<const unsigned char *>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+#else
+        mFile = open(filename.c_str(), O_RDONLY);
+        if (mFile == -1)
+            throw std::runtime_error("Could not open " + filename);
+        struct stat status;
+        if (fstat(mFile, &status) == 0)
+            mSize = (std::size_t)status.st_size;
+        if (mSize > 0)
+        {
+            auto data = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, mFile, 0);
+            if (data != MAP_FAILED)
+                mData = static_cast<const unsigned char *>(data);
+        }
+#endif
+        if (mData == nullptr)
+        {
+            close();
+            throw std::runtime_error("Could not read " + filename);
+        }
+    }
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    const unsigned char *getData() const
+    {
+        return mData;
+    }
+
+    std::size_t getSize() const
+    {
+        return mSize;
+    }
+
+private:
+    void close()
+    {
+#ifdef _WIN32
+        if (mData != nullptr)
+            UnmapViewOfFile(mData);
+        if (mMapping != nullptr)
+            CloseHandle(mMapping);
+        CloseHandle(mFile);
+#else
+        if (mData != nullptr)
+            munmap(const_cast<unsigned char *>(mData), mSize);
+        ::close(mFile);
+#endif
+    }
+
+    const unsigned char *mData;
+    std::size_t mSize;
+#ifdef _WIN32
+    HANDLE mFile;
+    HANDLE mMapping = nullptr;
+#else
+    int mFile;
+#endif
+};
+
+namespace
+{
+
+const char magic[] = "HRAC";
+const std::uint32_t formatVersion = 2;
+const std::uint32_t rawEncoding = 0;
+const std::uint32_t packedEncoding = 1;
+
+// Pixels have the four accumulation channels, followed by the two noise sums if there are any
+const unsigned int accumulationChannels = 4;
+const unsigned int noiseChannels = 2;
+const unsigned int hitChannel = 3;
+
+struct Level
+{
+    unsigned int width;
+    unsigned int height;
+    std::vector<float> pixels;
+};
+
+unsigned int halve(unsigned int size)
+{
+    return (size + 1) / 2;
+}
+
+// Like in merges, a pixel of a lower level is marked as hit if any pixel it covers is
+Level downsample(const Level &level, unsigned int channelCount)
+{
+    Level result;
+    result.width = halve(level.width);
+    result.height = halve(level.height);
+    result.pixels.assign((std::size_t)result.width * result.height * channelCount, 0.0f);
+    for (auto y = 0u; y < level.height; ++y)
+    {
+        for (auto x = 0u; x < level.width; ++x)
+        {
+            auto source = &level.pixels[((std::size_t)y * level.width + x) * channelCount];
+            auto destination = &result.pixels[((std::size_t)(y / 2) * result.width + x / 2) * channelCount];
+            for (auto c = 0u; c < channelCount; ++c)
+                destination[c] = c == hitChannel ? std::max(destination[c], source[c]) : destination[c] + source[c];
+        }
+    }
+    return result;
+}
+
+// Tiles store each channel separately, which keeps similar values together
+std::vector<float> getTile(const Level &level, unsigned int channelCount, unsigned int tileSize, unsigned int column, unsigned int row)
+{
+    auto x0 = column * tileSize;
+    auto y0 = row * tileSize;
+    auto width = std::min(tileSize, level.width - x0);
+    auto height = std::min(tileSize, level.height - y0);
+    std::vector<float> tile((std::size_t)width * height * channelCount);
+    std::size_t i = 0;
+    for (auto c = 0u; c < channelCount; ++c)
+    {
+        for (auto y = y0; y < y0 + height; ++y)
+        {
+            for (auto x = x0; x < x0 + width; ++x)
+                tile[i++] = level.pixels[((std::size_t)y * level.width + x) * channelCount + c];
+        }
+    }
+    return tile;
+}
+
+// PackBits run length encoding
+std::string packBits(const std::string &bytes)
+{
+    std::string packed;
+    std::size_t i = 0;
+    while (i < bytes.size())
+    {
+        std::size_t run = 1;
+        while (i + run < bytes.size() && run < 128 && bytes[i + run] == bytes[i])
+            ++run;
+        if (run >= 3)
+        {
+            packed.push_back((char)(257 - run));
+            packed.push_back(bytes[i]);
+            i += run;
+            continue;
+        }
+
+        auto start = i;
+        while (i < bytes.size() && i - start < 128)
+        {
+            if (i + 2 < bytes.size() && bytes[i] == bytes[i + 1] && bytes[i] == bytes[i + 2])
+                break;
+            ++i;
+        }
+        packed.push_back((char)(i - start - 1));
+        packed.append(bytes, start, i - start);
+    }
+    return packed;
+}
+
+std::string unpackBits(const unsigned char *data, std::size_t size, std::size_t unpackedSize)
+{
+    std::string bytes;
+    bytes.reserve(unpackedSize);
+    std::size_t i = 0;
+    while (i < size)
+    {
+        auto header = data[i++];
+        if (header < 128)
+        {
+            std::size_t count = header + 1u;
+            if (i + count > size || bytes.size() + count > unpackedSize)
+                throw std::runtime_error("Damaged tile");
+            bytes.append(reinterpret_cast<const char *>(data + i), count);
+            i += count;
+        }
+        else if (header > 128)
+        {
+            std::size_t count = 257u - header;
+            if (i >= size || bytes.size() + count > unpackedSize)
+                throw std::runtime_error("Damaged tile");
+            bytes.append(count, (char)data[i++]);
+        }
+    }
+    if (bytes.size() != unpackedSize)
+        throw std::runtime_error("Damaged tile");
+    return bytes;
+}
+
+/*
+Each value is replaced by its bits XORed with those of the value before it
+in the same channel, which turns empty and smooth areas into zero bytes,
+and the bytes are grouped by significance before run length encoding
+*/
+std::string packTile(const std::vector<float> &tile, std::size_t valuesPerChannel)
+{
+    std::vector<std::uint32_t> bits(tile.size());
+    std::memcpy(bits.data(), tile.data(), tile.size() * sizeof(float));
+    for (auto i = bits.size(); i-- > 1;)
+    {
+        if (i % valuesPerChannel != 0)
+            bits[i] ^= bits[i - 1];
+    }
+
+    std::string shuffled(bits.size() * 4, '\0');
+    for (auto b = 0u; b < 4; ++b)
+    {
+        for (std::size_t i = 0; i < bits.size(); ++i)
+            shuffled[b * bits.size() + i] = (char)(bits[i] >> (8 * b));
+    }
+    return packBits(shuffled);
+}
+
+std::vector<float> unpackTile(const unsigned char *data, std::size_t size, std::size_t valueCount, std::size_t valuesPerChannel)
+{
+    auto shuffled = unpackBits(data, size, valueCount * 4);
+    std::vector<std::uint32_t> bits(valueCount, 0);
+    for (auto b = 0u; b < 4; ++b)
+    {
+        for (std::size_t i = 0; i < valueCount; ++i)
+            bits[i] |= (std::uint32_t)(std::uint8_t)shuffled[b * valueCount + i] << (8 * b);
+    }
+    for (std::size_t i = 1; i < valueCount; ++i)
+    {
+        if (i % valuesPerChannel != 0)
+            bits[i] ^= bits[i - 1];
+    }
+
+    std::vector<float> tile(valueCount);
+    std::memcpy(tile.data(), bits.data(), valueCount * sizeof(float));
+    return tile;
+}
+
+std::string encodeRaw(const std::vector<float> &tile)
+{
+    ByteWriter data;
+    for (auto value : tile)
+        data.addFloat(value);
+    return std::string(data.getData(), data.getSize());
+}
+
+// Reads little-endian values from memory, checking that they are within it
+class MemoryReader
+{
+public:
+    MemoryReader(const unsigned char *data, std::size_t size) : mData(data), mSize(size), mPosition(0) {}
+
+    const unsigned char *read(std::size_t count)
+    {
+        if (count > mSize - mPosition)
+            throw std::runtime_error("Unexpected end of file");
+        auto data = mData + mPosition;
+        mPosition += count;
+        return data;
+    }
+
+    std::uint32_t readUint32()
+    {
+        auto bytes = read(4);
+        std::uint32_t value = 0;
+        for (auto i = 0; i < 4; ++i)
+            value |= (std::uint32_t)bytes[i] << (8 * i);
+        return value;
+    }
+
+    std::uint64_t readUint64()
+    {
+        auto low = readUint32();
+        return low | ((std::uint64_t)readUint32() << 32);
+    }
+
+    std::string readText(std::size_t length)
+    {
+        return std::string(reinterpret_cast<const char *>(read(length)), length);
+    }
+
+private:
+    const unsigned char *mData;
+    std::size_t mSize;
+    std::size_t mPosition;
+};
+
+std::uint32_t countLevels(unsigned int width, unsigned int height, unsigned int tileSize)
+{
+    std::uint32_t levelCount = 1;
+    while (width > tileSize || height > tileSize)
+    {
+        width = halve(width);
+        height = halve(height);
+        ++levelCount;
+    }
+    return levelCount;
+}
+
+unsigned int getTileCount(unsigned int size, unsigned int tileSize)
+{
+    return (size + tileSize - 1) / tileSize;
+}
+
+} // namespace
+
+void writeAccumulationFile(const std::string &filename, const RawImage &image, unsigned int tileSize, bool compressed)
+{
+    auto size = (std::size_t)image.width * image.height * 4;
+    if (image.width == 0 || image.height == 0 || image.accumulation.size() != size || (!image.noise.empty() && image.noise.size() != size))
+        throw std::runtime_error("Invalid image size");
+    if (tileSize == 0 || tileSize > 4096)
+        throw std::runtime_error("Invalid tile size");
+    if (image.randomStreamCount == 0 || image.randomStreamIndex >= image.randomStreamCount)
+        throw std::runtime_error("Invalid random stream");
+
+    auto channelCount = accumulationChannels + (image.noise.empty() ? 0 : noiseChannels);
+    std::vector<Level> levels(1);
+    levels[0].width = image.width;
+    levels[0].height = image.height;
+    levels[0].pixels.resize((std::size_t)image.width * image.height * channelCount);
+    for (std::size_t pixel = 0; pixel < (std::size_t)image.width * image.height; ++pixel)
+    {
+        auto destination = &levels[0].pixels[pixel * channelCount];
+        for (auto c = 0u; c < accumulationChannels; ++c)
+            destination[c] = image.accumulation[pixel * 4 + c];
+        if (!image.noise.empty())
+        {
+            for (auto c = 0u; c < noiseChannels; ++c)
+                destination[accumulationChannels + c] = image.noise[pixel * 4 + c];
+        }
+    }
+    auto levelCount = countLevels(image.width, image.height, tileSize);
+    while (levels.size() < levelCount)
+        levels.push_back(downsample(levels.back(), channelCount));
+
+    // Written next to the file and renamed over it once complete, like checkpoints
+    auto temporaryFilename = filename + ".tmp";
+    std::ofstream stream(temporaryFilename, std::ios::binary);
+    if (!stream)
+        throw std::runtime_error("Could not open " + temporaryFilename);
+
+    ByteWriter data;
+    data.addText(magic);
+    data.addUint32(formatVersion);
+    data.addUint32(image.width);
+    data.addUint32(image.height);
+    data.addUint32(tileSize);
+    data.addUint32(channelCount);
+    data.addUint32(levelCount);
+    data.addUint64(image.rayCount);
+    data.addUint32(image.seed);
+    data.addUint32(image.randomStreamIndex);
+    data.addUint32(image.randomStreamCount);
+    data.addUint32((std::uint32_t)image.scene.size());
+    data.addText(image.scene);
+    std::uint64_t indexOffset = data.getSize();
+    data.writeTo(stream);
+
+    // The index is written once the locations of the tiles are known
+    std::size_t tileCount = 0;
+    for (const auto &level : levels)
+        tileCount += (std::size_t)getTileCount(level.width, tileSize) * getTileCount(level.height, tileSize);
+    const std::uint64_t indexEntrySize = 16;
+    stream.write(std::string(tileCount * indexEntrySize, '\0').data(), (std::streamsize)(tileCount * indexEntrySize));
+
+    ByteWriter index;
+    auto offset = indexOffset + tileCount * indexEntrySize;
+    for (const auto &level : levels)
+    {
+        for (auto row = 0u; row < getTileCount(level.height, tileSize); ++row)
+        {
+            for (auto column = 0u; column < getTileCount(level.width, tileSize); ++column)
+            {
+                auto tile = getTile(level, channelCount, tileSize, column, row);
+                auto encoding = rawEncoding;
+                auto bytes = compressed ? packTile(tile, tile.size() / channelCount) : std::string();
+                if (compressed && bytes.size() < tile.size() * sizeof(float))
+                    encoding = packedEncoding;
+                else
+                    bytes = encodeRaw(tile);
+
+                stream.write(bytes.data(), (std::streamsize)bytes.size());
+                index.addUint64(offset);
+                index.addUint32((std::uint32_t)bytes.size());
+                index.addUint32(encoding);
+                offset += bytes.size();
+            }
+        }
+    }
+    stream.seekp((std::streamoff)indexOffset);
+    index.writeTo(stream);
+
+    stream.close();
+    if (!stream)
+    {
+        std::remove(temporaryFilename.c_str());
+        throw std::runtime_error("Could not write " + temporaryFilename);
+    }
+    syncToDisk(temporaryFilename);
+    replaceFile(temporaryFilename, filename);
+}
+
+RawImage mergeAccumulationFiles(const std::vector<std::string> &filenames)
+{
+    if (filenames.empty())
+        throw std::runtime_error("No files to merge");
+
+    RawImage result;
+    std::uint64_t sceneHash = 0;
+    std::vector<double> accumulation;
+    std::vector<double> noise;
+    bool hasNoise = true;
+    std::vector<std::pair<std::uint32_t, unsigned int>> streams;
+    for (const auto &filename : filenames)
+    {
+        AccumulationFileReader reader(filename);
+        auto image = reader.readImage();
+        std::uint64_t imageSceneHash;
+        try
+        {
+            imageSceneHash = SceneFile::parse(image.scene).scene.getHash();
+        }
+        catch (const std::runtime_error &e)
+        {
+            throw std::runtime_error(filename + ": " + e.what());
+        }
+
+        if (accumulation.empty())
+        {
+            result.width = image.width;
+            result.height = image.height;
+            result.rayCount = 0;
+            result.exposure = 0.0f;
+            result.scene = image.scene;
+            result.seed = image.seed;
+            result.randomStreamIndex = image.randomStreamIndex;
+            result.randomStreamCount = image.randomStreamCount;
+            sceneHash = imageSceneHash;
+            accumulation.assign(image.accumulation.size(), 0.0);
+            noise.assign(image.accumulation.size(), 0.0);
+        }
+        else if (image.width != result.width || image.height != result.height)
+        {
+            throw std::runtime_error(filename + " has a different size than " + filenames[0]);
+        }
+        else if (imageSceneHash != sceneHash)
+        {
+            throw std::runtime_error(filename + " has a different scene than " + filenames[0]);
+        }
+
+        // Streams split the seeds differently for each count, so renders with different counts may share seeds
+        if (image.randomStreamCount != result.randomStreamCount)
+            throw std::runtime_error(filename + " is one of " + std::to_string(image.randomStreamCount) + " random streams, but " + filenames[0] + " is one of " + std::to_string(result.randomStreamCount));
+        std::pair<std::uint32_t, unsigned int> stream(image.seed, image.randomStreamIndex);
+        auto duplicate = std::find(streams.begin(), streams.end(), stream);
+        if (duplicate != streams.end())
+            throw std::runtime_error(filename + " contains the same render as " + filenames[duplicate - streams.begin()]);
+        streams.push_back(stream);
+
+        // The fourth channel only marks the pixels that rays have hit
+        for (std::size_t i = 0; i < accumulation.size(); ++i)
+            accumulation[i] = i % 4 == 3 ? std::max(accumulation[i], (double)image.accumulation[i]) : accumulation[i] + image.accumulation[i];
+        hasNoise = hasNoise && !image.noise.empty();
+        if (hasNoise)
+        {
+            for (std::size_t i = 0; i < noise.size(); ++i)
+                noise[i] += image.noise[i];
+        }
+        result.rayCount += image.rayCount;
+    }
+
+    // Every stream of one seed adds up to the whole render, and streams never repeat within a seed
+    bool complete = streams.size() == result.randomStreamCount;
+    for (const auto &stream : streams)
+        complete = complete && stream.first == result.seed;
+    if (complete)
+    {
+        result.randomStreamIndex = 0;
+        result.randomStreamCount = 1;
+    }
+    result.accumulation.assign(accumulation.begin(), accumulation.end());
+    if (hasNoise)
+        result.noise.assign(noise.begin(), noise.end());
+    return result;
+}
+
+AccumulationFileReader::AccumulationFileReader(const std::string &filename)
+    : mFilename(filename),
+      mFile(std::make_unique<MappedFile>(filename))
+{
+    try
+    {
+        MemoryReader reader(mFile->getData(), mFile->getSize());
+        if (reader.readText(4) != magic)
+            throw std::runtime_error("Not an accumulation file");
+        if (reader.readUint32() != formatVersion)
+            throw std::runtime_error("Unsupported accumulation file version");
+
+        auto width = reader.readUint32();
+        auto height = reader.readUint32();
+        mTileSize = reader.readUint32();
+        mChannelCount = reader.readUint32();
+        auto levelCount = reader.readUint32();
+        mRayCount = reader.readUint64();
+        mSeed = reader.readUint32();
+        mRandomStreamIndex = reader.readUint32();
+        mRandomStreamCount = reader.readUint32();
+        mScene = reader.readText(reader.readUint32());
+
+        const unsigned int maxSize = 65536;
+        if (width == 0 || height == 0 || width > maxSize || height > maxSize)
+            throw std::runtime_error("Invalid image size");
+        if (mTileSize == 0 || mTileSize > 4096)
+            throw std::runtime_error("Invalid tile size");
+        if (mChannelCount != accumulationChannels && mChannelCount != accumulationChannels + noiseChannels)
+            throw std::runtime_error("Invalid number of channels");
+        if (levelCount != countLevels(width, height, mTileSize))
+            throw std::runtime_error("Invalid number of levels");
+        if (mRandomStreamCount == 0 || mRandomStreamIndex >= mRandomStreamCount)
+            throw std::runtime_error("Invalid random stream");
+
+        for (auto level = 0u; level < levelCount; ++level)
+        {
+            mLevelWidths.push_back(width);
+            mLevelHeights.push_back(height);
+            mLevelFirstTiles.push_back(mTiles.size());
+            auto tileCount = (std::size_t)getTileColumns(level) * getTileRows(level);
+            for (std::size_t i = 0; i < tileCount; ++i)
+            {
+                Tile tile;
+                tile.offset = reader.readUint64();
+                tile.size = reader.readUint32();
+                tile.encoding = reader.readUint32();
+                if (tile.offset > mFile->getSize() || tile.size > mFile->getSize() - tile.offset || tile.encoding > packedEncoding)
+                    throw std::runtime_error("Damaged tile index");
+                mTiles.push_back(tile);
+            }
+            width = halve(width);
+            height = halve(height);
+        }
+    }
+    catch (const std::runtime_error &e)
+    {
+        throw std::runtime_error(filename + ": " + e.what());
+    }
+}
+
+AccumulationFileReader::~AccumulationFileReader() = default;
+
+unsigned int AccumulationFileReader::getLevelCount() const
+{
+    return (unsigned int)mLevelWidths.size();
+}
+
+unsigned int AccumulationFileReader::getWidth(unsigned int level) const
+{
+    return mLevelWidths.at(level);
+}
+
+unsigned int AccumulationFileReader::getHeight(unsigned int level) const
+{
+    return mLevelHeights.at(level);
+}
+
+unsigned int AccumulationFileReader::getTileSize() const
+{
+    return mTileSize;
+}
+
+bool AccumulationFileReader::hasNoise() const
+{
+    return mChannelCount > accumulationChannels;
+}
+
+unsigned long long AccumulationFileReader::getRayCount() const
+{
+    return mRayCount;
+}
+
+std::uint32_t AccumulationFileReader::getSeed() const
+{
+    return mSeed;
+}
+
+unsigned int AccumulationFileReader::getRandomStreamIndex() const
+{
+    return mRandomStreamIndex;
+}
+
+unsigned int AccumulationFileReader::getRandomStreamCount() const
+{
+    return mRandomStreamCount;
+}
+
+const std::string &AccumulationFileReader::getScene() const
+{
+    return mScene;
+}
+
+unsigned int AccumulationFileReader::getTileColumns(unsigned int level) const
+{
+    return getTileCount(mLevelWidths[level], mTileSize);
+}
+
+unsigned int AccumulationFileReader::getTileRows(unsigned int level) const
+{
+    return getTileCount(mLevelHeights[level], mTileSize);
+}
+
+std::vector<float> AccumulationFileReader::decodeTile(unsigned int level, unsigned int column, unsigned int row) const
+{
+    const auto &tile = mTiles[mLevelFirstTiles[level] + (std::size_t)row * getTileColumns(level) + column];
+    auto width = std::min(mTileSize, mLevelWidths[level] - column * mTileSize);
+    auto height = std::min(mTileSize, mLevelHeights[level] - row * mTileSize);
+    auto valuesPerChannel = (std::size_t)width * height;
+    auto valueCount = valuesPerChannel * mChannelCount;
+    auto data = mFile->getData() + tile.offset;
+
+    try
+    {
+        if (tile.encoding == packedEncoding)
+            return unpackTile(data, tile.size, valueCount, valuesPerChannel);
+
+        if (tile.size != valueCount * sizeof(float))
+            throw std::runtime_error("Damaged tile");
+        MemoryReader reader(data, tile.size);
+        std::vector<float> values(valueCount);
+        for (auto &value : values)
+        {
+            auto bits = reader.readUint32();
+            std::memcpy(&value, &bits, sizeof(value));
+        }
+        return values;
+    }
+    catch (const std::runtime_error &e)
+    {
+        throw std::runtime_error(mFilename + ": " + e.what());
+    }
+}
+
+std::vector<float> AccumulationFileReader::readChannels(unsigned int level, unsigned int x, unsigned int y, unsigned int width, unsigned int height, unsigned int firstChannel) const
+{
+    if (level >= getLevelCount() || x > mLevelWidths[level] || width > mLevelWidths[level] - x || y > mLevelHeights[level] || height > mLevelHeights[level] - y)
+        throw std::runtime_error("Region is outside the image");
+
+    std::vector<float> result((std::size_t)width * height * 4, 0.0f);
+    if (width == 0 || height == 0 || firstChannel >= mChannelCount)
+        return result;
+
+    auto channelCount = firstChannel == 0 ? accumulationChannels : noiseChannels;
+    for (auto row = y / mTileSize; row <= (y + height - 1) / mTileSize; ++row)
+    {
+        for (auto column = x / mTileSize; column <= (x + width - 1) / mTileSize; ++column)
+        {
+            auto tile = decodeTile(level, column, row);
+            auto tileX = column * mTileSize;
+            auto tileY = row * mTileSize;
+            auto tileWidth = std::min(mTileSize, mLevelWidths[level] - tileX);
+            auto tileHeight = std::min(mTileSize, mLevelHeights[level] - tileY);
+            auto valuesPerChannel = (std::size_t)tileWidth * tileHeight;
+
+            auto fromX = std::max(x, tileX);
+            auto toX = std::min(x + width, tileX + tileWidth);
+            auto fromY = std::max(y, tileY);
+            auto toY = std::min(y + height, tileY + tileHeight);
+            for (auto c = 0u; c < channelCount; ++c)
+            {
+                auto plane = &tile[(firstChannel + c) * valuesPerChannel];
+                for (auto pixelY = fromY; pixelY < toY; ++pixelY)
+                {
+                    for (auto pixelX = fromX; pixelX < toX; ++pixelX)
+                        result[((std::size_t)(pixelY - y) * width + (pixelX - x)) * 4 + c] = plane[(std::size_t)(pixelY - tileY) * tileWidth + (pixelX - tileX)];
+                }
+            }
+        }
+    }
+    return result;
+}
+
+std::vector<float> AccumulationFileReader::readAccumulation(unsigned int level, unsigned int x, unsigned int y, unsigned int width, unsigned int height) const
+{
+    return readChannels(level, x, y, width, height, 0);
+}
+
+std::vector<float> AccumulationFileReader::readNoise(unsigned int level, unsigned int x, unsigned int y, unsigned int width, unsigned int height) const
+{
+    return readChannels(level, x, y, width, height, accumulationChannels);
+}
+
+RawImage AccumulationFileReader::readImage(unsigned int level) const
+{
+    if (level >= getLevelCount())
+        throw std::runtime_error("Level is outside the image");
+
+    RawImage image;
+    image.width = mLevelWidths[level];
+    image.height = mLevelHeights[level];
+    image.accumulation = readAccumulation(level, 0, 0, image.width, image.height);
+    if (hasNoise())
+        image.noise = readNoise(level, 0, 0, image.width, image.height);
+    image.rayCount = mRayCount;
+    image.exposure = 0.0f;
+    image.scene = mScene;
+    image.seed = mSeed;
+    image.randomStreamIndex = mRandomStreamIndex;
+    image.randomStreamCount = mRandomStreamCount;
+    return image;
+}
+
+} // namespace HaloSim
@@ -0,0 +1,105 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "imageFile.h"
+
+namespace HaloSim
+{
+
+/*
+The native file format for simulation results, meant for archiving. Pixels
+are stored in square tiles, each compressed on its own without loss when
+that makes it smaller, and a tile index gives the location of every tile,
+so that any part of the image can be read without decoding the rest. Lower
+resolution levels of the image follow the full resolution, halving the size
+each time until the image fits in one tile. A pixel of a lower level holds
+the sums of the pixels it covers, like the previews of the simulation
+engine, so a level is exposed with a resolution divisor of two to the power
+of the level. Only the hit marker in the fourth channel of the accumulation
+is the maximum of the pixels instead of their sum.
+
+Files carry the accumulation, the noise sums if there are any, the ray
+count, the seed and random stream, and the scene file text, which is enough
+to merge files and expose them again later. Rows go from the bottom up, like
+the textures of the simulation engine, and regions are given in those
+coordinates. Files are written to a temporary file that replaces the old
+file once it is complete.
+*/
+void writeAccumulationFile(const std::string &filename, const RawImage &image, unsigned int tileSize = 64, bool compressed = true);
+
+/*
+Merges accumulation files of the same scene and size, such as the shards of
+a render, into one image with the sum of their accumulations, noise sums and
+ray counts. Sums are taken in double precision and rounded once at the
+end. The noise is left out unless every file has it, and the scene file
+text comes from the first file. Throws std::runtime_error for files that do
+not match, that were split into a
+different number of random streams, or that share a seed and stream and so
+repeat each other's rays. The result is stream 0 of 1 if the files hold
+every stream of one seed, and otherwise has the seed and stream of the
+first file.
+*/
+RawImage mergeAccumulationFiles(const std::vector<std::string> &filenames);
+
+class MappedFile;
+
+/*
+Reads accumulation files through a memory map, decoding only the tiles
+that are needed. Throws std::runtime_error for missing or damaged files,
+and for regions outside the image.
+*/
+class AccumulationFileReader
+{
+public:
+    explicit AccumulationFileReader(const std::string &filename);
+    ~AccumulationFileReader();
+
+    unsigned int getLevelCount() const;
+    unsigned int getWidth(unsigned int level = 0) const;
+    unsigned int getHeight(unsigned int level = 0) const;
+    unsigned int getTileSize() const;
+    bool hasNoise() const;
+    unsigned long long getRayCount() const;
+    std::uint32_t getSeed() const;
+    unsigned int getRandomStreamIndex() const;
+    unsigned int getRandomStreamCount() const;
+    const std::string &getScene() const;
+
+    // Four floats per pixel, like RawImage. Noise is all zeros in files without it.
+    std::vector<float> readAccumulation(unsigned int level, unsigned int x, unsigned int y, unsigned int width, unsigned int height) const;
+    std::vector<float> readNoise(unsigned int level, unsigned int x, unsigned int y, unsigned int width, unsigned int height) const;
+
+    // A whole level, with the exposure left at zero
+    RawImage readImage(unsigned int level = 0) const;
+
+private:
+    struct Tile
+    {
+        std::uint64_t offset;
+        std::uint32_t size;
+        std::uint32_t encoding;
+    };
+
+    std::vector<float> readChannels(unsigned int level, unsigned int x, unsigned int y, unsigned int width, unsigned int height, unsigned int firstChannel) const;
+    std::vector<float> decodeTile(unsigned int level, unsigned int column, unsigned int row) const;
+    unsigned int getTileColumns(unsigned int level) const;
+    unsigned int getTileRows(unsigned int level) const;
+
+    std::string mFilename;
+    std::unique_ptr<MappedFile> mFile;
+    unsigned int mTileSize;
+    unsigned int mChannelCount;
+    unsigned long long mRayCount;
+    std::uint32_t mSeed;
+    unsigned int mRandomStreamIndex;
+    unsigned int mRandomStreamCount;
+    std::string mScene;
+    std::vector<unsigned int> mLevelWidths;
+    std::vector<unsigned int> mLevelHeights;
+    std::vector<std::size_t> mLevelFirstTiles;
+    std::vector<Tile> mTiles;
+};
+
+} // namespace HaloSim
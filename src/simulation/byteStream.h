@@ -0,0 +1,159 @@
+#pragma once
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+namespace HaloSim
+{
+
+/*
+Binary files are written and read little-endian, regardless of the machine.
+The writer collects bytes until they are written into a stream, so that
+large files can be written a piece at a time.
+*/
+class ByteWriter
+{
+public:
+    void addUint8(std::uint8_t value)
+    {
+        mBytes.push_back((char)value);
+    }
+
+    void addUint16(std::uint16_t value)
+    {
+        for (auto i = 0; i < 2; ++i)
+            addUint8((std::uint8_t)(value >> (8 * i)));
+    }
+
+    void addUint32(std::uint32_t value)
+    {
+        for (auto i = 0; i < 4; ++i)
+            addUint8((std::uint8_t)(value >> (8 * i)));
+    }
+
+    void addUint64(std::uint64_t value)
+    {
+        for (auto i = 0; i < 8; ++i)
+            addUint8((std::uint8_t)(value >> (8 * i)));
+    }
+
+    void addFloat(float value)
+    {
+        std::uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        addUint32(bits);
+    }
+
+    void addDouble(double value)
+    {
+        std::uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        addUint64(bits);
+    }
+
+    void addText(const std::string &text)
+    {
+        mBytes += text;
+    }
+
+    // Null terminated
+    void addName(const std::string &name)
+    {
+        mBytes += name;
+        mBytes.push_back('\0');
+    }
+
+    const char *getData() const
+    {
+        return mBytes.data();
+    }
+
+    std::size_t getSize() const
+    {
+        return mBytes.size();
+    }
+
+    void writeTo(std::ofstream &stream)
+    {
+        stream.write(mBytes.data(), (std::streamsize)mBytes.size());
+        mBytes.clear();
+    }
+
+private:
+    std::string mBytes;
+};
+
+// Reads what a ByteWriter wrote, and throws std::runtime_error at the end of the data
+class ByteReader
+{
+public:
+    explicit ByteReader(std::istream &stream) : mStream(stream) {}
+
+    void readBytes(char *bytes, std::size_t count)
+    {
+        mStream.read(bytes, (std::streamsize)count);
+        if ((std::size_t)mStream.gcount() != count)
+            throw std::runtime_error("Unexpected end of file");
+    }
+
+    std::uint8_t readUint8()
+    {
+        char byte;
+        readBytes(&byte, 1);
+        return (std::uint8_t)byte;
+    }
+
+    std::uint32_t readUint32()
+    {
+        std::uint32_t value = 0;
+        for (auto i = 0; i < 4; ++i)
+            value |= (std::uint32_t)readUint8() << (8 * i);
+        return value;
+    }
+
+    std::uint64_t readUint64()
+    {
+        std::uint64_t value = 0;
+        for (auto i = 0; i < 8; ++i)
+            value |= (std::uint64_t)readUint8() << (8 * i);
+        return value;
+    }
+
+    float readFloat()
+    {
+        auto bits = readUint32();
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    void readFloats(float *values, std::size_t count)
+    {
+        mBuffer.resize(count * 4);
+        readBytes(mBuffer.data(), mBuffer.size());
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            std::uint32_t bits = 0;
+            for (auto j = 0; j < 4; ++j)
+                bits |= (std::uint32_t)(std::uint8_t)mBuffer[i * 4 + j] << (8 * j);
+            std::memcpy(&values[i], &bits, sizeof(bits));
+        }
+    }
+
+    std::string readText(std::size_t length)
+    {
+        std::string text(length, '\0');
+        if (length > 0)
+            readBytes(&text[0], length);
+        return text;
+    }
+
+private:
+    std::istream &mStream;
+    std::vector<char> mBuffer;
+};
+
+} // namespace HaloSim
@@ -0,0 +1,159 @@
+#include "checkpoint.h"
+#include <fstream>
+#include <cstdio>
+#include <algorithm>
+#include <stdexcept>
+#include "byteStream.h"
+#include "hash.h"
+#include "fileReplacement.h"
+
+namespace HaloSim
+{
+
+namespace
+{
+
+const char magic[] = "HRCK";
+
+// Rows are written one at a time, so that the whole file is never held in memory twice
+void writeImage(ByteWriter &data, std::ofstream &stream, Hasher &hasher, const std::vector<float> &image, unsigned int width)
+{
+    auto rowSize = (std::size_t)width * 4;
+    for (std::size_t row = 0; row < image.size(); row += rowSize)
+    {
+        for (auto i = row; i < row + rowSize; ++i)
+            data.addFloat(image[i]);
+        hasher.addBytes(data.getData(), data.getSize());
+        data.writeTo(stream);
+    }
+}
+
+std::vector<float> readImage(ByteReader &reader, unsigned int width, unsigned int height)
+{
+    std::vector<float> image((std::size_t)width * height * 4);
+    auto rowSize = (std::size_t)width * 4;
+    for (std::size_t row = 0; row < image.size(); row += rowSize)
+        reader.readFloats(&image[row], rowSize);
+    return image;
+}
+
+} // namespace
+
+Checkpoint Checkpoint::load(const std::string &filename)
+{
+    std::ifstream stream(filename, std::ios::binary);
+    if (!stream)
+        throw std::runtime_error("Could not open " + filename);
+
+    try
+    {
+        // Sizes read from a damaged file are checked against the file before anything is allocated for them
+        stream.seekg(0, std::ios::end);
+        std::uint64_t fileSize = (std::uint64_t)stream.tellg();
+        stream.seekg(0);
+        auto checkSize = [&](std::uint64_t size) {
+            if (size > fileSize - (std::uint64_t)stream.tellg())
+                throw std::runtime_error("The checkpoint is damaged");
+        };
+
+        ByteReader reader(stream);
+        if (reader.readText(4) != magic)
+            throw std::runtime_error("Not a checkpoint file");
+        if (reader.readUint32() != formatVersion)
+            throw std::runtime_error("Unsupported checkpoint version");
+
+        Checkpoint checkpoint;
+        checkpoint.width = reader.readUint32();
+        checkpoint.height = reader.readUint32();
+        checkpoint.iteration = reader.readUint32();
+        checkpoint.rayCount = reader.readUint64();
+        checkpoint.randomCounter = reader.readUint64();
+        checkpoint.randomStreamIndex = reader.readUint32();
+        checkpoint.randomStreamCount = reader.readUint32();
+        for (auto text : {&checkpoint.backend, &checkpoint.scene})
+        {
+            auto length = reader.readUint32();
+            checkSize(length);
+            *text = reader.readText(length);
+        }
+        bool hasNoise = reader.readUint8() != 0;
+
+        const unsigned int maxSize = 65536;
+        if (checkpoint.width == 0 || checkpoint.height == 0 || checkpoint.width > maxSize || checkpoint.height > maxSize)
+            throw std::runtime_error("Invalid image size");
+        auto imageSize = (std::uint64_t)checkpoint.width * checkpoint.height * 4 * sizeof(float);
+        checkSize(imageSize * (hasNoise ? 2 : 1) + sizeof(std::uint64_t));
+        checkpoint.accumulation = readImage(reader, checkpoint.width, checkpoint.height);
+        if (hasNoise)
+            checkpoint.noise = readImage(reader, checkpoint.width, checkpoint.height);
+
+        // The checksum covers everything before it
+        auto checksumOffset = stream.tellg();
+        auto checksum = reader.readUint64();
+        stream.seekg(0);
+        Hasher hasher;
+        std::vector<char> buffer(1 << 20);
+        for (std::streamoff remaining = checksumOffset; remaining > 0;)
+        {
+            auto count = (std::size_t)std::min<std::streamoff>(remaining, (std::streamoff)buffer.size());
+            reader.readBytes(buffer.data(), count);
+            hasher.addBytes(buffer.data(), count);
+            remaining -= (std::streamoff)count;
+        }
+        if (hasher.getHash() != checksum)
+            throw std::runtime_error("The checkpoint is damaged");
+        return checkpoint;
+    }
+    catch (const std::runtime_error &e)
+    {
+        throw std::runtime_error(filename + ": " + e.what());
+    }
+}
+
+void Checkpoint::save(const std::string &filename) const
+{
+    auto size = (std::size_t)width * height * 4;
+    if (width == 0 || height == 0 || accumulation.size() != size || (!noise.empty() && noise.size() != size))
+        throw std::runtime_error("Invalid image size");
+
+    auto temporaryFilename = filename + ".tmp";
+    std::ofstream stream(temporaryFilename, std::ios::binary);
+    if (!stream)
+        throw std::runtime_error("Could not open " + temporaryFilename);
+
+    Hasher hasher;
+    ByteWriter data;
+    data.addText(magic);
+    data.addUint32(formatVersion);
+    data.addUint32(width);
+    data.addUint32(height);
+    data.addUint32(iteration);
+    data.addUint64(rayCount);
+    data.addUint64(randomCounter);
+    data.addUint32(randomStreamIndex);
+    data.addUint32(randomStreamCount);
+    data.addUint32((std::uint32_t)backend.size());
+    data.addText(backend);
+    data.addUint32((std::uint32_t)scene.size());
+    data.addText(scene);
+    data.addUint8(noise.empty() ? 0 : 1);
+    hasher.addBytes(data.getData(), data.getSize());
+    data.writeTo(stream);
+
+    writeImage(data, stream, hasher, accumulation, width);
+    if (!noise.empty())
+        writeImage(data, stream, hasher, noise, width);
+    data.addUint64(hasher.getHash());
+    data.writeTo(stream);
+
+    stream.close();
+    if (!stream)
+    {
+        std::remove(temporaryFilename.c_str());
+        throw std::runtime_error("Could not write " + temporaryFilename);
+    }
+    syncToDisk(temporaryFilename);
+    replaceFile(temporaryFilename, filename);
+}
+
+} // namespace HaloSim
@@ -0,0 +1,48 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace HaloSim
+{
+
+/*
+Everything needed to continue a simulation exactly where it stopped: the
+scene file text, the accumulation and noise images, and the iteration, ray
+count and random counter of the simulator that made them. The random
+counter is the number of random seeds the simulator has drawn since it was
+seeded, and the random stream tells which of them were its own when the
+seeds were shared between shards. Images have four floats per pixel, bottom
+row first, and the noise image may be empty.
+
+Checkpoint files are binary and end in a checksum, so that a file cut short
+by a crash is noticed when it is loaded.
+*/
+struct Checkpoint
+{
+    static const std::uint32_t formatVersion = 1;
+
+    std::string backend;
+    std::string scene;
+    unsigned int width;
+    unsigned int height;
+    unsigned int iteration;
+    unsigned long long rayCount;
+    std::uint64_t randomCounter;
+    unsigned int randomStreamIndex;
+    unsigned int randomStreamCount;
+    std::vector<float> accumulation;
+    std::vector<float> noise;
+
+    // Throws std::runtime_error for missing, damaged or unsupported files
+    static Checkpoint load(const std::string &filename);
+
+    /*
+    Writes the file next to its destination and renames it over the
+    destination once it is complete and flushed to disk, so that a crash
+    leaves either the previous checkpoint or the new one.
+    */
+    void save(const std::string &filename) const;
+};
+
+} // namespace HaloSim
@@ -0,0 +1,638 @@
+#include "cpuSimulator.h"
+#include <cmath>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+
+namespace HaloSim
+{
+
+namespace
+{
+
+const float pi = 3.1415926535f;
+const unsigned int chunkSize = 16384;
+const int maxBounces = 10;
+const unsigned int maxTriangles = 32;
+
+struct Vec3
+{
+    float x, y, z;
+
+    Vec3 operator+(const Vec3 &o) const { return {x + o.x, y + o.y, z + o.z}; }
+    Vec3 operator-(const Vec3 &o) const { return {x - o.x, y - o.y, z - o.z}; }
+    Vec3 operator-() const { return {-x, -y, -z}; }
+    Vec3 operator*(float s) const { return {x * s, y * s, z * s}; }
+};
+
+Vec3 operator*(float s, const Vec3 &v) { return v * s; }
+float dot(const Vec3 &a, const Vec3 &b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+float length(const Vec3 &v) { return std::sqrt(dot(v, v)); }
+Vec3 normalize(const Vec3 &v) { return v * (1.0f / length(v)); }
+
+Vec3 cross(const Vec3 &a, const Vec3 &b)
+{
+    return {a.y * b.z - a.z * b.y,
+            a.z * b.x - a.x * b.z,
+            a.x * b.y - a.y * b.x};
+}
+
+Vec3 reflect(const Vec3 &i, const Vec3 &n)
+{
+    return i - 2.0f * dot(n, i) * n;
+}
+
+Vec3 refract(const Vec3 &i, const Vec3 &n, float eta)
+{
+    float k = 1.0f - eta * eta * (1.0f - dot(n, i) * dot(n, i));
+    if (k < 0.0f)
+        return {0.0f, 0.0f, 0.0f};
+    return eta * i - (eta * dot(n, i) + std::sqrt(k)) * n;
+}
+
+// Column major, like the matrices of the simulation shaders
+struct Mat3
+{
+    Vec3 columns[3];
+
+    Vec3 operator*(const Vec3 &v) const
+    {
+        return columns[0] * v.x + columns[1] * v.y + columns[2] * v.z;
+    }
+
+    Mat3 operator*(const Mat3 &m) const
+    {
+        return {{*this * m.columns[0], *this * m.columns[1], *this * m.columns[2]}};
+    }
+};
+
+// Row vector times matrix, which multiplies with the transpose
+Vec3 operator*(const Vec3 &v, const Mat3 &m)
+{
+    return {dot(v, m.columns[0]), dot(v, m.columns[1]), dot(v, m.columns[2])};
+}
+
+Mat3 rotateAroundX(float angle)
+{
+    float c = std::cos(angle), s = std::sin(angle);
+    return {{{1.0f, 0.0f, 0.0f}, {0.0f, c, s}, {0.0f, -s, c}}};
+}
+
+Mat3 rotateAroundY(float angle)
+{
+    float c = std::cos(angle), s = std::sin(angle);
+    return {{{c, 0.0f, -s}, {0.0f, 1.0f, 0.0f}, {s, 0.0f, c}}};
+}
+
+Mat3 rotateAroundZ(float angle)
+{
+    float c = std::cos(angle), s = std::sin(angle);
+    return {{{c, s, 0.0f}, {-s, c, 0.0f}, {0.0f, 0.0f, 1.0f}}};
+}
+
+float radians(float degrees)
+{
+    return degrees * pi / 180.0f;
+}
+
+std::uint32_t wangHash(std::uint32_t a)
+{
+    a -= (a << 6);
+    a ^= (a >> 17);
+    a -= (a << 9);
+    a ^= (a << 4);
+    a -= (a << 3);
+    a ^= (a << 10);
+    a ^= (a >> 15);
+    return a;
+}
+
+class RandomSequence
+{
+public:
+    explicit RandomSequence(std::uint32_t seed) : mState(wangHash(seed)) {}
+
+    float rand()
+    {
+        mState ^= (mState << 13);
+        mState ^= (mState >> 17);
+        mState ^= (mState << 5);
+        return (float)mState / 4294967295.0f;
+    }
+
+    float randn()
+    {
+        float u1 = std::sqrt(-2.0f * std::log(rand()));
+        float u2 = 2.0f * pi * rand();
+        return u1 * std::cos(u2);
+    }
+
+private:
+    std::uint32_t mState;
+};
+
+float xFit1931(float wave)
+{
+    float t1 = (wave - 442.0f) * ((wave < 442.0f) ? 0.0624f : 0.0374f);
+    float t2 = (wave - 599.8f) * ((wave < 599.8f) ? 0.0264f : 0.0323f);
+    float t3 = (wave - 501.1f) * ((wave < 501.1f) ? 0.0490f : 0.0382f);
+    return 0.362f * std::exp(-0.5f * t1 * t1) + 1.056f * std::exp(-0.5f * t2 * t2) - 0.065f * std::exp(-0.5f * t3 * t3);
+}
+
+float yFit1931(float wave)
+{
+    float t1 = (wave - 568.8f) * ((wave < 568.8f) ? 0.0213f : 0.0247f);
+    float t2 = (wave - 530.9f) * ((wave < 530.9f) ? 0.0613f : 0.0322f);
+    return 0.821f * std::exp(-0.5f * t1 * t1) + 0.286f * std::exp(-0.5f * t2 * t2);
+}
+
+float zFit1931(float wave)
+{
+    float t1 = (wave - 437.0f) * ((wave < 437.0f) ? 0.0845f : 0.0278f);
+    float t2 = (wave - 459.0f) * ((wave < 459.0f) ? 0.0385f : 0.0725f);
+    return 1.217f * std::exp(-0.5f * t1 * t1) + 0.681f * std::exp(-0.5f * t2 * t2);
+}
+
+float getReflectionCoefficient(const Vec3 &normal, const Vec3 &rayDir, float n0, float n1)
+{
+    float incidentAngle = std::acos(std::min(1.0f, std::max(-1.0f, dot(-rayDir, normal))));
+    if (n1 / n0 < std::sin(incidentAngle))
+        return 1.0f;
+    float transmittedAngle = std::asin(n0 * std::sin(incidentAngle) / n1);
+    float incidentCos = std::cos(incidentAngle);
+    float transmittedCos = std::cos(transmittedAngle);
+    float rs = (n0 * incidentCos - n1 * transmittedCos) / (n0 * incidentCos + n1 * transmittedCos);
+    float rp = (n0 * transmittedCos - n1 * incidentCos) / (n0 * transmittedCos + n1 * incidentCos);
+    return 0.5f * (rs * rs + rp * rp);
+}
+
+// Crystal geometry interpolated between two bins of a geometry table
+class CrystalGeometry
+{
+public:
+    CrystalGeometry(const CrystalGeometryTable &table, float caMultiplier)
+        : mData(table.getData()),
+          mTriangleCount(table.getTriangleCount())
+    {
+        float bin = (std::max(0.0f, caMultiplier) - table.getCaRatioMin()) / table.getCaRatioStep();
+        int firstBin = std::min(std::max((int)std::floor(bin), 0), (int)CrystalGeometryTable::binCount - 2);
+        unsigned int binSize = mTriangleCount * CrystalGeometryTable::attributesPerTriangle * 4;
+        mOffsets[0] = firstBin * binSize;
+        mOffsets[1] = mOffsets[0] + binSize;
+        mWeight = bin - (float)firstBin;
+    }
+
+    unsigned int getTriangleCount() const { return mTriangleCount; }
+
+    Vec3 getAttribute(unsigned int triangle, unsigned int attribute, float *w = nullptr) const
+    {
+        auto index = (triangle * CrystalGeometryTable::attributesPerTriangle + attribute) * 4;
+        const float *a = &mData[mOffsets[0] + index];
+        const float *b = &mData[mOffsets[1] + index];
+        if (w != nullptr)
+            *w = a[3] + (b[3] - a[3]) * mWeight;
+        return {a[0] + (b[0] - a[0]) * mWeight,
+                a[1] + (b[1] - a[1]) * mWeight,
+                a[2] + (b[2] - a[2]) * mWeight};
+    }
+
+    Vec3 getNormal(unsigned int triangle) const
+    {
+        return normalize(getAttribute(triangle, 3));
+    }
+
+private:
+    const std::vector<float> &mData;
+    unsigned int mTriangleCount;
+    unsigned int mOffsets[2];
+    float mWeight;
+};
+
+class RayTracer
+{
+public:
+    RayTracer(const Scene &scene, const CrystalPopulation &population, const CrystalGeometryTable &table, RandomSequence &random)
+        : mScene(scene),
+          mPopulation(population),
+          mRandom(random),
+          mGeometry(table, population.caRatioAverage + random.randn() * population.caRatioStd)
+    {
+    }
+
+    // Random numbers are drawn in the same order as in the simulation shader
+    bool traceRay(float &wavelength, Vec3 &resultRay)
+    {
+        Vec3 rayDirection = -sampleSun(radians(mScene.light.altitude));
+        wavelength = 400.0f + mRandom.rand() * 300.0f;
+
+        Mat3 rotationMatrix = getRotationMatrix();
+        resultRay = castRayThroughCrystal(rayDirection * rotationMatrix, wavelength);
+        if (length(resultRay) < 0.0001f)
+            return false;
+        resultRay = rotationMatrix * resultRay;
+
+        float multipleScatter = mScene.multipleScatteringProbability;
+        if (multipleScatter != 0.0f && multipleScatter > mRandom.rand())
+        {
+            rotationMatrix = getRotationMatrix();
+            resultRay = castRayThroughCrystal(resultRay * rotationMatrix, wavelength);
+            if (length(resultRay) < 0.0001f)
+                return false;
+            resultRay = rotationMatrix * resultRay;
+        }
+        return true;
+    }
+
+private:
+    Vec3 sampleSun(float altitude)
+    {
+        Vec3 sunCenterDirection = {0.0f, std::sin(altitude), std::cos(altitude)};
+        Vec3 diskBasis0 = {1.0f, 0.0f, 0.0f};
+        Vec3 diskBasis1 = cross(sunCenterDirection, diskBasis0);
+        float sampleAngle = mRandom.rand() * 2.0f * pi;
+        float sampleDistance = std::sqrt(mRandom.rand()) * 0.5f * radians(mScene.light.diameter);
+        Vec3 offset = sampleDistance * (std::sin(sampleAngle) * diskBasis0 + std::cos(sampleAngle) * diskBasis1);
+        return normalize(sunCenterDirection + offset);
+    }
+
+    Mat3 getUniformRandomRotationMatrix()
+    {
+        // From Fast Random Rotation Matrices, by James Arvo
+        float theta = 2.0f * pi * mRandom.rand();
+        float phi = 2.0f * pi * mRandom.rand();
+        float z = mRandom.rand();
+        Mat3 zRotationMatrix = {{{std::cos(theta), -std::sin(theta), 0.0f}, {std::sin(theta), std::cos(theta), 0.0f}, {0.0f, 0.0f, 1.0f}}};
+        Vec3 v = {std::cos(phi) * std::sqrt(z), std::sin(phi) * std::sqrt(z), std::sqrt(1.0f - z)};
+        Mat3 householder = {{2.0f * v.x * v - Vec3{1.0f, 0.0f, 0.0f},
+                             2.0f * v.y * v - Vec3{0.0f, 1.0f, 0.0f},
+                             2.0f * v.z * v - Vec3{0.0f, 0.0f, 1.0f}}};
+        return householder * zRotationMatrix;
+    }
+
+    Mat3 getRotationMatrix()
+    {
+        const auto &crystal = mPopulation;
+        if (crystal.tiltDistribution == 0 && crystal.rotationDistribution == 0)
+            return getUniformRandomRotationMatrix();
+
+        Mat3 tiltMatrix = crystal.tiltDistribution == 0
+                              ? rotateAroundZ(mRandom.rand() * 2.0f * pi)
+                              : rotateAroundZ(radians(crystal.tiltAverage + crystal.tiltStd * mRandom.randn()));
+        Mat3 rotationMatrix = crystal.rotationDistribution == 0
+                                  ? rotateAroundY(mRandom.rand() * 2.0f * pi)
+                                  : rotateAroundY(radians(crystal.rotationAverage + crystal.rotationStd * mRandom.randn()));
+        return rotateAroundY(mRandom.rand() * 2.0f * pi) * tiltMatrix * rotationMatrix;
+    }
+
+    unsigned int selectFirstTriangle(const CrystalGeometry &geometry, const Vec3 &rayDirection)
+    {
+        float projectedAreas[maxTriangles];
+        float sumProjectedAreas = 0.0f;
+        for (auto i = 0u; i < geometry.getTriangleCount(); ++i)
+        {
+            float area;
+            Vec3 normal = geometry.getAttribute(i, 3, &area);
+            projectedAreas[i] = std::max(0.0f, area * dot(normal, rayDirection));
+            sumProjectedAreas += projectedAreas[i];
+        }
+
+        float selector = mRandom.rand() * sumProjectedAreas;
+        for (auto i = 0u; i < geometry.getTriangleCount(); ++i)
+        {
+            selector -= projectedAreas[i];
+            if (selector < 0.0f)
+                return i;
+        }
+        return 0;
+    }
+
+    Vec3 sampleTriangle(const CrystalGeometry &geometry, unsigned int triangle)
+    {
+        float u = mRandom.rand();
+        float v = mRandom.rand();
+        if (u + v > 1.0f)
+        {
+            u = 1.0f - u;
+            v = 1.0f - v;
+        }
+        return geometry.getAttribute(triangle, 0) + u * geometry.getAttribute(triangle, 1) + v * geometry.getAttribute(triangle, 2);
+    }
+
+    Vec3 castRayThroughCrystal(Vec3 rayDirection, float wavelength)
+    {
+        const auto &geometry = mGeometry;
+        float indexOfRefraction = 1.3203f - 0.0000333f * wavelength;
+
+        // Enter the crystal, or reflect off it
+        unsigned int triangle = selectFirstTriangle(geometry, rayDirection);
+        Vec3 rayOrigin = sampleTriangle(geometry, triangle);
+        Vec3 normal = -geometry.getNormal(triangle);
+        if (mRandom.rand() < getReflectionCoefficient(normal, rayDirection, 1.0f, indexOfRefraction))
+            return reflect(rayDirection, normal);
+        rayDirection = refract(rayDirection, normal, 1.0f / indexOfRefraction);
+
+        for (int i = 0; i < maxBounces; ++i)
+        {
+            unsigned int hitTriangle;
+            Vec3 hitPoint;
+            if (!findIntersection(geometry, rayOrigin, rayDirection, hitTriangle, hitPoint))
+                break;
+
+            normal = geometry.getNormal(hitTriangle);
+            if (mRandom.rand() < getReflectionCoefficient(normal, rayDirection, indexOfRefraction, 1.0f))
+            {
+                rayOrigin = hitPoint;
+                rayDirection = reflect(rayDirection, normal);
+                continue;
+            }
+            return refract(rayDirection, normal, indexOfRefraction);
+        }
+        return {0.0f, 0.0f, 0.0f};
+    }
+
+    bool findIntersection(const CrystalGeometry &geometry, const Vec3 &rayOrigin, const Vec3 &rayDirection, unsigned int &hitTriangle, Vec3 &hitPoint)
+    {
+        for (auto i = 0u; i < geometry.getTriangleCount(); ++i)
+        {
+            Vec3 v0 = geometry.getAttribute(i, 0);
+            Vec3 v0v1 = geometry.getAttribute(i, 1);
+            Vec3 v0v2 = geometry.getAttribute(i, 2);
+
+            Vec3 pVec = cross(rayDirection, v0v2);
+            float determinant = dot(v0v1, pVec);
+            if (determinant < 0.000001f)
+                continue;
+
+            Vec3 tVec = rayOrigin - v0;
+            float u = dot(tVec, pVec);
+            if (u < 0.0f || u > determinant)
+                continue;
+
+            Vec3 qVec = cross(tVec, v0v1);
+            float v = dot(rayDirection, qVec);
+            if (v < 0.0f || u + v > determinant)
+                continue;
+
+            float t = dot(v0v2, qVec) / determinant;
+            hitTriangle = i;
+            hitPoint = rayOrigin + t * rayDirection;
+            return true;
+        }
+        return false;
+    }
+
+    const Scene &mScene;
+    const CrystalPopulation &mPopulation;
+    RandomSequence &mRandom;
+    CrystalGeometry mGeometry;
+};
+
+bool projectToPixel(const Camera &camera, unsigned int width, unsigned int height, Vec3 resultRay, unsigned int &pixel)
+{
+    if (camera.hideSubHorizon && resultRay.y > 0.0f)
+        return false;
+
+    resultRay = -((rotateAroundX(radians(camera.pitch)) * rotateAroundY(radians(camera.yaw))) * resultRay);
+
+    float aspectRatio = (float)height / (float)width;
+    float polarR = std::acos(std::min(1.0f, std::max(-1.0f, resultRay.z)));
+    float polarAngle = std::atan2(resultRay.y, resultRay.x);
+
+    float fovRadians = radians(camera.fov);
+    float fr;
+    float fovNormalizer;
+    switch (camera.projection)
+    {
+    case Rectilinear:
+        if (polarR > 0.5f * pi)
+            return false;
+        fr = std::tan(polarR);
+        fovNormalizer = 0.5f / std::tan(fovRadians / 2.0f);
+        break;
+    case Equidistant:
+        fr = polarR;
+        fovNormalizer = 1.0f / fovRadians;
+        break;
+    case EqualArea:
+        fr = 2.0f * std::sin(polarR / 2.0f);
+        fovNormalizer = 1.0f / (4.0f * std::sin(fovRadians / 4.0f));
+        break;
+    case Orthographic:
+        if (polarR > 0.5f * pi)
+            return false;
+        fr = std::sin(polarR);
+        fovNormalizer = 0.5f / std::sin(fovRadians / 2.0f);
+        break;
+    default:
+        fr = 2.0f * std::tan(polarR / 2.0f);
+        fovNormalizer = 1.0f / (4.0f * std::tan(fovRadians / 4.0f));
+        break;
+    }
+
+    float u = 0.5f + fovNormalizer * fr * aspectRatio * std::cos(polarAngle);
+    float v = 0.5f + fovNormalizer * fr * std::sin(polarAngle);
+    if (u <= 0.0f || v <= 0.0f || u >= 1.0f || v >= 1.0f)
+        return false;
+
+    unsigned int x = std::min(width - 1, (unsigned int)(width * u));
+    unsigned int y = std::min(height - 1, (unsigned int)(height * v));
+    pixel = y * width + x;
+    return true;
+}
+
+} // namespace
+
+CpuSimulator::CpuSimulator(const Scene &scene, unsigned int width, unsigned int height, unsigned int threadCount)
+    : mScene(scene),
+      mWidth(width),
+      mHeight(height),
+      mThreadCount(threadCount > 0 ? threadCount : std::max(1u, std::thread::hardware_concurrency())),
+      mSeed(std::random_device()()),
+      mMersenneTwister(mSeed),
+      mRandomCounter(0),
+      mStreamIndex(0),
+      mStreamCount(1),
+      mIteration(0),
+      mRayCount(0)
+{
+    for (const auto &population : mScene.crystals)
+        mGeometryTables.emplace_back(population);
+    clear();
+}
+
+void CpuSimulator::setSeed(std::uint32_t seed)
+{
+    mSeed = seed;
+    mMersenneTwister.seed(seed);
+    mRandomCounter = 0;
+}
+
+void CpuSimulator::setRandomStream(unsigned int index, unsigned int count)
+{
+    if (count == 0 || index >= count)
+        throw std::runtime_error("Invalid random stream");
+    mStreamIndex = index;
+    mStreamCount = count;
+}
+
+std::uint32_t CpuSimulator::nextRandomSeed()
+{
+    mMersenneTwister.discard(mStreamIndex);
+    auto seed = (std::uint32_t)mMersenneTwister();
+    mMersenneTwister.discard(mStreamCount - 1 - mStreamIndex);
+    mRandomCounter += mStreamCount;
+    return seed;
+}
+
+void CpuSimulator::clear()
+{
+    mAccumulation.assign((std::size_t)mWidth * mHeight * 4, 0.0f);
+    mNoise.assign((std::size_t)mWidth * mHeight * 4, 0.0f);
+    mIteration = 0;
+    mRayCount = 0;
+}
+
+void CpuSimulator::restore(unsigned int iteration, unsigned long long rayCount, std::uint64_t randomCounter, std::vector<float> accumulation, std::vector<float> noise)
+{
+    auto size = (std::size_t)mWidth * mHeight * 4;
+    if (accumulation.size() != size || noise.size() != size)
+        throw std::runtime_error("The images do not match the size of the simulation");
+
+    mAccumulation = std::move(accumulation);
+    mNoise = std::move(noise);
+    mIteration = iteration;
+    mRayCount = rayCount;
+
+    // Each seed is a single draw, so the generator can be wound forward to the same state
+    mMersenneTwister.seed(mSeed);
+    mMersenneTwister.discard(randomCounter);
+    mRandomCounter = randomCounter;
+}
+
+void CpuSimulator::traceChunk(unsigned int population, std::uint32_t seed, unsigned int firstRay, unsigned int rayCount, std::vector<Hit> &hits) const
+{
+    for (auto ray = firstRay; ray < firstRay + rayCount; ++ray)
+    {
+        RandomSequence random(seed + ray);
+        RayTracer tracer(mScene, mScene.crystals[population], mGeometryTables[population], random);
+
+        float wavelength;
+        Vec3 resultRay;
+        if (!tracer.traceRay(wavelength, resultRay))
+            continue;
+
+        unsigned int pixel;
+        if (!projectToPixel(mScene.camera, mWidth, mHeight, resultRay, pixel))
+            continue;
+
+        float daylight = 1.0f - 0.0013333f * wavelength;
+        hits.push_back({pixel, {daylight * xFit1931(wavelength), daylight * yFit1931(wavelength), daylight * zFit1931(wavelength)}});
+    }
+}
+
+/*
+Splits the rays between the crystal populations in proportion to their
+weights, like the simulation engine does
+*/
+void CpuSimulator::step(unsigned int rays)
+{
+    struct Chunk
+    {
+        unsigned int population;
+        std::uint32_t seed;
+        unsigned int firstRay;
+        unsigned int rayCount;
+        std::vector<Hit> hits;
+    };
+
+    // Rounding the running total of the rays makes the step trace exactly its number of rays
+    std::vector<Chunk> chunks;
+    double cumulativeProbability = 0.0;
+    for (auto i = 0u; i < mScene.crystals.size(); ++i)
+    {
+        auto firstPopulationRay = std::llround(rays * cumulativeProbability);
+        cumulativeProbability += mScene.getCrystalProbability(i);
+        auto populationRays = (unsigned int)(std::min<long long>(rays, std::llround(rays * cumulativeProbability)) - firstPopulationRay);
+        auto seed = nextRandomSeed();
+        for (auto firstRay = 0u; firstRay < populationRays; firstRay += chunkSize)
+            chunks.push_back({i, seed, firstRay, std::min(chunkSize, populationRays - firstRay), {}});
+        mRayCount += populationRays;
+    }
+
+    std::atomic<std::size_t> nextChunk(0);
+    auto worker = [&]() {
+        for (auto chunk = nextChunk++; chunk < chunks.size(); chunk = nextChunk++)
+            traceChunk(chunks[chunk].population, chunks[chunk].seed, chunks[chunk].firstRay, chunks[chunk].rayCount, chunks[chunk].hits);
+    };
+    std::vector<std::thread> threads;
+    for (auto i = 1u; i < mThreadCount; ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &thread : threads)
+        thread.join();
+
+    for (const auto &chunk : chunks)
+    {
+        for (const auto &hit : chunk.hits)
+        {
+            auto pixel = (std::size_t)hit.pixel * 4;
+            mAccumulation[pixel] += hit.color[0];
+            mAccumulation[pixel + 1] += hit.color[1];
+            mAccumulation[pixel + 2] += hit.color[2];
+            mAccumulation[pixel + 3] = 1.0f;
+            mNoise[pixel] += hit.color[1] * hit.color[1];
+            mNoise[pixel + 1] += 1.0f;
+        }
+    }
+    ++mIteration;
+}
+
+unsigned int CpuSimulator::getWidth() const
+{
+    return mWidth;
+}
+
+unsigned int CpuSimulator::getHeight() const
+{
+    return mHeight;
+}
+
+unsigned int CpuSimulator::getIteration() const
+{
+    return mIteration;
+}
+
+unsigned long long CpuSimulator::getRayCount() const
+{
+    return mRayCount;
+}
+
+std::uint64_t CpuSimulator::getRandomCounter() const
+{
+    return mRandomCounter;
+}
+
+const std::vector<float> &CpuSimulator::getAccumulation() const
+{
+    return mAccumulation;
+}
+
+const std::vector<float> &CpuSimulator::getNoise() const
+{
+    return mNoise;
+}
+
+double CpuSimulator::getNoiseEstimate() const
+{
+    double errorSum = 0.0;
+    double luminanceSum = 0.0;
+    for (std::size_t pixel = 0; pixel < mAccumulation.size(); pixel += 4)
+    {
+        errorSum += std::sqrt(mNoise[pixel]);
+        luminanceSum += mAccumulation[pixel + 1];
+    }
+    return luminanceSum > 0.0 ? errorSum / luminanceSum : -1.0;
+}
+
+} // namespace HaloSim
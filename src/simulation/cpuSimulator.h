@@ -0,0 +1,86 @@
+#pragma once
+#include <vector>
+#include <random>
+#include <cstdint>
+#include "scene.h"
+#include "crystalGeometryTable.h"
+
+namespace HaloSim
+{
+
+/*
+Traces the rays of a scene on the CPU, with the same model as the single
+pass simulation shader, for machines without a suitable GPU. Rays are
+traced in fixed size chunks on all cores and accumulated in the order of the
+chunks, so that a given seed gives the same image regardless of the number
+of threads.
+
+The accumulation has four floats per pixel, XYZ colors and a constant one,
+and the noise image has the sums of squared luminance and the ray counts of
+the pixels, like the textures of the simulation engine.
+*/
+class CpuSimulator
+{
+public:
+    CpuSimulator(const Scene &scene, unsigned int width, unsigned int height, unsigned int threadCount = 0);
+
+    void setSeed(std::uint32_t seed);
+
+    /*
+    Deals the random seeds of a seed out to several simulators like cards,
+    so that the shards of a render never share a seed. This simulator then
+    only uses every count-th seed, starting from the index-th.
+    */
+    void setRandomStream(unsigned int index, unsigned int count);
+
+    void step(unsigned int rays);
+    void clear();
+
+    /*
+    Continues a simulation of the same scene and seed from the iteration, ray
+    count, random counter and images it had earlier. Throws
+    std::runtime_error if the images do not fit the simulator.
+    */
+    void restore(unsigned int iteration, unsigned long long rayCount, std::uint64_t randomCounter, std::vector<float> accumulation, std::vector<float> noise);
+
+    unsigned int getWidth() const;
+    unsigned int getHeight() const;
+    unsigned int getIteration() const;
+    unsigned long long getRayCount() const;
+
+    // Number of random seeds drawn since the simulator was seeded, including those of other streams
+    std::uint64_t getRandomCounter() const;
+
+    const std::vector<float> &getAccumulation() const;
+    const std::vector<float> &getNoise() const;
+
+    // Same estimate as the noise tracking of the simulation engine
+    double getNoiseEstimate() const;
+
+private:
+    struct Hit
+    {
+        unsigned int pixel;
+        float color[3];
+    };
+
+    std::uint32_t nextRandomSeed();
+    void traceChunk(unsigned int population, std::uint32_t seed, unsigned int firstRay, unsigned int rayCount, std::vector<Hit> &hits) const;
+
+    Scene mScene;
+    unsigned int mWidth;
+    unsigned int mHeight;
+    unsigned int mThreadCount;
+    std::vector<CrystalGeometryTable> mGeometryTables;
+    std::uint32_t mSeed;
+    std::mt19937 mMersenneTwister;
+    std::uint64_t mRandomCounter;
+    unsigned int mStreamIndex;
+    unsigned int mStreamCount;
+    std::vector<float> mAccumulation;
+    std::vector<float> mNoise;
+    unsigned int mIteration;
+    unsigned long long mRayCount;
+};
+
+} // namespace HaloSim
@@ -0,0 +1,172 @@
+#include "crystalGeometryTable.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace HaloSim
+{
+
+namespace
+{
+
+struct Vector3
+{
+    float x, y, z;
+
+    Vector3 operator-(const Vector3 &other) const
+    {
+        return {x - other.x, y - other.y, z - other.z};
+    }
+
+    Vector3 cross(const Vector3 &other) const
+    {
+        return {y * other.z - z * other.y,
+                z * other.x - x * other.z,
+                x * other.y - y * other.x};
+    }
+
+    float length() const
+    {
+        return std::sqrt(x * x + y * y + z * z);
+    }
+};
+
+// Hexagonal prism with the C-axis along the Y-axis and a C/A ratio of 1
+const std::array<Vector3, 12> hexagonalPrismVertices = {{
+    {0.0f, 1.0f, 1.0f},
+    {-0.8660254038f, 1.0f, 0.5f},
+    {-0.8660254038f, 1.0f, -0.5f},
+    {0.0f, 1.0f, -1.0f},
+    {0.8660254038f, 1.0f, -0.5f},
+    {0.8660254038f, 1.0f, 0.5f},
+
+    {0.0f, -1.0f, 1.0f},
+    {-0.8660254038f, -1.0f, 0.5f},
+    {-0.8660254038f, -1.0f, -0.5f},
+    {0.0f, -1.0f, -1.0f},
+    {0.8660254038f, -1.0f, -0.5f},
+    {0.8660254038f, -1.0f, 0.5f},
+}};
+
+const std::array<std::array<unsigned int, 3>, 20> hexagonalPrismTriangles = {{
+    // Face 1 (basal)
+    {{0, 1, 3}},
+    {{1, 2, 3}},
+    {{0, 3, 4}},
+    {{0, 4, 5}},
+
+    // Face 2 (basal)
+    {{6, 9, 7}},
+    {{7, 9, 8}},
+    {{6, 10, 9}},
+    {{6, 11, 10}},
+
+    // Face 3 (prism)
+    {{0, 6, 1}},
+    {{6, 7, 1}},
+
+    // Face 4 (prism)
+    {{1, 7, 2}},
+    {{7, 8, 2}},
+
+    // Face 5 (prism)
+    {{2, 8, 3}},
+    {{8, 9, 3}},
+
+    // Face 6 (prism)
+    {{3, 9, 4}},
+    {{9, 10, 4}},
+
+    // Face 7 (prism)
+    {{4, 10, 5}},
+    {{10, 11, 5}},
+
+    // Face 8 (prism)
+    {{5, 11, 0}},
+    {{11, 6, 0}},
+}};
+
+void appendVector(std::vector<float> &data, const Vector3 &vector, float w)
+{
+    data.push_back(vector.x);
+    data.push_back(vector.y);
+    data.push_back(vector.z);
+    data.push_back(w);
+}
+
+} // namespace
+
+CrystalGeometryTable::CrystalGeometryTable(const CrystalPopulation &population)
+{
+    // The table covers C/A ratios within four standard deviations of the average
+    const float caRatioMin = std::max(0.0f, population.caRatioAverage - 4.0f * population.caRatioStd);
+    const float caRatioMax = std::max(caRatioMin + 1.0f, population.caRatioAverage + 4.0f * population.caRatioStd);
+
+    mCaRatioMin = caRatioMin;
+    mCaRatioStep = (caRatioMax - caRatioMin) / (binCount - 1);
+
+    mData.reserve(binCount * getTriangleCount() * attributesPerTriangle * 4);
+    for (auto bin = 0u; bin < binCount; ++bin)
+    {
+        addBin(mCaRatioMin + bin * mCaRatioStep);
+    }
+}
+
+void CrystalGeometryTable::addBin(float caRatio)
+{
+    for (const auto &triangle : hexagonalPrismTriangles)
+    {
+        Vector3 v0 = hexagonalPrismVertices[triangle[0]];
+        Vector3 v1 = hexagonalPrismVertices[triangle[1]];
+        Vector3 v2 = hexagonalPrismVertices[triangle[2]];
+        v0.y *= caRatio;
+        v1.y *= caRatio;
+        v2.y *= caRatio;
+
+        Vector3 edge1 = v1 - v0;
+        Vector3 edge2 = v2 - v0;
+        Vector3 crossProduct = edge1.cross(edge2);
+        float crossProductLength = crossProduct.length();
+
+        /*
+        Triangles degenerate when the C/A ratio is zero. Their normal is taken
+        from the unscaled crystal, so that normals interpolated towards the
+        degenerate end of the table keep their length.
+        */
+        Vector3 normal = crossProduct;
+        if (crossProductLength == 0.0f)
+        {
+            auto &vertices = hexagonalPrismVertices;
+            normal = (vertices[triangle[1]] - vertices[triangle[0]]).cross(vertices[triangle[2]] - vertices[triangle[0]]);
+        }
+        float normalLength = normal.length();
+        normal = {normal.x / normalLength, normal.y / normalLength, normal.z / normalLength};
+
+        appendVector(mData, v0, 0.0f);
+        appendVector(mData, edge1, 0.0f);
+        appendVector(mData, edge2, 0.0f);
+        appendVector(mData, normal, 0.5f * crossProductLength);
+    }
+}
+
+float CrystalGeometryTable::getCaRatioMin() const
+{
+    return mCaRatioMin;
+}
+
+float CrystalGeometryTable::getCaRatioStep() const
+{
+    return mCaRatioStep;
+}
+
+unsigned int CrystalGeometryTable::getTriangleCount() const
+{
+    return static_cast<unsigned int>(hexagonalPrismTriangles.size());
+}
+
+const std::vector<float> &CrystalGeometryTable::getData() const
+{
+    return mData;
+}
+
+} // namespace HaloSim
@@ -0,0 +1,35 @@
+#pragma once
+#include <vector>
+#include "crystalPopulation.h"
+
+namespace HaloSim
+{
+
+/*
+Precomputed triangle geometry of a crystal population for a range of C/A
+ratios. For each C/A ratio bin and triangle the table holds the first vertex,
+the two edge vectors and the outward facing unit normal with the triangle area,
+each padded to four floats for the simulation shaders.
+*/
+class CrystalGeometryTable
+{
+public:
+    static const unsigned int binCount = 64;
+    static const unsigned int attributesPerTriangle = 4;
+
+    explicit CrystalGeometryTable(const CrystalPopulation &population);
+
+    float getCaRatioMin() const;
+    float getCaRatioStep() const;
+    unsigned int getTriangleCount() const;
+    const std::vector<float> &getData() const;
+
+private:
+    void addBin(float caRatio);
+
+    float mCaRatioMin;
+    float mCaRatioStep;
+    std::vector<float> mData;
+};
+
+} // namespace HaloSim
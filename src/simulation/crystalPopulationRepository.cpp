@@ -20,6 +20,12 @@ void CrystalPopulationRepository::add(CrystalPopulationPreset preset)
     mWeights.push_back(1);
 }
 
+void CrystalPopulationRepository::add(const CrystalPopulation &population, unsigned int weight)
+{
+    mCrystals.push_back(population);
+    mWeights.push_back(weight);
+}
+
 void CrystalPopulationRepository::addDefaults()
 {
     mCrystals.push_back(CrystalPopulation::presetPopulation(CrystalPopulationPreset::Column));
@@ -38,6 +44,12 @@ void CrystalPopulationRepository::remove(unsigned int index)
     mWeights.erase(mWeights.begin() + index);
 }
 
+void CrystalPopulationRepository::clear()
+{
+    mCrystals.clear();
+    mWeights.clear();
+}
+
 CrystalPopulation &CrystalPopulationRepository::get(unsigned int index)
 {
     return mCrystals[index];
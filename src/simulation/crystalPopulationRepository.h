@@ -10,7 +10,9 @@ class CrystalPopulationRepository
 public:
     CrystalPopulationRepository();
     void add(CrystalPopulationPreset preset = Random);
+    void add(const CrystalPopulation &population, unsigned int weight);
     void remove(unsigned int index);
+    void clear();
     CrystalPopulation &get(unsigned int index);
     double getProbability(unsigned int index) const;
     unsigned int getWeight(unsigned int index) const;
@@ -0,0 +1,144 @@
+#include "denoiser.h"
+#include <cmath>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+
+namespace HaloSim
+{
+
+Denoiser::Denoiser(double targetError, unsigned int maxRadius, unsigned int threadCount)
+    : mTargetError(targetError),
+      mMaxRadius(std::max(1u, maxRadius)),
+      mThreadCount(threadCount > 0 ? threadCount : std::max(1u, std::thread::hardware_concurrency()))
+{
+}
+
+// Rows are handed out to the worker threads one at a time
+void Denoiser::forEachRow(unsigned int height, const std::function<void(unsigned int)> &function) const
+{
+    std::atomic<unsigned int> nextRow(0);
+    auto worker = [&]() {
+        for (auto row = nextRow++; row < height; row = nextRow++)
+            function(row);
+    };
+
+    std::vector<std::thread> threads;
+    for (auto i = 1u; i < mThreadCount; ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &thread : threads)
+        thread.join();
+}
+
+std::vector<float> Denoiser::denoise(unsigned int width, unsigned int height, const std::vector<float> &accumulation, const std::vector<float> &noise) const
+{
+    const std::size_t pixelCount = (std::size_t)width * height;
+    if (accumulation.size() != pixelCount * 4 || noise.size() != pixelCount * 4)
+        throw std::runtime_error("Invalid denoiser image size");
+
+    /*
+    The luminances and the sums of squared luminance are prefiltered with a
+    3 x 3 box, which gives a guide image and its variance that are defined
+    even for pixels that no ray has hit yet.
+    */
+    std::vector<float> guide(pixelCount);
+    std::vector<float> guideVariance(pixelCount);
+    forEachRow(height, [&](unsigned int y) {
+        for (auto x = 0u; x < width; ++x)
+        {
+            float luminance = 0.0f;
+            float squares = 0.0f;
+            for (auto qy = std::max(1u, y) - 1; qy <= std::min(height - 1, y + 1); ++qy)
+            {
+                for (auto qx = std::max(1u, x) - 1; qx <= std::min(width - 1, x + 1); ++qx)
+                {
+                    auto q = (std::size_t)qy * width + qx;
+                    luminance += accumulation[q * 4 + 1];
+                    squares += noise[q * 4];
+                }
+            }
+            guide[(std::size_t)y * width + x] = luminance;
+            guideVariance[(std::size_t)y * width + x] = squares;
+        }
+    });
+
+    /*
+    Averaging over an area of A pixels divides the relative error by about
+    sqrt(A). The relative error of a single pixel is about three times that
+    of the 3 x 3 box around it, and a Gaussian with deviation s covers an
+    area of 4 pi s^2, which gives the deviation needed to reach the target.
+    */
+    const double pi = 3.14159265358979323846;
+    const float deviationScale = 3.0f / (float)(mTargetError * std::sqrt(4.0 * pi));
+    const float maxDeviation = 0.5f * mMaxRadius;
+    const float rangeTolerance = 2.0f;
+
+    /*
+    Deviations are rounded to steps of a quarter pixel, so that the spatial
+    weights come from precomputed one dimensional kernels
+    */
+    const unsigned int deviationSteps = 4;
+    std::vector<std::vector<float>> kernels(mMaxRadius * 2 * deviationSteps + 1);
+    for (auto i = 2u; i < kernels.size(); ++i)
+    {
+        float deviation = (float)i / deviationSteps;
+        auto radius = std::min(mMaxRadius, (unsigned int)std::ceil(2.0f * deviation));
+        for (auto d = 0u; d <= radius; ++d)
+            kernels[i].push_back(std::exp(-(float)(d * d) / (2.0f * deviation * deviation)));
+    }
+
+    std::vector<float> result(pixelCount * 4);
+    forEachRow(height, [&](unsigned int y) {
+        for (auto x = 0u; x < width; ++x)
+        {
+            auto p = (std::size_t)y * width + x;
+            float deviation = guide[p] > 0.0f ? std::min(maxDeviation, deviationScale * std::sqrt(guideVariance[p]) / guide[p]) : maxDeviation;
+            auto kernelIndex = (unsigned int)std::lround(deviation * deviationSteps);
+            if (kernelIndex < 2)
+            {
+                std::copy(&accumulation[p * 4], &accumulation[p * 4 + 4], &result[p * 4]);
+                continue;
+            }
+
+            const auto &kernel = kernels[kernelIndex];
+            auto radius = (unsigned int)kernel.size() - 1;
+            float sum[3] = {0.0f, 0.0f, 0.0f};
+            float weightSum = 0.0f;
+            for (auto qy = y - std::min(y, radius); qy <= std::min(height - 1, y + radius); ++qy)
+            {
+                float rowWeight = kernel[qy > y ? qy - y : y - qy];
+                for (auto qx = x - std::min(x, radius); qx <= std::min(width - 1, x + radius); ++qx)
+                {
+                    auto q = (std::size_t)qy * width + qx;
+                    float weight = rowWeight * kernel[qx > x ? qx - x : x - qx];
+
+                    /*
+                    The range weight approximates a Gaussian with a rational
+                    function, which is much cheaper than exp in this loop
+                    */
+                    float difference = guide[q] - guide[p];
+                    if (difference != 0.0f)
+                    {
+                        float tolerance = rangeTolerance * rangeTolerance * (guideVariance[q] + guideVariance[p]);
+                        float z = tolerance > 0.0f ? difference * difference / (2.0f * tolerance) : 1e6f;
+                        weight /= 1.0f + z * (1.0f + 0.5f * z);
+                    }
+
+                    for (auto c = 0; c < 3; ++c)
+                        sum[c] += weight * accumulation[q * 4 + c];
+                    weightSum += weight;
+                }
+            }
+
+            for (auto c = 0; c < 3; ++c)
+                result[p * 4 + c] = sum[c] / weightSum;
+            result[p * 4 + 3] = accumulation[p * 4 + 3];
+        }
+    });
+
+    return result;
+}
+
+} // namespace HaloSim
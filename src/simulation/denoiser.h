@@ -0,0 +1,36 @@
+#pragma once
+#include <vector>
+#include <functional>
+
+namespace HaloSim
+{
+
+/*
+Reduces the noise of a simulation result that has not converged yet, on the
+CPU. Each pixel is replaced by a Gaussian weighted average of its
+neighbourhood, with a width chosen from the relative error of the pixel, so
+that well sampled halos stay sharp while faint arcs are smoothed. Neighbours
+whose prefiltered luminance differs from that of the pixel by more than
+their noise explains are weighted down, which keeps the edges of halos.
+
+Images have four floats per pixel. The accumulation holds XYZ colors, and
+the noise image holds the sums of squared luminance and the ray counts of
+the pixels, so the simulation must have noise tracking on. The fourth
+channel of the accumulation is passed through for every pixel.
+*/
+class Denoiser
+{
+public:
+    explicit Denoiser(double targetError = 0.02, unsigned int maxRadius = 6, unsigned int threadCount = 0);
+
+    std::vector<float> denoise(unsigned int width, unsigned int height, const std::vector<float> &accumulation, const std::vector<float> &noise) const;
+
+private:
+    void forEachRow(unsigned int height, const std::function<void(unsigned int)> &function) const;
+
+    double mTargetError;
+    unsigned int mMaxRadius;
+    unsigned int mThreadCount;
+};
+
+} // namespace HaloSim
@@ -0,0 +1,44 @@
+#include "fileReplacement.h"
+#include <cstdio>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace HaloSim
+{
+
+void syncToDisk(const std::string &filename)
+{
+#ifndef _WIN32
+    auto file = open(filename.c_str(), O_RDONLY);
+    if (file == -1 || fsync(file) != 0)
+    {
+        if (file != -1)
+            close(file);
+        throw std::runtime_error("Could not flush " + filename);
+    }
+    close(file);
+#endif
+}
+
+void replaceFile(const std::string &source, const std::string &destination)
+{
+#ifdef _WIN32
+    bool replaced = MoveFileExA(source.c_str(), destination.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    bool replaced = std::rename(source.c_str(), destination.c_str()) == 0;
+#endif
+    if (!replaced)
+    {
+        std::remove(source.c_str());
+        throw std::runtime_error("Could not replace " + destination);
+    }
+}
+
+} // namespace HaloSim
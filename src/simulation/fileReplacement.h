@@ -0,0 +1,17 @@
+#pragma once
+#include <string>
+
+namespace HaloSim
+{
+
+/*
+Files that are written again over an older version go to a temporary file
+first, which is flushed to the disk and then renamed over the old file. A
+crash or a full disk then leaves either the old file or the new one, never
+a mix of both. Both functions throw std::runtime_error when they fail, and
+replaceFile removes the temporary file.
+*/
+void syncToDisk(const std::string &filename);
+void replaceFile(const std::string &source, const std::string &destination);
+
+} // namespace HaloSim
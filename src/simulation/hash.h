@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace HaloSim
+{
+
+// FNV-1a
+class Hasher
+{
+public:
+    template <typename T>
+    void add(T value)
+    {
+        unsigned char bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        addBytes(bytes, sizeof(T));
+    }
+
+    void add(const std::string &text)
+    {
+        add(text.size());
+        addBytes(text.data(), text.size());
+    }
+
+    void addBytes(const void *data, std::size_t count)
+    {
+        auto bytes = static_cast<const unsigned char *>(data);
+        for (std::size_t i = 0; i < count; ++i)
+            mHash = (mHash ^ bytes[i]) * 1099511628211ull;
+    }
+
+    std::uint64_t getHash() const
+    {
+        return mHash;
+    }
+
+private:
+
+    std::uint64_t mHash = 14695981039346656037ull;
+};
+
+} // namespace HaloSim
@@ -0,0 +1,236 @@
+#include "imageFile.h"
+#include <fstream>
+#include <cstring>
+#include <stdexcept>
+#include "byteStream.h"
+
+namespace HaloSim
+{
+
+namespace
+{
+
+std::ofstream openOutput(const std::string &filename)
+{
+    std::ofstream stream(filename, std::ios::binary);
+    if (!stream)
+        throw std::runtime_error("Could not open " + filename);
+    return stream;
+}
+
+void closeOutput(std::ofstream &stream, const std::string &filename)
+{
+    stream.close();
+    if (!stream)
+        throw std::runtime_error("Could not write " + filename);
+}
+
+void checkRawImage(const RawImage &image)
+{
+    auto size = (std::size_t)image.width * image.height * 4;
+    if (image.width == 0 || image.height == 0 || image.accumulation.size() != size || (!image.noise.empty() && image.noise.size() != size))
+        throw std::runtime_error("Invalid image size");
+}
+
+void addExrAttribute(ByteWriter &header, const std::string &name, const std::string &type, std::uint32_t size)
+{
+    header.addName(name);
+    header.addName(type);
+    header.addUint32(size);
+}
+
+} // namespace
+
+void writeExr(const std::string &filename, const RawImage &image)
+{
+    checkRawImage(image);
+    auto width = image.width;
+    auto height = image.height;
+
+    // Channels are stored in alphabetical order, each with the offset of its value in a pixel
+    struct Channel
+    {
+        const char *name;
+        const std::vector<float> *source;
+        unsigned int offset;
+    };
+    std::vector<Channel> channels = {{"B", &image.accumulation, 2}, {"G", &image.accumulation, 1}, {"R", &image.accumulation, 0}};
+    if (!image.noise.empty())
+    {
+        channels.push_back({"luminanceSquares", &image.noise, 0});
+        channels.push_back({"rayCount", &image.noise, 1});
+    }
+
+    ByteWriter header;
+    header.addUint32(20000630);
+    header.addUint32(2);
+
+    std::uint32_t channelListSize = 1;
+    for (const auto &channel : channels)
+        channelListSize += (std::uint32_t)std::strlen(channel.name) + 1 + 16;
+    addExrAttribute(header, "channels", "chlist", channelListSize);
+    for (const auto &channel : channels)
+    {
+        const std::uint32_t floatPixelType = 2;
+        header.addName(channel.name);
+        header.addUint32(floatPixelType);
+        header.addUint32(0);
+        header.addUint32(1);
+        header.addUint32(1);
+    }
+    header.addUint8(0);
+
+    // The primaries of CIE XYZ, with the white point of equal energy
+    addExrAttribute(header, "chromaticities", "chromaticities", 32);
+    for (float value : {1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f / 3.0f, 1.0f / 3.0f})
+        header.addFloat(value);
+
+    addExrAttribute(header, "compression", "compression", 1);
+    header.addUint8(0);
+    for (const char *window : {"dataWindow", "displayWindow"})
+    {
+        addExrAttribute(header, window, "box2i", 16);
+        header.addUint32(0);
+        header.addUint32(0);
+        header.addUint32(width - 1);
+        header.addUint32(height - 1);
+    }
+    addExrAttribute(header, "lineOrder", "lineOrder", 1);
+    header.addUint8(0);
+    addExrAttribute(header, "pixelAspectRatio", "float", 4);
+    header.addFloat(1.0f);
+    addExrAttribute(header, "screenWindowCenter", "v2f", 8);
+    header.addFloat(0.0f);
+    header.addFloat(0.0f);
+    addExrAttribute(header, "screenWindowWidth", "float", 4);
+    header.addFloat(1.0f);
+
+    addExrAttribute(header, "haloray.rayCount", "double", 8);
+    header.addDouble((double)image.rayCount);
+    addExrAttribute(header, "haloray.exposure", "float", 4);
+    header.addFloat(image.exposure);
+    if (!image.scene.empty())
+    {
+        addExrAttribute(header, "haloray.scene", "string", (std::uint32_t)image.scene.size());
+        header.addText(image.scene);
+    }
+    header.addUint8(0);
+
+    // Each scanline is a chunk of its own, listed in the offset table after the header
+    std::uint64_t lineSize = (std::uint64_t)width * channels.size() * sizeof(float);
+    std::uint64_t firstLineOffset = header.getSize() + (std::uint64_t)height * 8;
+    for (auto y = 0u; y < height; ++y)
+        header.addUint64(firstLineOffset + y * (lineSize + 8));
+
+    auto stream = openOutput(filename);
+    header.writeTo(stream);
+
+    ByteWriter line;
+    for (auto y = 0u; y < height; ++y)
+    {
+        line.addUint32(y);
+        line.addUint32((std::uint32_t)lineSize);
+        auto row = (std::size_t)(height - 1 - y) * width;
+        for (const auto &channel : channels)
+        {
+            for (auto x = 0u; x < width; ++x)
+                line.addFloat((*channel.source)[(row + x) * 4 + channel.offset]);
+        }
+        line.writeTo(stream);
+    }
+    closeOutput(stream, filename);
+}
+
+void writePfm(const std::string &filename, const RawImage &image)
+{
+    checkRawImage(image);
+
+    // A negative scale marks little-endian data, and rows go from the bottom up
+    ByteWriter data;
+    data.addText("PF\n" + std::to_string(image.width) + " " + std::to_string(image.height) + "\n-1.0\n");
+    auto stream = openOutput(filename);
+    data.writeTo(stream);
+    for (auto y = 0u; y < image.height; ++y)
+    {
+        auto row = (std::size_t)y * image.width;
+        for (auto x = 0u; x < image.width; ++x)
+        {
+            for (auto c = 0u; c < 3; ++c)
+                data.addFloat(image.accumulation[(row + x) * 4 + c]);
+        }
+        data.writeTo(stream);
+    }
+    closeOutput(stream, filename);
+}
+
+void writeTiff16(const std::string &filename, unsigned int width, unsigned int height, const std::vector<std::uint16_t> &rgb)
+{
+    if (width == 0 || height == 0 || rgb.size() != (std::size_t)width * height * 3)
+        throw std::runtime_error("Invalid image size");
+
+    const std::uint16_t shortType = 3;
+    const std::uint16_t longType = 4;
+    const std::uint16_t rationalType = 5;
+    const std::uint32_t entryCount = 13;
+
+    // The directory is followed by the bits per sample, the resolutions and the pixels
+    const std::uint32_t directoryOffset = 8;
+    const std::uint32_t bitsPerSampleOffset = directoryOffset + 2 + entryCount * 12 + 4;
+    const std::uint32_t resolutionOffset = bitsPerSampleOffset + 3 * 2;
+    const std::uint32_t pixelOffset = resolutionOffset + 8;
+    const std::uint64_t pixelSize = (std::uint64_t)rgb.size() * 2;
+    if (pixelOffset + pixelSize > 0xffffffffull)
+        throw std::runtime_error("Image is too large for TIFF");
+
+    ByteWriter data;
+    data.addText("II");
+    data.addUint16(42);
+    data.addUint32(directoryOffset);
+
+    data.addUint16((std::uint16_t)entryCount);
+    auto addEntry = [&data](std::uint16_t tag, std::uint16_t type, std::uint32_t count, std::uint32_t value) {
+        data.addUint16(tag);
+        data.addUint16(type);
+        data.addUint32(count);
+        if (type == shortType && count == 1)
+        {
+            data.addUint16((std::uint16_t)value);
+            data.addUint16(0);
+        }
+        else
+        {
+            data.addUint32(value);
+        }
+    };
+    addEntry(256, longType, 1, width);
+    addEntry(257, longType, 1, height);
+    addEntry(258, shortType, 3, bitsPerSampleOffset);
+    addEntry(259, shortType, 1, 1);
+    addEntry(262, shortType, 1, 2);
+    addEntry(273, longType, 1, pixelOffset);
+    addEntry(277, shortType, 1, 3);
+    addEntry(278, longType, 1, height);
+    addEntry(279, longType, 1, (std::uint32_t)pixelSize);
+    addEntry(282, rationalType, 1, resolutionOffset);
+    addEntry(283, rationalType, 1, resolutionOffset);
+    addEntry(284, shortType, 1, 1);
+    addEntry(296, shortType, 1, 2);
+    data.addUint32(0);
+
+    for (auto i = 0; i < 3; ++i)
+        data.addUint16(16);
+    data.addUint32(72);
+    data.addUint32(1);
+
+    auto stream = openOutput(filename);
+    data.writeTo(stream);
+    for (auto y = 0u; y < height; ++y)
+    {
+        for (auto i = (std::size_t)y * width * 3; i < (std::size_t)(y + 1) * width * 3; ++i)
+            data.addUint16(rgb[i]);
+        data.writeTo(stream);
+    }
+    closeOutput(stream, filename);
+}
+
+} // namespace HaloSim
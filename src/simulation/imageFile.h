@@ -0,0 +1,48 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace HaloSim
+{
+
+/*
+The linear result of a simulation, with four floats per pixel and the
+bottom row first, like the textures of the simulation engine. The
+accumulation holds XYZ colors, and the optional noise image the sums of
+squared luminance and the ray counts of the pixels. The exposure scales the
+accumulation to the brightness of the view. The seed and random stream of
+the simulation tell the shards of a render apart, and an image that is not
+a shard is stream 0 of 1.
+*/
+struct RawImage
+{
+    unsigned int width;
+    unsigned int height;
+    std::vector<float> accumulation;
+    std::vector<float> noise;
+    unsigned long long rayCount;
+    float exposure;
+    std::string scene;
+    std::uint32_t seed;
+    unsigned int randomStreamIndex;
+    unsigned int randomStreamCount;
+};
+
+/*
+OpenEXR with 32-bit float channels, without compression. XYZ is stored in
+the R, G and B channels with the chromaticities of the XYZ primaries, which
+is how OpenEXR describes XYZ images. The noise sums become the
+luminanceSquares and rayCount channels, and the ray count, exposure and
+scene file text are stored as haloray.rayCount, haloray.exposure and
+haloray.scene attributes.
+*/
+void writeExr(const std::string &filename, const RawImage &image);
+
+// Portable float map with the XYZ colors, which has no room for the rest
+void writePfm(const std::string &filename, const RawImage &image);
+
+// Uncompressed 16-bit RGB, with three values per pixel and the top row first
+void writeTiff16(const std::string &filename, unsigned int width, unsigned int height, const std::vector<std::uint16_t> &rgb);
+
+} // namespace HaloSim
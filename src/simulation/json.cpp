@@ -0,0 +1,709 @@
+#include "json.h"
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <sstream>
+#include <locale>
+#include <stdexcept>
+
+namespace HaloSim
+{
+
+namespace
+{
+
+const char *getTypeName(JsonValue::Type type)
+{
+    switch (type)
+    {
+    case JsonValue::Type::Null:
+        return "null";
+    case JsonValue::Type::Boolean:
+        return "a boolean";
+    case JsonValue::Type::Number:
+        return "a number";
+    case JsonValue::Type::String:
+        return "a string";
+    case JsonValue::Type::Array:
+        return "an array";
+    default:
+        return "an object";
+    }
+}
+
+/*
+Numbers with at most 15 significant digits and small exponents are exactly
+representable as a product or quotient of two doubles, which is correctly
+rounded. Other numbers are left to the standard library. Both ignore the C
+locale, which Qt sets from the environment.
+*/
+bool parseNumber(const char *&position, const char *end, double &result)
+{
+    const char *start = position;
+    const char *p = position;
+    bool negative = false;
+    if (p != end && *p == '-')
+    {
+        negative = true;
+        ++p;
+    }
+    if (p == end || *p < '0' || *p > '9')
+        return false;
+
+    std::uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    if (*p == '0')
+    {
+        ++p;
+    }
+    else
+    {
+        for (; p != end && *p >= '0' && *p <= '9'; ++p)
+        {
+            if (digits < 19)
+                mantissa = mantissa * 10 + (std::uint64_t)(*p - '0');
+            else
+                ++exponent;
+            if (mantissa != 0)
+                ++digits;
+        }
+    }
+
+    if (p != end && *p == '.')
+    {
+        ++p;
+        if (p == end || *p < '0' || *p > '9')
+            return false;
+        for (; p != end && *p >= '0' && *p <= '9'; ++p)
+        {
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + (std::uint64_t)(*p - '0');
+                --exponent;
+            }
+            if (mantissa != 0)
+                ++digits;
+        }
+    }
+
+    if (p != end && (*p == 'e' || *p == 'E'))
+    {
+        ++p;
+        bool negativeExponent = false;
+        if (p != end && (*p == '+' || *p == '-'))
+        {
+            negativeExponent = *p == '-';
+            ++p;
+        }
+        if (p == end || *p < '0' || *p > '9')
+            return false;
+        int explicitExponent = 0;
+        for (; p != end && *p >= '0' && *p <= '9'; ++p)
+            explicitExponent = std::min(100000, explicitExponent * 10 + (*p - '0'));
+        exponent += negativeExponent ? -explicitExponent : explicitExponent;
+    }
+    position = p;
+
+    static const double powersOfTen[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                         1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    if (digits <= 15 && exponent >= -22 && exponent <= 22)
+    {
+        double value = (double)mantissa;
+        value = exponent < 0 ? value / powersOfTen[-exponent] : value * powersOfTen[exponent];
+        result = negative ? -value : value;
+        return true;
+    }
+
+    std::istringstream stream(std::string(start, p));
+    stream.imbue(std::locale::classic());
+    stream >> result;
+    if (stream.fail())
+    {
+        // Out of range values are clamped like by strtod
+        result = exponent < 0 ? 0.0 : HUGE_VAL;
+        if (negative)
+            result = -result;
+    }
+    return true;
+}
+
+double parseNumber(const std::string &text)
+{
+    const char *position = text.data();
+    double value = 0.0;
+    parseNumber(position, text.data() + text.size(), value);
+    return value;
+}
+
+std::string formatNumber(double value, int precision)
+{
+    std::ostringstream stream;
+    stream.imbue(std::locale::classic());
+    stream.precision(precision);
+    stream << value;
+    return stream.str();
+}
+
+// The shortest representation that parses back to the same value
+std::string formatNumber(double value)
+{
+    if (!std::isfinite(value))
+        throw std::runtime_error("JSON cannot represent infinite numbers");
+    if (value == std::floor(value) && std::abs(value) < 1e15)
+        return std::to_string((long long)value);
+    for (int precision = 1; precision < 17; ++precision)
+    {
+        auto text = formatNumber(value, precision);
+        if (parseNumber(text) == value)
+            return text;
+    }
+    return formatNumber(value, 17);
+}
+
+void appendUtf8(std::string &output, std::uint32_t codePoint)
+{
+    if (codePoint < 0x80)
+    {
+        output += (char)codePoint;
+    }
+    else if (codePoint < 0x800)
+    {
+        output += (char)(0xc0 | (codePoint >> 6));
+        output += (char)(0x80 | (codePoint & 0x3f));
+    }
+    else if (codePoint < 0x10000)
+    {
+        output += (char)(0xe0 | (codePoint >> 12));
+        output += (char)(0x80 | ((codePoint >> 6) & 0x3f));
+        output += (char)(0x80 | (codePoint & 0x3f));
+    }
+    else
+    {
+        output += (char)(0xf0 | (codePoint >> 18));
+        output += (char)(0x80 | ((codePoint >> 12) & 0x3f));
+        output += (char)(0x80 | ((codePoint >> 6) & 0x3f));
+        output += (char)(0x80 | (codePoint & 0x3f));
+    }
+}
+
+void serializeString(std::string &output, const std::string &text)
+{
+    output += '"';
+    for (char c : text)
+    {
+        switch (c)
+        {
+        case '"':
+            output += "\\\"";
+            break;
+        case '\\':
+            output += "\\\\";
+            break;
+        case '\n':
+            output += "\\n";
+            break;
+        case '\r':
+            output += "\\r";
+            break;
+        case '\t':
+            output += "\\t";
+            break;
+        default:
+            if ((unsigned char)c < 0x20)
+            {
+                const char *hexDigits = "0123456789abcdef";
+                output += "\\u00";
+                output += hexDigits[(c >> 4) & 0xf];
+                output += hexDigits[c & 0xf];
+            }
+            else
+            {
+                output += c;
+            }
+        }
+    }
+    output += '"';
+}
+
+// Recursive descent parser working directly on the text
+class Parser
+{
+public:
+    explicit Parser(const std::string &text)
+        : mPosition(text.data()),
+          mEnd(text.data() + text.size()),
+          mLine(1)
+    {
+    }
+
+    JsonValue parseDocument()
+    {
+        auto value = parseValue(0);
+        skipWhitespace();
+        if (mPosition != mEnd)
+            fail("unexpected text after the document");
+        return value;
+    }
+
+private:
+    [[noreturn]] void fail(const std::string &message) const
+    {
+        throw std::runtime_error("Invalid JSON on line " + std::to_string(mLine) + ": " + message);
+    }
+
+    void skipWhitespace()
+    {
+        for (; mPosition != mEnd; ++mPosition)
+        {
+            if (*mPosition == '\n')
+                ++mLine;
+            else if (*mPosition != ' ' && *mPosition != '\t' && *mPosition != '\r')
+                break;
+        }
+    }
+
+    bool consume(char c)
+    {
+        skipWhitespace();
+        if (mPosition != mEnd && *mPosition == c)
+        {
+            ++mPosition;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char c)
+    {
+        if (!consume(c))
+            fail(std::string("expected '") + c + "'");
+    }
+
+    bool consumeLiteral(const char *literal)
+    {
+        auto length = std::char_traits<char>::length(literal);
+        if ((std::size_t)(mEnd - mPosition) < length || std::char_traits<char>::compare(mPosition, literal, length) != 0)
+            return false;
+        mPosition += length;
+        return true;
+    }
+
+    JsonValue parseValue(unsigned int depth)
+    {
+        // Deeply nested documents would otherwise overflow the stack
+        const unsigned int maxDepth = 256;
+        if (depth > maxDepth)
+            fail("too deeply nested");
+
+        skipWhitespace();
+        if (mPosition == mEnd)
+            fail("unexpected end of text");
+
+        switch (*mPosition)
+        {
+        case '{':
+            return parseObject(depth);
+        case '[':
+            return parseArray(depth);
+        case '"':
+            return JsonValue(parseString());
+        case 't':
+            if (consumeLiteral("true"))
+                return JsonValue(true);
+            break;
+        case 'f':
+            if (consumeLiteral("false"))
+                return JsonValue(false);
+            break;
+        case 'n':
+            if (consumeLiteral("null"))
+                return JsonValue();
+            break;
+        default:
+            double number;
+            if (parseNumber(mPosition, mEnd, number))
+                return JsonValue(number);
+        }
+        fail("unexpected character");
+    }
+
+    JsonValue parseObject(unsigned int depth)
+    {
+        expect('{');
+        auto object = JsonValue::createObject();
+        if (consume('}'))
+            return object;
+        do
+        {
+            skipWhitespace();
+            if (mPosition == mEnd || *mPosition != '"')
+                fail("expected a key");
+            auto key = parseString();
+            if (object.contains(key))
+                fail("duplicate key " + key);
+            expect(':');
+            object.set(key, parseValue(depth + 1));
+        } while (consume(','));
+        expect('}');
+        return object;
+    }
+
+    JsonValue parseArray(unsigned int depth)
+    {
+        expect('[');
+        auto array = JsonValue::createArray();
+        if (consume(']'))
+            return array;
+        do
+        {
+            array.append(parseValue(depth + 1));
+        } while (consume(','));
+        expect(']');
+        return array;
+    }
+
+    std::uint32_t parseHexDigits()
+    {
+        if (mEnd - mPosition < 4)
+            fail("truncated escape sequence");
+        std::uint32_t value = 0;
+        for (int i = 0; i < 4; ++i, ++mPosition)
+        {
+            char c = *mPosition;
+            value <<= 4;
+            if (c >= '0' && c <= '9')
+                value |= (std::uint32_t)(c - '0');
+            else if (c >= 'a' && c <= 'f')
+                value |= (std::uint32_t)(c - 'a' + 10);
+            else if (c >= 'A' && c <= 'F')
+                value |= (std::uint32_t)(c - 'A' + 10);
+            else
+                fail("invalid escape sequence");
+        }
+        return value;
+    }
+
+    std::string parseString()
+    {
+        ++mPosition;
+        std::string result;
+        while (true)
+        {
+            // Plain runs of characters are copied at once
+            auto runStart = mPosition;
+            while (mPosition != mEnd && *mPosition != '"' && *mPosition != '\\' && (unsigned char)*mPosition >= 0x20)
+                ++mPosition;
+            result.append(runStart, mPosition);
+
+            if (mPosition == mEnd)
+                fail("unterminated string");
+            char c = *mPosition++;
+            if (c == '"')
+                return result;
+            if (c != '\\')
+                fail("control character in string");
+            if (mPosition == mEnd)
+                fail("unterminated string");
+
+            switch (*mPosition++)
+            {
+            case '"':
+                result += '"';
+                break;
+            case '\\':
+                result += '\\';
+                break;
+            case '/':
+                result += '/';
+                break;
+            case 'b':
+                result += '\b';
+                break;
+            case 'f':
+                result += '\f';
+                break;
+            case 'n':
+                result += '\n';
+                break;
+            case 'r':
+                result += '\r';
+                break;
+            case 't':
+                result += '\t';
+                break;
+            case 'u':
+            {
+                auto codePoint = parseHexDigits();
+                if (codePoint >= 0xd800 && codePoint < 0xdc00)
+                {
+                    if (!consumeLiteral("\\u"))
+                        fail("unpaired surrogate");
+                    auto low = parseHexDigits();
+                    if (low < 0xdc00 || low >= 0xe000)
+                        fail("unpaired surrogate");
+                    codePoint = 0x10000 + ((codePoint - 0xd800) << 10) + (low - 0xdc00);
+                }
+                else if (codePoint >= 0xdc00 && codePoint < 0xe000)
+                {
+                    fail("unpaired surrogate");
+                }
+                appendUtf8(result, codePoint);
+                break;
+            }
+            default:
+                fail("invalid escape sequence");
+            }
+        }
+    }
+
+    const char *mPosition;
+    const char *mEnd;
+    unsigned int mLine;
+};
+
+} // namespace
+
+JsonValue::JsonValue()
+    : mType(Type::Null),
+      mBool(false),
+      mNumber(0.0)
+{
+}
+
+JsonValue::JsonValue(bool value)
+    : mType(Type::Boolean),
+      mBool(value),
+      mNumber(0.0)
+{
+}
+
+JsonValue::JsonValue(int value)
+    : JsonValue((double)value)
+{
+}
+
+JsonValue::JsonValue(unsigned int value)
+    : JsonValue((double)value)
+{
+}
+
+JsonValue::JsonValue(double value)
+    : mType(Type::Number),
+      mBool(false),
+      mNumber(value)
+{
+}
+
+JsonValue::JsonValue(const char *value)
+    : JsonValue(std::string(value))
+{
+}
+
+JsonValue::JsonValue(const std::string &value)
+    : mType(Type::String),
+      mBool(false),
+      mNumber(0.0),
+      mString(value)
+{
+}
+
+JsonValue JsonValue::createArray()
+{
+    JsonValue value;
+    value.mType = Type::Array;
+    return value;
+}
+
+JsonValue JsonValue::createObject()
+{
+    JsonValue value;
+    value.mType = Type::Object;
+    return value;
+}
+
+JsonValue JsonValue::fromFloat(float value)
+{
+    if (!std::isfinite(value))
+        throw std::runtime_error("JSON cannot represent infinite numbers");
+    for (int precision = 1; precision <= 9; ++precision)
+    {
+        auto number = parseNumber(formatNumber(value, precision));
+        if ((float)number == value)
+            return JsonValue(number);
+    }
+    return JsonValue((double)value);
+}
+
+void JsonValue::expectType(Type type) const
+{
+    if (mType != type)
+        throw std::runtime_error(std::string("Expected ") + getTypeName(type) + " instead of " + getTypeName(mType));
+}
+
+JsonValue::Type JsonValue::getType() const
+{
+    return mType;
+}
+
+bool JsonValue::isNull() const
+{
+    return mType == Type::Null;
+}
+
+bool JsonValue::toBool() const
+{
+    expectType(Type::Boolean);
+    return mBool;
+}
+
+double JsonValue::toNumber() const
+{
+    expectType(Type::Number);
+    return mNumber;
+}
+
+const std::string &JsonValue::toString() const
+{
+    expectType(Type::String);
+    return mString;
+}
+
+std::size_t JsonValue::size() const
+{
+    if (mType == Type::Object)
+        return mMembers.size();
+    expectType(Type::Array);
+    return mArray.size();
+}
+
+const JsonValue &JsonValue::at(std::size_t index) const
+{
+    expectType(Type::Array);
+    if (index >= mArray.size())
+        throw std::runtime_error("Array index out of range");
+    return mArray[index];
+}
+
+void JsonValue::append(JsonValue value)
+{
+    expectType(Type::Array);
+    mArray.push_back(std::move(value));
+}
+
+bool JsonValue::contains(const std::string &key) const
+{
+    expectType(Type::Object);
+    for (const auto &member : mMembers)
+    {
+        if (member.first == key)
+            return true;
+    }
+    return false;
+}
+
+const JsonValue &JsonValue::at(const std::string &key) const
+{
+    expectType(Type::Object);
+    for (const auto &member : mMembers)
+    {
+        if (member.first == key)
+            return member.second;
+    }
+    throw std::runtime_error("Missing key " + key);
+}
+
+void JsonValue::set(const std::string &key, JsonValue value)
+{
+    expectType(Type::Object);
+    for (auto &member : mMembers)
+    {
+        if (member.first == key)
+        {
+            member.second = std::move(value);
+            return;
+        }
+    }
+    mMembers.emplace_back(key, std::move(value));
+}
+
+const std::vector<JsonValue::Member> &JsonValue::getMembers() const
+{
+    expectType(Type::Object);
+    return mMembers;
+}
+
+std::string JsonValue::serialize() const
+{
+    std::string output;
+    serialize(output, 0);
+    output += '\n';
+    return output;
+}
+
+/*
+Arrays and objects that only hold numbers, strings and booleans are written
+on a single line, others with one member per line
+*/
+void JsonValue::serialize(std::string &output, unsigned int indent) const
+{
+    const unsigned int indentWidth = 4;
+    switch (mType)
+    {
+    case Type::Null:
+        output += "null";
+        return;
+    case Type::Boolean:
+        output += mBool ? "true" : "false";
+        return;
+    case Type::Number:
+        output += formatNumber(mNumber);
+        return;
+    case Type::String:
+        serializeString(output, mString);
+        return;
+    default:
+        break;
+    }
+
+    bool isArray = mType == Type::Array;
+    auto count = isArray ? mArray.size() : mMembers.size();
+    bool multiline = false;
+    for (auto i = 0u; i < count; ++i)
+    {
+        auto childType = isArray ? mArray[i].mType : mMembers[i].second.mType;
+        multiline = multiline || childType == Type::Array || childType == Type::Object;
+    }
+
+    output += isArray ? '[' : '{';
+    for (auto i = 0u; i < count; ++i)
+    {
+        if (i > 0)
+            output += ',';
+        if (multiline)
+            output += '\n' + std::string((indent + 1) * indentWidth, ' ');
+        else if (i > 0)
+            output += ' ';
+
+        if (isArray)
+        {
+            mArray[i].serialize(output, indent + 1);
+        }
+        else
+        {
+            serializeString(output, mMembers[i].first);
+            output += ": ";
+            mMembers[i].second.serialize(output, indent + 1);
+        }
+    }
+    if (multiline)
+        output += '\n' + std::string(indent * indentWidth, ' ');
+    output += isArray ? ']' : '}';
+}
+
+JsonValue JsonValue::parse(const std::string &text)
+{
+    return Parser(text).parseDocument();
+}
+
+} // namespace HaloSim
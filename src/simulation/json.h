@@ -0,0 +1,82 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstddef>
+
+namespace HaloSim
+{
+
+/*
+A small JSON document model for the files read and written by the
+simulation. Members of objects keep their order, so that serializing the
+same document always gives the same text. Accessing a value as the wrong
+type throws std::runtime_error.
+*/
+class JsonValue
+{
+public:
+    enum class Type
+    {
+        Null,
+        Boolean,
+        Number,
+        String,
+        Array,
+        Object
+    };
+
+    using Member = std::pair<std::string, JsonValue>;
+
+    JsonValue();
+    JsonValue(bool value);
+    JsonValue(int value);
+    JsonValue(unsigned int value);
+    JsonValue(double value);
+    JsonValue(const char *value);
+    JsonValue(const std::string &value);
+
+    static JsonValue createArray();
+    static JsonValue createObject();
+
+    Type getType() const;
+    bool isNull() const;
+
+    bool toBool() const;
+    double toNumber() const;
+    const std::string &toString() const;
+
+    // Arrays
+    std::size_t size() const;
+    const JsonValue &at(std::size_t index) const;
+    void append(JsonValue value);
+
+    // Objects
+    bool contains(const std::string &key) const;
+    const JsonValue &at(const std::string &key) const;
+    void set(const std::string &key, JsonValue value);
+    const std::vector<Member> &getMembers() const;
+
+    std::string serialize() const;
+    static JsonValue parse(const std::string &text);
+
+    /*
+    The shortest decimal representation of a float that reads back as the
+    same float, so that written files stay readable and reproduce the values
+    exactly
+    */
+    static JsonValue fromFloat(float value);
+
+private:
+    void serialize(std::string &output, unsigned int indent) const;
+    void expectType(Type type) const;
+
+    Type mType;
+    bool mBool;
+    double mNumber;
+    std::string mString;
+    std::vector<JsonValue> mArray;
+    std::vector<Member> mMembers;
+};
+
+} // namespace HaloSim
@@ -0,0 +1,42 @@
+#include "scene.h"
+#include <numeric>
+#include "hash.h"
+
+namespace HaloSim
+{
+
+double Scene::getCrystalProbability(unsigned int index) const
+{
+    unsigned int totalWeights = std::accumulate(crystalWeights.cbegin(), crystalWeights.cend(), 0);
+    return static_cast<double>(crystalWeights[index]) / totalWeights;
+}
+
+std::uint64_t Scene::getHash() const
+{
+    Hasher hasher;
+    hasher.add(light.altitude);
+    hasher.add(light.diameter);
+    hasher.add(camera.pitch);
+    hasher.add(camera.yaw);
+    hasher.add(camera.fov);
+    hasher.add(static_cast<int>(camera.projection));
+    hasher.add(camera.hideSubHorizon);
+    hasher.add(multipleScatteringProbability);
+    hasher.add(crystals.size());
+    for (auto i = 0u; i < crystals.size(); ++i)
+    {
+        const auto &crystal = crystals[i];
+        hasher.add(crystal.caRatioAverage);
+        hasher.add(crystal.caRatioStd);
+        hasher.add(crystal.tiltDistribution);
+        hasher.add(crystal.tiltAverage);
+        hasher.add(crystal.tiltStd);
+        hasher.add(crystal.rotationDistribution);
+        hasher.add(crystal.rotationAverage);
+        hasher.add(crystal.rotationStd);
+        hasher.add(crystalWeights[i]);
+    }
+    return hasher.getHash();
+}
+
+} // namespace HaloSim
@@ -0,0 +1,29 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include "camera.h"
+#include "lightSource.h"
+#include "crystalPopulation.h"
+
+namespace HaloSim
+{
+
+/*
+Everything that determines the result of a simulation, independent of how
+it is computed.
+*/
+struct Scene
+{
+    LightSource light;
+    Camera camera;
+    std::vector<CrystalPopulation> crystals;
+    std::vector<unsigned int> crystalWeights;
+    float multipleScatteringProbability;
+
+    double getCrystalProbability(unsigned int index) const;
+
+    // Hash of all the fields, equal for scenes that simulate the same result
+    std::uint64_t getHash() const;
+};
+
+} // namespace HaloSim
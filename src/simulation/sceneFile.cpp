@@ -0,0 +1,373 @@
+#include "sceneFile.h"
+#include <cmath>
+#include <set>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include "hash.h"
+#include "crystalPopulationRepository.h"
+
+namespace HaloSim
+{
+
+namespace
+{
+
+const char *formatName = "haloray-scene";
+const char *distributionNames[] = {"uniform", "gaussian"};
+const char *projectionNames[] = {"stereographic", "rectilinear", "equidistant", "equal-area", "orthographic"};
+
+template <std::size_t N>
+int findName(const char *(&names)[N], const std::string &name, const std::string &key)
+{
+    for (auto i = 0u; i < N; ++i)
+    {
+        if (name == names[i])
+            return (int)i;
+    }
+    throw std::runtime_error("Unknown value " + name + " for " + key);
+}
+
+std::string formatLimit(float value)
+{
+    auto text = JsonValue::fromFloat(value).serialize();
+    return text.substr(0, text.size() - 1);
+}
+
+/*
+Reads the members of an object, and fails for members that are never read,
+so that misspelled keys do not silently fall back to defaults
+*/
+class ObjectReader
+{
+public:
+    ObjectReader(const JsonValue &object, const std::string &path)
+        : mObject(object),
+          mPath(path)
+    {
+        if (object.getType() != JsonValue::Type::Object)
+            throw std::runtime_error("Expected an object for " + path);
+    }
+
+    bool has(const std::string &key)
+    {
+        mReadKeys.insert(key);
+        return mObject.contains(key);
+    }
+
+    const JsonValue &get(const std::string &key)
+    {
+        mReadKeys.insert(key);
+        return mObject.at(key);
+    }
+
+    std::string getPath(const std::string &key) const
+    {
+        return mPath.empty() ? key : mPath + "." + key;
+    }
+
+    float readFloat(const std::string &key, float defaultValue, float minimum, float maximum)
+    {
+        if (!has(key))
+            return defaultValue;
+        auto value = readNumber(key);
+        if (!(value >= minimum && value <= maximum))
+            throw std::runtime_error(getPath(key) + " must be between " + formatLimit(minimum) + " and " + formatLimit(maximum));
+        return (float)value;
+    }
+
+    std::uint32_t readUnsigned(const std::string &key, std::uint32_t defaultValue, std::uint32_t minimum = 0)
+    {
+        if (!has(key))
+            return defaultValue;
+        auto value = readNumber(key);
+        if (value != std::floor(value) || value < minimum || value > 4294967295.0)
+            throw std::runtime_error(getPath(key) + " must be a whole number of at least " + std::to_string(minimum));
+        return (std::uint32_t)value;
+    }
+
+    bool readBool(const std::string &key, bool defaultValue)
+    {
+        if (!has(key))
+            return defaultValue;
+        try
+        {
+            return get(key).toBool();
+        }
+        catch (const std::runtime_error &e)
+        {
+            throw std::runtime_error(getPath(key) + ": " + e.what());
+        }
+    }
+
+    std::string readString(const std::string &key, const std::string &defaultValue)
+    {
+        if (!has(key))
+            return defaultValue;
+        try
+        {
+            return get(key).toString();
+        }
+        catch (const std::runtime_error &e)
+        {
+            throw std::runtime_error(getPath(key) + ": " + e.what());
+        }
+    }
+
+    void checkUnknownKeys() const
+    {
+        for (const auto &member : mObject.getMembers())
+        {
+            if (mReadKeys.count(member.first) == 0)
+                throw std::runtime_error("Unknown key " + getPath(member.first));
+        }
+    }
+
+private:
+    double readNumber(const std::string &key)
+    {
+        try
+        {
+            return get(key).toNumber();
+        }
+        catch (const std::runtime_error &e)
+        {
+            throw std::runtime_error(getPath(key) + ": " + e.what());
+        }
+    }
+
+    const JsonValue &mObject;
+    std::string mPath;
+    std::set<std::string> mReadKeys;
+};
+
+void readDistribution(ObjectReader &parent, const std::string &key, int &distribution, float &average, float &std)
+{
+    if (!parent.has(key))
+        return;
+    ObjectReader reader(parent.get(key), parent.getPath(key));
+    distribution = findName(distributionNames, reader.readString("distribution", distributionNames[distribution]), reader.getPath("distribution"));
+    average = reader.readFloat("average", average, -360.0f, 360.0f);
+    std = reader.readFloat("std", std, 0.0f, 360.0f);
+    reader.checkUnknownKeys();
+}
+
+JsonValue writeDistribution(int distribution, float average, float std)
+{
+    auto object = JsonValue::createObject();
+    object.set("distribution", distributionNames[distribution]);
+    object.set("average", JsonValue::fromFloat(average));
+    object.set("std", JsonValue::fromFloat(std));
+    return object;
+}
+
+CrystalPopulation readCrystal(const JsonValue &value, const std::string &path, unsigned int &weight)
+{
+    ObjectReader reader(value, path);
+    auto preset = CrystalPopulation::createRandom();
+    if (reader.has("preset"))
+    {
+        const char *presetNames[] = {"random", "plate", "column", "parry", "lowitz"};
+        auto name = reader.readString("preset", "");
+        preset = CrystalPopulation::presetPopulation((CrystalPopulationPreset)findName(presetNames, name, reader.getPath("preset")));
+    }
+
+    auto population = preset;
+    weight = reader.readUnsigned("weight", 1);
+    if (reader.has("caRatio"))
+    {
+        ObjectReader caRatio(reader.get("caRatio"), reader.getPath("caRatio"));
+        population.caRatioAverage = caRatio.readFloat("average", population.caRatioAverage, 0.0f, 100.0f);
+        population.caRatioStd = caRatio.readFloat("std", population.caRatioStd, 0.0f, 100.0f);
+        caRatio.checkUnknownKeys();
+    }
+    readDistribution(reader, "tilt", population.tiltDistribution, population.tiltAverage, population.tiltStd);
+    readDistribution(reader, "rotation", population.rotationDistribution, population.rotationAverage, population.rotationStd);
+    reader.checkUnknownKeys();
+    return population;
+}
+
+} // namespace
+
+SceneFile SceneFile::createDefault()
+{
+    SceneFile file;
+    file.scene.light = LightSource::createDefaultLightSource();
+    file.scene.camera = Camera::createDefaultCamera();
+    file.scene.multipleScatteringProbability = 0.0f;
+
+    CrystalPopulationRepository defaultCrystals;
+    for (auto i = 0u; i < defaultCrystals.getCount(); ++i)
+    {
+        file.scene.crystals.push_back(defaultCrystals.get(i));
+        file.scene.crystalWeights.push_back(defaultCrystals.getWeight(i));
+    }
+
+    file.raysPerStep = 500000;
+    file.seed = 1;
+    file.outputWidth = 1920;
+    file.outputHeight = 1080;
+    return file;
+}
+
+SceneFile SceneFile::fromJson(const JsonValue &document)
+{
+    ObjectReader reader(document, "");
+    if (reader.readString("format", "") != formatName)
+        throw std::runtime_error("Not a scene file");
+    auto version = reader.readUnsigned("version", 0);
+    if (version < 1 || version > formatVersion)
+        throw std::runtime_error("Unsupported scene file version " + std::to_string(version));
+
+    auto file = createDefault();
+    auto &scene = file.scene;
+
+    if (reader.has("sun"))
+    {
+        ObjectReader sun(reader.get("sun"), "sun");
+        scene.light.altitude = sun.readFloat("altitude", scene.light.altitude, -90.0f, 90.0f);
+        scene.light.diameter = sun.readFloat("diameter", scene.light.diameter, 0.0f, 180.0f);
+        sun.checkUnknownKeys();
+    }
+
+    if (reader.has("camera"))
+    {
+        ObjectReader camera(reader.get("camera"), "camera");
+        scene.camera.pitch = camera.readFloat("pitch", scene.camera.pitch, -90.0f, 90.0f);
+        scene.camera.yaw = camera.readFloat("yaw", scene.camera.yaw, -360.0f, 360.0f);
+        scene.camera.projection = (Projection)findName(projectionNames, camera.readString("projection", projectionNames[scene.camera.projection]), "camera.projection");
+        scene.camera.fov = camera.readFloat("fov", scene.camera.fov, 0.01f, scene.camera.getMaximumFov());
+        scene.camera.hideSubHorizon = camera.readBool("hideSubHorizon", scene.camera.hideSubHorizon);
+        camera.checkUnknownKeys();
+    }
+
+    if (reader.has("crystals"))
+    {
+        const auto &crystals = reader.get("crystals");
+        if (crystals.getType() != JsonValue::Type::Array || crystals.size() == 0)
+            throw std::runtime_error("crystals must be a list of at least one crystal population");
+        scene.crystals.clear();
+        scene.crystalWeights.clear();
+        unsigned long long totalWeight = 0;
+        for (auto i = 0u; i < crystals.size(); ++i)
+        {
+            unsigned int weight;
+            scene.crystals.push_back(readCrystal(crystals.at(i), "crystals[" + std::to_string(i) + "]", weight));
+            scene.crystalWeights.push_back(weight);
+            totalWeight += weight;
+        }
+        if (totalWeight == 0)
+            throw std::runtime_error("At least one crystal population must have a weight");
+    }
+
+    scene.multipleScatteringProbability = reader.readFloat("multipleScattering", scene.multipleScatteringProbability, 0.0f, 1.0f);
+    file.raysPerStep = reader.readUnsigned("raysPerStep", file.raysPerStep, 1);
+    file.seed = reader.readUnsigned("seed", file.seed);
+
+    if (reader.has("output"))
+    {
+        ObjectReader output(reader.get("output"), "output");
+        file.outputWidth = output.readUnsigned("width", file.outputWidth, 1);
+        file.outputHeight = output.readUnsigned("height", file.outputHeight, 1);
+        output.checkUnknownKeys();
+    }
+
+    reader.checkUnknownKeys();
+    return file;
+}
+
+SceneFile SceneFile::parse(const std::string &text)
+{
+    return fromJson(JsonValue::parse(text));
+}
+
+SceneFile SceneFile::load(const std::string &filename)
+{
+    std::ifstream stream(filename, std::ios::binary);
+    if (!stream)
+        throw std::runtime_error("Could not open " + filename);
+    std::ostringstream text;
+    text << stream.rdbuf();
+    try
+    {
+        return parse(text.str());
+    }
+    catch (const std::runtime_error &e)
+    {
+        throw std::runtime_error(filename + ": " + e.what());
+    }
+}
+
+JsonValue SceneFile::toJson() const
+{
+    auto document = JsonValue::createObject();
+    document.set("format", formatName);
+    document.set("version", formatVersion);
+
+    auto sun = JsonValue::createObject();
+    sun.set("altitude", JsonValue::fromFloat(scene.light.altitude));
+    sun.set("diameter", JsonValue::fromFloat(scene.light.diameter));
+    document.set("sun", sun);
+
+    auto camera = JsonValue::createObject();
+    camera.set("pitch", JsonValue::fromFloat(scene.camera.pitch));
+    camera.set("yaw", JsonValue::fromFloat(scene.camera.yaw));
+    camera.set("fov", JsonValue::fromFloat(scene.camera.fov));
+    camera.set("projection", projectionNames[scene.camera.projection]);
+    camera.set("hideSubHorizon", scene.camera.hideSubHorizon);
+    document.set("camera", camera);
+
+    auto crystals = JsonValue::createArray();
+    for (auto i = 0u; i < scene.crystals.size(); ++i)
+    {
+        const auto &population = scene.crystals[i];
+        auto crystal = JsonValue::createObject();
+        crystal.set("weight", scene.crystalWeights[i]);
+        auto caRatio = JsonValue::createObject();
+        caRatio.set("average", JsonValue::fromFloat(population.caRatioAverage));
+        caRatio.set("std", JsonValue::fromFloat(population.caRatioStd));
+        crystal.set("caRatio", caRatio);
+        crystal.set("tilt", writeDistribution(population.tiltDistribution, population.tiltAverage, population.tiltStd));
+        crystal.set("rotation", writeDistribution(population.rotationDistribution, population.rotationAverage, population.rotationStd));
+        crystals.append(crystal);
+    }
+    document.set("crystals", crystals);
+
+    document.set("multipleScattering", JsonValue::fromFloat(scene.multipleScatteringProbability));
+    document.set("raysPerStep", raysPerStep);
+    document.set("seed", (unsigned int)seed);
+
+    auto output = JsonValue::createObject();
+    output.set("width", outputWidth);
+    output.set("height", outputHeight);
+    document.set("output", output);
+
+    return document;
+}
+
+std::string SceneFile::serialize() const
+{
+    return toJson().serialize();
+}
+
+void SceneFile::save(const std::string &filename) const
+{
+    std::ofstream stream(filename, std::ios::binary);
+    stream << serialize();
+    stream.close();
+    if (!stream)
+        throw std::runtime_error("Could not write " + filename);
+}
+
+std::uint64_t SceneFile::getHash() const
+{
+    Hasher hasher;
+    hasher.add(scene.getHash());
+    hasher.add(raysPerStep);
+    hasher.add(seed);
+    hasher.add(outputWidth);
+    hasher.add(outputHeight);
+    return hasher.getHash();
+}
+
+} // namespace HaloSim
@@ -0,0 +1,41 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include "scene.h"
+#include "json.h"
+
+namespace HaloSim
+{
+
+/*
+A scene together with the settings needed to reproduce its simulation, as
+stored in scene files. Scene files are versioned JSON documents. Fields that
+are left out of a file get their default values, and unknown fields are
+errors. Saving the same settings always gives the same text.
+*/
+struct SceneFile
+{
+    static const int formatVersion = 1;
+
+    Scene scene;
+    unsigned int raysPerStep;
+    std::uint32_t seed;
+    unsigned int outputWidth;
+    unsigned int outputHeight;
+
+    static SceneFile createDefault();
+
+    // These throw std::runtime_error for invalid files
+    static SceneFile fromJson(const JsonValue &document);
+    static SceneFile parse(const std::string &text);
+    static SceneFile load(const std::string &filename);
+
+    JsonValue toJson() const;
+    std::string serialize() const;
+    void save(const std::string &filename) const;
+
+    // Hash of all the fields, equal for files that reproduce the same simulation
+    std::uint64_t getHash() const;
+};
+
+} // namespace HaloSim
@@ -0,0 +1,412 @@
+#include "sharedMemoryRing.h"
+#include <atomic>
+#include <new>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// The sequence numbers are read and written by other processes, so they must not need locks
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "Shared memory needs lock-free atomics");
+
+namespace HaloSim
+{
+
+/*
+A block of shared memory of the operating system, with POSIX shared memory
+or a named file mapping on Windows. The writer creates the block, and
+readers map it read-only, so that they can never disturb the writer.
+*/
+class SharedMemory
+{
+public:
+    SharedMemory(const std::string &name, std::size_t size)
+        : mName(name),
+          mOwner(true),
+          mData(nullptr),
+          mSize(size)
+    {
+#ifdef _WIN32
+        mMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD)((std::uint64_t)size >> 32), (DWORD)size, getPath().c_str());
+        if (mMapping == nullptr)
+            throw std::runtime_error("Could not create shared memory " + name);
+        if (GetLastError() == ERROR_ALREADY_EXISTS)
+        {
+            CloseHandle(mMapping);
+            throw std::runtime_error("Shared memory " + name + " is already in use");
+        }
+        mData = static_cast<unsigned char *>(MapViewOfFile(mMapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+        if (mData == nullptr)
+        {
+            CloseHandle(mMapping);
+            throw std::runtime_error("Could not map shared memory " + name);
+        }
+#else
+        int file = shm_open(getPath().c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (file == -1 && errno == EEXIST)
+            throw std::runtime_error("Shared memory " + name + " is already in use");
+        if (file == -1)
+            throw std::runtime_error("Could not create shared memory " + name);
+        if (ftruncate(file, (off_t)size) != 0)
+        {
+            close(file);
+            shm_unlink(getPath().c_str());
+            throw std::runtime_error("Could not allocate shared memory " + name);
+        }
+        auto data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+        close(file);
+        if (data == MAP_FAILED)
+        {
+            shm_unlink(getPath().c_str());
+            throw std::runtime_error("Could not map shared memory " + name);
+        }
+        mData = static_cast<unsigned char *>(data);
+#endif
+    }
+
+    explicit SharedMemory(const std::string &name)
+        : mName(name),
+          mOwner(false),
+          mData(nullptr),
+          mSize(0)
+    {
+#ifdef _WIN32
+        mMapping = OpenFileMappingA(FILE_MAP_READ, FALSE, getPath().c_str());
+        if (mMapping == nullptr)
+            throw std::runtime_error("Could not open shared memory " + name);
+        mData = static_cast<unsigned char *>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+        if (mData == nullptr)
+        {
+            CloseHandle(mMapping);
+            throw std::runtime_error("Could not map shared memory " + name);
+        }
+        MEMORY_BASIC_INFORMATION info;
+        VirtualQuery(mData, &info, sizeof(info));
+        mSize = info.RegionSize;
+#else
+        int file = shm_open(getPath().c_str(), O_RDONLY, 0);
+        if (file == -1)
+            throw std::runtime_error("Could not open shared memory " + name);
+        struct stat status;
+        if (fstat(file, &status) != 0 || status.st_size <= 0)
+        {
+            close(file);
+            throw std::runtime_error("Could not open shared memory " + name);
+        }
+        mSize = (std::size_t)status.st_size;
+        auto data = mmap(nullptr, mSize, PROT_READ, MAP_SHARED, file, 0);
+        close(file);
+        if (data == MAP_FAILED)
+            throw std::runtime_error("Could not map shared memory " + name);
+        mData = static_cast<unsigned char *>(data);
+#endif
+    }
+
+    ~SharedMemory()
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(mData);
+        CloseHandle(mMapping);
+#else
+        munmap(mData, mSize);
+        if (mOwner)
+            shm_unlink(getPath().c_str());
+#endif
+    }
+
+    SharedMemory(const SharedMemory &) = delete;
+    SharedMemory &operator=(const SharedMemory &) = delete;
+
+    unsigned char *getData() const
+    {
+        return mData;
+    }
+
+    std::size_t getSize() const
+    {
+        return mSize;
+    }
+
+    /*
+    Removes the name of a block, so that a new block can be created with it
+    while the readers of the old one keep it. Windows removes the name by
+    itself once the last handle is closed.
+    */
+    static void remove(const std::string &name)
+    {
+#ifndef _WIN32
+        shm_unlink(getPath(name).c_str());
+#else
+        (void)name;
+#endif
+    }
+
+private:
+    static std::string getPath(const std::string &name)
+    {
+#ifdef _WIN32
+        return "Local\\" + name;
+#else
+        return "/" + name;
+#endif
+    }
+
+    std::string getPath() const
+    {
+        return getPath(mName);
+    }
+
+    std::string mName;
+    bool mOwner;
+    unsigned char *mData;
+    std::size_t mSize;
+#ifdef _WIN32
+    HANDLE mMapping;
+#endif
+};
+
+namespace
+{
+
+const std::uint32_t version = 1;
+const std::size_t headerSize = 64;
+const unsigned int accumulationChannels = 4;
+const unsigned int noiseChannels = 2;
+
+struct RingHeader
+{
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t slotCount;
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t channelCount;
+    std::atomic<std::uint32_t> closed;
+    std::uint32_t writerProcess;
+    std::uint64_t slotSize;
+    std::atomic<std::uint64_t> latestSequence;
+};
+
+struct SlotHeader
+{
+    std::atomic<std::uint64_t> sequence;
+    std::uint64_t rayCount;
+    std::uint64_t sceneHash;
+};
+
+static_assert(sizeof(RingHeader) <= headerSize && sizeof(SlotHeader) <= headerSize, "Headers must fit before the data");
+
+RingHeader *getHeader(const SharedMemory &memory)
+{
+    return reinterpret_cast<RingHeader *>(memory.getData());
+}
+
+SlotHeader *getSlot(const SharedMemory &memory, std::uint64_t sequence)
+{
+    auto header = getHeader(memory);
+    auto offset = headerSize + (std::size_t)((sequence - 1) % header->slotCount) * header->slotSize;
+    return reinterpret_cast<SlotHeader *>(memory.getData() + offset);
+}
+
+float *getPixels(SlotHeader *slot)
+{
+    return reinterpret_cast<float *>(reinterpret_cast<unsigned char *>(slot) + headerSize);
+}
+
+std::uint32_t getProcessId()
+{
+#ifdef _WIN32
+    return (std::uint32_t)GetCurrentProcessId();
+#else
+    return (std::uint32_t)getpid();
+#endif
+}
+
+/*
+Windows removes the name of a crashed writer by itself, so only POSIX needs
+to tell whether a writer that did not close its ring still runs. A process
+id of zero is unknown and counts as running.
+*/
+bool hasProcessEnded(std::uint32_t process)
+{
+#ifdef _WIN32
+    (void)process;
+    return false;
+#else
+    return process != 0 && process <= (std::uint32_t)std::numeric_limits<pid_t>::max() && kill((pid_t)process, 0) == -1 && errno == ESRCH;
+#endif
+}
+
+// Only a writer that has stopped gives up its ring, since a live writer would go on writing into a ring nobody reads
+bool isAbandonedRing(const std::string &name)
+{
+    try
+    {
+        SharedMemory memory(name);
+        auto header = getHeader(memory);
+        if (memory.getSize() < headerSize || std::memcmp(header->magic, "HRSM", 4) != 0)
+            return false;
+        return header->closed.load(std::memory_order_acquire) != 0 || hasProcessEnded(header->writerProcess);
+    }
+    catch (const std::runtime_error &)
+    {
+        return false;
+    }
+}
+
+} // namespace
+
+SharedMemoryWriter::SharedMemoryWriter(const std::string &name, unsigned int width, unsigned int height, bool hasNoise, unsigned int slotCount)
+    : mSequence(0)
+{
+    if (width == 0 || height == 0 || slotCount < 2)
+        throw std::runtime_error("Invalid shared memory ring size");
+    auto channelCount = accumulationChannels + (hasNoise ? noiseChannels : 0);
+    auto pixelSize = (std::size_t)width * height * channelCount * sizeof(float);
+    auto slotSize = (headerSize + pixelSize + headerSize - 1) / headerSize * headerSize;
+
+    // Readers of an abandoned ring keep it, and see the new one once they open the name again
+    if (isAbandonedRing(name))
+        SharedMemory::remove(name);
+    mMemory = std::make_unique<SharedMemory>(name, headerSize + slotSize * slotCount);
+
+    // The sequence numbers are zero until the first snapshot, as the memory starts out cleared
+    auto header = new (mMemory->getData()) RingHeader();
+    header->slotCount = slotCount;
+    header->width = width;
+    header->height = height;
+    header->channelCount = channelCount;
+    header->slotSize = slotSize;
+    header->writerProcess = getProcessId();
+    for (auto i = 1u; i <= slotCount; ++i)
+        new (getSlot(*mMemory, i)) SlotHeader();
+    header->version = version;
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(header->magic, "HRSM", 4);
+}
+
+SharedMemoryWriter::~SharedMemoryWriter()
+{
+    getHeader(*mMemory)->closed.store(1, std::memory_order_release);
+}
+
+void SharedMemoryWriter::publish(const RawImage &image, std::uint64_t sceneHash)
+{
+    auto header = getHeader(*mMemory);
+    auto pixelCount = (std::size_t)header->width * header->height;
+    bool hasNoise = header->channelCount > accumulationChannels;
+    if (image.width != header->width || image.height != header->height || image.accumulation.size() != pixelCount * accumulationChannels ||
+        (hasNoise && image.noise.size() != pixelCount * accumulationChannels))
+        throw std::runtime_error("The image does not fit the shared memory ring");
+
+    auto sequence = mSequence + 1;
+    auto slot = getSlot(*mMemory, sequence);
+
+    // Readers that see an odd number, or a number that changed while they read, know the slot is not theirs
+    slot->sequence.store(sequence * 2 - 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->rayCount = image.rayCount;
+    slot->sceneHash = sceneHash;
+    auto pixels = getPixels(slot);
+    for (std::size_t i = 0; i < pixelCount; ++i)
+    {
+        std::memcpy(pixels, &image.accumulation[i * accumulationChannels], accumulationChannels * sizeof(float));
+        pixels += accumulationChannels;
+        if (hasNoise)
+        {
+            std::memcpy(pixels, &image.noise[i * accumulationChannels], noiseChannels * sizeof(float));
+            pixels += noiseChannels;
+        }
+    }
+    slot->sequence.store(sequence * 2, std::memory_order_release);
+    header->latestSequence.store(sequence, std::memory_order_release);
+    mSequence = sequence;
+}
+
+std::uint64_t SharedMemoryWriter::getSequence() const
+{
+    return mSequence;
+}
+
+SharedMemoryReader::SharedMemoryReader(const std::string &name)
+    : mMemory(std::make_unique<SharedMemory>(name))
+{
+    auto header = getHeader(*mMemory);
+    if (mMemory->getSize() < headerSize || std::memcmp(header->magic, "HRSM", 4) != 0)
+        throw std::runtime_error(name + " is not a snapshot ring");
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header->version != version)
+        throw std::runtime_error("Unsupported snapshot ring version " + std::to_string(header->version));
+
+    // Every slot must hold its header and pixels inside the memory, without the sizes overflowing
+    auto size = (std::uint64_t)mMemory->getSize();
+    bool validChannels = header->channelCount == accumulationChannels || header->channelCount == accumulationChannels + noiseChannels;
+    if (header->slotCount == 0 || header->width == 0 || header->height == 0 || !validChannels || header->slotSize < headerSize ||
+        header->slotSize % headerSize != 0 || header->slotSize > (size - headerSize) / header->slotCount ||
+        (std::uint64_t)header->width * header->height > (header->slotSize - headerSize) / (header->channelCount * sizeof(float)))
+        throw std::runtime_error(name + " is damaged");
+}
+
+SharedMemoryReader::~SharedMemoryReader() = default;
+
+bool SharedMemoryReader::beginRead(SharedSnapshot &snapshot, const float *&pixels) const
+{
+    auto header = getHeader(*mMemory);
+    while (true)
+    {
+        auto sequence = header->latestSequence.load(std::memory_order_acquire);
+        if (sequence == 0)
+            return false;
+
+        // The writer may have started on this slot again since it was the latest
+        auto slot = getSlot(*mMemory, sequence);
+        if (slot->sequence.load(std::memory_order_acquire) != sequence * 2)
+            continue;
+
+        snapshot.sequence = sequence;
+        snapshot.width = header->width;
+        snapshot.height = header->height;
+        snapshot.channelCount = header->channelCount;
+        snapshot.rayCount = slot->rayCount;
+        snapshot.sceneHash = slot->sceneHash;
+        pixels = getPixels(slot);
+        return true;
+    }
+}
+
+bool SharedMemoryReader::finishRead(const SharedSnapshot &snapshot) const
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return getSlot(*mMemory, snapshot.sequence)->sequence.load(std::memory_order_relaxed) == snapshot.sequence * 2;
+}
+
+bool SharedMemoryReader::readLatest(SharedSnapshot &snapshot, std::vector<float> &pixels) const
+{
+    while (true)
+    {
+        const float *source;
+        if (!beginRead(snapshot, source))
+            return false;
+        pixels.assign(source, source + (std::size_t)snapshot.width * snapshot.height * snapshot.channelCount);
+        if (finishRead(snapshot))
+            return true;
+    }
+}
+
+bool SharedMemoryReader::isClosed() const
+{
+    return getHeader(*mMemory)->closed.load(std::memory_order_acquire) != 0;
+}
+
+} // namespace HaloSim
@@ -0,0 +1,97 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "imageFile.h"
+
+namespace HaloSim
+{
+
+class SharedMemory;
+
+/*
+Snapshots of a simulation in shared memory, for viewers and analysis tools
+in other processes. The memory has a header followed by a ring of slots,
+each with a snapshot of the accumulation. The writer fills the slots in
+turn and never waits for readers, who check the sequence number of a slot
+before and after reading it to tell whether the writer overwrote it
+meanwhile.
+
+All values are little-endian. The header has
+- magic "HRSM" and a uint32 version of 1
+- uint32 slot count, width, height and channel count
+- uint32 closed flag, set once the writer has stopped
+- uint32 process id of the writer, 0 if it is unknown
+- uint64 slot size in bytes, including the slot header
+- uint64 sequence number of the latest complete snapshot, 0 before the first
+and the slots start 64 bytes from the start, each with
+- uint64 sequence number, odd while the slot is being written and twice the
+  snapshot number once it is complete
+- uint64 ray count and uint64 hash of the scene file
+and the pixels 64 bytes from the start of the slot. Pixels have the four
+floats of the accumulation, followed by the two noise sums when there are
+six channels, and the bottom row comes first. Snapshot n is in slot
+(n - 1) modulo the slot count.
+*/
+struct SharedSnapshot
+{
+    std::uint64_t sequence;
+    unsigned int width;
+    unsigned int height;
+    unsigned int channelCount;
+    unsigned long long rayCount;
+    std::uint64_t sceneHash;
+};
+
+class SharedMemoryWriter
+{
+public:
+    /*
+    Takes over a ring of the same name only if its writer has closed it or,
+    on POSIX systems, if the process of the writer no longer exists. Throws
+    std::runtime_error if the shared memory cannot be created, or if another
+    writer may still be using the name.
+    */
+    SharedMemoryWriter(const std::string &name, unsigned int width, unsigned int height, bool hasNoise, unsigned int slotCount = 3);
+    ~SharedMemoryWriter();
+    SharedMemoryWriter(const SharedMemoryWriter &) = delete;
+    SharedMemoryWriter &operator=(const SharedMemoryWriter &) = delete;
+
+    // The image must have the size of the ring, and a noise image if the ring has room for one
+    void publish(const RawImage &image, std::uint64_t sceneHash);
+
+    std::uint64_t getSequence() const;
+
+private:
+    std::unique_ptr<SharedMemory> mMemory;
+    std::uint64_t mSequence;
+};
+
+class SharedMemoryReader
+{
+public:
+    // Throws std::runtime_error if there is no such ring
+    explicit SharedMemoryReader(const std::string &name);
+    ~SharedMemoryReader();
+
+    /*
+    Points to the pixels of the latest snapshot in the shared memory itself,
+    without copying them. Returns false if there is no snapshot yet. The
+    pixels are only valid if finishRead returns true afterwards.
+    */
+    bool beginRead(SharedSnapshot &snapshot, const float *&pixels) const;
+    bool finishRead(const SharedSnapshot &snapshot) const;
+
+    // Copies the latest snapshot, trying again if the writer overwrites it during the copy
+    bool readLatest(SharedSnapshot &snapshot, std::vector<float> &pixels) const;
+
+    // A closed ring gets no more snapshots, and a new writer makes a new ring to open
+    bool isClosed() const;
+
+private:
+    std::unique_ptr<SharedMemory> mMemory;
+};
+
+} // namespace HaloSim
@@ -2,73 +2,268 @@
 #include <memory>
 #include <random>
 #include <limits>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <mutex>
+#include <QFile>
+#include <QOpenGLContext>
 #include <QOpenGLShaderProgram>
 #include "../opengl/texture.h"
+#include "../opengl/buffer.h"
 #include "camera.h"
 #include "lightSource.h"
 #include "crystalPopulation.h"
+#include "crystalGeometryTable.h"
 
 namespace HaloSim
 {
 
+const std::chrono::milliseconds SimulationEngine::previewSettleTime(200);
+
 SimulationEngine::SimulationEngine(
     unsigned int outputWidth,
     unsigned int outputHeight,
     std::shared_ptr<CrystalPopulationRepository> crystalRepository)
-    : mOutputWidth(outputWidth),
-      mOutputHeight(outputHeight),
-      mMersenneTwister(std::mt19937(std::random_device()())),
-      mUniformDistribution(std::uniform_int_distribution<unsigned int>(0, std::numeric_limits<unsigned int>::max())),
-      mRunning(false),
-      mRaysPerStep(500000),
-      mIteration(0),
+    : mStateVersion(1),
+      mSimulatedStateVersion(0),
+      mSimulationSnapshot(0),
+      mDisplaySnapshot(1),
+      mLatestSnapshot(2),
+      mStepFence(nullptr),
+      mPreviewing(false),
+      mOutputWidth(0),
+      mOutputHeight(0),
+      mResolutionDivisor(1),
+      mAccumulationCacheMemoryLimit(0),
+      mAccumulationSceneHash(0),
+      mRandomSeed(std::random_device()()),
+      mMersenneTwister(mRandomSeed),
+      mRandomCounter(0),
+      mRandomStreamIndex(0),
+      mRandomStreamCount(1),
+      mBatchJobCount(0),
+      mBatchDispatchWidth(0),
+      mBatchIteration(0),
       mInitialized(false),
-      mCamera(Camera::createDefaultCamera()),
-      mLight(LightSource::createDefaultLightSource()),
-      mCameraLockedToLightSource(false),
-      mMultipleScatteringProbability(0.0),
+      mIteration(0),
+      mWavefrontQueueCapacity(0),
+      mMaxRaysPerStep(0),
+      mAdaptiveRaysPerStep(0),
+      mTimedRays(0),
+      mTimerQueryPending(false),
+      mTimerQuery(0),
+      mRayCount(0),
+      mVisibleRayCountsPending(false),
+      mNoiseGroupCount(0),
+      mNoiseSumsPending(false),
+      mNoiseEstimate(-1.0),
       mCrystalRepository(crystalRepository)
 {
+    mState.scene.light = LightSource::createDefaultLightSource();
+    mState.scene.camera = Camera::createDefaultCamera();
+    mState.scene.multipleScatteringProbability = 0.0f;
+    mState.raysPerStep = 500000;
+    mState.maxIterations = std::numeric_limits<unsigned int>::max();
+    mState.maxRayCount = std::numeric_limits<unsigned long long>::max();
+    mState.pipeline = SimulationPipeline::Megakernel;
+    mState.running = false;
+    mState.cameraLockedToLightSource = false;
+    mState.adaptiveRayAllocation = false;
+    mState.noiseTracking = false;
+    mState.noiseTarget = 0.0;
+    mState.stepTimeBudget = 0;
+    mState.outputVisible = true;
+    mState.previewsEnabled = true;
+    mState.outputWidth = outputWidth;
+    mState.outputHeight = outputHeight;
+    clear();
 }
 
 bool SimulationEngine::isRunning() const
 {
-    return mRunning;
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    return mState.running;
 }
 
 Camera SimulationEngine::getCamera() const
 {
-    return mCamera;
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    return mState.scene.camera;
 }
 
 void SimulationEngine::setCamera(const Camera camera)
 {
-    clear();
-    mCamera = camera;
-    if (mCameraLockedToLightSource)
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    mState.scene.camera = camera;
+    if (mState.cameraLockedToLightSource)
     {
         pointCameraToLightSource();
     }
+    notifyStateChanged();
 }
 
 LightSource SimulationEngine::getLightSource() const
 {
-    return mLight;
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    return mState.scene.light;
 }
 
 void SimulationEngine::setLightSource(const LightSource light)
 {
-    clear();
-    mLight = light;
-    if (mCameraLockedToLightSource)
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    mState.scene.light = light;
+    if (mState.cameraLockedToLightSource)
     {
         pointCameraToLightSource();
     }
+    notifyStateChanged();
+}
+
+// Must be called with the state mutex locked
+void SimulationEngine::notifyStateChanged()
+{
+    ++mStateVersion;
+    mStateChanged.notify_all();
+}
+
+// Must be called with the state mutex locked
+bool SimulationEngine::hasWork() const
+{
+    return mStateVersion != mSimulatedStateVersion ||
+           (mState.running && (mPreviewing || (mIteration < mState.maxIterations && mRayCount < mState.maxRayCount && !isNoiseTargetReached(mState.noiseTarget))));
+}
+
+/*
+Blocks until there is something to simulate, or until the timeout expires.
+Returns true if there is something to simulate.
+*/
+bool SimulationEngine::waitForWork(std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(mStateMutex);
+    return mStateChanged.wait_for(lock, timeout, [this]() { return hasWork(); });
 }
 
 const unsigned int SimulationEngine::getOutputTextureHandle() const
 {
-    return mSimulationTexture->getHandle();
+    const auto &snapshot = mOutputSnapshots[mDisplaySnapshot];
+    return snapshot.texture == nullptr ? 0 : snapshot.texture->getHandle();
+}
+
+unsigned int SimulationEngine::getOutputTextureWidth() const
+{
+    const auto &snapshot = mOutputSnapshots[mDisplaySnapshot];
+    return snapshot.texture == nullptr ? 0 : snapshot.texture->getWidth();
+}
+
+unsigned int SimulationEngine::getOutputTextureHeight() const
+{
+    const auto &snapshot = mOutputSnapshots[mDisplaySnapshot];
+    return snapshot.texture == nullptr ? 0 : snapshot.texture->getHeight();
+}
+
+const unsigned int SimulationEngine::getOutputNoiseTextureHandle() const
+{
+    const auto &snapshot = mOutputSnapshots[mDisplaySnapshot];
+    return snapshot.noiseTexture == nullptr ? 0 : snapshot.noiseTexture->getHandle();
+}
+
+std::uint64_t SimulationEngine::getOutputSceneHash() const
+{
+    return mOutputSnapshots[mDisplaySnapshot].sceneHash;
+}
+
+unsigned int SimulationEngine::getOutputIteration() const
+{
+    return mOutputSnapshots[mDisplaySnapshot].iteration;
+}
+
+unsigned long long SimulationEngine::getOutputRayCount() const
+{
+    return mOutputSnapshots[mDisplaySnapshot].rayCount;
+}
+
+unsigned int SimulationEngine::getOutputResolutionDivisor() const
+{
+    return mOutputSnapshots[mDisplaySnapshot].resolutionDivisor;
+}
+
+Camera SimulationEngine::getOutputCamera() const
+{
+    return mOutputSnapshots[mDisplaySnapshot].camera;
+}
+
+/*
+Switches the displayed snapshot to the latest published one, if there is a
+newer one. This is called with the display context current, so it uses the
+OpenGL functions of that context instead of the ones of the engine. Nothing
+here waits for the GPU on the CPU.
+*/
+bool SimulationEngine::updateOutput()
+{
+    if ((mLatestSnapshot.load() & freshSnapshotFlag) == 0)
+        return false;
+
+    auto gl = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_4_4_Core>();
+
+    // Drawing the current snapshot must finish before it is written to again
+    auto &previousSnapshot = mOutputSnapshots[mDisplaySnapshot];
+    previousSnapshot.fence = gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    gl->glFlush();
+
+    mDisplaySnapshot = mLatestSnapshot.exchange(mDisplaySnapshot) & ~freshSnapshotFlag;
+
+    auto &snapshot = mOutputSnapshots[mDisplaySnapshot];
+    if (snapshot.fence != nullptr)
+    {
+        gl->glWaitSync(snapshot.fence, 0, GL_TIMEOUT_IGNORED);
+        gl->glDeleteSync(snapshot.fence);
+        snapshot.fence = nullptr;
+    }
+    return true;
+}
+
+void SimulationEngine::resolveOutput()
+{
+    auto &snapshot = mOutputSnapshots[mSimulationSnapshot];
+    if (snapshot.fence != nullptr)
+    {
+        glWaitSync(snapshot.fence, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(snapshot.fence);
+        snapshot.fence = nullptr;
+    }
+
+    // Snapshots are resized only when they are owned by the simulation
+    if (snapshot.texture == nullptr || snapshot.texture->getWidth() != mOutputWidth || snapshot.texture->getHeight() != mOutputHeight)
+        snapshot.texture = std::make_unique<OpenGL::Texture>(mOutputWidth, mOutputHeight, 2, OpenGL::TextureType::Color);
+
+    glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    glCopyImageSubData(mSimulationTexture->getHandle(), GL_TEXTURE_2D, 0, 0, 0, 0,
+                       snapshot.texture->getHandle(), GL_TEXTURE_2D, 0, 0, 0, 0,
+                       mOutputWidth, mOutputHeight, 1);
+
+    if (mNoiseTexture == nullptr)
+    {
+        snapshot.noiseTexture.reset();
+    }
+    else
+    {
+        if (snapshot.noiseTexture == nullptr || snapshot.noiseTexture->getWidth() != mOutputWidth || snapshot.noiseTexture->getHeight() != mOutputHeight)
+            snapshot.noiseTexture = std::make_unique<OpenGL::Texture>(mOutputWidth, mOutputHeight, 3, OpenGL::TextureType::Color);
+        glCopyImageSubData(mNoiseTexture->getHandle(), GL_TEXTURE_2D, 0, 0, 0, 0,
+                           snapshot.noiseTexture->getHandle(), GL_TEXTURE_2D, 0, 0, 0, 0,
+                           mOutputWidth, mOutputHeight, 1);
+    }
+
+    snapshot.iteration = mIteration;
+    snapshot.rayCount = mRayCount;
+    snapshot.resolutionDivisor = mResolutionDivisor;
+    snapshot.sceneHash = mAccumulationSceneHash;
+    snapshot.camera = mSimulatedState.scene.camera;
+    snapshot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+
+    mSimulationSnapshot = mLatestSnapshot.exchange(mSimulationSnapshot | freshSnapshotFlag) & ~freshSnapshotFlag;
 }
 
 unsigned int SimulationEngine::getIteration() const
@@ -76,93 +271,926 @@ unsigned int SimulationEngine::getIteration() const
     return mIteration;
 }
 
+unsigned int SimulationEngine::getMaxIterations() const
+{
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    return mState.maxIterations;
+}
+
+void SimulationEngine::setMaxIterations(unsigned int maxIterations)
+{
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    mState.maxIterations = maxIterations;
+    mStateChanged.notify_all();
+}
+
+unsigned long long SimulationEngine::getMaxRayCount() const
+{
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    return mState.maxRayCount;
+}
+
+void SimulationEngine::setMaxRayCount(unsigned long long rays)
+{
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    mState.maxRayCount = rays;
+    mStateChanged.notify_all();
+}
+
 void SimulationEngine::start()
 {
-    if (isRunning())
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    if (mState.running)
         return;
-    clear();
-    mRunning = true;
-    mIteration = 0;
+    mState.running = true;
+    notifyStateChanged();
 }
 
 void SimulationEngine::stop()
 {
-    mRunning = false;
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    mState.running = false;
+    mStateChanged.notify_all();
 }
 
+/*
+Takes the latest settings, restarting the simulation if they have changed,
+and simulates one more iteration if the simulation is running. The result is
+published as a new output snapshot. At most one step is queued on the GPU
+ahead of the one being executed.
+*/
 void SimulationEngine::step()
 {
-    ++mIteration;
+    if (!isReady())
+        return;
 
-    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-    glBindImageTexture(mSimulationTexture->getTextureUnit(), mSimulationTexture->getHandle(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
-    glClearTexImage(mSpinlockTexture->getHandle(), 0, GL_RED, GL_UNSIGNED_INT, NULL);
-    glBindImageTexture(mSpinlockTexture->getTextureUnit(), mSpinlockTexture->getHandle(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+    if (mStepFence != nullptr)
+    {
+        glClientWaitSync(mStepFence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(mStepFence);
+        mStepFence = nullptr;
+    }
+
+    // The previous step has finished, so its timer query result is available
+    if (mTimerQueryPending)
+    {
+        GLuint64 elapsedNanoseconds;
+        glGetQueryObjectui64v(mTimerQuery, GL_QUERY_RESULT, &elapsedNanoseconds);
+        mTimerQueryPending = false;
+        adaptRaysPerStep(elapsedNanoseconds);
+    }
 
-    mSimulationShader->bind();
+    if (mVisibleRayCountsPending || mNoiseSumsPending)
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    readVisibleRayCounts();
+    readNoiseEstimate();
 
-    for (auto i = 0u; i < mCrystalRepository->getCount(); ++i)
+    bool stateChanged = false;
+    {
+        std::lock_guard<std::mutex> lock(mStateMutex);
+        if (mStateVersion != mSimulatedStateVersion)
+        {
+            mSimulatedState = mState;
+            mSimulatedStateVersion = mStateVersion;
+            stateChanged = true;
+        }
+        mSimulatedState.running = mState.running;
+        mSimulatedState.maxIterations = mState.maxIterations;
+        mSimulatedState.maxRayCount = mState.maxRayCount;
+        mSimulatedState.stepTimeBudget = mState.stepTimeBudget;
+        mSimulatedState.outputVisible = mState.outputVisible;
+        mSimulatedState.previewsEnabled = mState.previewsEnabled;
+        mSimulatedState.adaptiveRayAllocation = mState.adaptiveRayAllocation;
+        mSimulatedState.noiseTarget = mState.noiseTarget;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (stateChanged)
+    {
+        storeAccumulation();
+        mAccumulationSceneHash = mSimulatedState.scene.getHash();
+        mIteration = 0;
+        mPreviewing = false;
+        if (!restoreAccumulation())
+        {
+            mPreviewing = mSimulatedState.running && mSimulatedState.outputVisible && mSimulatedState.previewsEnabled;
+            mPreviewEnd = now + previewSettleTime;
+        }
+    }
+    else if (mPreviewing && mSimulatedState.running && now >= mPreviewEnd)
     {
+        mPreviewing = false;
+        mIteration = 0;
+    }
+
+    if (mIteration == 0)
+        restartSimulation();
+
+    if (mSimulatedState.running && mIteration < mSimulatedState.maxIterations && mRayCount < mSimulatedState.maxRayCount &&
+        !isNoiseTargetReached(mSimulatedState.noiseTarget))
+    {
+        ++mIteration;
+
         glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-        unsigned int seed = mUniformDistribution(mMersenneTwister);
+        glBindImageTexture(mSimulationTexture->getTextureUnit(), mSimulationTexture->getHandle(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+        glClearTexImage(mSpinlockTexture->getHandle(), 0, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+        glBindImageTexture(mSpinlockTexture->getTextureUnit(), mSpinlockTexture->getHandle(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+        if (mNoiseTexture != nullptr)
+            glBindImageTexture(2, mNoiseTexture->getHandle(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
 
-        auto crystals = mCrystalRepository->get(i);
-        auto probability = mCrystalRepository->getProbability(i);
-        auto numRays = static_cast<unsigned int>(mRaysPerStep * probability);
+        updateGeometryTables();
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, mGeometryTableBuffer->getHandle());
 
-        /*
-        The following line needs to use glUniform1ui instead of the
-        setUniformValue method because of a bug in Qt:
-        https://bugreports.qt.io/browse/QTBUG-45507
-        */
-        glUniform1ui(glGetUniformLocation(mSimulationShader->programId(), "rngSeed"), seed);
-        mSimulationShader->setUniformValue("sun.altitude", mLight.altitude);
-        mSimulationShader->setUniformValue("sun.diameter", mLight.diameter);
+        const auto &scene = mSimulatedState.scene;
+        auto populationCount = scene.crystals.size();
+        if (mSimulatedState.adaptiveRayAllocation)
+        {
+            auto countersSize = std::max<std::size_t>(1, populationCount) * sizeof(unsigned int);
+            if (mVisibleRayCountBuffer == nullptr || mVisibleRayCountBuffer->getSize() < countersSize)
+                mVisibleRayCountBuffer = std::make_unique<OpenGL::Buffer>(countersSize);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, mVisibleRayCountBuffer->getHandle());
+            glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, mVisibleRayCountBuffer->getHandle());
+        }
 
-        mSimulationShader->setUniformValue("crystalProperties.caRatioAverage", crystals.caRatioAverage);
-        mSimulationShader->setUniformValue("crystalProperties.caRatioStd", crystals.caRatioStd);
+        auto stepRays = static_cast<unsigned int>(std::min<unsigned long long>(getStepRayCount(), mSimulatedState.maxRayCount - mRayCount));
+        auto rayFractions = getPopulationRayFractions();
+        mRayWeights.assign(populationCount, 0.0f);
+        mCountedRays.assign(populationCount, 0);
+        mTimedRays = 0;
+        glBeginQuery(GL_TIME_ELAPSED, mTimerQuery);
 
-        mSimulationShader->setUniformValue("crystalProperties.tiltDistribution", crystals.tiltDistribution);
-        mSimulationShader->setUniformValue("crystalProperties.tiltAverage", crystals.tiltAverage);
-        mSimulationShader->setUniformValue("crystalProperties.tiltStd", crystals.tiltStd);
+        // Rounding the running total of the rays makes the step trace exactly its number of rays
+        double cumulativeFraction = 0.0;
+        for (auto i = 0u; i < populationCount; ++i)
+        {
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
 
-        mSimulationShader->setUniformValue("crystalProperties.rotationDistribution", crystals.rotationDistribution);
-        mSimulationShader->setUniformValue("crystalProperties.rotationAverage", crystals.rotationAverage);
-        mSimulationShader->setUniformValue("crystalProperties.rotationStd", crystals.rotationStd);
+            auto firstRay = std::llround(stepRays * cumulativeFraction);
+            cumulativeFraction += rayFractions[i];
+            auto numRays = static_cast<unsigned int>(std::min<long long>(stepRays, std::llround(stepRays * cumulativeFraction)) - firstRay);
+            if (numRays == 0)
+                continue;
+            mRayWeights[i] = static_cast<float>(stepRays * scene.getCrystalProbability(i) / numRays);
+            mCountedRays[i] = numRays;
+            mTimedRays += numRays;
 
-        mSimulationShader->setUniformValue("camera.pitch", mCamera.pitch);
-        mSimulationShader->setUniformValue("camera.yaw", mCamera.yaw);
-        mSimulationShader->setUniformValue("camera.fov", mCamera.fov);
-        mSimulationShader->setUniformValue("camera.projection", mCamera.projection);
-        mSimulationShader->setUniformValue("camera.hideSubHorizon", mCamera.hideSubHorizon ? 1 : 0);
+            if (mSimulatedState.pipeline == SimulationPipeline::Wavefront || !mSimulatedState.views.empty())
+            {
+                traceWavefront(i, numRays);
+            }
+            else
+            {
+                setSimulationUniforms(mSimulationShader.get(), i);
+                glDispatchCompute(numRays, 1, 1);
+            }
+        }
 
-        mSimulationShader->setUniformValue("multipleScatter", mMultipleScatteringProbability);
+        glEndQuery(GL_TIME_ELAPSED);
+        mTimerQueryPending = true;
+        mVisibleRayCountsPending = mSimulatedState.adaptiveRayAllocation;
+        mRayCount += mTimedRays;
 
-        glDispatchCompute(numRays, 1, 1);
+        if (mNoiseTexture != nullptr)
+            estimateNoise();
     }
+
+    resolveOutput();
+    mStepFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 }
 
-void SimulationEngine::clear()
+/*
+Sums the relative errors and luminances of the pixels in work groups of
+16 x 16 pixels. The group sums are added up on the CPU after the step.
+*/
+void SimulationEngine::estimateNoise()
 {
-    if (!mInitialized)
+    const unsigned int groupSize = 16;
+    auto groupsX = (mOutputWidth + groupSize - 1) / groupSize;
+    auto groupsY = (mOutputHeight + groupSize - 1) / groupSize;
+    mNoiseGroupCount = groupsX * groupsY;
+
+    auto sumsSize = mNoiseGroupCount * 2 * sizeof(float);
+    if (mNoiseSumBuffer == nullptr || mNoiseSumBuffer->getSize() < sumsSize)
+        mNoiseSumBuffer = std::make_unique<OpenGL::Buffer>(sumsSize);
+
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    mNoiseShader->bind();
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, mNoiseSumBuffer->getHandle());
+    glDispatchCompute(groupsX, groupsY, 1);
+    mNoiseSumsPending = true;
+}
+
+void SimulationEngine::readNoiseEstimate()
+{
+    if (!mNoiseSumsPending)
+        return;
+    mNoiseSumsPending = false;
+
+    std::vector<float> groupSums(mNoiseGroupCount * 2);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mNoiseSumBuffer->getHandle());
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, groupSums.size() * sizeof(float), groupSums.data());
+
+    double errorSum = 0.0;
+    double luminanceSum = 0.0;
+    for (auto i = 0u; i < groupSums.size(); i += 2)
+    {
+        errorSum += groupSums[i];
+        luminanceSum += groupSums[i + 1];
+    }
+    mNoiseEstimate = luminanceSum > 0.0 ? errorSum / luminanceSum : -1.0;
+}
+
+bool SimulationEngine::isNoiseTargetReached(double target) const
+{
+    double estimate = mNoiseEstimate;
+    return target > 0.0 && estimate >= 0.0 && estimate <= target;
+}
+
+void SimulationEngine::resetPopulationStatistics()
+{
+    auto populationCount = mSimulatedState.scene.crystals.size();
+    mPopulationRayCounts.assign(populationCount, 0.0);
+    mPopulationVisibleRayCounts.assign(populationCount, 0.0);
+    mVisibleRayCountsPending = false;
+}
+
+// The previous step has finished, so reading its counts does not stall
+void SimulationEngine::readVisibleRayCounts()
+{
+    if (!mVisibleRayCountsPending)
+        return;
+    mVisibleRayCountsPending = false;
+
+    auto populationCount = mCountedRays.size();
+    std::vector<unsigned int> visibleRays(populationCount);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mVisibleRayCountBuffer->getHandle());
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, populationCount * sizeof(unsigned int), visibleRays.data());
+    for (auto i = 0u; i < populationCount && i < mPopulationRayCounts.size(); ++i)
+    {
+        mPopulationRayCounts[i] += mCountedRays[i];
+        mPopulationVisibleRayCounts[i] += visibleRays[i];
+    }
+}
+
+/*
+Without adaptive allocation, rays are allocated in proportion to the weights
+of the crystal populations. With it, half of the rays are allocated to
+minimize the sum over the populations of w^2 / (f h), where w is the weight
+share of a population, f its fraction of the rays and h the fraction of its
+rays that hit the image. The relative variance of the image of a population
+is inversely proportional to f h, the number of its rays that hit the image,
+so this is the sum of the relative variances of the population images, each
+counted by the square of the share of the scene the population makes up. A
+population that adds little to the image therefore cannot take most of the
+rays just because few of them hit. The minimum is at f proportional to
+w / sqrt(h). The other half keeps the proportional allocation, which bounds
+the ray weights to two at most.
+*/
+std::vector<double> SimulationEngine::getPopulationRayFractions() const
+{
+    const auto &scene = mSimulatedState.scene;
+    auto populationCount = scene.crystals.size();
+    std::vector<double> fractions(populationCount);
+    for (auto i = 0u; i < populationCount; ++i)
+        fractions[i] = scene.getCrystalProbability(i);
+
+    if (!mSimulatedState.adaptiveRayAllocation || mPopulationRayCounts.size() != populationCount)
+        return fractions;
+
+    // Estimates from fewer rays than this are too noisy to act on
+    const double minimumRayCount = 10000.0;
+    std::vector<double> scores(populationCount, 0.0);
+    double totalScore = 0.0;
+    for (auto i = 0u; i < populationCount; ++i)
+    {
+        if (fractions[i] <= 0.0 || mPopulationRayCounts[i] < minimumRayCount || mPopulationVisibleRayCounts[i] <= 0.0)
+            continue;
+        scores[i] = fractions[i] / std::sqrt(mPopulationVisibleRayCounts[i] / mPopulationRayCounts[i]);
+        totalScore += scores[i];
+    }
+    if (totalScore <= 0.0)
+        return fractions;
+
+    for (auto i = 0u; i < populationCount; ++i)
+        fractions[i] = 0.5 * fractions[i] + 0.5 * scores[i] / totalScore;
+    return fractions;
+}
+
+unsigned int SimulationEngine::getStepRayCount() const
+{
+    if (!mSimulatedState.outputVisible)
+        return mMaxRaysPerStep;
+    if (mSimulatedState.stepTimeBudget > 0)
+        return mAdaptiveRaysPerStep;
+    return std::min(mSimulatedState.raysPerStep, mMaxRaysPerStep);
+}
+
+/*
+Scales the number of rays so that the next step takes about as long as the
+time budget. The change per step is limited, since the time per ray varies
+between steps.
+*/
+void SimulationEngine::adaptRaysPerStep(GLuint64 elapsedNanoseconds)
+{
+    if (mSimulatedState.stepTimeBudget == 0 || mTimedRays == 0 || elapsedNanoseconds == 0)
+        return;
+
+    const double minimumRays = 1000.0;
+    double budgetNanoseconds = mSimulatedState.stepTimeBudget * 1.0e6;
+    double scale = std::min(2.0, std::max(0.5, budgetNanoseconds / elapsedNanoseconds));
+    double rays = std::min(static_cast<double>(mMaxRaysPerStep), std::max(minimumRays, mTimedRays * scale));
+    mAdaptiveRaysPerStep = static_cast<unsigned int>(rays);
+}
+
+void SimulationEngine::restartSimulation()
+{
+    mResolutionDivisor = mPreviewing ? previewResolutionDivisor : 1;
+    auto width = std::max(1u, mSimulatedState.outputWidth / mResolutionDivisor);
+    auto height = std::max(1u, mSimulatedState.outputHeight / mResolutionDivisor);
+    if (mSimulationTexture == nullptr || mOutputWidth != width || mOutputHeight != height)
+    {
+        mOutputWidth = width;
+        mOutputHeight = height;
+        initializeTextures();
+    }
+    if (!mSimulatedState.noiseTracking)
+        mNoiseTexture.reset();
+    else if (mNoiseTexture == nullptr || mNoiseTexture->getWidth() != width || mNoiseTexture->getHeight() != height)
+        mNoiseTexture = std::make_unique<OpenGL::Texture>(width, height, 3, OpenGL::TextureType::Color);
+    initializeViewTextures();
+    clearTextures();
+    mRayCount = 0;
+    mNoiseEstimate = -1.0;
+    mNoiseSumsPending = false;
+    resetPopulationStatistics();
+}
+
+std::size_t SimulationEngine::getDefaultAccumulationCacheMemoryLimit()
+{
+    bool ok;
+    auto megabytes = qgetenv("HALORAY_ACCUMULATION_CACHE_MB").toULongLong(&ok);
+    if (ok)
+        return static_cast<std::size_t>(std::min<unsigned long long>(megabytes, std::numeric_limits<std::size_t>::max() >> 20) << 20);
+
+    // Total video memory with NVIDIA drivers, and free texture memory with AMD drivers, in kilobytes
+    const GLenum totalMemoryNvx = 0x9048;
+    const GLenum textureFreeMemoryAti = 0x87FC;
+    GLint kilobytes[4] = {0, 0, 0, 0};
+    auto context = QOpenGLContext::currentContext();
+    if (context->hasExtension("GL_NVX_gpu_memory_info"))
+        glGetIntegerv(totalMemoryNvx, kilobytes);
+    else if (context->hasExtension("GL_ATI_meminfo"))
+        glGetIntegerv(textureFreeMemoryAti, kilobytes);
+    if (kilobytes[0] <= 0)
+        return 1024u * 1024u * 1024u;
+    return static_cast<std::size_t>(std::min<unsigned long long>(static_cast<unsigned long long>(kilobytes[0]) * 1024 / 4, std::numeric_limits<std::size_t>::max()));
+}
+
+static std::size_t getTextureMemorySize(const OpenGL::Texture &texture)
+{
+    // Accumulation textures have four 32-bit floats per pixel
+    return static_cast<std::size_t>(texture.getWidth()) * texture.getHeight() * 4 * sizeof(float);
+}
+
+/*
+Moves the current accumulation into the cache. Previews are not cached, and
+the least recently used accumulations are dropped to stay within the memory
+limit.
+*/
+void SimulationEngine::storeAccumulation()
+{
+    // Additional views are not cached, and always start over
+    if (mPreviewing || mIteration == 0 || mSimulationTexture == nullptr || !mViewTextures.empty())
+        return;
+    auto entryMemorySize = getTextureMemorySize(*mSimulationTexture) * (mNoiseTexture != nullptr ? 2 : 1);
+    if (entryMemorySize > mAccumulationCacheMemoryLimit)
+        return;
+
+    mAccumulationCache.push_front({mAccumulationSceneHash, std::move(mSimulationTexture), std::move(mNoiseTexture), mIteration, mRayCount});
+
+    std::size_t memorySize = 0;
+    for (auto entry = mAccumulationCache.begin(); entry != mAccumulationCache.end();)
+    {
+        memorySize += getTextureMemorySize(*entry->texture);
+        if (entry->noiseTexture != nullptr)
+            memorySize += getTextureMemorySize(*entry->noiseTexture);
+        if (memorySize > mAccumulationCacheMemoryLimit)
+            entry = mAccumulationCache.erase(entry);
+        else
+            ++entry;
+    }
+}
+
+/*
+Continues from a cached accumulation of the current scene at the current
+output size, if there is one.
+*/
+bool SimulationEngine::restoreAccumulation()
+{
+    if (!mSimulatedState.views.empty())
+        return false;
+
+    auto width = mSimulatedState.outputWidth;
+    auto height = mSimulatedState.outputHeight;
+    auto entry = std::find_if(mAccumulationCache.begin(), mAccumulationCache.end(), [&](const CachedAccumulation &cached) {
+        return cached.sceneHash == mAccumulationSceneHash && cached.texture->getWidth() == width && cached.texture->getHeight() == height &&
+               (cached.noiseTexture != nullptr) == mSimulatedState.noiseTracking;
+    });
+    if (entry == mAccumulationCache.end())
+        return false;
+
+    mSimulationTexture = std::move(entry->texture);
+    mNoiseTexture = std::move(entry->noiseTexture);
+    mNoiseEstimate = -1.0;
+    mNoiseSumsPending = false;
+    mIteration = entry->iteration;
+    mRayCount = entry->rayCount;
+    mAccumulationCache.erase(entry);
+    resetPopulationStatistics();
+
+    mResolutionDivisor = 1;
+    mOutputWidth = width;
+    mOutputHeight = height;
+    if (mSpinlockTexture == nullptr || mSpinlockTexture->getWidth() != width || mSpinlockTexture->getHeight() != height)
+        mSpinlockTexture = std::make_unique<OpenGL::Texture>(width, height, 1, OpenGL::TextureType::Monochrome);
+    return true;
+}
+
+/*
+Geometry tables only depend on the C/A ratio distributions of the crystal
+populations, so they are rebuilt and uploaded only when those change.
+*/
+void SimulationEngine::updateGeometryTables()
+{
+    const auto &crystals = mSimulatedState.scene.crystals;
+    auto populationCount = crystals.size();
+    bool tablesChanged = mGeometryTableBuffer == nullptr || mGeometryTablePopulations.size() != populationCount;
+    for (auto i = 0u; !tablesChanged && i < populationCount; ++i)
+    {
+        const auto &previous = mGeometryTablePopulations[i];
+        const auto &current = crystals[i];
+        tablesChanged = previous.caRatioAverage != current.caRatioAverage || previous.caRatioStd != current.caRatioStd;
+    }
+    if (!tablesChanged)
+        return;
+
+    std::vector<float> tableData;
+    mGeometryTablePopulations.clear();
+    mGeometryTableLocations.clear();
+    for (const auto &population : crystals)
+    {
+        mGeometryTablePopulations.push_back(population);
+        mGeometryTableLocations.push_back(appendGeometryTable(population, tableData));
+    }
+
+    mGeometryTableBuffer = std::make_unique<OpenGL::Buffer>(tableData.size() * sizeof(float), tableData.data());
+}
+
+SimulationEngine::GeometryTableLocation SimulationEngine::appendGeometryTable(const CrystalPopulation &population, std::vector<float> &tableData)
+{
+    CrystalGeometryTable table(population);
+
+    GeometryTableLocation location;
+    location.offset = static_cast<int>(tableData.size() / 4);
+    location.triangleCount = static_cast<int>(table.getTriangleCount());
+    location.caRatioMin = table.getCaRatioMin();
+    location.caRatioStep = table.getCaRatioStep();
+
+    tableData.insert(tableData.end(), table.getData().cbegin(), table.getData().cend());
+    return location;
+}
+
+void SimulationEngine::setSimulationUniforms(QOpenGLShaderProgram *program, unsigned int populationIndex)
+{
+    const auto &scene = mSimulatedState.scene;
+    const auto &crystals = scene.crystals[populationIndex];
+    const auto &geometryTable = mGeometryTableLocations[populationIndex];
+
+    program->bind();
+
+    /*
+    The following line needs to use glUniform1ui instead of the
+    setUniformValue method because of a bug in Qt:
+    https://bugreports.qt.io/browse/QTBUG-45507
+    */
+    unsigned int seed = nextRandomSeed();
+    glUniform1ui(glGetUniformLocation(program->programId(), "rngSeed"), seed);
+    program->setUniformValue("sun.altitude", scene.light.altitude);
+    program->setUniformValue("sun.diameter", scene.light.diameter);
+
+    program->setUniformValue("crystalProperties.caRatioAverage", crystals.caRatioAverage);
+    program->setUniformValue("crystalProperties.caRatioStd", crystals.caRatioStd);
+
+    program->setUniformValue("crystalProperties.tiltDistribution", crystals.tiltDistribution);
+    program->setUniformValue("crystalProperties.tiltAverage", crystals.tiltAverage);
+    program->setUniformValue("crystalProperties.tiltStd", crystals.tiltStd);
+
+    program->setUniformValue("crystalProperties.rotationDistribution", crystals.rotationDistribution);
+    program->setUniformValue("crystalProperties.rotationAverage", crystals.rotationAverage);
+    program->setUniformValue("crystalProperties.rotationStd", crystals.rotationStd);
+
+    setCameraUniforms(program, scene.camera);
+
+    program->setUniformValue("multipleScatter", scene.multipleScatteringProbability);
+    program->setUniformValue("rayWeight", mRayWeights[populationIndex]);
+    program->setUniformValue("countedPopulation", mSimulatedState.adaptiveRayAllocation ? static_cast<int>(populationIndex) : -1);
+    program->setUniformValue("trackNoise", mNoiseTexture != nullptr ? 1 : 0);
+
+    program->setUniformValue("geometryTable.offset", geometryTable.offset);
+    program->setUniformValue("geometryTable.binCount", static_cast<int>(CrystalGeometryTable::binCount));
+    program->setUniformValue("geometryTable.triangleCount", geometryTable.triangleCount);
+    program->setUniformValue("geometryTable.caRatioMin", geometryTable.caRatioMin);
+    program->setUniformValue("geometryTable.caRatioStep", geometryTable.caRatioStep);
+}
+
+void SimulationEngine::setQueueUniforms(QOpenGLShaderProgram *program, unsigned int inputQueue)
+{
+    program->bind();
+    glUniform1ui(glGetUniformLocation(program->programId(), "queueCapacity"), mWavefrontQueueCapacity);
+    glUniform1ui(glGetUniformLocation(program->programId(), "inputQueue"), inputQueue);
+}
+
+void SimulationEngine::setCameraUniforms(QOpenGLShaderProgram *program, const Camera &camera)
+{
+    program->bind();
+    program->setUniformValue("camera.pitch", camera.pitch);
+    program->setUniformValue("camera.yaw", camera.yaw);
+    program->setUniformValue("camera.fov", camera.fov);
+    program->setUniformValue("camera.projection", camera.projection);
+    program->setUniformValue("camera.hideSubHorizon", camera.hideSubHorizon ? 1 : 0);
+}
+
+/*
+Traces rays in stages that pass rays to each other through queues: rays are
+generated and enter their crystals, bounce once inside their crystals per
+bounce stage, and escaped rays are finally projected on the output image. The
+bounce and splat stages are dispatched indirectly, sized by a small prepare
+stage to the number of rays still alive, so that rays with many bounces do not
+hold back the rest of their work group.
+*/
+void SimulationEngine::traceWavefront(unsigned int populationIndex, unsigned int numRays)
+{
+    if (mRayQueues[0] == nullptr)
+        initializeWavefrontBuffers();
+
+    const unsigned int groupSize = 64;
+    const unsigned int bounceDispatchOffset = 0;
+    const unsigned int splatDispatchOffset = 4 * sizeof(unsigned int);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, mEscapedRayQueue->getHandle());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, mQueueCounters->getHandle());
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, mQueueCounters->getHandle());
+
+    // Rays are both bounced and scattered again from up to two crystals
+    const unsigned int bounceIterations = mSimulatedState.scene.multipleScatteringProbability > 0.0f ? 2 * 10 : 10;
+
+    for (auto firstRay = 0u; firstRay < numRays; firstRay += mWavefrontQueueCapacity)
+    {
+        auto chunkRays = std::min(mWavefrontQueueCapacity, numRays - firstRay);
+
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, mQueueCounters->getHandle());
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+
+        // Generated rays are written to the first queue
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mRayQueues[0]->getHandle());
+        setSimulationUniforms(mGenerateShader.get(), populationIndex);
+        setQueueUniforms(mGenerateShader.get(), 1);
+        glUniform1ui(glGetUniformLocation(mGenerateShader->programId(), "rayCount"), chunkRays);
+        glDispatchCompute((chunkRays + groupSize - 1) / groupSize, 1, 1);
+
+        setSimulationUniforms(mBounceShader.get(), populationIndex);
+        for (auto i = 0u; i < bounceIterations; ++i)
+        {
+            auto inputQueue = i % 2;
+
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            setQueueUniforms(mPrepareShader.get(), inputQueue);
+            glDispatchCompute(1, 1, 1);
+
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, mRayQueues[inputQueue]->getHandle());
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mRayQueues[1 - inputQueue]->getHandle());
+            setQueueUniforms(mBounceShader.get(), inputQueue);
+            glDispatchComputeIndirect(bounceDispatchOffset);
+        }
+
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        setQueueUniforms(mPrepareShader.get(), bounceIterations % 2);
+        glDispatchCompute(1, 1, 1);
+
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        setSimulationUniforms(mSplatShader.get(), populationIndex);
+        glDispatchComputeIndirect(splatDispatchOffset);
+        splatViews(splatDispatchOffset);
+    }
+}
+
+// Projects the escaped rays again into each additional view
+void SimulationEngine::splatViews(unsigned int splatDispatchOffset)
+{
+    const auto &views = mSimulatedState.views;
+    if (views.empty())
         return;
+
+    for (auto i = 0u; i < views.size(); ++i)
+    {
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        glBindImageTexture(0, mViewTextures[i]->getHandle(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+        glBindImageTexture(1, mViewSpinlockTextures[i]->getHandle(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+        setCameraUniforms(mSplatShader.get(), views[i].camera);
+        mSplatShader->setUniformValue("countedPopulation", -1);
+        mSplatShader->setUniformValue("trackNoise", 0);
+        glDispatchComputeIndirect(splatDispatchOffset);
+    }
+
     glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-    glClearTexImage(mSimulationTexture->getHandle(), 0, GL_RGBA, GL_FLOAT, NULL);
     glBindImageTexture(mSimulationTexture->getTextureUnit(), mSimulationTexture->getHandle(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
-    glClearTexImage(mSpinlockTexture->getHandle(), 0, GL_RED, GL_UNSIGNED_INT, NULL);
     glBindImageTexture(mSpinlockTexture->getTextureUnit(), mSpinlockTexture->getHandle(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
-    mIteration = 0;
+}
+
+void SimulationEngine::initializeWavefrontBuffers()
+{
+    // Position, direction and three rotation matrix columns
+    const std::size_t rayRecordSize = 5 * 4 * sizeof(unsigned int);
+    const std::size_t escapedRayRecordSize = 4 * sizeof(unsigned int);
+    const std::size_t countersSize = 12 * sizeof(unsigned int);
+
+    GLint64 maxBlockSize;
+    glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &maxBlockSize);
+    mWavefrontQueueCapacity = static_cast<unsigned int>(std::min<GLint64>(1 << 19, maxBlockSize / rayRecordSize));
+
+    mRayQueues[0] = std::make_unique<OpenGL::Buffer>(mWavefrontQueueCapacity * rayRecordSize);
+    mRayQueues[1] = std::make_unique<OpenGL::Buffer>(mWavefrontQueueCapacity * rayRecordSize);
+    mEscapedRayQueue = std::make_unique<OpenGL::Buffer>(mWavefrontQueueCapacity * escapedRayRecordSize);
+    mQueueCounters = std::make_unique<OpenGL::Buffer>(countersSize);
+}
+
+void SimulationEngine::setBatch(const std::vector<Scene> &scenes)
+{
+    mBatchScenes = scenes;
+    mBatchLayerTextures.clear();
+    mBatchTexture.reset();
+    mBatchSpinlockTexture.reset();
+    mBatchGeometryTableBuffer.reset();
+    mBatchJobBuffer.reset();
+    mBatchJobCount = 0;
+    mBatchDispatchWidth = 0;
+    mBatchIteration = 0;
+
+    if (scenes.empty())
+        return;
+
+    GLint maxLayers;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+    if (scenes.size() > static_cast<std::size_t>(maxLayers))
+        throw std::runtime_error("Too many scenes in batch");
+
+    /*
+    Each crystal population of each scene is a separate job with its own
+    geometry table, traced by one row of work groups in the dispatch.
+    */
+    unsigned int raysPerStep, width, height;
+    {
+        // Clamped like the interactive steps, as the rows of work groups are as wide as the rays of a job
+        std::lock_guard<std::mutex> lock(mStateMutex);
+        raysPerStep = std::min(mState.raysPerStep, mMaxRaysPerStep);
+        width = mState.outputWidth;
+        height = mState.outputHeight;
+    }
+
+    std::vector<float> tableData;
+    std::vector<BatchJob> jobs;
+    for (auto layer = 0u; layer < scenes.size(); ++layer)
+    {
+        const auto &scene = scenes[layer];
+        for (auto i = 0u; i < scene.crystals.size(); ++i)
+        {
+            auto numRays = static_cast<unsigned int>(raysPerStep * scene.getCrystalProbability(i));
+            if (numRays == 0)
+                continue;
+
+            const auto &crystals = scene.crystals[i];
+            auto geometryTable = appendGeometryTable(crystals, tableData);
+
+            BatchJob job;
+            job.sunAltitude = scene.light.altitude;
+            job.sunDiameter = scene.light.diameter;
+            job.multipleScatter = scene.multipleScatteringProbability;
+            job.layer = static_cast<int>(layer);
+            job.caRatioAverage = crystals.caRatioAverage;
+            job.caRatioStd = crystals.caRatioStd;
+            job.tiltDistribution = crystals.tiltDistribution;
+            job.tiltAverage = crystals.tiltAverage;
+            job.tiltStd = crystals.tiltStd;
+            job.rotationDistribution = crystals.rotationDistribution;
+            job.rotationAverage = crystals.rotationAverage;
+            job.rotationStd = crystals.rotationStd;
+            job.cameraPitch = scene.camera.pitch;
+            job.cameraYaw = scene.camera.yaw;
+            job.cameraFov = scene.camera.fov;
+            job.cameraProjection = scene.camera.projection;
+            job.cameraHideSubHorizon = scene.camera.hideSubHorizon ? 1 : 0;
+            job.geometryOffset = geometryTable.offset;
+            job.geometryBinCount = static_cast<int>(CrystalGeometryTable::binCount);
+            job.geometryTriangleCount = geometryTable.triangleCount;
+            job.geometryCaRatioMin = geometryTable.caRatioMin;
+            job.geometryCaRatioStep = geometryTable.caRatioStep;
+            job.rayCount = numRays;
+            jobs.push_back(job);
+
+            mBatchDispatchWidth = std::max(mBatchDispatchWidth, numRays);
+        }
+    }
+
+    GLint maxJobs;
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 1, &maxJobs);
+    if (jobs.size() > static_cast<std::size_t>(maxJobs))
+        throw std::runtime_error("Too many crystal populations in batch");
+
+    auto layers = static_cast<unsigned int>(scenes.size());
+    mBatchTexture = std::make_unique<OpenGL::Texture>(width, height, 0, OpenGL::TextureType::Color, layers);
+    mBatchSpinlockTexture = std::make_unique<OpenGL::Texture>(width, height, 1, OpenGL::TextureType::Monochrome, layers);
+    for (auto layer = 0u; layer < layers; ++layer)
+    {
+        mBatchLayerTextures.push_back(std::make_unique<OpenGL::Texture>(*mBatchTexture, layer));
+    }
+
+    if (!jobs.empty())
+    {
+        mBatchGeometryTableBuffer = std::make_unique<OpenGL::Buffer>(tableData.size() * sizeof(float), tableData.data());
+        mBatchJobBuffer = std::make_unique<OpenGL::Buffer>(jobs.size() * sizeof(BatchJob), jobs.data());
+        mBatchJobCount = static_cast<unsigned int>(jobs.size());
+    }
+
+    clearBatch();
+}
+
+void SimulationEngine::clearBatch()
+{
+    if (mBatchTexture == nullptr)
+        return;
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    glClearTexImage(mBatchTexture->getHandle(), 0, GL_RGBA, GL_FLOAT, NULL);
+    mBatchIteration = 0;
+}
+
+/*
+The rows of work groups are as wide as the job with the most rays, and the
+extra invocations of smaller jobs return immediately. Random seeds are
+derived from the index of the invocation in the whole dispatch, so that each
+job gets a distinct sequence.
+*/
+void SimulationEngine::stepBatch()
+{
+    if (!isReady() || mBatchJobCount == 0)
+        return;
+
+    ++mBatchIteration;
+
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    glClearTexImage(mBatchSpinlockTexture->getHandle(), 0, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+    glBindImageTexture(mBatchTexture->getTextureUnit(), mBatchTexture->getHandle(), 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA32F);
+    glBindImageTexture(mBatchSpinlockTexture->getTextureUnit(), mBatchSpinlockTexture->getHandle(), 0, GL_TRUE, 0, GL_READ_WRITE, GL_R32UI);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, mBatchGeometryTableBuffer->getHandle());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, mBatchJobBuffer->getHandle());
+
+    mBatchShader->bind();
+    unsigned int seed = nextRandomSeed();
+    glUniform1ui(glGetUniformLocation(mBatchShader->programId(), "rngSeed"), seed);
+    glDispatchCompute(mBatchDispatchWidth, mBatchJobCount, 1);
+
+    // Layers are read through texture views
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+}
+
+unsigned int SimulationEngine::getBatchSize() const
+{
+    return static_cast<unsigned int>(mBatchScenes.size());
+}
+
+unsigned int SimulationEngine::getBatchIteration() const
+{
+    return mBatchIteration;
+}
+
+const unsigned int SimulationEngine::getBatchTextureHandle() const
+{
+    return mBatchTexture->getHandle();
+}
+
+const unsigned int SimulationEngine::getBatchLayerTextureHandle(unsigned int layer) const
+{
+    return mBatchLayerTextures.at(layer)->getHandle();
+}
+
+void SimulationEngine::clear()
+{
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    mState.scene.crystals.clear();
+    mState.scene.crystalWeights.clear();
+    for (auto i = 0u; i < mCrystalRepository->getCount(); ++i)
+    {
+        mState.scene.crystals.push_back(mCrystalRepository->get(i));
+        mState.scene.crystalWeights.push_back(mCrystalRepository->getWeight(i));
+    }
+    notifyStateChanged();
+}
+
+void SimulationEngine::clearTextures()
+{
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    glClearTexImage(mSimulationTexture->getHandle(), 0, GL_RGBA, GL_FLOAT, NULL);
+    glClearTexImage(mSpinlockTexture->getHandle(), 0, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+    if (mNoiseTexture != nullptr)
+        glClearTexImage(mNoiseTexture->getHandle(), 0, GL_RGBA, GL_FLOAT, NULL);
+    for (auto i = 0u; i < mViewTextures.size(); ++i)
+    {
+        glClearTexImage(mViewTextures[i]->getHandle(), 0, GL_RGBA, GL_FLOAT, NULL);
+        glClearTexImage(mViewSpinlockTextures[i]->getHandle(), 0, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+    }
+}
+
+// View textures are kept as long as the sizes of the views stay the same
+void SimulationEngine::initializeViewTextures()
+{
+    const auto &views = mSimulatedState.views;
+    mViewTextures.resize(views.size());
+    mViewSpinlockTextures.resize(views.size());
+    for (auto i = 0u; i < views.size(); ++i)
+    {
+        const auto &view = views[i];
+        auto &texture = mViewTextures[i];
+        if (texture != nullptr && texture->getWidth() == view.width && texture->getHeight() == view.height)
+            continue;
+        texture = std::make_unique<OpenGL::Texture>(view.width, view.height, 0, OpenGL::TextureType::Color);
+        mViewSpinlockTextures[i] = std::make_unique<OpenGL::Texture>(view.width, view.height, 1, OpenGL::TextureType::Monochrome);
+    }
+}
+
+void SimulationEngine::setAdditionalViews(const std::vector<OutputView> &views)
+{
+    for (const auto &view : views)
+    {
+        if (view.width == 0 || view.height == 0)
+            throw std::runtime_error("Invalid view size");
+    }
+
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    mState.views = views;
+    notifyStateChanged();
+}
+
+std::vector<OutputView> SimulationEngine::getAdditionalViews() const
+{
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    return mState.views;
+}
+
+const unsigned int SimulationEngine::getViewTextureHandle(unsigned int index) const
+{
+    return mViewTextures.at(index)->getHandle();
 }
 
 unsigned int SimulationEngine::getRaysPerStep() const
 {
-    return mRaysPerStep;
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    return mState.raysPerStep;
 }
 
 void SimulationEngine::setRaysPerStep(unsigned int rays)
 {
-    clear();
-    mRaysPerStep = rays;
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    mState.raysPerStep = rays;
+    notifyStateChanged();
+}
+
+unsigned int SimulationEngine::getStepTimeBudget() const
+{
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    return mState.stepTimeBudget;
+}
+
+void SimulationEngine::setStepTimeBudget(unsigned int milliseconds)
+{
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    mState.stepTimeBudget = milliseconds;
+    mStateChanged.notify_all();
+}
+
+void SimulationEngine::setOutputVisible(bool visible)
+{
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    mState.outputVisible = visible;
+    mStateChanged.notify_all();
+}
+
+void SimulationEngine::setPreviewsEnabled(bool enabled)
+{
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    mState.previewsEnabled = enabled;
+    mStateChanged.notify_all();
 }
 
 void SimulationEngine::initialize()
@@ -170,23 +1198,188 @@ void SimulationEngine::initialize()
     if (mInitialized)
         return;
     initializeOpenGLFunctions();
-    initializeShader();
-    initializeTextures();
+    initializeShaders();
+
+    int maxComputeGroups;
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &maxComputeGroups);
+    const unsigned int absoluteMaxRaysPerStep = 5000000;
+    mMaxRaysPerStep = std::min(absoluteMaxRaysPerStep, static_cast<unsigned int>(maxComputeGroups));
+    mAdaptiveRaysPerStep = std::min(mMaxRaysPerStep, getRaysPerStep());
+    mAccumulationCacheMemoryLimit = getDefaultAccumulationCacheMemoryLimit();
+    glGenQueries(1, &mTimerQuery);
+
     mInitialized = true;
 }
 
-void SimulationEngine::initializeShader()
+/*
+Must be called on the simulation thread before its context is destroyed,
+since OpenGL objects can only be deleted with a context current.
+*/
+void SimulationEngine::releaseResources()
+{
+    if (!mInitialized)
+        return;
+    mInitialized = false;
+
+    if (mStepFence != nullptr)
+        glDeleteSync(mStepFence);
+    mStepFence = nullptr;
+    glDeleteQueries(1, &mTimerQuery);
+    mTimerQueryPending = false;
+    for (auto &snapshot : mOutputSnapshots)
+    {
+        if (snapshot.fence != nullptr)
+            glDeleteSync(snapshot.fence);
+        snapshot.fence = nullptr;
+        snapshot.texture.reset();
+        snapshot.noiseTexture.reset();
+    }
+
+    for (auto program : getShaderPrograms())
+        program->reset();
+    setBatch({});
+    mSimulationTexture.reset();
+    mSpinlockTexture.reset();
+    mViewTextures.clear();
+    mViewSpinlockTextures.clear();
+    mAccumulationCache.clear();
+    mRayQueues[0].reset();
+    mRayQueues[1].reset();
+    mEscapedRayQueue.reset();
+    mQueueCounters.reset();
+    mGeometryTableBuffer.reset();
+    mGeometryTablePopulations.clear();
+    mVisibleRayCountBuffer.reset();
+    mVisibleRayCountsPending = false;
+    mNoiseTexture.reset();
+    mNoiseSumBuffer.reset();
+    mNoiseSumsPending = false;
+}
+
+bool SimulationEngine::isReady() const
+{
+    return mInitialized;
+}
+
+std::vector<std::unique_ptr<QOpenGLShaderProgram> *> SimulationEngine::getShaderPrograms()
+{
+    return {
+        &mSimulationShader,
+        &mGenerateShader,
+        &mBounceShader,
+        &mPrepareShader,
+        &mSplatShader,
+        &mBatchShader,
+        &mNoiseShader,
+    };
+}
+
+QByteArray SimulationEngine::readShaderSource(std::initializer_list<QString> fileNames)
 {
-    mSimulationShader = std::make_unique<QOpenGLShaderProgram>();
-#ifdef _WIN32
-    mSimulationShader->addCacheableShaderFromSourceFile(QOpenGLShader::ShaderTypeBit::Compute, ":/shaders/raytrace.glsl");
-#else
-    mSimulationShader->addShaderFromSourceFile(QOpenGLShader::ShaderTypeBit::Compute, ":/shaders/raytrace.glsl");
-#endif
-    if (mSimulationShader->link() == false)
+    QByteArray source;
+    for (auto &fileName : fileNames)
     {
-        throw std::runtime_error(mSimulationShader->log().toUtf8());
+        QFile sourceFile(fileName);
+        if (!sourceFile.open(QIODevice::ReadOnly))
+            throw std::runtime_error(QString("Could not read shader source %1").arg(fileName).toUtf8());
+        source.append(sourceFile.readAll());
+        source.append('\n');
     }
+    return source;
+}
+
+// Defines must follow the version directive at the start of the source
+QByteArray SimulationEngine::addShaderDefine(QByteArray source, const QByteArray &name)
+{
+    auto versionEnd = source.indexOf('\n') + 1;
+    return source.insert(versionEnd, "#define " + name + "\n");
+}
+
+void SimulationEngine::initializeShaders()
+{
+    const QString common = ":/shaders/common.glsl";
+    const QString rayQueues = ":/shaders/wavefront/rayQueues.glsl";
+    std::vector<QByteArray> sources = {
+        readShaderSource({common, ":/shaders/raytrace.glsl"}),
+        readShaderSource({common, rayQueues, ":/shaders/wavefront/generate.glsl"}),
+        readShaderSource({common, rayQueues, ":/shaders/wavefront/bounce.glsl"}),
+        readShaderSource({common, rayQueues, ":/shaders/wavefront/prepare.glsl"}),
+        readShaderSource({common, rayQueues, ":/shaders/wavefront/splat.glsl"}),
+        addShaderDefine(readShaderSource({common, ":/shaders/batch.glsl", ":/shaders/raytrace.glsl"}), "BATCH"),
+        readShaderSource({":/shaders/noise.glsl"}),
+    };
+
+    OpenGL::ProgramBinaryCache cache;
+    auto driverIdentifier = getDriverIdentifier();
+    auto programs = getShaderPrograms();
+
+    for (auto i = 0u; i < sources.size(); ++i)
+    {
+        auto cacheKey = OpenGL::ProgramBinaryCache::computeKey(driverIdentifier, sources[i]);
+        OpenGL::ProgramBinary binary;
+        if (cache.load(cacheKey, binary))
+            *programs[i] = createProgramFromBinary(binary);
+
+        if (*programs[i] == nullptr)
+        {
+            *programs[i] = createProgramFromSource(sources[i], binary);
+            if (!binary.data.isEmpty())
+                cache.store(cacheKey, binary);
+        }
+    }
+}
+
+std::unique_ptr<QOpenGLShaderProgram> SimulationEngine::createProgramFromBinary(const OpenGL::ProgramBinary &binary)
+{
+    auto program = std::make_unique<QOpenGLShaderProgram>();
+    if (!program->create())
+        return nullptr;
+    glProgramBinary(program->programId(), binary.format, binary.data.constData(), binary.data.size());
+
+    // Linking a program without shaders only checks if the binary was accepted
+    if (program->link() == false)
+        return nullptr;
+    return program;
+}
+
+/*
+Compiles a program and retrieves its binary for the program binary cache. The
+binary is left empty if the driver does not support program binaries.
+*/
+std::unique_ptr<QOpenGLShaderProgram> SimulationEngine::createProgramFromSource(const QByteArray &source, OpenGL::ProgramBinary &binary)
+{
+    auto program = std::make_unique<QOpenGLShaderProgram>();
+    if (!program->create())
+        throw std::runtime_error("Could not create shader program");
+    glProgramParameteri(program->programId(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    program->addShaderFromSourceCode(QOpenGLShader::ShaderTypeBit::Compute, source);
+    if (program->link() == false)
+    {
+        throw std::runtime_error(program->log().toUtf8());
+    }
+
+    int binaryLength;
+    glGetProgramiv(program->programId(), GL_PROGRAM_BINARY_LENGTH, &binaryLength);
+    binary.data.clear();
+    if (binaryLength > 0)
+    {
+        GLenum format;
+        binary.data.resize(binaryLength);
+        glGetProgramBinary(program->programId(), binaryLength, NULL, &format, binary.data.data());
+        binary.format = format;
+    }
+    return program;
+}
+
+QByteArray SimulationEngine::getDriverIdentifier()
+{
+    QByteArray identifier;
+    for (auto name : {GL_VENDOR, GL_RENDERER, GL_VERSION})
+    {
+        identifier.append(reinterpret_cast<const char *>(glGetString(name)));
+        identifier.append('\n');
+    }
+    return identifier;
 }
 
 void SimulationEngine::initializeTextures()
@@ -195,40 +1388,186 @@ void SimulationEngine::initializeTextures()
     mSpinlockTexture = std::make_unique<OpenGL::Texture>(mOutputWidth, mOutputHeight, 1, OpenGL::TextureType::Monochrome);
 }
 
-void SimulationEngine::resizeOutputTextureCallback(const unsigned int width, const unsigned int height)
+void SimulationEngine::setOutputSize(unsigned int width, unsigned int height)
 {
-    mOutputWidth = width;
-    mOutputHeight = height;
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    if (mState.outputWidth == width && mState.outputHeight == height)
+        return;
+    mState.outputWidth = width;
+    mState.outputHeight = height;
+    notifyStateChanged();
+}
 
-    mSimulationTexture.reset();
-    mSpinlockTexture.reset();
+unsigned int SimulationEngine::getOutputWidth() const
+{
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    return mState.outputWidth;
+}
 
-    initializeTextures();
-    clear();
+unsigned int SimulationEngine::getOutputHeight() const
+{
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    return mState.outputHeight;
 }
 
 void SimulationEngine::lockCameraToLightSource(bool locked)
 {
-    mCameraLockedToLightSource = locked;
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    mState.cameraLockedToLightSource = locked;
     pointCameraToLightSource();
+    notifyStateChanged();
 }
 
+// Must be called with the state mutex locked
 void SimulationEngine::pointCameraToLightSource()
 {
-    clear();
-    mCamera.yaw = 0.0f;
-    mCamera.pitch = mLight.altitude;
+    mState.scene.camera.yaw = 0.0f;
+    mState.scene.camera.pitch = mState.scene.light.altitude;
 }
 
 void SimulationEngine::setMultipleScatteringProbability(double probability)
 {
-    clear();
-    mMultipleScatteringProbability = static_cast<float>(std::min(std::max(probability, 0.0), 1.0));
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    mState.scene.multipleScatteringProbability = static_cast<float>(std::min(std::max(probability, 0.0), 1.0));
+    notifyStateChanged();
 }
 
 double SimulationEngine::getMultipleScatteringProbability() const
 {
-    return static_cast<double>(mMultipleScatteringProbability);
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    return static_cast<double>(mState.scene.multipleScatteringProbability);
+}
+
+void SimulationEngine::setAdaptiveRayAllocation(bool enabled)
+{
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    mState.adaptiveRayAllocation = enabled;
+    mStateChanged.notify_all();
+}
+
+bool SimulationEngine::getAdaptiveRayAllocation() const
+{
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    return mState.adaptiveRayAllocation;
+}
+
+void SimulationEngine::setNoiseTracking(bool enabled)
+{
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    if (mState.noiseTracking == enabled)
+        return;
+    mState.noiseTracking = enabled;
+    notifyStateChanged();
+}
+
+bool SimulationEngine::getNoiseTracking() const
+{
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    return mState.noiseTracking;
+}
+
+void SimulationEngine::setNoiseTarget(double relativeError)
+{
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    mState.noiseTarget = relativeError;
+    mStateChanged.notify_all();
+}
+
+double SimulationEngine::getNoiseTarget() const
+{
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    return mState.noiseTarget;
+}
+
+double SimulationEngine::getNoiseEstimate() const
+{
+    return mNoiseEstimate;
+}
+
+void SimulationEngine::setPipeline(SimulationPipeline pipeline)
+{
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    mState.pipeline = pipeline;
+    notifyStateChanged();
+}
+
+SimulationPipeline SimulationEngine::getPipeline() const
+{
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    return mState.pipeline;
+}
+
+void SimulationEngine::setRandomSeed(std::uint32_t seed)
+{
+    mRandomSeed = seed;
+    mMersenneTwister.seed(seed);
+    mRandomCounter = 0;
+}
+
+std::uint32_t SimulationEngine::getRandomSeed() const
+{
+    return mRandomSeed;
+}
+
+void SimulationEngine::setRandomStream(unsigned int index, unsigned int count)
+{
+    if (count == 0 || index >= count)
+        throw std::runtime_error("Invalid random stream");
+    mRandomStreamIndex = index;
+    mRandomStreamCount = count;
+}
+
+std::uint64_t SimulationEngine::getRandomCounter() const
+{
+    return mRandomCounter;
+}
+
+// Each seed is a single draw, so that the generator can be wound forward to any counter
+unsigned int SimulationEngine::nextRandomSeed()
+{
+    mMersenneTwister.discard(mRandomStreamIndex);
+    auto seed = static_cast<unsigned int>(mMersenneTwister());
+    mMersenneTwister.discard(mRandomStreamCount - 1 - mRandomStreamIndex);
+    mRandomCounter += mRandomStreamCount;
+    return seed;
+}
+
+/*
+The accumulation is added to the cache of the current scene, and restored
+like any other cached accumulation when the first step starts the scene
+*/
+void SimulationEngine::resumeAccumulation(unsigned int iteration, unsigned long long rayCount, std::uint64_t randomCounter, const std::vector<float> &accumulation, const std::vector<float> &noise)
+{
+    SimulationState state;
+    {
+        std::lock_guard<std::mutex> lock(mStateMutex);
+        state = mState;
+    }
+    auto size = static_cast<std::size_t>(state.outputWidth) * state.outputHeight * 4;
+    if (accumulation.size() != size || (state.noiseTracking && noise.size() != size))
+        throw std::runtime_error("The accumulation does not match the output size");
+
+    auto texture = std::make_unique<OpenGL::Texture>(state.outputWidth, state.outputHeight, 0, OpenGL::TextureType::Color);
+    glBindTexture(GL_TEXTURE_2D, texture->getHandle());
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, state.outputWidth, state.outputHeight, GL_RGBA, GL_FLOAT, accumulation.data());
+    std::unique_ptr<OpenGL::Texture> noiseTexture;
+    if (state.noiseTracking)
+    {
+        noiseTexture = std::make_unique<OpenGL::Texture>(state.outputWidth, state.outputHeight, 3, OpenGL::TextureType::Color);
+        glBindTexture(GL_TEXTURE_2D, noiseTexture->getHandle());
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, state.outputWidth, state.outputHeight, GL_RGBA, GL_FLOAT, noise.data());
+    }
+    mAccumulationCache.push_front({state.scene.getHash(), std::move(texture), std::move(noiseTexture), iteration, rayCount});
+
+    mMersenneTwister.seed(mRandomSeed);
+    mMersenneTwister.discard(randomCounter);
+    mRandomCounter = randomCounter;
+}
+
+Scene SimulationEngine::getScene() const
+{
+    std::lock_guard<std::mutex> lock(mStateMutex);
+    return mState.scene;
 }
 
 } // namespace HaloSim
@@ -1,34 +1,100 @@
 #pragma once
 #include <random>
 #include <memory>
+#include <vector>
+#include <list>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <initializer_list>
+#include <QByteArray>
 #include <QOpenGLShaderProgram>
 #include <QOpenGLFunctions_4_4_Core>
 #include "../opengl/texture.h"
+#include "../opengl/buffer.h"
+#include "../opengl/programBinaryCache.h"
 #include "camera.h"
 #include "lightSource.h"
 #include "crystalPopulation.h"
 #include "crystalPopulationRepository.h"
+#include "scene.h"
 
 namespace HaloSim
 {
 
+enum SimulationPipeline
+{
+    Megakernel = 0,
+    Wavefront
+};
+
+// A camera looking at the simulated rays, with an image of its own
+struct OutputView
+{
+    Camera camera;
+    unsigned int width;
+    unsigned int height;
+};
+
+/*
+The simulation is run on its own thread with its own OpenGL context, see
+SimulationThread. Settings can be changed from any thread, and the changes
+are picked up by the next step. Methods that use OpenGL must be called on the
+simulation thread, except for the output methods, which are called on the
+thread of the context that displays the output.
+*/
 class SimulationEngine : protected QOpenGLFunctions_4_4_Core
 {
 public:
     SimulationEngine(unsigned int outputWidth, unsigned int outputHeight, std::shared_ptr<CrystalPopulationRepository> crystalRepository);
+
     void initialize();
-    void start();
+    void releaseResources();
+    bool isReady() const;
     void step();
+    bool waitForWork(std::chrono::milliseconds timeout);
+
+    void start();
     void stop();
     bool isRunning() const;
 
+    /*
+    Restarts the simulation, reading the crystal populations again from the
+    repository. Must be called on the thread that modifies the repository.
+    */
     void clear();
 
     unsigned int getIteration() const;
 
+    unsigned int getMaxIterations() const;
+    void setMaxIterations(unsigned int maxIterations);
+
+    // The simulation stops at this many rays, and the last step is cut short to not trace more
+    unsigned long long getMaxRayCount() const;
+    void setMaxRayCount(unsigned long long rays);
+
     unsigned int getRaysPerStep() const;
     void setRaysPerStep(unsigned int rays);
 
+    /*
+    With a time budget, the number of rays per step is adapted so that each
+    step takes about the given time on the GPU, leaving room for drawing the
+    user interface. Zero disables the budget. While the output is not
+    visible, steps are as large as possible regardless of these settings.
+    */
+    unsigned int getStepTimeBudget() const;
+    void setStepTimeBudget(unsigned int milliseconds);
+    void setOutputVisible(bool visible);
+
+    /*
+    Low resolution previews are shown for a moment after the settings change,
+    which is only of use while someone is changing them. Renders without a
+    view turn previews off.
+    */
+    void setPreviewsEnabled(bool enabled);
+
     Camera getCamera() const;
     void setCamera(const Camera);
 
@@ -40,32 +106,338 @@ public:
     void setMultipleScatteringProbability(double);
     double getMultipleScatteringProbability() const;
 
-    const unsigned int getOutputTextureHandle() const;
+    void setPipeline(SimulationPipeline pipeline);
+    SimulationPipeline getPipeline() const;
+
+    /*
+    With adaptive ray allocation, crystal populations whose rays seldom hit
+    the image get more rays than their weights would give them, in
+    proportion to their weights, and their rays are weighted down to keep
+    the result the same.
+    */
+    void setAdaptiveRayAllocation(bool enabled);
+    bool getAdaptiveRayAllocation() const;
+
+    /*
+    Noise tracking accumulates per pixel sums of squared luminance and ray
+    counts next to the output, and estimates the average relative error of
+    the pixels, weighted by their brightness, after each step. Changing it
+    restarts the simulation. With a noise target, the simulation stops once
+    the estimate falls below the target. The estimate is negative until
+    there is one.
+    */
+    void setNoiseTracking(bool enabled);
+    bool getNoiseTracking() const;
+    void setNoiseTarget(double relativeError);
+    double getNoiseTarget() const;
+    double getNoiseEstimate() const;
+
+    Scene getScene() const;
+
+    /*
+    Seeds the random numbers of the simulation, which are otherwise seeded
+    randomly. Must be called on the simulation thread.
+    */
+    void setRandomSeed(std::uint32_t seed);
+    std::uint32_t getRandomSeed() const;
+
+    /*
+    Deals the random seeds out to several engines, so that the shards of a
+    render never share a seed. This engine then only uses every count-th
+    seed, starting from the index-th. Must be called on the simulation thread.
+    */
+    void setRandomStream(unsigned int index, unsigned int count);
 
-    void resizeOutputTextureCallback(const unsigned int width, const unsigned int height);
+    // Number of random seeds drawn since the engine was seeded, including those of other streams
+    std::uint64_t getRandomCounter() const;
+
+    /*
+    Continues the simulation of the current scene at the current output size
+    from an accumulation saved earlier, with the images, iteration, ray count
+    and random counter it had. Images have four floats per pixel, and the
+    noise image is needed with noise tracking. Must be called on the
+    simulation thread after initialize and before the first step, and throws
+    std::runtime_error if the images do not fit.
+    */
+    void resumeAccumulation(unsigned int iteration, unsigned long long rayCount, std::uint64_t randomCounter, const std::vector<float> &accumulation, const std::vector<float> &noise);
+
+    /*
+    Size of the simulated image in pixels, independent of how large it is
+    displayed.
+    */
+    void setOutputSize(unsigned int width, unsigned int height);
+    unsigned int getOutputWidth() const;
+    unsigned int getOutputHeight() const;
+
+    /*
+    Additional views project the same rays as the main camera into images of
+    their own, so they cost no extra crystal tracing. Escaped rays are only
+    kept by the wavefront pipeline, which is therefore always used while there
+    are additional views. The view textures are used on the simulation thread.
+    */
+    void setAdditionalViews(const std::vector<OutputView> &views);
+    std::vector<OutputView> getAdditionalViews() const;
+    const unsigned int getViewTextureHandle(unsigned int index) const;
+
+    /*
+    Renders several scenes into the layers of an array texture, tracing all
+    crystal populations of all scenes with a single dispatch per batch step.
+    The rays per step at the time the batch is set, limited to what one
+    dispatch can trace like the interactive steps, are used for every scene.
+    Batches are always traced with the single pass pipeline.
+    */
+    void setBatch(const std::vector<Scene> &scenes);
+    void clearBatch();
+    void stepBatch();
+    unsigned int getBatchSize() const;
+    unsigned int getBatchIteration() const;
+    const unsigned int getBatchTextureHandle() const;
+    const unsigned int getBatchLayerTextureHandle(unsigned int layer) const;
+
+    /*
+    Each step publishes a snapshot of the simulation result. Call updateOutput
+    to switch to the latest published snapshot, which then stays the same
+    until the next call. The texture handle is zero before the first snapshot.
+    While settings are being changed, the output is a preview with a fraction
+    of the full resolution, given by the resolution divisor. With noise
+    tracking, the snapshot also has a copy of the noise sums, and the scene
+    hash tells apart snapshots of different scenes. The texture size is the
+    full resolution, even for previews.
+    */
+    bool updateOutput();
+    const unsigned int getOutputTextureHandle() const;
+    unsigned int getOutputTextureWidth() const;
+    unsigned int getOutputTextureHeight() const;
+    const unsigned int getOutputNoiseTextureHandle() const;
+    std::uint64_t getOutputSceneHash() const;
+    unsigned int getOutputIteration() const;
+    unsigned long long getOutputRayCount() const;
+    unsigned int getOutputResolutionDivisor() const;
+    Camera getOutputCamera() const;
 
 private:
-    void initializeShader();
+    struct SimulationState
+    {
+        Scene scene;
+        unsigned int raysPerStep;
+        unsigned int maxIterations;
+        unsigned long long maxRayCount;
+        SimulationPipeline pipeline;
+        bool running;
+        bool cameraLockedToLightSource;
+        bool adaptiveRayAllocation;
+        bool noiseTracking;
+        double noiseTarget;
+        unsigned int stepTimeBudget;
+        bool outputVisible;
+        bool previewsEnabled;
+        unsigned int outputWidth;
+        unsigned int outputHeight;
+        std::vector<OutputView> views;
+    };
+
+    struct OutputSnapshot
+    {
+        std::unique_ptr<OpenGL::Texture> texture;
+        std::unique_ptr<OpenGL::Texture> noiseTexture;
+        GLsync fence = nullptr;
+        unsigned int iteration = 0;
+        unsigned long long rayCount = 0;
+        unsigned int resolutionDivisor = 1;
+        std::uint64_t sceneHash = 0;
+        Camera camera;
+    };
+
+    struct CachedAccumulation
+    {
+        std::uint64_t sceneHash;
+        std::unique_ptr<OpenGL::Texture> texture;
+        std::unique_ptr<OpenGL::Texture> noiseTexture;
+        unsigned int iteration;
+        unsigned long long rayCount;
+    };
+
+    struct GeometryTableLocation
+    {
+        int offset;
+        int triangleCount;
+        float caRatioMin;
+        float caRatioStep;
+    };
+
+    // Matches the layout of batchJob_t in batch.glsl
+    struct BatchJob
+    {
+        float sunAltitude;
+        float sunDiameter;
+        float multipleScatter;
+        int layer;
+
+        float caRatioAverage;
+        float caRatioStd;
+        int tiltDistribution;
+        float tiltAverage;
+        float tiltStd;
+        int rotationDistribution;
+        float rotationAverage;
+        float rotationStd;
+
+        float cameraPitch;
+        float cameraYaw;
+        float cameraFov;
+        int cameraProjection;
+        int cameraHideSubHorizon;
+
+        int geometryOffset;
+        int geometryBinCount;
+        int geometryTriangleCount;
+        float geometryCaRatioMin;
+        float geometryCaRatioStep;
+
+        unsigned int rayCount;
+    };
+
+    void initializeShaders();
+    void initializeWavefrontBuffers();
+    std::vector<std::unique_ptr<QOpenGLShaderProgram> *> getShaderPrograms();
+    static QByteArray readShaderSource(std::initializer_list<QString> fileNames);
+    static QByteArray addShaderDefine(QByteArray source, const QByteArray &name);
+    std::unique_ptr<QOpenGLShaderProgram> createProgramFromBinary(const OpenGL::ProgramBinary &binary);
+    std::unique_ptr<QOpenGLShaderProgram> createProgramFromSource(const QByteArray &source, OpenGL::ProgramBinary &binary);
+    QByteArray getDriverIdentifier();
     void initializeTextures();
+    void initializeViewTextures();
+    void clearTextures();
+    void restartSimulation();
+    void resetPopulationStatistics();
+    void readVisibleRayCounts();
+    std::vector<double> getPopulationRayFractions() const;
+    void estimateNoise();
+    void readNoiseEstimate();
+    bool isNoiseTargetReached(double target) const;
+    std::size_t getDefaultAccumulationCacheMemoryLimit();
+    void storeAccumulation();
+    bool restoreAccumulation();
     void pointCameraToLightSource();
+    void notifyStateChanged();
+    bool hasWork() const;
+    unsigned int getStepRayCount() const;
+    void adaptRaysPerStep(GLuint64 elapsedNanoseconds);
+    void resolveOutput();
+    void updateGeometryTables();
+    static GeometryTableLocation appendGeometryTable(const CrystalPopulation &population, std::vector<float> &tableData);
+    void setSimulationUniforms(QOpenGLShaderProgram *program, unsigned int populationIndex);
+    unsigned int nextRandomSeed();
+    void setCameraUniforms(QOpenGLShaderProgram *program, const Camera &camera);
+    void setQueueUniforms(QOpenGLShaderProgram *program, unsigned int inputQueue);
+    void traceWavefront(unsigned int populationIndex, unsigned int numRays);
+    void splatViews(unsigned int splatDispatchOffset);
+
+    /*
+    Settings requested from any thread, and the copy of them being simulated.
+    The simulation restarts whenever the state version changes.
+    */
+    mutable std::mutex mStateMutex;
+    std::condition_variable mStateChanged;
+    SimulationState mState;
+    unsigned int mStateVersion;
+    SimulationState mSimulatedState;
+    unsigned int mSimulatedStateVersion;
+
+    /*
+    Snapshots are passed from the simulation to the display without locks:
+    both sides own one snapshot each, and exchange it with the latest one.
+    Fences order the GPU commands of the two contexts using a snapshot.
+    */
+    static const unsigned int freshSnapshotFlag = 1u << 31;
+    OutputSnapshot mOutputSnapshots[3];
+    unsigned int mSimulationSnapshot;
+    unsigned int mDisplaySnapshot;
+    std::atomic<unsigned int> mLatestSnapshot;
+    GLsync mStepFence;
+
+    /*
+    After a restart the simulation accumulates a low resolution preview, and
+    switches to full resolution once the settings have not changed for a
+    while.
+    */
+    static const unsigned int previewResolutionDivisor = 4;
+    static const std::chrono::milliseconds previewSettleTime;
+    bool mPreviewing;
+    std::chrono::steady_clock::time_point mPreviewEnd;
 
     unsigned int mOutputWidth;
     unsigned int mOutputHeight;
+    unsigned int mResolutionDivisor;
+
+    /*
+    Accumulations of recently simulated scenes, most recently used first, so
+    that going back to one of them continues where it was left. The cache
+    may use a quarter of the video memory, or 1 GiB if the driver does not
+    tell how much there is, unless HALORAY_ACCUMULATION_CACHE_MB says
+    otherwise.
+    */
+    std::size_t mAccumulationCacheMemoryLimit;
+    std::list<CachedAccumulation> mAccumulationCache;
+    std::uint64_t mAccumulationSceneHash;
+    std::uint32_t mRandomSeed;
     std::mt19937 mMersenneTwister;
-    std::uniform_int_distribution<unsigned int> mUniformDistribution;
+    std::uint64_t mRandomCounter;
+    unsigned int mRandomStreamIndex;
+    unsigned int mRandomStreamCount;
     std::unique_ptr<QOpenGLShaderProgram> mSimulationShader;
+    std::unique_ptr<QOpenGLShaderProgram> mGenerateShader;
+    std::unique_ptr<QOpenGLShaderProgram> mBounceShader;
+    std::unique_ptr<QOpenGLShaderProgram> mPrepareShader;
+    std::unique_ptr<QOpenGLShaderProgram> mSplatShader;
+    std::unique_ptr<QOpenGLShaderProgram> mBatchShader;
+    std::unique_ptr<QOpenGLShaderProgram> mNoiseShader;
     std::unique_ptr<OpenGL::Texture> mSimulationTexture;
     std::unique_ptr<OpenGL::Texture> mSpinlockTexture;
+    std::vector<std::unique_ptr<OpenGL::Texture>> mViewTextures;
+    std::vector<std::unique_ptr<OpenGL::Texture>> mViewSpinlockTextures;
+    std::unique_ptr<OpenGL::Buffer> mRayQueues[2];
+    std::unique_ptr<OpenGL::Buffer> mEscapedRayQueue;
+    std::unique_ptr<OpenGL::Buffer> mQueueCounters;
+    std::unique_ptr<OpenGL::Buffer> mGeometryTableBuffer;
+
+    /*
+    Rays traced and rays that hit the image per crystal population since the
+    restart, and the weights of the rays of each population in this step
+    */
+    std::unique_ptr<OpenGL::Buffer> mVisibleRayCountBuffer;
+    std::vector<double> mPopulationRayCounts;
+    std::vector<double> mPopulationVisibleRayCounts;
+    std::vector<unsigned int> mCountedRays;
+    std::vector<float> mRayWeights;
+    bool mVisibleRayCountsPending;
 
-    Camera mCamera;
-    LightSource mLight;
+    std::unique_ptr<OpenGL::Texture> mNoiseTexture;
+    std::unique_ptr<OpenGL::Buffer> mNoiseSumBuffer;
+    unsigned int mNoiseGroupCount;
+    bool mNoiseSumsPending;
+    std::atomic<double> mNoiseEstimate;
+    std::vector<GeometryTableLocation> mGeometryTableLocations;
+    std::vector<CrystalPopulation> mGeometryTablePopulations;
+    std::vector<Scene> mBatchScenes;
+    std::unique_ptr<OpenGL::Texture> mBatchTexture;
+    std::unique_ptr<OpenGL::Texture> mBatchSpinlockTexture;
+    std::vector<std::unique_ptr<OpenGL::Texture>> mBatchLayerTextures;
+    std::unique_ptr<OpenGL::Buffer> mBatchGeometryTableBuffer;
+    std::unique_ptr<OpenGL::Buffer> mBatchJobBuffer;
+    unsigned int mBatchJobCount;
+    unsigned int mBatchDispatchWidth;
+    unsigned int mBatchIteration;
 
-    bool mRunning;
-    bool mInitialized;
-    unsigned int mRaysPerStep;
-    unsigned int mIteration;
-    bool mCameraLockedToLightSource;
-    float mMultipleScatteringProbability;
+    std::atomic<bool> mInitialized;
+    std::atomic<unsigned int> mIteration;
+    unsigned int mWavefrontQueueCapacity;
+    unsigned int mMaxRaysPerStep;
+    unsigned int mAdaptiveRaysPerStep;
+    unsigned int mTimedRays;
+    bool mTimerQueryPending;
+    GLuint mTimerQuery;
+    unsigned long long mRayCount;
     std::shared_ptr<CrystalPopulationRepository> mCrystalRepository;
 };
 
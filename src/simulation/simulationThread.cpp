@@ -0,0 +1,167 @@
+#include "simulationThread.h"
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <QCoreApplication>
+
+namespace HaloSim
+{
+
+namespace
+{
+const double foregroundWeight = 4.0;
+const double backgroundWeight = 1.0;
+}
+
+SimulationThread::SimulationThread(QOpenGLContext *shareContext, std::shared_ptr<SimulationEngine> engine)
+    : mContext(std::make_unique<QOpenGLContext>()),
+      mSurface(std::make_unique<QOffscreenSurface>()),
+      mEngine(engine),
+      mSchedulerPass(0.0),
+      mOutputVisible(true),
+      mOutputVisibilityChanged(false)
+{
+    // The surface and the context must be created on the GUI thread
+    mSurface->setFormat(shareContext->format());
+    mSurface->create();
+
+    mContext->setFormat(shareContext->format());
+    mContext->setShareContext(shareContext);
+    if (!mContext->create())
+        throw std::runtime_error("Could not create shared OpenGL context for simulation");
+    mContext->moveToThread(this);
+
+    mJobs.push_back({mEngine, foregroundWeight, 0.0});
+}
+
+SimulationThread::~SimulationThread()
+{
+    requestInterruption();
+    wait();
+}
+
+void SimulationThread::addBackgroundJob(std::shared_ptr<SimulationEngine> engine)
+{
+    std::lock_guard<std::mutex> lock(mPendingJobsMutex);
+    mAddedJobs.push_back(engine);
+}
+
+/*
+The resources of the engine are released on the simulation thread, so the
+output of the engine must no longer be displayed.
+*/
+void SimulationThread::removeBackgroundJob(std::shared_ptr<SimulationEngine> engine)
+{
+    std::lock_guard<std::mutex> lock(mPendingJobsMutex);
+    mRemovedJobs.push_back(engine);
+}
+
+void SimulationThread::setOutputVisible(bool visible)
+{
+    // The foreground engine is told right away, as the thread may be waiting for it
+    mEngine->setOutputVisible(visible);
+    std::lock_guard<std::mutex> lock(mPendingJobsMutex);
+    mOutputVisible = visible;
+    mOutputVisibilityChanged = true;
+}
+
+// Takes the jobs added and removed, and the visibility set, since the previous call
+void SimulationThread::updateJobs()
+{
+    std::vector<std::shared_ptr<SimulationEngine>> added;
+    std::vector<std::shared_ptr<SimulationEngine>> removed;
+    bool outputVisible;
+    bool outputVisibilityChanged;
+    {
+        std::lock_guard<std::mutex> lock(mPendingJobsMutex);
+        added.swap(mAddedJobs);
+        removed.swap(mRemovedJobs);
+        outputVisible = mOutputVisible;
+        outputVisibilityChanged = mOutputVisibilityChanged;
+        mOutputVisibilityChanged = false;
+    }
+
+    if (outputVisibilityChanged)
+    {
+        for (auto &job : mJobs)
+            job.engine->setOutputVisible(outputVisible);
+    }
+
+    for (auto &engine : added)
+    {
+        engine->initialize();
+        engine->setOutputVisible(outputVisible);
+        mJobs.push_back({engine, backgroundWeight, mSchedulerPass});
+    }
+
+    for (auto &engine : removed)
+    {
+        auto job = std::find_if(mJobs.begin() + 1, mJobs.end(), [&](const Job &job) { return job.engine == engine; });
+        if (job == mJobs.end())
+            continue;
+        engine->releaseResources();
+        mJobs.erase(job);
+    }
+}
+
+SimulationThread::Job *SimulationThread::selectJob()
+{
+    Job *selected = nullptr;
+    for (auto &job : mJobs)
+    {
+        if (!job.engine->waitForWork(std::chrono::milliseconds(0)))
+            continue;
+
+        // Jobs that were idle do not get to catch up with the others
+        job.pass = std::max(job.pass, mSchedulerPass);
+        if (selected == nullptr || job.pass < selected->pass)
+            selected = &job;
+    }
+    return selected;
+}
+
+void SimulationThread::run()
+{
+    if (!mContext->makeCurrent(mSurface.get()))
+    {
+        emit failed("Could not make simulation context current");
+        return;
+    }
+
+    try
+    {
+        mEngine->initialize();
+        while (!isInterruptionRequested())
+        {
+            updateJobs();
+
+            auto job = selectJob();
+            if (job == nullptr)
+            {
+                // Interruption requests and new jobs are checked at least this often while idle
+                mEngine->waitForWork(std::chrono::milliseconds(20));
+                continue;
+            }
+
+            mSchedulerPass = job->pass;
+            job->pass += 1.0 / job->weight;
+            job->engine->step();
+
+            if (job->engine == mEngine)
+                emit stepCompleted(mEngine->getIteration());
+            else
+                emit backgroundStepCompleted();
+        }
+    }
+    catch (const std::exception &e)
+    {
+        emit failed(QString::fromUtf8(e.what()));
+    }
+
+    for (auto &job : mJobs)
+        job.engine->releaseResources();
+    mContext->doneCurrent();
+    mContext->moveToThread(QCoreApplication::instance()->thread());
+}
+
+} // namespace HaloSim
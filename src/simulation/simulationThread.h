@@ -0,0 +1,74 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <QThread>
+#include <QString>
+#include <QOpenGLContext>
+#include <QOffscreenSurface>
+#include "simulationEngine.h"
+
+namespace HaloSim
+{
+
+/*
+Runs simulation engines on their own thread, using an OpenGL context shared
+with the context that displays the output. The foreground engine is the one
+being interacted with, and background engines continue rendering other
+scenes with the spare capacity. The thread sleeps while there is nothing to
+simulate, and signals each completed step.
+*/
+class SimulationThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    SimulationThread(QOpenGLContext *shareContext, std::shared_ptr<SimulationEngine> engine);
+    ~SimulationThread();
+
+    void addBackgroundJob(std::shared_ptr<SimulationEngine> engine);
+    void removeBackgroundJob(std::shared_ptr<SimulationEngine> engine);
+
+    // Applies to the foreground engine and every background engine, including those added later
+    void setOutputVisible(bool visible);
+
+signals:
+    void stepCompleted(unsigned int iteration);
+    void backgroundStepCompleted();
+    void failed(QString error);
+
+protected:
+    void run() override;
+
+private:
+    /*
+    Steps are shared between the engines with work in proportion to their
+    weights, by always stepping the engine with the smallest pass. A step
+    advances the pass of its engine by the inverse of the weight.
+    */
+    struct Job
+    {
+        std::shared_ptr<SimulationEngine> engine;
+        double weight;
+        double pass;
+    };
+
+    void updateJobs();
+    Job *selectJob();
+
+    std::unique_ptr<QOpenGLContext> mContext;
+    std::unique_ptr<QOffscreenSurface> mSurface;
+    std::shared_ptr<SimulationEngine> mEngine;
+
+    std::vector<Job> mJobs;
+    double mSchedulerPass;
+
+    // Background jobs added and removed from other threads
+    std::mutex mPendingJobsMutex;
+    std::vector<std::shared_ptr<SimulationEngine>> mAddedJobs;
+    std::vector<std::shared_ptr<SimulationEngine>> mRemovedJobs;
+    bool mOutputVisible;
+    bool mOutputVisibilityChanged;
+};
+
+} // namespace HaloSim
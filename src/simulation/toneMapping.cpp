@@ -0,0 +1,60 @@
+#include "toneMapping.h"
+#include <cmath>
+#include <algorithm>
+
+namespace HaloSim
+{
+
+float getExposure(double brightness, unsigned long long rayCount, unsigned int width, unsigned int height, unsigned int resolutionDivisor, float fieldOfView)
+{
+    // Relative to the default output size, where each pixel gets the same share of the rays
+    const double referenceRayCount = 500000.0;
+    const double referencePixelCount = 1920.0 * 1080.0;
+    const double divisor = resolutionDivisor;
+    double pixelScale = std::max(1.0, (double)width * height) / referencePixelCount;
+    return (float)(brightness * referenceRayCount * pixelScale / std::max(1ull, rayCount) / (divisor * divisor) / (fieldOfView / 180.0));
+}
+
+namespace
+{
+
+template <typename T>
+std::vector<T> toneMap(unsigned int width, unsigned int height, const std::vector<float> &xyz, float exposure, float maxValue)
+{
+    const float xyzToSrgb[3][3] = {
+        {3.2406f, -1.5372f, -0.4986f},
+        {-0.9689f, 1.8758f, 0.0415f},
+        {0.0557f, -0.2040f, 1.0570f},
+    };
+
+    std::vector<T> result((std::size_t)width * height * 3);
+    for (auto y = 0u; y < height; ++y)
+    {
+        for (auto x = 0u; x < width; ++x)
+        {
+            const float *pixel = &xyz[((std::size_t)(height - 1 - y) * width + x) * 4];
+            T *output = &result[((std::size_t)y * width + x) * 3];
+            for (auto c = 0; c < 3; ++c)
+            {
+                float linear = exposure * (xyzToSrgb[c][0] * pixel[0] + xyzToSrgb[c][1] * pixel[1] + xyzToSrgb[c][2] * pixel[2]);
+                float gammaCorrected = std::pow(std::min(1.0f, std::max(0.0f, linear)), 0.42f);
+                output[c] = (T)std::lround(maxValue * gammaCorrected);
+            }
+        }
+    }
+    return result;
+}
+
+} // namespace
+
+std::vector<unsigned char> toneMapToSrgb(unsigned int width, unsigned int height, const std::vector<float> &xyz, float exposure)
+{
+    return toneMap<unsigned char>(width, height, xyz, exposure, 255.0f);
+}
+
+std::vector<std::uint16_t> toneMapToSrgb16(unsigned int width, unsigned int height, const std::vector<float> &xyz, float exposure)
+{
+    return toneMap<std::uint16_t>(width, height, xyz, exposure, 65535.0f);
+}
+
+} // namespace HaloSim
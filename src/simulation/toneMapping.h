@@ -0,0 +1,22 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+namespace HaloSim
+{
+
+/*
+Conversion of simulated XYZ images to 8-bit sRGB, the same way as the view
+displays them. Brightness is normalized by the number of rays traced, so
+that it does not depend on how many rays each step traces, by the number of
+pixels of the full resolution image and the pixel area of a lower resolution
+preview, so that it does not depend on the output size, and by the field of
+view. The width and height are those of the full resolution image.
+*/
+float getExposure(double brightness, unsigned long long rayCount, unsigned int width, unsigned int height, unsigned int resolutionDivisor, float fieldOfView);
+
+// Takes four floats per pixel, bottom row first, and returns RGB rows from the top
+std::vector<unsigned char> toneMapToSrgb(unsigned int width, unsigned int height, const std::vector<float> &xyz, float exposure);
+std::vector<std::uint16_t> toneMapToSrgb16(unsigned int width, unsigned int height, const std::vector<float> &xyz, float exposure);
+
+} // namespace HaloSim
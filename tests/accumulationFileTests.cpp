@@ -0,0 +1,297 @@
+#include "test.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#include "simulation/accumulationFile.h"
+
+using HaloSim::AccumulationFileReader;
+using HaloSim::RawImage;
+
+namespace
+{
+
+const unsigned int width = 37;
+const unsigned int height = 23;
+const unsigned int tileSize = 8;
+
+RawImage createImage()
+{
+    RawImage image;
+    image.width = width;
+    image.height = height;
+    image.accumulation.resize((std::size_t)width * height * 4);
+    image.noise.resize((std::size_t)width * height * 4);
+    image.rayCount = 123456789012ull;
+    image.exposure = 0.0f;
+    image.scene = "{\"format\": \"haloray-scene\", \"version\": 1}\n";
+    image.seed = 3;
+    image.randomStreamIndex = 1;
+    image.randomStreamCount = 4;
+    return image;
+}
+
+// Noise only has the luminance squares and ray counts, and the other two channels read back as zeros
+RawImage createRandomImage()
+{
+    auto image = createImage();
+    std::mt19937 random(11);
+    std::uniform_real_distribution<float> values(0.0f, 1000.0f);
+    for (auto &value : image.accumulation)
+        value = values(random);
+    for (std::size_t i = 0; i < image.noise.size(); i += 4)
+    {
+        image.noise[i] = values(random);
+        image.noise[i + 1] = std::floor(values(random));
+    }
+
+    // Values that only survive if every bit does
+    image.accumulation[0] = -0.0f;
+    image.accumulation[1] = 1e-40f;
+    image.accumulation[2] = INFINITY;
+    image.accumulation[3] = 3.4e38f;
+    return image;
+}
+
+RawImage createConstantImage()
+{
+    auto image = createImage();
+    for (std::size_t i = 0; i < image.accumulation.size(); ++i)
+        image.accumulation[i] = 0.25f * (float)(i % 4);
+    for (std::size_t i = 0; i < image.noise.size(); i += 4)
+    {
+        image.noise[i] = 0.5f;
+        image.noise[i + 1] = 7.0f;
+    }
+    return image;
+}
+
+bool haveSameBits(const std::vector<float> &a, const std::vector<float> &b)
+{
+    return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0;
+}
+
+std::uint64_t getFileSize(const std::string &filename)
+{
+    std::ifstream stream(filename, std::ios::binary | std::ios::ate);
+    return (std::uint64_t)stream.tellg();
+}
+
+// The pixels of a region of an image with four floats per pixel
+std::vector<float> crop(const std::vector<float> &pixels, unsigned int imageWidth, unsigned int x, unsigned int y, unsigned int regionWidth, unsigned int regionHeight)
+{
+    std::vector<float> region;
+    for (auto row = y; row < y + regionHeight; ++row)
+    {
+        auto begin = pixels.begin() + ((std::ptrdiff_t)row * imageWidth + x) * 4;
+        region.insert(region.end(), begin, begin + (std::ptrdiff_t)regionWidth * 4);
+    }
+    return region;
+}
+
+void checkRoundTrip(const RawImage &image, bool compressed)
+{
+    Test::TemporaryFile file("roundTrip.hra");
+    HaloSim::writeAccumulationFile(file.getFilename(), image, tileSize, compressed);
+    CHECK(!std::ifstream(file.getFilename() + ".tmp"));
+
+    AccumulationFileReader reader(file.getFilename());
+    CHECK_EQUAL(reader.getWidth(), width);
+    CHECK_EQUAL(reader.getHeight(), height);
+    CHECK_EQUAL(reader.getTileSize(), tileSize);
+    CHECK(reader.hasNoise());
+    CHECK_EQUAL(reader.getRayCount(), image.rayCount);
+    CHECK_EQUAL(reader.getSeed(), image.seed);
+    CHECK_EQUAL(reader.getRandomStreamIndex(), image.randomStreamIndex);
+    CHECK_EQUAL(reader.getRandomStreamCount(), image.randomStreamCount);
+    CHECK_EQUAL(reader.getScene(), image.scene);
+
+    auto result = reader.readImage();
+    CHECK_EQUAL(result.width, width);
+    CHECK_EQUAL(result.height, height);
+    CHECK(haveSameBits(result.accumulation, image.accumulation));
+    CHECK(haveSameBits(result.noise, image.noise));
+}
+
+} // namespace
+
+TEST(accumulationFileRoundTripKeepsRandomTiles)
+{
+    checkRoundTrip(createRandomImage(), true);
+    checkRoundTrip(createRandomImage(), false);
+}
+
+TEST(accumulationFileRoundTripKeepsConstantTiles)
+{
+    checkRoundTrip(createConstantImage(), true);
+    checkRoundTrip(createConstantImage(), false);
+}
+
+TEST(accumulationFileCompressesConstantTiles)
+{
+    Test::TemporaryFile packed("packed.hra");
+    Test::TemporaryFile raw("raw.hra");
+    HaloSim::writeAccumulationFile(packed.getFilename(), createConstantImage(), tileSize, true);
+    HaloSim::writeAccumulationFile(raw.getFilename(), createConstantImage(), tileSize, false);
+    CHECK(getFileSize(packed.getFilename()) * 4 < getFileSize(raw.getFilename()));
+
+    // Random tiles do not compress, and are stored as they are instead of growing
+    HaloSim::writeAccumulationFile(packed.getFilename(), createRandomImage(), tileSize, true);
+    HaloSim::writeAccumulationFile(raw.getFilename(), createRandomImage(), tileSize, false);
+    CHECK(getFileSize(packed.getFilename()) <= getFileSize(raw.getFilename()));
+}
+
+TEST(accumulationFileReadsRegionsAcrossTiles)
+{
+    Test::TemporaryFile file("regions.hra");
+    HaloSim::writeAccumulationFile(file.getFilename(), createRandomImage(), tileSize, true);
+    AccumulationFileReader reader(file.getFilename());
+    auto image = reader.readImage();
+
+    const unsigned int regions[][4] = {
+        {0, 0, width, height},
+        {5, 3, 20, 13},
+        {7, 7, 2, 2},
+        {8, 8, 8, 8},
+        {30, 15, 7, 8},
+        {36, 22, 1, 1},
+        {0, 22, width, 1},
+    };
+    for (const auto &region : regions)
+    {
+        auto accumulation = reader.readAccumulation(0, region[0], region[1], region[2], region[3]);
+        CHECK(haveSameBits(accumulation, crop(image.accumulation, width, region[0], region[1], region[2], region[3])));
+        auto noise = reader.readNoise(0, region[0], region[1], region[2], region[3]);
+        CHECK(haveSameBits(noise, crop(image.noise, width, region[0], region[1], region[2], region[3])));
+    }
+
+    CHECK_THROWS(reader.readAccumulation(0, 30, 0, 8, 1));
+    CHECK_THROWS(reader.readAccumulation(0, 0, 23, 1, 1));
+    CHECK_THROWS(reader.readAccumulation(reader.getLevelCount(), 0, 0, 1, 1));
+}
+
+TEST(accumulationFileLevelsHoldPixelSums)
+{
+    Test::TemporaryFile file("levels.hra");
+    auto image = createRandomImage();
+    HaloSim::writeAccumulationFile(file.getFilename(), image, tileSize, true);
+    AccumulationFileReader reader(file.getFilename());
+
+    auto lastLevel = reader.getLevelCount() - 1;
+    CHECK(reader.getWidth(lastLevel) <= tileSize && reader.getHeight(lastLevel) <= tileSize);
+
+    // Summed in the same order as the writer, so that the sums match exactly, except for the hit markers
+    auto level = reader.readImage(0);
+    for (auto i = 1u; i <= lastLevel; ++i)
+    {
+        auto next = reader.readImage(i);
+        CHECK_EQUAL(next.width, (level.width + 1) / 2);
+        CHECK_EQUAL(next.height, (level.height + 1) / 2);
+        std::vector<float> sums(next.accumulation.size(), 0.0f);
+        for (auto y = 0u; y < level.height; ++y)
+        {
+            for (auto x = 0u; x < level.width; ++x)
+            {
+                for (auto c = 0u; c < 4; ++c)
+                {
+                    auto &sum = sums[((std::size_t)(y / 2) * next.width + x / 2) * 4 + c];
+                    auto value = level.accumulation[((std::size_t)y * level.width + x) * 4 + c];
+                    sum = c == 3 ? std::max(sum, value) : sum + value;
+                }
+            }
+        }
+        CHECK(haveSameBits(next.accumulation, sums));
+        level = next;
+    }
+}
+
+TEST(accumulationFileRejectsDamagedFiles)
+{
+    Test::TemporaryFile file("damaged.hra");
+    HaloSim::writeAccumulationFile(file.getFilename(), createConstantImage(), tileSize, true);
+    std::string bytes;
+    {
+        std::ifstream stream(file.getFilename(), std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+    }
+
+    // A file cut short is noticed when it is opened or, at the latest, when its last tile is read
+    for (auto size : {std::size_t(0), std::size_t(3), std::size_t(40), bytes.size() / 2, bytes.size() - 1})
+    {
+        {
+            std::ofstream stream(file.getFilename(), std::ios::binary | std::ios::trunc);
+            stream.write(bytes.data(), (std::streamsize)size);
+        }
+        bool thrown = false;
+        try
+        {
+            AccumulationFileReader reader(file.getFilename());
+            for (auto level = 0u; level < reader.getLevelCount(); ++level)
+                reader.readImage(level);
+        }
+        catch (const std::runtime_error &)
+        {
+            thrown = true;
+        }
+        if (!thrown)
+            Test::fail(__FILE__, __LINE__, "Read a file cut to " + std::to_string(size) + " bytes");
+    }
+}
+
+TEST(accumulationFileMergeAddsUpStreams)
+{
+    Test::TemporaryFile first("first.hra");
+    Test::TemporaryFile second("second.hra");
+    auto image = createConstantImage();
+    image.randomStreamIndex = 0;
+    image.randomStreamCount = 2;
+    HaloSim::writeAccumulationFile(first.getFilename(), image, tileSize, true);
+    image.randomStreamIndex = 1;
+    HaloSim::writeAccumulationFile(second.getFilename(), image, tileSize, true);
+
+    auto merged = HaloSim::mergeAccumulationFiles({first.getFilename(), second.getFilename()});
+    CHECK_EQUAL(merged.rayCount, image.rayCount * 2);
+    CHECK_EQUAL(merged.accumulation[1], image.accumulation[1] * 2.0f);
+    CHECK_EQUAL(merged.noise[0], image.noise[0] * 2.0f);
+    CHECK_EQUAL(merged.seed, image.seed);
+    CHECK_EQUAL(merged.randomStreamIndex, 0u);
+    CHECK_EQUAL(merged.randomStreamCount, 1u);
+
+    // Only part of the streams keep the stream of the first file
+    image.randomStreamCount = 3;
+    image.randomStreamIndex = 2;
+    HaloSim::writeAccumulationFile(first.getFilename(), image, tileSize, true);
+    image.seed = 4;
+    HaloSim::writeAccumulationFile(second.getFilename(), image, tileSize, true);
+    merged = HaloSim::mergeAccumulationFiles({first.getFilename(), second.getFilename()});
+    CHECK_EQUAL(merged.seed, 3u);
+    CHECK_EQUAL(merged.randomStreamIndex, 2u);
+    CHECK_EQUAL(merged.randomStreamCount, 3u);
+}
+
+TEST(accumulationFileMergeRejectsRepeatedStreams)
+{
+    Test::TemporaryFile first("first.hra");
+    Test::TemporaryFile second("second.hra");
+    auto image = createRandomImage();
+    HaloSim::writeAccumulationFile(first.getFilename(), image, tileSize, true);
+    CHECK_THROWS(HaloSim::mergeAccumulationFiles({first.getFilename(), first.getFilename()}));
+
+    // A render of the same stream that came out differently, like on a GPU, still repeats the rays
+    image.accumulation[5] += 1.0f;
+    HaloSim::writeAccumulationFile(second.getFilename(), image, tileSize, true);
+    CHECK_THROWS(HaloSim::mergeAccumulationFiles({first.getFilename(), second.getFilename()}));
+
+    // Streams of a different split share seeds with every stream of this one
+    image.randomStreamIndex = 2;
+    image.randomStreamCount = 5;
+    HaloSim::writeAccumulationFile(second.getFilename(), image, tileSize, true);
+    CHECK_THROWS(HaloSim::mergeAccumulationFiles({first.getFilename(), second.getFilename()}));
+
+    image.randomStreamIndex = 4;
+    image.randomStreamCount = 4;
+    CHECK_THROWS(HaloSim::writeAccumulationFile(second.getFilename(), image, tileSize, true));
+}
@@ -0,0 +1,144 @@
+#include "test.h"
+#include <cstdint>
+#include <fstream>
+#include <random>
+#include <string>
+#include "simulation/checkpoint.h"
+
+using HaloSim::Checkpoint;
+
+namespace
+{
+
+Checkpoint createCheckpoint(bool hasNoise)
+{
+    Checkpoint checkpoint;
+    checkpoint.backend = "cpu";
+    checkpoint.scene = "{\"format\": \"haloray-scene\", \"version\": 1}\n";
+    checkpoint.width = 5;
+    checkpoint.height = 3;
+    checkpoint.iteration = 42;
+    checkpoint.rayCount = 21000000000ull;
+    checkpoint.randomCounter = 0x123456789abcdefull;
+    checkpoint.randomStreamIndex = 2;
+    checkpoint.randomStreamCount = 3;
+
+    std::mt19937 random(5);
+    std::uniform_real_distribution<float> values(0.0f, 100.0f);
+    checkpoint.accumulation.resize((std::size_t)checkpoint.width * checkpoint.height * 4);
+    for (auto &value : checkpoint.accumulation)
+        value = values(random);
+    if (hasNoise)
+    {
+        checkpoint.noise.resize(checkpoint.accumulation.size());
+        for (auto &value : checkpoint.noise)
+            value = values(random);
+    }
+    return checkpoint;
+}
+
+std::string readBytes(const std::string &filename)
+{
+    std::ifstream stream(filename, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+}
+
+void writeBytes(const std::string &filename, const std::string &bytes)
+{
+    std::ofstream stream(filename, std::ios::binary | std::ios::trunc);
+    stream.write(bytes.data(), (std::streamsize)bytes.size());
+}
+
+} // namespace
+
+TEST(checkpointRoundTripKeepsState)
+{
+    for (auto hasNoise : {false, true})
+    {
+        Test::TemporaryFile file("roundTrip.hrck");
+        auto checkpoint = createCheckpoint(hasNoise);
+        checkpoint.save(file.getFilename());
+        auto loaded = Checkpoint::load(file.getFilename());
+
+        CHECK_EQUAL(loaded.backend, checkpoint.backend);
+        CHECK_EQUAL(loaded.scene, checkpoint.scene);
+        CHECK_EQUAL(loaded.width, checkpoint.width);
+        CHECK_EQUAL(loaded.height, checkpoint.height);
+        CHECK_EQUAL(loaded.iteration, checkpoint.iteration);
+        CHECK_EQUAL(loaded.rayCount, checkpoint.rayCount);
+        CHECK_EQUAL(loaded.randomCounter, checkpoint.randomCounter);
+        CHECK_EQUAL(loaded.randomStreamIndex, checkpoint.randomStreamIndex);
+        CHECK_EQUAL(loaded.randomStreamCount, checkpoint.randomStreamCount);
+        CHECK(loaded.accumulation == checkpoint.accumulation);
+        CHECK(loaded.noise == checkpoint.noise);
+    }
+}
+
+TEST(checkpointRejectsTruncatedFiles)
+{
+    Test::TemporaryFile file("truncated.hrck");
+    createCheckpoint(true).save(file.getFilename());
+    auto bytes = readBytes(file.getFilename());
+    for (std::size_t size = 0; size < bytes.size(); ++size)
+    {
+        writeBytes(file.getFilename(), bytes.substr(0, size));
+        bool thrown = false;
+        try
+        {
+            Checkpoint::load(file.getFilename());
+        }
+        catch (const std::runtime_error &)
+        {
+            thrown = true;
+        }
+        if (!thrown)
+            Test::fail(__FILE__, __LINE__, "Loaded a checkpoint cut to " + std::to_string(size) + " bytes");
+    }
+}
+
+TEST(checkpointRejectsFlippedBits)
+{
+    Test::TemporaryFile file("flipped.hrck");
+    createCheckpoint(true).save(file.getFilename());
+    auto bytes = readBytes(file.getFilename());
+    for (std::size_t i = 0; i < bytes.size(); ++i)
+    {
+        auto damaged = bytes;
+        damaged[i] = (char)(damaged[i] ^ (1 << (i % 8)));
+        writeBytes(file.getFilename(), damaged);
+        bool thrown = false;
+        try
+        {
+            Checkpoint::load(file.getFilename());
+        }
+        catch (const std::runtime_error &)
+        {
+            thrown = true;
+        }
+        if (!thrown)
+            Test::fail(__FILE__, __LINE__, "Loaded a checkpoint with a flipped bit in byte " + std::to_string(i));
+    }
+}
+
+TEST(checkpointRejectsHugeSizesBeforeAllocating)
+{
+    Test::TemporaryFile file("huge.hrck");
+    createCheckpoint(false).save(file.getFilename());
+    auto bytes = readBytes(file.getFilename());
+
+    // The length of the backend name follows the fixed part of the header, and the image size is near its start
+    const std::size_t backendLengthOffset = 44;
+    const std::size_t widthOffset = 8;
+    for (auto offset : {backendLengthOffset, widthOffset, widthOffset + 4})
+    {
+        auto damaged = bytes;
+        damaged.replace(offset, 4, std::string(4, '\xff'));
+        writeBytes(file.getFilename(), damaged);
+        CHECK_THROWS(Checkpoint::load(file.getFilename()));
+    }
+
+    auto damaged = bytes;
+    damaged.replace(widthOffset, 8, std::string("\x00\x00\x01\x00\x00\x00\x01\x00", 8));
+    writeBytes(file.getFilename(), damaged);
+    CHECK_THROWS(Checkpoint::load(file.getFilename()));
+}
@@ -0,0 +1,122 @@
+#include "test.h"
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+#include "simulation/denoiser.h"
+
+using HaloSim::Denoiser;
+
+namespace
+{
+
+const unsigned int width = 48;
+const unsigned int height = 32;
+
+// A simulated image, where each ray adds the same color to the pixel it hits
+struct NoisyImage
+{
+    std::vector<float> accumulation;
+    std::vector<float> noise;
+};
+
+void addRays(NoisyImage &image, unsigned int x, unsigned int y, unsigned int rayCount, float luminance)
+{
+    auto p = ((std::size_t)y * width + x) * 4;
+    image.accumulation[p] += 0.9f * luminance * rayCount;
+    image.accumulation[p + 1] += luminance * rayCount;
+    image.accumulation[p + 2] += 1.1f * luminance * rayCount;
+    if (rayCount > 0)
+        image.accumulation[p + 3] = 1.0f;
+    image.noise[p] += luminance * luminance * rayCount;
+    image.noise[p + 1] += (float)rayCount;
+}
+
+NoisyImage createImage()
+{
+    NoisyImage image;
+    image.accumulation.resize((std::size_t)width * height * 4, 0.0f);
+    image.noise.resize(image.accumulation.size(), 0.0f);
+    return image;
+}
+
+// Root mean square of the differences of the luminances from the expected one
+double getError(const std::vector<float> &accumulation, double expected)
+{
+    double sum = 0.0;
+    for (std::size_t i = 1; i < accumulation.size(); i += 4)
+        sum += (accumulation[i] - expected) * (accumulation[i] - expected);
+    return std::sqrt(sum / (accumulation.size() / 4));
+}
+
+} // namespace
+
+TEST(denoiserReducesNoiseOfFaintAreas)
+{
+    // A few rays per pixel of an evenly lit area
+    const double raysPerPixel = 4.0;
+    const float luminance = 0.5f;
+    auto image = createImage();
+    std::mt19937 random(7);
+    std::poisson_distribution<unsigned int> rays(raysPerPixel);
+    for (auto y = 0u; y < height; ++y)
+    {
+        for (auto x = 0u; x < width; ++x)
+            addRays(image, x, y, rays(random), luminance);
+    }
+
+    auto result = Denoiser(0.02, 6, 2).denoise(width, height, image.accumulation, image.noise);
+    auto expected = raysPerPixel * luminance;
+    auto before = getError(image.accumulation, expected);
+    auto after = getError(result, expected);
+    CHECK(before > 0.3 * expected);
+    CHECK(after < 0.25 * before);
+
+    // The average brightness stays where it was
+    double sum = 0.0;
+    for (std::size_t i = 1; i < result.size(); i += 4)
+        sum += result[i];
+    CHECK(std::abs(sum / (width * height) - expected) < 0.05 * expected);
+}
+
+TEST(denoiserKeepsConvergedEdgesSharp)
+{
+    // The right half of the image is lit with so many rays that its noise is far below the target
+    const unsigned int edge = width / 2;
+    const float luminance = 0.25f;
+    auto image = createImage();
+    for (auto y = 0u; y < height; ++y)
+    {
+        for (auto x = edge; x < width; ++x)
+            addRays(image, x, y, 1000000, luminance);
+    }
+
+    auto result = Denoiser(0.02, 6, 2).denoise(width, height, image.accumulation, image.noise);
+    const float bright = image.accumulation[((std::size_t)edge * 4) + 1];
+    for (auto y = 0u; y < height; ++y)
+    {
+        for (auto x = 0u; x < width; ++x)
+        {
+            auto p = ((std::size_t)y * width + x) * 4;
+            for (auto c = 0u; c < 4; ++c)
+            {
+                if (std::abs(result[p + c] - image.accumulation[p + c]) > 1e-4f * bright)
+                    Test::fail(__FILE__, __LINE__, "Pixel " + std::to_string(x) + ", " + std::to_string(y) + " changed");
+            }
+        }
+    }
+}
+
+TEST(denoiserKeepsHitMarkers)
+{
+    // A single ray in the dark is smoothed away, but its pixel is still marked as hit
+    auto image = createImage();
+    addRays(image, 10, 10, 1, 1.0f);
+    addRays(image, 11, 10, 1, 1.0f);
+    auto result = Denoiser(0.02, 6, 2).denoise(width, height, image.accumulation, image.noise);
+    CHECK(result[((std::size_t)10 * width + 10) * 4 + 1] < 1.0f);
+    for (std::size_t p = 0; p < (std::size_t)width * height; ++p)
+        CHECK_EQUAL(result[p * 4 + 3], image.accumulation[p * 4 + 3]);
+
+    CHECK_THROWS(Denoiser().denoise(width, height, image.accumulation, std::vector<float>()));
+}
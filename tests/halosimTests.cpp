@@ -0,0 +1,184 @@
+#include "test.h"
+#include <cstring>
+#include <string>
+#include <vector>
+#include "halosim.h"
+
+/*
+Tests of the C interface, which only reach the simulation through the
+exported functions of the shared library
+*/
+
+namespace
+{
+
+halosim_scene *createScene()
+{
+    auto scene = halosim_scene_create();
+    CHECK(scene != nullptr);
+    CHECK_EQUAL(halosim_scene_set_output_size(scene, 48, 32), HALOSIM_OK);
+    CHECK_EQUAL(halosim_scene_set_rays_per_step(scene, 2000), HALOSIM_OK);
+    CHECK_EQUAL(halosim_scene_set_seed(scene, 3), HALOSIM_OK);
+    CHECK_EQUAL(halosim_scene_set_camera(scene, 0.0f, 0.0f, 90.0f, HALOSIM_PROJECTION_STEREOGRAPHIC, 0), HALOSIM_OK);
+    return scene;
+}
+
+// The pixels of an image view, read through its strides
+std::vector<float> readImage(const halosim_image &image)
+{
+    std::vector<float> pixels;
+    auto bytes = reinterpret_cast<const unsigned char *>(image.data);
+    for (auto y = 0u; y < image.height; ++y)
+    {
+        for (auto x = 0u; x < image.width; ++x)
+        {
+            auto pixel = reinterpret_cast<const float *>(bytes + y * image.row_stride + x * image.pixel_stride);
+            pixels.insert(pixels.end(), pixel, pixel + 4);
+        }
+    }
+    return pixels;
+}
+
+std::vector<float> readAccumulation(const halosim_simulator *simulator)
+{
+    halosim_image image;
+    CHECK_EQUAL(halosim_simulator_get_accumulation(simulator, &image), HALOSIM_OK);
+    return readImage(image);
+}
+
+} // namespace
+
+TEST(halosimSimulatorStepsAndResets)
+{
+    CHECK_EQUAL(halosim_get_api_version(), HALOSIM_API_VERSION);
+    auto scene = createScene();
+    auto simulator = halosim_simulator_create(scene, 2);
+    CHECK(simulator != nullptr);
+    halosim_scene_destroy(scene);
+
+    CHECK_EQUAL(halosim_simulator_get_ray_count(simulator), 0u);
+    CHECK(halosim_simulator_get_noise_estimate(simulator) < 0.0);
+    CHECK_EQUAL(halosim_simulator_step(simulator, 0), HALOSIM_OK);
+    CHECK_EQUAL(halosim_simulator_get_iteration(simulator), 1u);
+    CHECK_EQUAL(halosim_simulator_get_ray_count(simulator), 2000u);
+
+    halosim_image image;
+    CHECK_EQUAL(halosim_simulator_get_accumulation(simulator, &image), HALOSIM_OK);
+    CHECK(image.data != nullptr);
+    CHECK_EQUAL(image.width, 48u);
+    CHECK_EQUAL(image.height, 32u);
+    CHECK_EQUAL(image.pixel_stride, 4 * sizeof(float));
+    CHECK_EQUAL(image.row_stride, 48 * 4 * sizeof(float));
+    auto first = readImage(image);
+    double luminance = 0.0;
+    for (std::size_t i = 1; i < first.size(); i += 4)
+        luminance += first[i];
+    CHECK(luminance > 0.0);
+
+    halosim_image noise;
+    CHECK_EQUAL(halosim_simulator_get_noise(simulator, &noise), HALOSIM_OK);
+    CHECK_EQUAL(noise.width, image.width);
+    CHECK_EQUAL(noise.row_stride, image.row_stride);
+    auto noisePixels = readImage(noise);
+    double rayCount = 0.0;
+    for (std::size_t i = 1; i < noisePixels.size(); i += 4)
+        rayCount += noisePixels[i];
+    CHECK(rayCount > 0.0 && rayCount <= 2000.0);
+    CHECK(halosim_simulator_get_exposure(simulator, 1.0) > 0.0f);
+
+    CHECK_EQUAL(halosim_simulator_step(simulator, 500), HALOSIM_OK);
+    CHECK_EQUAL(halosim_simulator_get_ray_count(simulator), 2500u);
+
+    // The same rays are traced again after a reset
+    CHECK_EQUAL(halosim_simulator_reset(simulator), HALOSIM_OK);
+    CHECK_EQUAL(halosim_simulator_get_iteration(simulator), 0u);
+    CHECK_EQUAL(halosim_simulator_get_ray_count(simulator), 0u);
+    CHECK(readAccumulation(simulator) == std::vector<float>(first.size(), 0.0f));
+    CHECK_EQUAL(halosim_simulator_step(simulator, 0), HALOSIM_OK);
+    CHECK(readAccumulation(simulator) == first);
+    halosim_simulator_destroy(simulator);
+}
+
+TEST(halosimSimulatorIgnoresThreadCount)
+{
+    auto scene = createScene();
+    auto single = halosim_simulator_create(scene, 1);
+    auto several = halosim_simulator_create(scene, 3);
+    halosim_scene_destroy(scene);
+    for (auto i = 0; i < 3; ++i)
+    {
+        CHECK_EQUAL(halosim_simulator_step(single, 0), HALOSIM_OK);
+        CHECK_EQUAL(halosim_simulator_step(several, 0), HALOSIM_OK);
+    }
+    CHECK(readAccumulation(single) == readAccumulation(several));
+    halosim_simulator_destroy(single);
+    halosim_simulator_destroy(several);
+}
+
+TEST(halosimScenesRoundTripThroughText)
+{
+    auto scene = createScene();
+    auto crystalCount = halosim_scene_get_crystal_count(scene);
+    halosim_crystal crystal;
+    CHECK_EQUAL(halosim_scene_get_preset(HALOSIM_PRESET_PARRY, &crystal), HALOSIM_OK);
+    CHECK_EQUAL(halosim_scene_add_crystal(scene, &crystal, 3), HALOSIM_OK);
+    CHECK_EQUAL(halosim_scene_get_crystal_count(scene), crystalCount + 1);
+
+    auto size = halosim_scene_serialize(scene, nullptr, 0);
+    CHECK(size > 1);
+    std::vector<char> text(size);
+    CHECK_EQUAL(halosim_scene_serialize(scene, text.data(), text.size()), size);
+    CHECK_EQUAL(text.back(), '\0');
+
+    auto parsed = halosim_scene_parse(text.data(), size - 1);
+    CHECK(parsed != nullptr);
+    CHECK_EQUAL(halosim_scene_get_hash(parsed), halosim_scene_get_hash(scene));
+    uint32_t weight = 0;
+    halosim_crystal parsedCrystal;
+    CHECK_EQUAL(halosim_scene_get_crystal(parsed, crystalCount, &parsedCrystal, &weight), HALOSIM_OK);
+    CHECK_EQUAL(weight, 3u);
+    CHECK_EQUAL(parsedCrystal.tilt_distribution, crystal.tilt_distribution);
+
+    auto copy = halosim_scene_copy(parsed);
+    CHECK_EQUAL(halosim_scene_set_seed(copy, 4), HALOSIM_OK);
+    CHECK(halosim_scene_get_hash(copy) != halosim_scene_get_hash(parsed));
+    halosim_scene_destroy(copy);
+    halosim_scene_destroy(parsed);
+    halosim_scene_destroy(scene);
+}
+
+TEST(halosimReportsErrors)
+{
+    halosim_image image;
+    CHECK_EQUAL(halosim_simulator_step(nullptr, 0), HALOSIM_ERROR_INVALID_ARGUMENT);
+    CHECK(std::strlen(halosim_get_last_error()) > 0);
+    CHECK_EQUAL(halosim_simulator_reset(nullptr), HALOSIM_ERROR_INVALID_ARGUMENT);
+    CHECK_EQUAL(halosim_simulator_get_accumulation(nullptr, &image), HALOSIM_ERROR_INVALID_ARGUMENT);
+    CHECK_EQUAL(halosim_simulator_get_noise(nullptr, &image), HALOSIM_ERROR_INVALID_ARGUMENT);
+    CHECK(halosim_simulator_create(nullptr, 0) == nullptr);
+    CHECK(halosim_scene_parse(nullptr, 0) == nullptr);
+    CHECK_EQUAL(halosim_simulator_get_ray_count(nullptr), 0u);
+
+    auto scene = createScene();
+    auto simulator = halosim_simulator_create(scene, 1);
+    CHECK_EQUAL(halosim_simulator_get_accumulation(simulator, nullptr), HALOSIM_ERROR_INVALID_ARGUMENT);
+    halosim_simulator_destroy(simulator);
+
+    // Rejected changes leave the scene as it was
+    auto hash = halosim_scene_get_hash(scene);
+    CHECK_EQUAL(halosim_scene_set_output_size(scene, 0, 32), HALOSIM_ERROR_INVALID_SCENE);
+    CHECK_EQUAL(halosim_scene_set_sun(scene, 100.0f, 0.5f), HALOSIM_ERROR_INVALID_SCENE);
+    CHECK_EQUAL(halosim_scene_set_camera(scene, 0.0f, 0.0f, 90.0f, (halosim_projection)99, 0), HALOSIM_ERROR_INVALID_ARGUMENT);
+    CHECK_EQUAL(halosim_scene_add_crystal(scene, nullptr, 1), HALOSIM_ERROR_INVALID_ARGUMENT);
+    CHECK_EQUAL(halosim_scene_get_crystal(scene, 100, nullptr, nullptr), HALOSIM_ERROR_INVALID_ARGUMENT);
+    CHECK_EQUAL(halosim_scene_get_preset((halosim_preset)99, nullptr), HALOSIM_ERROR_INVALID_ARGUMENT);
+    CHECK_EQUAL(halosim_scene_get_hash(scene), hash);
+
+    const std::string text = "{\"format\": \"something else\"}";
+    CHECK(halosim_scene_parse(text.data(), text.size()) == nullptr);
+
+    // A scene whose crystals were all cleared cannot be simulated
+    halosim_scene_clear_crystals(scene);
+    CHECK(halosim_simulator_create(scene, 1) == nullptr);
+    halosim_scene_destroy(scene);
+}
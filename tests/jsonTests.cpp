@@ -0,0 +1,185 @@
+#include "test.h"
+#include <cmath>
+#include <random>
+#include <string>
+#include "simulation/json.h"
+
+using HaloSim::JsonValue;
+
+TEST(jsonRoundTripKeepsDocument)
+{
+    const std::string text = "{\n"
+                             "    \"name\": \"halo \\\"22\\\"\\n\",\n"
+                             "    \"values\": [1, -2.5, 0.001, 1e+300, true, false, null],\n"
+                             "    \"nested\": {\n"
+                             "        \"empty\": [],\n"
+                             "        \"object\": {}\n"
+                             "    },\n"
+                             "    \"last\": 0\n"
+                             "}\n";
+    auto document = JsonValue::parse(text);
+    CHECK_EQUAL(document.serialize(), text);
+    CHECK_EQUAL(JsonValue::parse(document.serialize()).serialize(), text);
+
+    // Members keep the order they were written in
+    const auto &members = document.getMembers();
+    CHECK_EQUAL(members.size(), 4u);
+    CHECK_EQUAL(members[0].first, "name");
+    CHECK_EQUAL(members[3].first, "last");
+    CHECK_EQUAL(document.at("name").toString(), "halo \"22\"\n");
+    CHECK_EQUAL(document.at("values").at(2).toNumber(), 0.001);
+    CHECK(document.at("values").at(6).isNull());
+}
+
+TEST(jsonSetReplacesMembers)
+{
+    auto object = JsonValue::createObject();
+    object.set("a", 1);
+    object.set("b", 2);
+    object.set("a", 3);
+    CHECK_EQUAL(object.serialize(), "{\"a\": 3, \"b\": 2}\n");
+}
+
+TEST(jsonParsesNumbers)
+{
+    CHECK_EQUAL(JsonValue::parse("0").toNumber(), 0.0);
+    CHECK_EQUAL(JsonValue::parse("-0.5").toNumber(), -0.5);
+    CHECK_EQUAL(JsonValue::parse("0.1").toNumber(), 0.1);
+    CHECK_EQUAL(JsonValue::parse("123.456e-2").toNumber(), 1.23456);
+    CHECK_EQUAL(JsonValue::parse("1E22").toNumber(), 1e22);
+    CHECK_EQUAL(JsonValue::parse("4294967295").toNumber(), 4294967295.0);
+
+    // Too many digits or too large exponents for the fast path
+    CHECK_EQUAL(JsonValue::parse("3.14159265358979323846").toNumber(), 3.14159265358979323846);
+    CHECK_EQUAL(JsonValue::parse("123456789012345678901234567890").toNumber(), 123456789012345678901234567890.0);
+    CHECK_EQUAL(JsonValue::parse("2.2250738585072014e-308").toNumber(), 2.2250738585072014e-308);
+    CHECK_EQUAL(JsonValue::parse("1e400").toNumber(), HUGE_VAL);
+    CHECK_EQUAL(JsonValue::parse("-1e-400").toNumber(), 0.0);
+}
+
+TEST(jsonWritesShortestNumbers)
+{
+    CHECK_EQUAL(JsonValue(0.1).serialize(), "0.1\n");
+    CHECK_EQUAL(JsonValue(-42).serialize(), "-42\n");
+    CHECK_EQUAL(JsonValue(4294967295u).serialize(), "4294967295\n");
+    CHECK_EQUAL(JsonValue(1e300).serialize(), "1e+300\n");
+    CHECK_EQUAL(JsonValue::fromFloat(0.1f).serialize(), "0.1\n");
+    CHECK_EQUAL(JsonValue::fromFloat(33.3f).serialize(), "33.3\n");
+    CHECK_THROWS(JsonValue(HUGE_VAL).serialize());
+    CHECK_THROWS(JsonValue::fromFloat(NAN));
+}
+
+TEST(jsonNumbersReadBackExactly)
+{
+    std::mt19937_64 random(7);
+    std::uniform_real_distribution<double> mantissas(-1.0, 1.0);
+    std::uniform_int_distribution<int> exponents(-280, 280);
+    for (auto i = 0; i < 10000; ++i)
+    {
+        auto value = std::ldexp(mantissas(random), exponents(random) % 64) * std::pow(10.0, exponents(random));
+        CHECK_EQUAL(JsonValue::parse(JsonValue(value).serialize()).toNumber(), value);
+
+        auto single = (float)std::ldexp(mantissas(random), exponents(random) % 100);
+        CHECK_EQUAL((float)JsonValue::parse(JsonValue::fromFloat(single).serialize()).toNumber(), single);
+    }
+}
+
+TEST(jsonDecodesEscapes)
+{
+    CHECK_EQUAL(JsonValue::parse("\"\\/\\b\\f\\t\\r\"").toString(), "/\b\f\t\r");
+    CHECK_EQUAL(JsonValue::parse("\"\\u0041\\u00e9\\u20AC\"").toString(), "A\xc3\xa9\xe2\x82\xac");
+    CHECK_EQUAL(JsonValue::parse("\"\\ud83d\\ude00\"").toString(), "\xf0\x9f\x98\x80");
+
+    // Control characters are escaped, other characters are written as they are
+    CHECK_EQUAL(JsonValue(std::string("\x01 \xc3\xa9")).serialize(), "\"\\u0001 \xc3\xa9\"\n");
+    auto text = std::string("tab\there \x1f \"quoted\" back\\slash");
+    CHECK_EQUAL(JsonValue::parse(JsonValue(text).serialize()).toString(), text);
+}
+
+TEST(jsonRejectsUnpairedSurrogates)
+{
+    CHECK_THROWS(JsonValue::parse("\"\\ud83d\""));
+    CHECK_THROWS(JsonValue::parse("\"\\ud83dx\""));
+    CHECK_THROWS(JsonValue::parse("\"\\ud83d\\u0041\""));
+    CHECK_THROWS(JsonValue::parse("\"\\ude00\""));
+}
+
+TEST(jsonLimitsNesting)
+{
+    auto nested = [](unsigned int depth) {
+        return std::string(depth, '[') + "1" + std::string(depth, ']');
+    };
+    CHECK_EQUAL(JsonValue::parse(nested(256)).size(), 1u);
+    CHECK_THROWS(JsonValue::parse(nested(257)));
+    CHECK_THROWS(JsonValue::parse(std::string(100000, '[')));
+}
+
+TEST(jsonRejectsMalformedText)
+{
+    const char *documents[] = {
+        "",
+        "   ",
+        "{",
+        "}",
+        "[1,]",
+        "[1 2]",
+        "{\"a\": 1,}",
+        "{\"a\" 1}",
+        "{a: 1}",
+        "{\"a\": 1, \"a\": 2}",
+        "tru",
+        "nul",
+        "01",
+        "1.",
+        ".5",
+        "-",
+        "+1",
+        "1e",
+        "1e+",
+        "\"unterminated",
+        "\"tab\tinside\"",
+        "\"\\x\"",
+        "\"\\u12\"",
+        "\"\\u12g4\"",
+        "[1] 2",
+        "NaN",
+    };
+    for (auto document : documents)
+    {
+        bool thrown = false;
+        try
+        {
+            JsonValue::parse(document);
+        }
+        catch (const std::runtime_error &)
+        {
+            thrown = true;
+        }
+        if (!thrown)
+            Test::fail(__FILE__, __LINE__, std::string("Parsed malformed JSON: ") + document);
+    }
+}
+
+TEST(jsonReportsLineOfError)
+{
+    try
+    {
+        JsonValue::parse("{\n\"a\": 1,\n\"b\": ?\n}");
+        Test::fail(__FILE__, __LINE__, "Parsed malformed JSON");
+    }
+    catch (const std::runtime_error &e)
+    {
+        CHECK(std::string(e.what()).find("line 3") != std::string::npos);
+    }
+}
+
+TEST(jsonChecksTypes)
+{
+    auto document = JsonValue::parse("{\"number\": 1, \"list\": [true]}");
+    CHECK_THROWS(document.at("number").toString());
+    CHECK_THROWS(document.at("list").toBool());
+    CHECK_THROWS(document.at("list").at(1));
+    CHECK_THROWS(document.at("missing"));
+    CHECK_THROWS(document.at(0));
+    CHECK_THROWS(JsonValue(1).append(JsonValue()));
+}
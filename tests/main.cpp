@@ -0,0 +1,67 @@
+#include "test.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace Test
+{
+
+namespace
+{
+
+struct TestCase
+{
+    const char *name;
+    TestFunction function;
+};
+
+// Filled by the static registrations of the test files, before main runs
+std::vector<TestCase> &getTestCases()
+{
+    static std::vector<TestCase> testCases;
+    return testCases;
+}
+
+struct Failure : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+} // namespace
+
+Registration::Registration(const char *name, TestFunction function)
+{
+    getTestCases().push_back({name, function});
+}
+
+void fail(const char *file, int line, const std::string &message)
+{
+    throw Failure(std::string(file) + ":" + std::to_string(line) + ": " + message);
+}
+
+} // namespace Test
+
+// Runs all the tests, or those whose names contain the first argument
+int main(int argc, char *argv[])
+{
+    auto filter = argc > 1 ? argv[1] : "";
+    unsigned int runCount = 0;
+    unsigned int failureCount = 0;
+    for (const auto &testCase : Test::getTestCases())
+    {
+        if (std::strstr(testCase.name, filter) == nullptr)
+            continue;
+        ++runCount;
+        try
+        {
+            testCase.function();
+        }
+        catch (const std::exception &e)
+        {
+            ++failureCount;
+            std::fprintf(stderr, "FAILED %s\n    %s\n", testCase.name, e.what());
+        }
+    }
+    std::printf("%u of %u tests passed\n", runCount - failureCount, runCount);
+    return failureCount == 0 && runCount > 0 ? 0 : 1;
+}
@@ -0,0 +1,184 @@
+#include "test.h"
+#include <string>
+#include "simulation/sceneFile.h"
+
+using HaloSim::JsonValue;
+using HaloSim::SceneFile;
+
+namespace
+{
+
+SceneFile createCustomSceneFile()
+{
+    auto file = SceneFile::createDefault();
+    file.scene.light.altitude = 22.3f;
+    file.scene.light.diameter = 0.53f;
+    file.scene.camera.pitch = -12.5f;
+    file.scene.camera.yaw = 181.1f;
+    file.scene.camera.fov = 1.0f / 3.0f;
+    file.scene.camera.projection = HaloSim::Projection::EqualArea;
+    file.scene.camera.hideSubHorizon = true;
+    file.scene.multipleScatteringProbability = 0.1f;
+
+    auto plate = HaloSim::CrystalPopulation::createPlate();
+    plate.caRatioAverage = 0.07f;
+    plate.tiltStd = 1e-3f;
+    file.scene.crystals = {plate, HaloSim::CrystalPopulation::createLowitz()};
+    file.scene.crystalWeights = {3, 0};
+
+    file.raysPerStep = 123457;
+    file.seed = 4294967295u;
+    file.outputWidth = 641;
+    file.outputHeight = 479;
+    return file;
+}
+
+// The default scene file with one member replaced, in a nested object if the path has a dot
+std::string withMember(const std::string &path, const std::string &value)
+{
+    auto dot = path.find('.');
+    auto document = SceneFile::createDefault().toJson();
+    if (dot == std::string::npos)
+    {
+        document.set(path, JsonValue::parse(value));
+    }
+    else
+    {
+        auto object = document.at(path.substr(0, dot));
+        object.set(path.substr(dot + 1), JsonValue::parse(value));
+        document.set(path.substr(0, dot), object);
+    }
+    return document.serialize();
+}
+
+} // namespace
+
+TEST(sceneFileRoundTripKeepsSettings)
+{
+    auto file = createCustomSceneFile();
+    auto text = file.serialize();
+    auto parsed = SceneFile::parse(text);
+
+    CHECK_EQUAL(parsed.serialize(), text);
+    CHECK_EQUAL(parsed.getHash(), file.getHash());
+    CHECK_EQUAL(parsed.scene.light.altitude, 22.3f);
+    CHECK_EQUAL(parsed.scene.camera.fov, 1.0f / 3.0f);
+    CHECK(parsed.scene.camera.projection == HaloSim::Projection::EqualArea);
+    CHECK(parsed.scene.camera.hideSubHorizon);
+    CHECK_EQUAL(parsed.scene.crystals.size(), 2u);
+    CHECK_EQUAL(parsed.scene.crystals[0].caRatioAverage, 0.07f);
+    CHECK_EQUAL(parsed.scene.crystals[0].tiltStd, 1e-3f);
+    CHECK_EQUAL(parsed.scene.crystalWeights[1], 0u);
+    CHECK_EQUAL(parsed.raysPerStep, 123457u);
+    CHECK_EQUAL(parsed.seed, 4294967295u);
+    CHECK_EQUAL(parsed.outputWidth, 641u);
+    CHECK_EQUAL(parsed.outputHeight, 479u);
+}
+
+TEST(sceneFileSerializesSameSettingsToSameText)
+{
+    CHECK_EQUAL(createCustomSceneFile().serialize(), createCustomSceneFile().serialize());
+    CHECK_EQUAL(SceneFile::createDefault().serialize(), SceneFile::parse(SceneFile::createDefault().serialize()).serialize());
+
+    // Reformatting the file does not change what it reads as
+    auto compact = JsonValue::parse(createCustomSceneFile().serialize());
+    auto reformatted = "  " + compact.serialize() + "\n\n";
+    CHECK_EQUAL(SceneFile::parse(reformatted).serialize(), createCustomSceneFile().serialize());
+}
+
+TEST(sceneFileHashTellsSettingsApart)
+{
+    auto file = createCustomSceneFile();
+    auto changed = file;
+    changed.seed = 1;
+    CHECK(changed.getHash() != file.getHash());
+    changed = file;
+    changed.raysPerStep += 1;
+    CHECK(changed.getHash() != file.getHash());
+    changed = file;
+    changed.scene.crystals[0].tiltStd = 2e-3f;
+    CHECK(changed.getHash() != file.getHash());
+}
+
+TEST(sceneFileFillsInDefaults)
+{
+    auto file = SceneFile::parse("{\"format\": \"haloray-scene\", \"version\": 1}");
+    CHECK_EQUAL(file.serialize(), SceneFile::createDefault().serialize());
+
+    file = SceneFile::parse("{\"format\": \"haloray-scene\", \"version\": 1, \"sun\": {\"altitude\": 5}, \"crystals\": [{\"preset\": \"column\"}]}");
+    CHECK_EQUAL(file.scene.light.altitude, 5.0f);
+    CHECK_EQUAL(file.scene.light.diameter, SceneFile::createDefault().scene.light.diameter);
+    CHECK_EQUAL(file.scene.crystals.size(), 1u);
+    CHECK_EQUAL(file.scene.crystals[0].caRatioAverage, HaloSim::CrystalPopulation::createColumn().caRatioAverage);
+    CHECK_EQUAL(file.scene.crystalWeights[0], 1u);
+}
+
+TEST(sceneFileRejectsUnknownKeys)
+{
+    CHECK_THROWS(SceneFile::parse(withMember("rays", "1000")));
+    CHECK_THROWS(SceneFile::parse(withMember("camera.pich", "10")));
+    CHECK_THROWS(SceneFile::parse(withMember("output.depth", "8")));
+    CHECK_THROWS(SceneFile::parse("{\"format\": \"haloray-scene\", \"version\": 1, \"crystals\": [{\"tilt\": {\"avg\": 1}}]}"));
+    CHECK_THROWS(SceneFile::parse("{\"format\": \"haloray-scene\", \"version\": 1, \"crystals\": [{\"preset\": \"column\", \"colour\": 1}]}"));
+
+    try
+    {
+        SceneFile::parse(withMember("camera.pich", "10"));
+    }
+    catch (const std::runtime_error &e)
+    {
+        CHECK_EQUAL(std::string(e.what()), "Unknown key camera.pich");
+    }
+}
+
+TEST(sceneFileRejectsOtherFormatsAndVersions)
+{
+    CHECK_THROWS(SceneFile::parse("{}"));
+    CHECK_THROWS(SceneFile::parse("[]"));
+    CHECK_THROWS(SceneFile::parse("{\"format\": \"haloray-scene\"}"));
+    CHECK_THROWS(SceneFile::parse("{\"format\": \"other\", \"version\": 1}"));
+    CHECK_THROWS(SceneFile::parse(withMember("version", "2")));
+    CHECK_THROWS(SceneFile::parse(withMember("version", "0")));
+    CHECK_THROWS(SceneFile::parse(withMember("version", "\"1\"")));
+    CHECK_THROWS(SceneFile::parse(SceneFile::createDefault().serialize() + ","));
+}
+
+TEST(sceneFileRejectsInvalidValues)
+{
+    const char *members[][2] = {
+        {"sun.altitude", "90.5"},
+        {"sun.diameter", "-1"},
+        {"camera.pitch", "\"up\""},
+        {"camera.fov", "0"},
+        {"camera.projection", "\"fisheye\""},
+        {"camera.hideSubHorizon", "1"},
+        {"multipleScattering", "1.01"},
+        {"raysPerStep", "0"},
+        {"raysPerStep", "1.5"},
+        {"seed", "-1"},
+        {"seed", "4294967296"},
+        {"output.width", "0"},
+        {"output.height", "null"},
+        {"crystals", "[]"},
+        {"crystals", "{}"},
+        {"crystals", "[{\"weight\": 0}]"},
+        {"crystals", "[{\"preset\": \"needle\"}]"},
+        {"crystals", "[{\"tilt\": {\"distribution\": \"cauchy\"}}]"},
+        {"crystals", "[{\"caRatio\": {\"average\": -1}}]"},
+        {"crystals", "[1]"},
+    };
+    for (const auto &member : members)
+    {
+        bool thrown = false;
+        try
+        {
+            SceneFile::parse(withMember(member[0], member[1]));
+        }
+        catch (const std::runtime_error &)
+        {
+            thrown = true;
+        }
+        if (!thrown)
+            Test::fail(__FILE__, __LINE__, std::string("Accepted ") + member[0] + " = " + member[1]);
+    }
+}
@@ -0,0 +1,183 @@
+#include "test.h"
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "simulation/sharedMemoryRing.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
+
+using HaloSim::SharedMemoryReader;
+using HaloSim::SharedMemoryWriter;
+
+namespace
+{
+
+// Names are shared by the whole machine, so tests running at the same time must not meet
+std::string createRingName()
+{
+    return "halosim-tests-" + std::to_string(std::random_device()());
+}
+
+HaloSim::RawImage createImage(unsigned int width, unsigned int height)
+{
+    HaloSim::RawImage image;
+    image.width = width;
+    image.height = height;
+    image.accumulation.resize((std::size_t)width * height * 4);
+    image.noise.resize((std::size_t)width * height * 4);
+    for (std::size_t i = 0; i < image.accumulation.size(); ++i)
+    {
+        image.accumulation[i] = (float)i;
+        image.noise[i] = i % 4 < 2 ? (float)i + 0.5f : 0.0f;
+    }
+    image.rayCount = 1000;
+    image.exposure = 0.0f;
+    return image;
+}
+
+#ifndef _WIN32
+// A ring header written by hand, as a writer that crashed or a damaged ring would leave it
+void createRing(const std::string &name, std::uint32_t width, std::uint32_t height, std::uint64_t slotSize, std::uint32_t closed, std::uint32_t writerProcess = 0)
+{
+    const std::size_t headerSize = 64;
+    const std::uint32_t slotCount = 2;
+    std::vector<unsigned char> bytes(headerSize + slotCount * 128, 0);
+    const std::uint32_t header[] = {1, slotCount, width, height, 4, closed, writerProcess};
+    std::memcpy(bytes.data(), "HRSM", 4);
+    std::memcpy(bytes.data() + 4, header, sizeof(header));
+    std::memcpy(bytes.data() + 32, &slotSize, sizeof(slotSize));
+
+    auto path = "/" + name;
+    int file = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    CHECK(file != -1);
+    CHECK_EQUAL(write(file, bytes.data(), bytes.size()), (ssize_t)bytes.size());
+    close(file);
+}
+
+void removeRing(const std::string &name)
+{
+    shm_unlink(("/" + name).c_str());
+}
+#endif
+
+} // namespace
+
+TEST(sharedMemoryRingPublishesSnapshots)
+{
+    auto name = createRingName();
+    SharedMemoryWriter writer(name, 3, 2, true);
+    SharedMemoryReader reader(name);
+    HaloSim::SharedSnapshot snapshot;
+    std::vector<float> pixels;
+    CHECK(!reader.readLatest(snapshot, pixels));
+
+    auto image = createImage(3, 2);
+    writer.publish(image, 42);
+    writer.publish(image, 43);
+    CHECK(reader.readLatest(snapshot, pixels));
+    CHECK_EQUAL(snapshot.sequence, 2u);
+    CHECK_EQUAL(snapshot.width, 3u);
+    CHECK_EQUAL(snapshot.height, 2u);
+    CHECK_EQUAL(snapshot.channelCount, 6u);
+    CHECK_EQUAL(snapshot.rayCount, 1000u);
+    CHECK_EQUAL(snapshot.sceneHash, 43u);
+    CHECK_EQUAL(pixels.size(), 36u);
+    CHECK_EQUAL(pixels[6], image.accumulation[4]);
+    CHECK_EQUAL(pixels[10], image.noise[4]);
+    CHECK_EQUAL(pixels[11], image.noise[5]);
+    CHECK(!reader.isClosed());
+
+    CHECK_THROWS(writer.publish(createImage(2, 3), 44));
+}
+
+TEST(sharedMemoryRingKeepsNameOfLiveWriter)
+{
+    auto name = createRingName();
+    {
+        SharedMemoryWriter writer(name, 4, 4, false);
+        CHECK_THROWS(SharedMemoryWriter(name, 4, 4, false));
+    }
+    SharedMemoryWriter writer(name, 4, 4, false);
+
+#ifndef _WIN32
+    // A ring that was not closed is kept while its writer may be running, or when the writer is unknown
+    auto stale = createRingName();
+    createRing(stale, 1, 1, 128, 0, (std::uint32_t)getpid());
+    CHECK_THROWS(SharedMemoryWriter(stale, 4, 4, false));
+    removeRing(stale);
+    createRing(stale, 1, 1, 128, 0);
+    CHECK_THROWS(SharedMemoryWriter(stale, 4, 4, false));
+    removeRing(stale);
+
+    createRing(stale, 1, 1, 128, 1);
+    SharedMemoryWriter replacement(stale, 4, 4, false);
+    SharedMemoryReader reader(stale);
+    CHECK(!reader.isClosed());
+#endif
+}
+
+#ifndef _WIN32
+TEST(sharedMemoryRingTakesOverRingOfEndedWriter)
+{
+    // A writer that ends without closing its ring, as if it was killed
+    auto name = createRingName();
+    auto child = fork();
+    CHECK(child != -1);
+    if (child == 0)
+    {
+        try
+        {
+            new SharedMemoryWriter(name, 4, 4, false);
+        }
+        catch (...)
+        {
+            _exit(1);
+        }
+        _exit(0);
+    }
+    int status = 0;
+    CHECK_EQUAL(waitpid(child, &status, 0), child);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    SharedMemoryReader stale(name);
+    CHECK(!stale.isClosed());
+    SharedMemoryWriter writer(name, 2, 2, true);
+    writer.publish(createImage(2, 2), 1);
+    SharedMemoryReader reader(name);
+    HaloSim::SharedSnapshot snapshot;
+    std::vector<float> pixels;
+    CHECK(reader.readLatest(snapshot, pixels));
+    CHECK_EQUAL(snapshot.width, 2u);
+    CHECK(!stale.readLatest(snapshot, pixels));
+}
+
+TEST(sharedMemoryRingRejectsDamagedRings)
+{
+    auto name = createRingName();
+    createRing(name, 1, 1, 128, 0);
+    SharedMemoryReader(name).isClosed();
+    removeRing(name);
+
+    // Slots too small for their pixels, slots beyond the memory, and sizes that overflow
+    const std::uint64_t slotSizes[] = {64, 96, 192, 0x8000000000000000ull};
+    for (auto slotSize : slotSizes)
+    {
+        createRing(name, 1, 1, slotSize, 0);
+        CHECK_THROWS(SharedMemoryReader(name));
+        removeRing(name);
+    }
+    createRing(name, 1000, 1000, 128, 0);
+    CHECK_THROWS(SharedMemoryReader(name));
+    removeRing(name);
+    createRing(name, 65536, 65536, 128, 0);
+    CHECK_THROWS(SharedMemoryReader(name));
+    removeRing(name);
+}
+#endif
@@ -0,0 +1,96 @@
+#pragma once
+#include <string>
+#include <sstream>
+#include <stdexcept>
+#include <cstdio>
+
+/*
+A small test harness for the simulation core, which has no dependencies to
+bring a test framework along. TEST defines a test that registers itself, and
+a failed check ends its test with the location and the values involved.
+*/
+namespace Test
+{
+
+typedef void (*TestFunction)();
+
+struct Registration
+{
+    Registration(const char *name, TestFunction function);
+};
+
+[[noreturn]] void fail(const char *file, int line, const std::string &message);
+
+template <typename T>
+std::string describe(const T &value)
+{
+    std::ostringstream stream;
+    stream.precision(17);
+    stream << value;
+    return stream.str();
+}
+
+// A file in the working directory that is removed when the test is done with it
+class TemporaryFile
+{
+public:
+    explicit TemporaryFile(const std::string &name)
+        : mFilename("halosim-tests-" + name)
+    {
+    }
+
+    ~TemporaryFile()
+    {
+        std::remove(mFilename.c_str());
+    }
+
+    TemporaryFile(const TemporaryFile &) = delete;
+    TemporaryFile &operator=(const TemporaryFile &) = delete;
+
+    const std::string &getFilename() const
+    {
+        return mFilename;
+    }
+
+private:
+    std::string mFilename;
+};
+
+} // namespace Test
+
+#define TEST(name)                                                    \
+    static void name();                                               \
+    static const Test::Registration name##Registration(#name, &name); \
+    static void name()
+
+#define CHECK(condition)                                                    \
+    do                                                                      \
+    {                                                                       \
+        if (!(condition))                                                   \
+            Test::fail(__FILE__, __LINE__, "CHECK(" #condition ") failed"); \
+    } while (false)
+
+#define CHECK_EQUAL(actual, expected)                                                                                                     \
+    do                                                                                                                                    \
+    {                                                                                                                                     \
+        const auto actualValue = (actual);                                                                                                \
+        const auto expectedValue = (expected);                                                                                            \
+        if (!(actualValue == expectedValue))                                                                                              \
+            Test::fail(__FILE__, __LINE__, #actual " is " + Test::describe(actualValue) + ", expected " + Test::describe(expectedValue)); \
+    } while (false)
+
+#define CHECK_THROWS(expression)                                          \
+    do                                                                    \
+    {                                                                     \
+        bool thrown = false;                                              \
+        try                                                               \
+        {                                                                 \
+            (void)(expression);                                           \
+        }                                                                 \
+        catch (const std::runtime_error &)                                \
+        {                                                                 \
+            thrown = true;                                                \
+        }                                                                 \
+        if (!thrown)                                                      \
+            Test::fail(__FILE__, __LINE__, #expression " did not throw"); \
+    } while (false)